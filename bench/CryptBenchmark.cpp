@@ -0,0 +1,100 @@
+// Throughput of StegCrypt for every backend, key size and mode, and of ChaCha20-Poly1305
+// Usage: steg-crypt-bench [megabytes]
+
+#include "StegCrypt.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace Steg;
+
+namespace {
+
+    const char* GetName(StegCrypt::Backend backend) {
+        return backend == StegCrypt::Backend::BACKEND_AESNI ? "aesni" : "portable";
+    }
+
+    const char* GetName(StegCrypt::Algorithm algo) {
+        switch (algo) {
+            case StegCrypt::Algorithm::ALGO_AES128: return "aes128";
+            case StegCrypt::Algorithm::ALGO_AES192: return "aes192";
+            case StegCrypt::Algorithm::ALGO_AES256: return "aes256";
+            default: return "chacha20";
+        }
+    }
+
+    const char* GetName(StegCrypt::Mode mode) {
+        switch (mode) {
+            case StegCrypt::Mode::MODE_CBC: return "cbc";
+            case StegCrypt::Mode::MODE_CTR: return "ctr";
+            default: return "gcm";
+        }
+    }
+
+    // Megabytes per second of data processed by fn, best of a few runs
+    template<typename Function>
+    double Measure(size_t bytes, Function fn) {
+        double best = 0;
+        for (int run = 0; run < 3; run++) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = std::max(best, bytes / 1e6 / elapsed.count());
+        }
+        return best;
+    }
+
+    void MeasureRoundTrip(const char* backendName, const std::vector<byte>& password, const std::vector<byte>& data, StegCrypt::Algorithm algo, StegCrypt::Mode mode) {
+        std::vector<byte> encrypted;
+        double encryptRate = Measure(data.size(), [&] {
+            encrypted = StegCrypt::Encrypt(password, data, algo, mode);
+        });
+        double decryptRate = Measure(data.size(), [&] {
+            if (StegCrypt::Decrypt(password, encrypted, algo, mode).size() != data.size()) {
+                std::printf("Decrypted size mismatch\n");
+                std::exit(1);
+            }
+        });
+        std::printf("%-10s %-8s %-6s %14.1f %14.1f\n", backendName, GetName(algo), GetName(mode), encryptRate, decryptRate);
+    }
+
+}
+
+int main(int argc, char** argv) {
+
+    size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16;
+    size_t size = megabytes << 20;
+
+    // Key derivation is included in every call, the payload is large enough for it not to matter
+    std::vector<byte> password = {'b', 'e', 'n', 'c', 'h'};
+    std::vector<byte> data(size);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = byte(i * 131 + (i >> 8));
+    }
+
+    std::vector<StegCrypt::Backend> backends = {StegCrypt::Backend::BACKEND_PORTABLE};
+    StegCrypt::SetBackend(StegCrypt::Backend::BACKEND_AUTO);
+    if (StegCrypt::GetBackend() == StegCrypt::Backend::BACKEND_AESNI) {
+        backends.push_back(StegCrypt::Backend::BACKEND_AESNI);
+    } else {
+        std::printf("AES-NI is not supported on this CPU, only the portable backend is measured\n");
+    }
+
+    std::printf("%-10s %-8s %-6s %14s %14s\n", "backend", "algo", "mode", "encrypt MB/s", "decrypt MB/s");
+    for (StegCrypt::Backend backend : backends) {
+        StegCrypt::SetBackend(backend);
+        for (auto algo : {StegCrypt::Algorithm::ALGO_AES128, StegCrypt::Algorithm::ALGO_AES192, StegCrypt::Algorithm::ALGO_AES256}) {
+            for (auto mode : {StegCrypt::Mode::MODE_CBC, StegCrypt::Mode::MODE_CTR, StegCrypt::Mode::MODE_GCM}) {
+                MeasureRoundTrip(GetName(backend), password, data, algo, mode);
+            }
+        }
+    }
+
+    // ChaCha20-Poly1305 does not depend on the AES backend and is always authenticated like GCM
+    MeasureRoundTrip("any", password, data, StegCrypt::Algorithm::ALGO_CHACHA20, StegCrypt::Mode::MODE_GCM);
+
+    return 0;
+
+}
@@ -0,0 +1,42 @@
+// Key derivation latency for a range of Argon2 cost parameters
+// Usage: steg-kdf-bench
+
+#include "StegCrypt.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+using namespace Steg;
+
+int main() {
+
+    // A one byte CTR payload, so the time is spent deriving the key
+    std::vector<byte> password = {'b', 'e', 'n', 'c', 'h'};
+    std::vector<byte> data = {0};
+
+    std::printf("%-6s %-12s %-6s %12s\n", "time", "memory KiB", "lanes", "latency ms");
+    for (uint32_t timeCost : {1, 2, 4}) {
+        for (uint32_t memoryCost : {1 << 8, 1 << 12, 1 << 16, 1 << 18}) {
+            for (uint32_t lanes : {1, 2, 4, 8}) {
+                KDFParams kdf;
+                kdf.TimeCost = timeCost;
+                kdf.MemoryCost = memoryCost;
+                kdf.Lanes = lanes;
+
+                // Best of a few runs
+                double best = 0;
+                for (int run = 0; run < 3; run++) {
+                    auto start = std::chrono::steady_clock::now();
+                    StegCrypt::Encrypt(password, data, StegCrypt::Algorithm::ALGO_AES256, StegCrypt::Mode::MODE_CTR, kdf);
+                    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+                    best = run == 0 ? elapsed.count() : std::min(best, elapsed.count());
+                }
+                std::printf("%-6u %-12u %-6u %12.2f\n", timeCost, memoryCost, lanes, best);
+            }
+        }
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,299 @@
+// Throughput of every hot path as JSON, so results from two versions can be compared
+// Usage: steg-bench [--quick] [output.json]
+// Without an output file the JSON goes to stdout, progress always goes to stderr
+
+#include "GrayImage.h"
+#include "RGBImage.h"
+#include "StegCrypt.h"
+#include "StegEngine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+using namespace Steg;
+
+namespace {
+
+    constexpr PixelMode AllModes[] = {
+        PixelMode::GRAY_8, PixelMode::GRAY_16,
+        PixelMode::GRAYA_8, PixelMode::GRAYA_16,
+        PixelMode::RGB_8, PixelMode::RGB_16,
+        PixelMode::RGBA_8, PixelMode::RGBA_16
+    };
+
+    const char* GetName(PixelMode mode) {
+        switch (mode) {
+            case PixelMode::GRAY_8: return "GRAY_8";
+            case PixelMode::GRAY_16: return "GRAY_16";
+            case PixelMode::GRAYA_8: return "GRAYA_8";
+            case PixelMode::GRAYA_16: return "GRAYA_16";
+            case PixelMode::RGB_8: return "RGB_8";
+            case PixelMode::RGB_16: return "RGB_16";
+            case PixelMode::RGBA_8: return "RGBA_8";
+            case PixelMode::RGBA_16: return "RGBA_16";
+            default: return "INVALID";
+        }
+    }
+
+    const char* GetName(StegCrypt::Algorithm algo) {
+        switch (algo) {
+            case StegCrypt::Algorithm::ALGO_AES128: return "aes128";
+            case StegCrypt::Algorithm::ALGO_AES192: return "aes192";
+            case StegCrypt::Algorithm::ALGO_AES256: return "aes256";
+            default: return "chacha20";
+        }
+    }
+
+    const char* GetName(StegCrypt::Mode mode) {
+        switch (mode) {
+            case StegCrypt::Mode::MODE_CBC: return "cbc";
+            case StegCrypt::Mode::MODE_CTR: return "ctr";
+            default: return "gcm";
+        }
+    }
+
+    // Seconds taken by fn, best of a few runs
+    template<typename Function>
+    double Measure(Function fn) {
+        double best = 0;
+        for (int run = 0; run < 3; run++) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = run == 0 ? elapsed.count() : std::min(best, elapsed.count());
+        }
+        return best;
+    }
+
+    // Collects results and writes them as one JSON document
+    class Report {
+
+    public:
+
+        // parameters are the JSON members describing the case, without braces
+        void Add(const std::string& benchmark, const std::string& parameters, size_t bytes, double seconds) {
+            char numbers[128];
+            std::snprintf(numbers, sizeof(numbers), "\"bytes\":%zu,\"seconds\":%.9f,\"mb_per_s\":%.3f,\"ns_per_byte\":%.4f",
+                          bytes, seconds, bytes / 1e6 / seconds, seconds * 1e9 / std::max<size_t>(bytes, 1));
+            Results.push_back("{\"benchmark\":\"" + benchmark + "\"," + parameters + "," + numbers + "}");
+            std::cerr << benchmark << " " << parameters << " " << numbers << std::endl;
+        }
+
+        void Write(std::ostream& stream) const {
+            stream << "{\"crypt_backend\":\"" << (StegCrypt::GetBackend() == StegCrypt::Backend::BACKEND_AESNI ? "aesni" : "portable")
+                   << "\",\"results\":[";
+            for (size_t i = 0; i < Results.size(); i++) {
+                stream << (i == 0 ? "\n" : ",\n") << Results[i];
+            }
+            stream << "\n]}\n";
+        }
+
+    private:
+
+        std::vector<std::string> Results;
+
+    };
+
+    std::string CarrierParameters(PixelMode mode, uint32_t size) {
+        return std::string("\"mode\":\"") + GetName(mode) + "\",\"width\":" + std::to_string(size) + ",\"height\":" + std::to_string(size);
+    }
+
+    // Calls fn with a size x size carrier of the given mode filled with noise
+    template<typename Function>
+    void WithCarrier(PixelMode mode, uint32_t size, Function fn) {
+        auto fill = [&](Image& image) {
+            uint32_t state = 12345;
+            uint32_t byteCount = size * size * image.GetPixelWidth();
+            for (uint32_t i = 0; i < byteCount; i++) {
+                state = state * 1664525 + 1013904223;
+                image.SetByte(i, byte(state >> 24));
+            }
+            fn(image);
+        };
+
+        bool gray = mode == PixelMode::GRAY_8 || mode == PixelMode::GRAY_16 || mode == PixelMode::GRAYA_8 || mode == PixelMode::GRAYA_16;
+        bool alpha = mode == PixelMode::GRAYA_8 || mode == PixelMode::GRAYA_16 || mode == PixelMode::RGBA_8 || mode == PixelMode::RGBA_16;
+        bool wide = mode == PixelMode::GRAY_16 || mode == PixelMode::GRAYA_16 || mode == PixelMode::RGB_16 || mode == PixelMode::RGBA_16;
+        if (gray) {
+            GrayImage image(size, size, wide ? 16 : 8, alpha);
+            fill(image);
+        } else {
+            RGBImage image(size, size, wide ? 16 : 8, alpha);
+            fill(image);
+        }
+    }
+
+    void BenchmarkIndices(Report& report, const std::vector<uint32_t>& sizes) {
+        for (uint32_t size : sizes) {
+
+            // One index per byte of an RGBA_8 carrier
+            uint32_t indexCount = size * size * 4;
+            double seconds = Measure([&] {
+                RNG rng(0, indexCount - 2);
+                StegEngine::GenerateIndices(indexCount, rng);
+            });
+            report.Add("generate_indices", CarrierParameters(PixelMode::RGBA_8, size), indexCount, seconds);
+
+            // The LocalScatter order with no header indices left out
+            double blockSeconds = Measure([&] {
+                RNG rng(0, indexCount - 2);
+                StegEngine::GenerateBlockIndices(indexCount, rng, {});
+            });
+            report.Add("generate_block_indices", CarrierParameters(PixelMode::RGBA_8, size), indexCount, blockSeconds);
+        }
+    }
+
+    void BenchmarkEngine(Report& report, const std::vector<uint32_t>& sizes) {
+        for (PixelMode mode : AllModes) {
+            for (uint32_t size : sizes) {
+                WithCarrier(mode, size, [&](Image& image) {
+                    for (byte depth : {1, 2, 4, 8}) {
+                        for (bool alpha : {false, true}) {
+                            if (alpha && !image.HasAlpha()) {
+                                continue;
+                            }
+
+                            for (bool local : {false, true}) {
+                                EncoderSettings settings;
+                                settings.DataDepth = depth;
+                                settings.EncodeInAlpha = alpha;
+                                settings.LocalScatter = local;
+
+                                // Fill the carrier, throughput is measured in payload bytes
+                                std::vector<byte> payload(StegEngine::CalculateAvailableBytes(image, settings));
+                                for (size_t i = 0; i < payload.size(); i++) {
+                                    payload[i] = byte(i * 131 + (i >> 8));
+                                }
+
+                                std::string parameters = CarrierParameters(mode, size) + ",\"data_depth\":" + std::to_string(depth) +
+                                                         ",\"encode_in_alpha\":" + (alpha ? "true" : "false") +
+                                                         ",\"local_scatter\":" + (local ? "true" : "false");
+
+                                double encodeSeconds = Measure([&] {
+                                    StegEngine::Encode(image, payload, settings);
+                                });
+                                report.Add("encode", parameters, payload.size(), encodeSeconds);
+
+                                double decodeSeconds = Measure([&] {
+                                    if (StegEngine::Decode(image, std::vector<byte>()).size() != payload.size()) {
+                                        std::cerr << "Decoded size mismatch" << std::endl;
+                                        std::exit(1);
+                                    }
+                                });
+                                report.Add("decode", parameters, payload.size(), decodeSeconds);
+                            }
+                        }
+                    }
+                });
+            }
+        }
+    }
+
+    void BenchmarkCrypt(Report& report, size_t size) {
+        std::vector<byte> password = {'b', 'e', 'n', 'c', 'h'};
+        std::vector<byte> data(size);
+        for (size_t i = 0; i < size; i++) {
+            data[i] = byte(i * 131 + (i >> 8));
+        }
+
+        // Only the first run derives the key, so the best run measures the cipher
+        StegCrypt::SetKeyCacheCapacity(1);
+
+        for (auto algo : {StegCrypt::Algorithm::ALGO_AES128, StegCrypt::Algorithm::ALGO_AES192, StegCrypt::Algorithm::ALGO_AES256, StegCrypt::Algorithm::ALGO_CHACHA20}) {
+            for (auto mode : {StegCrypt::Mode::MODE_CBC, StegCrypt::Mode::MODE_CTR, StegCrypt::Mode::MODE_GCM}) {
+
+                // ChaCha20-Poly1305 ignores the mode
+                if (algo == StegCrypt::Algorithm::ALGO_CHACHA20 && mode != StegCrypt::Mode::MODE_GCM) {
+                    continue;
+                }
+
+                std::string parameters = std::string("\"algorithm\":\"") + GetName(algo) + "\",\"cipher_mode\":\"" + GetName(mode) + "\"";
+
+                std::vector<byte> encrypted;
+                double encryptSeconds = Measure([&] {
+                    encrypted = StegCrypt::Encrypt(password, data, algo, mode);
+                });
+                report.Add("encrypt", parameters, size, encryptSeconds);
+
+                double decryptSeconds = Measure([&] {
+                    StegCrypt::Decrypt(password, encrypted, algo, mode);
+                });
+                report.Add("decrypt", parameters, size, decryptSeconds);
+            }
+        }
+
+        StegCrypt::SetKeyCacheCapacity(0);
+    }
+
+    void BenchmarkPNG(Report& report, const std::vector<uint32_t>& sizes) {
+        std::string path = (std::filesystem::temp_directory_path() / "steg-bench.png").string();
+
+        for (PixelMode mode : AllModes) {
+
+            // 16-bit images cannot be saved yet
+            if (mode == PixelMode::GRAY_16 || mode == PixelMode::GRAYA_16 || mode == PixelMode::RGB_16 || mode == PixelMode::RGBA_16) {
+                continue;
+            }
+
+            for (uint32_t size : sizes) {
+                WithCarrier(mode, size, [&](Image& image) {
+                    size_t rasterBytes = size_t(size) * size * image.GetPixelWidth();
+
+                    double saveSeconds = Measure([&] {
+                        image.SaveImage(path);
+                    });
+                    report.Add("png_save", CarrierParameters(mode, size), rasterBytes, saveSeconds);
+
+                    double loadSeconds = Measure([&] {
+                        Image loaded(path);
+                    });
+                    report.Add("png_load", CarrierParameters(mode, size), rasterBytes, loadSeconds);
+                });
+            }
+        }
+
+        std::filesystem::remove(path);
+    }
+
+}
+
+int main(int argc, char** argv) {
+
+    bool quick = false;
+    const char* outputPath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else {
+            outputPath = argv[i];
+        }
+    }
+
+    // Carrier edge lengths in pixels
+    std::vector<uint32_t> sizes = quick ? std::vector<uint32_t>{128, 256} : std::vector<uint32_t>{256, 512, 1024};
+
+    Report report;
+    BenchmarkIndices(report, sizes);
+    BenchmarkEngine(report, sizes);
+    BenchmarkCrypt(report, quick ? size_t(1) << 20 : size_t(16) << 20);
+    BenchmarkPNG(report, sizes);
+
+    if (outputPath) {
+        std::ofstream file(outputPath);
+        report.Write(file);
+        if (!file) {
+            std::cerr << "Could not write " << outputPath << std::endl;
+            return 1;
+        }
+    } else {
+        report.Write(std::cout);
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Core.h"
+
+#include <mutex>
+#include <unordered_map>
+
+namespace Steg {
+
+    // Source of raster memory for Image
+    // Implementations must be thread-safe since images are created and destroyed on any thread
+    class BufferAllocator {
+
+    public:
+
+        // Every buffer handed out is aligned to at least this many bytes
+        static constexpr size_t Alignment = 64;
+
+        virtual ~BufferAllocator() = default;
+
+        // Returns a buffer of at least size bytes
+        // The contents are only guaranteed to be zero if zeroed is true
+        virtual byte* Allocate(size_t size, bool zeroed) = 0;
+
+        // Returns a buffer obtained from Allocate with the same size
+        virtual void Deallocate(byte* buffer, size_t size) = 0;
+
+    };
+
+    // Allocates and frees every buffer directly
+    class DefaultBufferAllocator : public BufferAllocator {
+
+    public:
+
+        byte* Allocate(size_t size, bool zeroed) override;
+
+        void Deallocate(byte* buffer, size_t size) override;
+
+    };
+
+    // Recycles buffers through size classes so batch jobs reuse raster memory instead of faulting in new pages
+    // Recycled buffers are only cleared when the caller asks for zeroed memory
+    class PooledBufferAllocator : public BufferAllocator {
+
+    public:
+
+        // Buffers at least this large are mapped separately and may be backed by transparent huge pages
+        static constexpr size_t HugePageSize = size_t(2) << 20;
+
+        // maxCachedBytes: upper bound on the memory held in the free lists
+        // useHugePages: request transparent huge pages for large buffers (Linux only, ignored elsewhere)
+        explicit PooledBufferAllocator(size_t maxCachedBytes = size_t(1) << 30, bool useHugePages = false);
+
+        ~PooledBufferAllocator() override;
+
+        PooledBufferAllocator(const PooledBufferAllocator& other) = delete;
+
+        PooledBufferAllocator& operator=(const PooledBufferAllocator& other) = delete;
+
+        byte* Allocate(size_t size, bool zeroed) override;
+
+        void Deallocate(byte* buffer, size_t size) override;
+
+        // Releases every cached buffer back to the system
+        void Trim();
+
+        size_t GetCachedBytes() const;
+
+        // Rounds a request up to its size class
+        // Classes are spaced a quarter power of two apart so at most 25% of a buffer is wasted
+        static size_t GetSizeClass(size_t size);
+
+    private:
+
+        byte* AllocateFromSystem(size_t sizeClass);
+
+        void FreeToSystem(byte* buffer, size_t sizeClass);
+
+        const size_t MaxCachedBytes;
+        const bool UseHugePages;
+
+        mutable std::mutex Mutex;
+        std::unordered_map<size_t, std::vector<byte*>> FreeLists;
+        size_t CachedBytes = 0;
+
+    };
+
+}
@@ -1,30 +1,32 @@
-#pragma once
-
-#include <array>
-#include <chrono>
-#include <memory>
-#include <random>
-#include <string>
-#include <vector>
-
-namespace Steg {
-
-    typedef unsigned char byte;
-
-    template<typename T>
-    using Scope = std::unique_ptr<T>;
-
-    template<typename T, typename ... Args>
-    constexpr Scope<T> CreateScope(Args&& ... args) {
-        return std::make_unique<T>(std::forward<Args>(args)...);
-    }
-
-    template<typename T>
-    using Ref = std::shared_ptr<T>;
-
-    template<typename T, typename ... Args>
-    constexpr Ref<T> CreateRef(Args&& ... args) {
-        return std::make_shared<T>(std::forward<Args>(args)...);
-    }
-
-}
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace Steg {
+
+    typedef unsigned char byte;
+
+    template<typename T>
+    using Scope = std::unique_ptr<T>;
+
+    template<typename T, typename ... Args>
+    constexpr Scope<T> CreateScope(Args&& ... args) {
+        return std::make_unique<T>(std::forward<Args>(args)...);
+    }
+
+    template<typename T>
+    using Ref = std::shared_ptr<T>;
+
+    template<typename T, typename ... Args>
+    constexpr Ref<T> CreateRef(Args&& ... args) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+
+}
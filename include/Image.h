@@ -1,76 +1,168 @@
-#pragma once
-
-#include "Core.h"
-
-namespace Steg {
-
-    enum class PixelMode {
-        GRAY_8, GRAY_16,
-        GRAYA_8, GRAYA_16,
-        RGB_8, RGB_16,
-        RGBA_8, RGBA_16,
-        INVALID
-    };
-
-    class Image {
-
-    public:
-
-        Image(const std::string& imagePath);
-
-        ~Image() = default;
-
-        void SaveImage(const std::string& imagePath) const;
-
-        uint64_t GetColor(uint32_t x, uint32_t y) const;
-
-        byte GetByte(uint32_t index) const;
-
-        bool IsAlphaIndex(uint32_t index) const;
-
-        void SetColor(uint32_t x, uint32_t y, uint64_t color);
-
-        void SetByte(uint32_t index, byte value);
-
-        uint32_t GetWidth() const;
-
-        uint32_t GetHeight() const;
-
-        PixelMode GetPixelMode() const;
-
-        uint32_t GetBitDepth() const;
-
-        uint32_t GetChannelCount() const;
-
-        uint32_t GetPixelWidth() const;
-
-        bool HasAlpha() const;
-
-    protected:
-
-        Image(uint32_t width, uint32_t height, const PixelMode& mode);
-
-        Image operator=(const Image& other) = delete;
-
-        static PixelMode GetGrayMode(uint32_t bitDepth, bool hasAlpha);
-
-        static PixelMode GetRGBMode(uint32_t bitDepth, bool hasAlpha);
-
-        static uint32_t GetBitDepth(const PixelMode& mode);
-
-        static uint32_t GetChannelCount(const PixelMode& mode);
-
-        static uint32_t GetPixelWidth(const PixelMode& mode);
-
-        static bool HasAlpha(const PixelMode& mode);
-
-    private:
-
-        uint32_t Width;
-        uint32_t Height;
-        uint32_t PixelCount;
-        PixelMode Mode;
-        std::vector<byte> Data;
-
-    };
-}
+#pragma once
+
+#include "Core.h"
+#include "ImageBuffer.h"
+#include "PixelMode.h"
+#include "PixelSpan.h"
+#include "StegTask.h"
+
+namespace Steg {
+
+    class PNGBlocks;
+
+    class Image {
+
+    public:
+
+        // The image gets the color type of the PNG, 16-bit files are read as 8-bit and palette files as RGBA_8
+        Image(const std::string& imagePath);
+
+        // Decodes a PNG file that is already in memory, for example one read from a pipe
+        explicit Image(std::span<const byte> pngData);
+
+        Image(const Image& other);
+
+        Image(Image&& other) noexcept;
+
+        ~Image();
+
+        // Works on pixels the caller owns instead of a copy of them, so encoding changes them in place
+        // stride is the distance in bytes between the starts of two rows, at least width times the pixel width
+        // The pixels must stay valid while the image is alive and are never freed by it
+        // Note: Copies and ConvertTo move the pixels into a buffer of their own, saves always compress every row
+        static Image Wrap(byte* pixels, uint32_t width, uint32_t height, size_t stride, const PixelMode& mode);
+
+        // Load and save on the library's thread pool, see StegTask.h and StegThreads.h
+        // The image being saved must stay alive and unmodified until the task finishes
+        static Task<Image> LoadImageAsync(std::string imagePath);
+
+        Task<void> SaveImageAsync(std::string imagePath) const;
+
+        // Only the rows written to since the image was last loaded or saved are compressed again,
+        // as long as the library was built with zlib and the PNG it came from was written by this library
+        void SaveImage(const std::string& imagePath) const;
+
+        // The PNG file SaveImage would write, without touching the disk
+        std::vector<byte> EncodePNG() const;
+
+        uint64_t GetColor(uint32_t x, uint32_t y) const;
+
+        byte GetByte(uint32_t index) const;
+
+        bool IsAlphaIndex(uint32_t index) const;
+
+        void SetColor(uint32_t x, uint32_t y, uint64_t color);
+
+        void SetByte(uint32_t index, byte value);
+
+        // Converts every pixel of the image to another PixelMode in a single pass
+        // See PixelConvert.h for how depth, gray and alpha are converted
+        void ConvertTo(const PixelMode& mode);
+
+        uint32_t GetWidth() const;
+
+        uint32_t GetHeight() const;
+
+        PixelMode GetPixelMode() const;
+
+        uint32_t GetBitDepth() const;
+
+        uint32_t GetChannelCount() const;
+
+        uint32_t GetPixelWidth() const;
+
+        bool HasAlpha() const;
+
+        // Typed row access for full-image passes
+        // Mode must match the image's PixelMode, which is checked once per call rather than once per pixel
+        // Mutable access counts as a write for the next save, Row marks its row and Rows marks the whole image
+
+        template<PixelMode M>
+        PixelSpan<M> Row(uint32_t y) {
+            CheckPixelMode(M);
+            MarkRow(y);
+            return RowRange<M>(Data.GetData(), Width, Height, Stride)[y];
+        }
+
+        template<PixelMode M>
+        PixelSpan<M, const byte> Row(uint32_t y) const {
+            return Rows<M>()[y];
+        }
+
+        template<PixelMode M>
+        RowRange<M> Rows() {
+            CheckPixelMode(M);
+            MarkAllRows();
+            return RowRange<M>(Data.GetData(), Width, Height, Stride);
+        }
+
+        template<PixelMode M>
+        RowRange<M, const byte> Rows() const {
+            CheckPixelMode(M);
+            return RowRange<M, const byte>(Data.GetData(), Width, Height, Stride);
+        }
+
+        // Sets the allocator used for the raster of every Image created afterwards
+        // Existing images keep the allocator they were created with
+        static void SetAllocator(const Ref<BufferAllocator>& allocator);
+
+        static Ref<BufferAllocator> GetAllocator();
+
+    protected:
+
+        Image(uint32_t width, uint32_t height, const PixelMode& mode);
+
+        Image operator=(const Image& other) = delete;
+
+        static PixelMode GetGrayMode(uint32_t bitDepth, bool hasAlpha);
+
+        static PixelMode GetRGBMode(uint32_t bitDepth, bool hasAlpha);
+
+        static uint32_t GetBitDepth(const PixelMode& mode);
+
+        static uint32_t GetChannelCount(const PixelMode& mode);
+
+        static uint32_t GetPixelWidth(const PixelMode& mode);
+
+        static bool HasAlpha(const PixelMode& mode);
+
+    private:
+
+        Image(byte* pixels, uint32_t width, uint32_t height, size_t stride, const PixelMode& mode);
+
+        // Position of an index in Data, the rows of a wrapped image may be followed by padding
+        size_t GetOffset(uint32_t index) const {
+            return Stride == RowSize ? index : index / RowSize * Stride + index % RowSize;
+        }
+
+        // The rows without padding in a buffer from the allocator
+        ImageBuffer PackRows() const;
+
+        void CheckPixelMode(const PixelMode& mode) const;
+
+        void MarkRow(uint32_t y);
+
+        void MarkAllRows();
+
+        // Decodes a PNG into this image and returns the LodePNG error, or 0
+        uint32_t ReadPNG(std::span<const byte> pngData);
+
+        std::vector<byte> WritePNG() const;
+
+
+        uint32_t Width;
+        uint32_t Height;
+        uint32_t PixelCount;
+        PixelMode Mode;
+
+        // Bytes of pixels per row and the distance between rows in Data, equal unless the image was wrapped
+        size_t RowSize = 0;
+        size_t Stride = 0;
+
+        ImageBuffer Data;
+
+        // The compressed rows of the last save, nullptr when saves compress the whole image, see PNGBlocks.h
+        Scope<PNGBlocks> Blocks;
+
+    };
+}
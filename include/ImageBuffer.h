@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Core.h"
+#include "BufferAllocator.h"
+
+namespace Steg {
+
+    // Raster storage for Image, allocated through a BufferAllocator or borrowed from the caller
+    class ImageBuffer {
+
+    public:
+
+        ImageBuffer();
+
+        ImageBuffer(size_t size, bool zeroed, const Ref<BufferAllocator>& allocator);
+
+        // Borrows size bytes at data, which are never freed and must outlive the buffer
+        ImageBuffer(byte* data, size_t size);
+
+        // Copies use the same allocator as the source, copies of a borrowed buffer use a DefaultBufferAllocator
+        ImageBuffer(const ImageBuffer& other);
+
+        ImageBuffer(ImageBuffer&& other) noexcept;
+
+        ImageBuffer& operator=(ImageBuffer other) noexcept;
+
+        ~ImageBuffer();
+
+        byte* GetData() {
+            return Data;
+        }
+
+        const byte* GetData() const {
+            return Data;
+        }
+
+        size_t GetSize() const {
+            return Size;
+        }
+
+        byte& operator[](size_t index) {
+            return Data[index];
+        }
+
+        const byte& operator[](size_t index) const {
+            return Data[index];
+        }
+
+        bool IsBorrowed() const {
+            return Data != nullptr && !Allocator;
+        }
+
+    private:
+
+        byte* Data;
+        size_t Size;
+        Ref<BufferAllocator> Allocator;
+
+    };
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Core.h"
+
+namespace Steg {
+
+    enum class PixelMode {
+        GRAY_8, GRAY_16,
+        GRAYA_8, GRAYA_16,
+        RGB_8, RGB_16,
+        RGBA_8, RGBA_16,
+        INVALID
+    };
+
+    // Compile-time layout of a PixelMode
+    // Samples are stored channel-interleaved and 16-bit samples are big-endian (PNG byte order)
+    template<PixelMode Mode>
+    struct PixelTraits {
+
+        static_assert(Mode != PixelMode::INVALID, "PixelTraits requires a valid PixelMode");
+
+        static constexpr uint32_t BitDepth =
+                (Mode == PixelMode::GRAY_8 || Mode == PixelMode::GRAYA_8 ||
+                 Mode == PixelMode::RGB_8 || Mode == PixelMode::RGBA_8) ? 8 : 16;
+
+        static constexpr uint32_t ChannelCount =
+                (Mode == PixelMode::GRAY_8 || Mode == PixelMode::GRAY_16) ? 1 :
+                (Mode == PixelMode::GRAYA_8 || Mode == PixelMode::GRAYA_16) ? 2 :
+                (Mode == PixelMode::RGB_8 || Mode == PixelMode::RGB_16) ? 3 : 4;
+
+        static constexpr bool HasAlpha = ChannelCount == 2 || ChannelCount == 4;
+
+        static constexpr bool IsGray = ChannelCount <= 2;
+
+        static constexpr uint32_t BytesPerSample = BitDepth / 8;
+
+        static constexpr uint32_t PixelWidth = ChannelCount * BytesPerSample;
+
+        using Sample = std::conditional_t<BitDepth == 8, uint8_t, uint16_t>;
+
+    };
+
+    // Calls function.template operator()<Mode>() with mode as a compile-time constant
+    // This lets a whole pass over an image pay for one switch instead of one per pixel
+    template<typename Function>
+    decltype(auto) DispatchPixelMode(PixelMode mode, Function&& function) {
+        switch (mode) {
+            case PixelMode::GRAY_8:
+                return function.template operator()<PixelMode::GRAY_8>();
+            case PixelMode::GRAY_16:
+                return function.template operator()<PixelMode::GRAY_16>();
+            case PixelMode::GRAYA_8:
+                return function.template operator()<PixelMode::GRAYA_8>();
+            case PixelMode::GRAYA_16:
+                return function.template operator()<PixelMode::GRAYA_16>();
+            case PixelMode::RGB_8:
+                return function.template operator()<PixelMode::RGB_8>();
+            case PixelMode::RGB_16:
+                return function.template operator()<PixelMode::RGB_16>();
+            case PixelMode::RGBA_8:
+                return function.template operator()<PixelMode::RGBA_8>();
+            case PixelMode::RGBA_16:
+                return function.template operator()<PixelMode::RGBA_16>();
+            default:
+                throw std::invalid_argument("Unsupported Pixel Mode");
+        }
+    }
+
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "Core.h"
+#include "PixelMode.h"
+
+#include <cstddef>
+#include <iterator>
+#include <span>
+
+namespace Steg {
+
+    // A view of one pixel inside an image buffer
+    // ByteType is byte for mutable views and const byte for read-only views
+    template<PixelMode Mode, typename ByteType = byte>
+    class Pixel {
+
+    public:
+
+        using Traits = PixelTraits<Mode>;
+        using Sample = typename Traits::Sample;
+
+        explicit Pixel(ByteType* data) : Data(data) {}
+
+        Sample Get(uint32_t channel) const {
+            if constexpr (Traits::BitDepth == 8) {
+                return Data[channel];
+            } else {
+                return Sample((Data[2 * channel] << 8) | Data[2 * channel + 1]);
+            }
+        }
+
+        void Set(uint32_t channel, Sample value) const requires (!std::is_const_v<ByteType>) {
+            if constexpr (Traits::BitDepth == 8) {
+                Data[channel] = value;
+            } else {
+                Data[2 * channel] = byte(value >> 8);
+                Data[2 * channel + 1] = byte(value & 0xFF);
+            }
+        }
+
+        // The alpha channel is always the last channel
+        Sample GetAlpha() const requires Traits::HasAlpha {
+            return Get(Traits::ChannelCount - 1);
+        }
+
+        ByteType* GetData() const {
+            return Data;
+        }
+
+    private:
+
+        ByteType* Data;
+
+    };
+
+    // Iterates over consecutive pixels of a row
+    template<PixelMode Mode, typename ByteType = byte>
+    class PixelIterator {
+
+    public:
+
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Pixel<Mode, ByteType>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Pixel<Mode, ByteType>;
+
+        PixelIterator() : Data(nullptr) {}
+
+        explicit PixelIterator(ByteType* data) : Data(data) {}
+
+        Pixel<Mode, ByteType> operator*() const {
+            return Pixel<Mode, ByteType>(Data);
+        }
+
+        PixelIterator& operator++() {
+            Data += PixelTraits<Mode>::PixelWidth;
+            return *this;
+        }
+
+        PixelIterator operator++(int) {
+            PixelIterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const PixelIterator& other) const = default;
+
+    private:
+
+        ByteType* Data;
+
+    };
+
+    // A view of one row of pixels with a compile-time PixelMode
+    template<PixelMode Mode, typename ByteType = byte>
+    class PixelSpan {
+
+    public:
+
+        using Traits = PixelTraits<Mode>;
+
+        PixelSpan(ByteType* data, uint32_t width) : Data(data), Width(width) {}
+
+        Pixel<Mode, ByteType> operator[](uint32_t x) const {
+            return Pixel<Mode, ByteType>(Data + x * Traits::PixelWidth);
+        }
+
+        PixelIterator<Mode, ByteType> begin() const {
+            return PixelIterator<Mode, ByteType>(Data);
+        }
+
+        PixelIterator<Mode, ByteType> end() const {
+            return PixelIterator<Mode, ByteType>(Data + Width * Traits::PixelWidth);
+        }
+
+        uint32_t GetWidth() const {
+            return Width;
+        }
+
+        // Raw interleaved samples of this row (16-bit samples are big-endian)
+        std::span<ByteType> GetBytes() const {
+            return std::span<ByteType>(Data, Width * Traits::PixelWidth);
+        }
+
+    private:
+
+        ByteType* Data;
+        uint32_t Width;
+
+    };
+
+    // Iterates over the rows of an image
+    template<PixelMode Mode, typename ByteType = byte>
+    class RowIterator {
+
+    public:
+
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = PixelSpan<Mode, ByteType>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = PixelSpan<Mode, ByteType>;
+
+        RowIterator() : Data(nullptr), Width(0), Stride(0) {}
+
+        RowIterator(ByteType* data, uint32_t width, size_t stride) : Data(data), Width(width), Stride(stride) {}
+
+        PixelSpan<Mode, ByteType> operator*() const {
+            return PixelSpan<Mode, ByteType>(Data, Width);
+        }
+
+        RowIterator& operator++() {
+            Data += Stride;
+            return *this;
+        }
+
+        RowIterator operator++(int) {
+            RowIterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const RowIterator& other) const {
+            return Data == other.Data;
+        }
+
+    private:
+
+        ByteType* Data;
+        uint32_t Width;
+        size_t Stride;
+
+    };
+
+    // All rows of an image, usable in range-based for loops
+    // Ex: for (auto row : image.Rows<PixelMode::RGBA_8>()) for (auto pixel : row) pixel.Set(3, 0xFF);
+    template<PixelMode Mode, typename ByteType = byte>
+    class RowRange {
+
+    public:
+
+        RowRange(ByteType* data, uint32_t width, uint32_t height, size_t stride)
+                : Data(data), Width(width), Height(height), Stride(stride) {}
+
+        PixelSpan<Mode, ByteType> operator[](uint32_t y) const {
+            return PixelSpan<Mode, ByteType>(Data + y * Stride, Width);
+        }
+
+        RowIterator<Mode, ByteType> begin() const {
+            return RowIterator<Mode, ByteType>(Data, Width, Stride);
+        }
+
+        RowIterator<Mode, ByteType> end() const {
+            return RowIterator<Mode, ByteType>(Data + Height * Stride, Width, Stride);
+        }
+
+        uint32_t GetHeight() const {
+            return Height;
+        }
+
+    private:
+
+        ByteType* Data;
+        uint32_t Width;
+        uint32_t Height;
+        size_t Stride;
+
+    };
+
+}
@@ -1,39 +1,210 @@
-#pragma once
-
-#include "Core.h"
-
-#include "RNG.h"
-
-namespace Steg {
-
-    class StegCrypt {
-
-    public:
-
-        enum class Algorithm {
-            ALGO_AES128,
-            ALGO_AES192,
-            ALGO_AES256
-        };
-
-        static std::vector<byte> Encrypt(const std::vector<byte>& key, const std::vector<byte> inputBytes, Algorithm algo);
-
-        static std::vector<byte> Decrypt(const std::vector<byte>& key, const std::vector<byte> inputBytes, Algorithm algo);
-
-    private:
-
-        static std::vector<byte> GetIV(RNG& rng, uint32_t ivLength);
-
-        static std::vector<byte> DeriveKey(const std::vector<byte>& key, uint32_t keySize, RNG& rng);
-
-        static std::vector<byte> AddPadding(const std::vector<byte> data, uint32_t blockLength);
-
-        static std::vector<byte> RemovePadding(const std::vector<byte> data);
-
-    public:
-
-        static uint32_t GetBlockLength(Algorithm algo);
-
-    };
-
-}
+#pragma once
+
+#include "Core.h"
+
+#include "RNG.h"
+
+#include <span>
+
+namespace Steg {
+
+    class KeyCache;
+
+    // Argon2i cost parameters used to derive the key from the password
+    // The defaults are the values used before they were configurable
+    struct KDFParams {
+
+        // Passes over memory, 1 to 255
+        uint32_t TimeCost = 2;
+
+        // Memory in KiB, a power of two of at least 8 * Lanes
+        uint32_t MemoryCost = 1 << 8;
+
+        // Independent lanes, each filled on its own thread, 1 to 255
+        // Note: Changing the lane count changes the derived key
+        uint32_t Lanes = 1;
+
+        bool operator==(const KDFParams& other) const = default;
+
+        // Throws std::invalid_argument if the parameters cannot be used or stored in the header
+        void Validate() const;
+
+    };
+
+    class StegCrypt {
+
+    public:
+
+        // CHACHA20: ChaCha20-Poly1305 (RFC 8439) with a 256-bit key, fast without AES hardware
+        enum class Algorithm {
+            ALGO_AES128,
+            ALGO_AES192,
+            ALGO_AES256,
+            ALGO_CHACHA20
+        };
+
+        // How consecutive blocks are chained together
+        // CBC: Padded and strictly serial (the original format)
+        // CTR: Blocks are independent so large payloads are split across threads, no padding
+        // GCM: CTR with an authentication tag, decrypting a modified payload fails
+        // Note: ALGO_CHACHA20 is always authenticated and ignores the mode, its layout is the same as GCM
+        enum class Mode {
+            MODE_CBC,
+            MODE_CTR,
+            MODE_GCM
+        };
+
+        // Which implementation runs the AES block function and GHASH
+        // ChaCha20 picks its SSE2 or AVX2 kernels from the CPU features on its own
+        // AUTO: AES-NI when the CPU supports it, the portable code otherwise
+        // PORTABLE: Always the portable code
+        // AESNI: AES-NI and PCLMULQDQ, selecting it on a CPU without them throws
+        enum class Backend {
+            BACKEND_AUTO,
+            BACKEND_PORTABLE,
+            BACKEND_AESNI
+        };
+
+        static std::vector<byte> Encrypt(const std::vector<byte>& key, const std::vector<byte>& inputBytes, Algorithm algo, Mode mode = Mode::MODE_CBC, const KDFParams& kdf = KDFParams());
+
+        static std::vector<byte> Decrypt(const std::vector<byte>& key, const std::vector<byte>& inputBytes, Algorithm algo, Mode mode = Mode::MODE_CBC, const KDFParams& kdf = KDFParams());
+
+        // Encrypts without allocating a buffer for the payload
+        // buffer must be GetEncryptedSize(dataSize) bytes with the data already written at GetDataOffset
+        // The IV or nonce, padding and tag are written around the data
+        static void EncryptInPlace(const std::vector<byte>& key, std::span<byte> buffer, uint32_t dataSize, Algorithm algo, Mode mode = Mode::MODE_CBC, const KDFParams& kdf = KDFParams());
+
+        // Decrypts an encrypted payload inside buffer and returns the part of buffer holding the data
+        static std::span<byte> DecryptInPlace(const std::vector<byte>& key, std::span<byte> buffer, Algorithm algo, Mode mode = Mode::MODE_CBC, const KDFParams& kdf = KDFParams());
+
+        // Re-encrypts part of the data of a CTR payload in place without touching the rest, offset is relative to the data
+        // prefix is the nonce in front of the data and body receives the data.size() encrypted bytes at offset
+        // A wrong password cannot be detected
+        // Note: The nonce is kept, so anyone holding both versions of the payload learns which bits of the range changed
+        static void PatchInPlace(const std::vector<byte>& key, std::span<const byte> prefix, std::span<byte> body, uint32_t offset, std::span<const byte> data, Algorithm algo, Mode mode = Mode::MODE_CTR, const KDFParams& kdf = KDFParams());
+
+        // Only CTR payloads can be patched in place
+        // CBC would have to encrypt every block after a change again, and GCM and ChaCha20-Poly1305 would reuse their
+        // nonce for a second tag, which gives away the authentication key and lets anyone forge payloads
+        static bool CanPatch(Algorithm algo, Mode mode);
+
+        // Offset of the data in the encrypted form, the length of the IV or nonce in front of it
+        static uint32_t GetDataOffset(Algorithm algo, Mode mode);
+
+        // Encrypts or decrypts a payload piece by piece in the same format as EncryptInPlace and DecryptInPlace
+        // The prefix (IV or nonce) is handled at construction, then everything after it is passed to Update in order
+        // Pieces are processed in place and every piece except the last must be a multiple of 16 bytes
+        class CipherStream {
+
+        public:
+
+            // Encryption: size is the data size and the IV or nonce is written to prefix
+            // Decryption: size is the whole encrypted size and the IV or nonce is read from prefix
+            // prefix is GetDataOffset bytes
+            CipherStream(const std::vector<byte>& key, std::span<byte> prefix, uint32_t size, bool encrypt, Algorithm algo, Mode mode = Mode::MODE_CBC, const KDFParams& kdf = KDFParams());
+
+            ~CipherStream();
+
+            CipherStream(const CipherStream& other) = delete;
+
+            CipherStream& operator=(const CipherStream& other) = delete;
+
+            // Encryption writes the padding or tag once a piece reaches them, the data must already be in place
+            void Update(std::span<byte> piece);
+
+            // Returns the size of the data, after decryption it is followed by the padding or tag
+            // Decryption checks the padding or tag here and throws if it is wrong
+            // Note: Unlike Decrypt, GCM plaintext is produced before authentication and must be discarded if this throws
+            uint32_t Finish();
+
+        private:
+
+            struct State;
+
+            Scope<State> Data;
+
+        };
+
+        // Size of the encrypted form of dataSize bytes, including the IV or nonce, padding and tag
+        static uint32_t GetEncryptedSize(uint32_t dataSize, Algorithm algo, Mode mode);
+
+        // Largest data size whose encrypted form fits in encryptedSize bytes
+        static uint32_t GetMaxDataSize(uint32_t encryptedSize, Algorithm algo, Mode mode);
+
+        // Applies to every operation started afterwards, on any thread
+        static void SetBackend(Backend backend);
+
+        // The backend in use, AUTO is resolved to PORTABLE or AESNI
+        static Backend GetBackend();
+
+        // Keeps up to capacity derived keys in memory so repeated calls with the same password skip the KDF
+        // The cache is off (capacity 0) by default, cached passwords and keys are zeroed when evicted
+        static void SetKeyCacheCapacity(size_t capacity);
+
+        // Zeroes and drops every cached key
+        static void ClearKeyCache();
+
+        // While one exists, every key derived on this thread is kept, even with the key cache off
+        // For operations that encrypt or decrypt several payloads with one password, the keys are zeroed when it ends
+        class KeyScope {
+
+        public:
+
+            KeyScope();
+
+            ~KeyScope();
+
+            KeyScope(const KeyScope& other) = delete;
+
+            KeyScope& operator=(const KeyScope& other) = delete;
+
+        private:
+
+            Scope<KeyCache> Cache;
+
+            // The scope this one is nested in
+            KeyCache* Outer;
+
+        };
+
+    private:
+
+        // CTR, GCM and ChaCha20-Poly1305 prefix the payload with a 96-bit nonce
+        static constexpr uint32_t NonceLength = 12;
+
+        // GCM and ChaCha20-Poly1305 append a 128-bit tag
+        static constexpr uint32_t TagLength = 16;
+
+        // Decrypts length bytes at data in place and returns the size of the data without padding or tag
+        // iv points to the IV or nonce that preceded the data
+        static size_t DecryptData(const std::vector<byte>& pass, const byte* iv, byte* data, size_t length, Algorithm algo, Mode mode, const KDFParams& kdf);
+
+        static void EncryptCBC(const std::vector<byte>& key, std::span<byte> buffer, uint32_t dataSize, Algorithm algo);
+
+        static size_t DecryptCBC(const std::vector<byte>& key, const byte* iv, byte* data, size_t length, Algorithm algo);
+
+        static void EncryptCounter(const std::vector<byte>& key, std::span<byte> buffer, uint32_t dataSize, Mode mode);
+
+        static size_t DecryptCounter(const std::vector<byte>& key, const byte* nonce, byte* data, size_t length, Mode mode);
+
+        static void EncryptChaCha(const std::vector<byte>& key, std::span<byte> buffer, uint32_t dataSize);
+
+        static size_t DecryptChaCha(const std::vector<byte>& key, const byte* nonce, byte* data, size_t length);
+
+        static void GetNonce(std::span<byte> nonce);
+
+        static void GetIV(std::span<byte> iv);
+
+        static std::vector<byte> DeriveKey(const std::vector<byte>& key, uint32_t keySize, const KDFParams& kdf, RNG& rng);
+
+        static void AddPadding(std::span<byte> paddedData, size_t dataSize);
+
+        static size_t RemovePadding(std::span<const byte> paddedData, uint32_t blockLength);
+
+    public:
+
+        static uint32_t GetBlockLength(Algorithm algo);
+
+    };
+
+}
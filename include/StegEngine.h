@@ -1,149 +1,389 @@
-#pragma once
-
-#include "Core.h"
-
-#include "StegCrypt.h"
-#include "RNG.h"
-#include "Image.h"
-
-namespace Steg {
-
-    struct EncryptionSettings {
-
-        // TRUE: Encrypt data before encoding
-        // FALSE: Leave payload alone
-        // Note: Encrypting may increase the payload size slightly
-        bool EncryptPayload = false;
-
-        // The password for encryption (this will later derive a key)
-        std::vector<byte> EncryptionPassword;
-
-        // Larger block sizes means encryption is more secure, but will occupy more space
-        StegCrypt::Algorithm Algo = StegCrypt::Algorithm::ALGO_AES128;
-
-    };
-
-    struct EncoderSettings {
-
-        // Split each data byte into DataDepth bits
-        // 1, 2, 4, 8 are valid values. 16 is not valid yet
-        byte DataDepth = 2;
-
-        // TRUE: Hide data in alpha channel if available
-        // FALSE: Leave alpha channel alone (preferred)
-        // Note: Only applies to RGBA_X or GRAYA_X PixelModes
-        bool EncodeInAlpha = false;
-
-        // TODO Normalize image option
-
-        EncryptionSettings Encryption;
-
-        byte ToByte() const {
-
-            // DataDepth has 4 possible values so it will occupy 2 bits
-            byte result = 0;
-            if (DataDepth == 1) {
-                result |= 0b00'000000;
-            } else if (DataDepth == 2) {
-                result |= 0b01'000000;
-            } else if (DataDepth == 4) {
-                result |= 0b10'000000;
-            } else if (DataDepth == 8) {
-                result |= 0b11'000000;
-            } else {
-                throw std::invalid_argument("Invalid data depth: " + DataDepth);
-                return 0;
-            }
-
-            // Each bool has 2 possible values so they will occupy 1 bit each
-            if (EncodeInAlpha) {
-                result |= 0b00'1'00000;
-            }
-
-            if (Encryption.EncryptPayload) {
-                result |= 0b000'1'0000;
-                switch (Encryption.Algo) {
-                    case StegCrypt::Algorithm::ALGO_AES128:
-                        result |= 0b0000'00'00;
-                        break;
-                    case StegCrypt::Algorithm::ALGO_AES192:
-                        result |= 0b0000'01'00;
-                        break;
-                    case StegCrypt::Algorithm::ALGO_AES256:
-                        result |= 0b0000'10'00;
-                        break;
-                }
-            }
-
-            // TODO Add more bool flags here as needed (2 bits left)
-
-            return result;
-
-        }
-
-        static EncoderSettings FromByte(byte settingsByte) {
-
-            EncoderSettings settings;
-
-            byte depth = (settingsByte & 0b11'000000) >> 6;
-            if (depth == 0b00) {
-                settings.DataDepth = 1;
-            } else if (depth == 0b01) {
-                settings.DataDepth = 2;
-            } else if (depth == 0b10) {
-                settings.DataDepth = 4;
-            } else if (depth == 0b11) {
-                settings.DataDepth = 8;
-            }
-
-            settings.EncodeInAlpha = settingsByte & 0b00'1'00000;
-
-            settings.Encryption.EncryptPayload = settingsByte & 0b000'1'0000;
-
-            if (settings.Encryption.EncryptPayload) {
-                switch ((settingsByte & 0b0000'11'00) >> 2) {
-                    case 0b00:
-                        settings.Encryption.Algo = StegCrypt::Algorithm::ALGO_AES128;
-                        break;
-                    case 0b01:
-                        settings.Encryption.Algo = StegCrypt::Algorithm::ALGO_AES192;
-                        break;
-                    case 0b10:
-                        settings.Encryption.Algo = StegCrypt::Algorithm::ALGO_AES256;
-                        break;
-                }
-            }
-
-            // TODO Add more bool flags here as needed (2 bits left)
-
-            return settings;
-
-        }
-
-    };
-
-    class StegEngine {
-
-    public:
-
-        static void Encode(Image& image, const std::vector<byte>& data, const EncoderSettings& settings);
-
-        static std::vector<byte> Decode(const Image& image, const std::vector<byte> key);
-
-        static uint32_t CalculateAvailableBytes(const Image& image, const EncoderSettings& settings);
-
-    private:
-
-        static constexpr uint32_t HeaderSize = 6;
-
-        static uint16_t GetPixelMask(uint32_t imageBitDepth, uint32_t dataBitDepth);
-
-        static byte GetPartMask(uint32_t imageBitDepth, uint32_t dataBitDepth);
-
-        static std::vector<uint32_t> GenerateIndices(uint32_t seed, RNG& rng);
-
-        static bool CanEncode(const Image& image, uint32_t payloadSize, const EncoderSettings& settings);
-
-    };
-
-}
+#pragma once
+
+#include "Core.h"
+
+#include "StegCrypt.h"
+#include "RNG.h"
+#include "Image.h"
+#include "StegMemory.h"
+#include "StegTask.h"
+
+#include <functional>
+
+namespace Steg {
+
+    struct EncryptionSettings {
+
+        // TRUE: Encrypt data before encoding
+        // FALSE: Leave payload alone
+        // Note: Encrypting may increase the payload size slightly
+        bool EncryptPayload = false;
+
+        // The password for encryption (this will later derive a key)
+        std::vector<byte> EncryptionPassword;
+
+        // Larger block sizes means encryption is more secure, but will occupy more space
+        // ChaCha20 is much faster than AES on CPUs without AES-NI and always detects tampering
+        StegCrypt::Algorithm Algo = StegCrypt::Algorithm::ALGO_AES128;
+
+        // CTR and GCM can use several threads and GCM detects tampering
+        // Note: Modes other than CBC are stored in the extended header
+        StegCrypt::Mode CipherMode = StegCrypt::Mode::MODE_CBC;
+
+        // Cost of deriving the key from the password, higher costs slow down guessing
+        // Note: Non-default values are stored in the extended header, MemoryCost must be a power of two
+        KDFParams KDF;
+
+    };
+
+    struct EncoderSettings {
+
+        // Split each data byte into DataDepth bits
+        // 1, 2, 4, 8 are valid values. 16 is not valid yet
+        byte DataDepth = 2;
+
+        // TRUE: Hide data in alpha channel if available
+        // FALSE: Leave alpha channel alone (preferred)
+        // Note: Only applies to RGBA_X or GRAYA_X PixelModes
+        bool EncodeInAlpha = false;
+
+        // TRUE: Convert the image to NormalizedMode before encoding
+        // FALSE: Encode in the image's own PixelMode
+        // Note: Converting modifies the image and may drop channels or precision
+        bool NormalizeImage = false;
+
+        // The PixelMode images are converted to when NormalizeImage is set
+        PixelMode NormalizedMode = PixelMode::RGB_8;
+
+        EncryptionSettings Encryption;
+
+        // TRUE: Visit the image in random 4 KiB blocks and hide data in random order within each block
+        // FALSE: Spread data over the whole image in one random order (the original format)
+        // Note: Both orders depend on the same seed, keeping consecutive parts on one page saves cache and TLB misses
+        bool LocalScatter = false;
+
+        // TRUE: The payload is an archive of named entries that are extracted one at a time
+        // Note: Set by EncodeArchive, Encode does not accept it
+        bool Archive = false;
+
+        // TRUE: Encrypt in chunks on a pool thread while the finished chunks are embedded
+        // FALSE: Encrypt the whole payload, then embed it
+        // Note: Only applies when EncryptPayload is set, the result is the same either way
+        bool Pipelined = false;
+
+        byte ToByte() const {
+
+            // DataDepth has 4 possible values so it will occupy 2 bits
+            byte result = 0;
+            if (DataDepth == 1) {
+                result |= 0b00'000000;
+            } else if (DataDepth == 2) {
+                result |= 0b01'000000;
+            } else if (DataDepth == 4) {
+                result |= 0b10'000000;
+            } else if (DataDepth == 8) {
+                result |= 0b11'000000;
+            } else {
+                throw std::invalid_argument("Invalid data depth: " + DataDepth);
+                return 0;
+            }
+
+            // Each bool has 2 possible values so they will occupy 1 bit each
+            if (EncodeInAlpha) {
+                result |= 0b00'1'00000;
+            }
+
+            if (Encryption.EncryptPayload) {
+                result |= 0b000'1'0000;
+                switch (Encryption.Algo) {
+                    case StegCrypt::Algorithm::ALGO_AES128:
+                        result |= 0b0000'00'00;
+                        break;
+                    case StegCrypt::Algorithm::ALGO_AES192:
+                        result |= 0b0000'01'00;
+                        break;
+                    case StegCrypt::Algorithm::ALGO_AES256:
+                        result |= 0b0000'10'00;
+                        break;
+                    case StegCrypt::Algorithm::ALGO_CHACHA20:
+                        result |= 0b0000'11'00;
+                        break;
+                }
+            }
+
+            if (LocalScatter) {
+                result |= 0b000000'1'0;
+            }
+
+            if (Archive) {
+                result |= 0b0000000'1;
+            }
+
+            // Note: Every bit is in use, further settings go in the extended header
+
+            return result;
+
+        }
+
+        static EncoderSettings FromByte(byte settingsByte) {
+
+            EncoderSettings settings;
+
+            byte depth = (settingsByte & 0b11'000000) >> 6;
+            if (depth == 0b00) {
+                settings.DataDepth = 1;
+            } else if (depth == 0b01) {
+                settings.DataDepth = 2;
+            } else if (depth == 0b10) {
+                settings.DataDepth = 4;
+            } else if (depth == 0b11) {
+                settings.DataDepth = 8;
+            }
+
+            settings.EncodeInAlpha = settingsByte & 0b00'1'00000;
+
+            settings.Encryption.EncryptPayload = settingsByte & 0b000'1'0000;
+
+            if (settings.Encryption.EncryptPayload) {
+                switch ((settingsByte & 0b0000'11'00) >> 2) {
+                    case 0b00:
+                        settings.Encryption.Algo = StegCrypt::Algorithm::ALGO_AES128;
+                        break;
+                    case 0b01:
+                        settings.Encryption.Algo = StegCrypt::Algorithm::ALGO_AES192;
+                        break;
+                    case 0b10:
+                        settings.Encryption.Algo = StegCrypt::Algorithm::ALGO_AES256;
+                        break;
+                    case 0b11:
+                        settings.Encryption.Algo = StegCrypt::Algorithm::ALGO_CHACHA20;
+                        break;
+                }
+            }
+
+            settings.LocalScatter = settingsByte & 0b000000'1'0;
+
+            settings.Archive = settingsByte & 0b0000000'1;
+
+            return settings;
+
+        }
+
+        // Header bytes following the settings byte
+        // Images written before the extended header have none, so nothing is written for default values
+        std::vector<byte> ToExtendedHeader() const {
+
+            std::vector<byte> result;
+
+            if (!Encryption.EncryptPayload) {
+                return result;
+            }
+
+            // Byte 0: Cipher mode
+            bool defaultKDF = Encryption.KDF == KDFParams();
+            if (Encryption.CipherMode != StegCrypt::Mode::MODE_CBC || !defaultKDF) {
+                result.push_back(byte(Encryption.CipherMode));
+            }
+
+            // Byte 1: KDF time cost
+            // Byte 2: log2 of the KDF memory cost in KiB
+            // Byte 3: KDF lanes
+            if (!defaultKDF) {
+                Encryption.KDF.Validate();
+                byte memoryLog = 0;
+                while ((uint32_t(1) << memoryLog) < Encryption.KDF.MemoryCost) {
+                    memoryLog++;
+                }
+                result.push_back(byte(Encryption.KDF.TimeCost));
+                result.push_back(memoryLog);
+                result.push_back(byte(Encryption.KDF.Lanes));
+            }
+
+            return result;
+
+        }
+
+        // Fields missing from a shorter extended header keep their default values
+        void ReadExtendedHeader(const std::vector<byte>& extendedHeader) {
+
+            if (extendedHeader.size() > 0) {
+                byte mode = extendedHeader[0];
+                if (mode > byte(StegCrypt::Mode::MODE_GCM)) {
+                    throw std::runtime_error("Unsupported cipher mode in header: " + std::to_string(mode));
+                }
+                Encryption.CipherMode = StegCrypt::Mode(mode);
+            }
+
+            if (extendedHeader.size() > 3) {
+                if (extendedHeader[2] > 31) {
+                    throw std::runtime_error("Unsupported KDF memory cost in header");
+                }
+                Encryption.KDF.TimeCost = extendedHeader[1];
+                Encryption.KDF.MemoryCost = uint32_t(1) << extendedHeader[2];
+                Encryption.KDF.Lanes = extendedHeader[3];
+                Encryption.KDF.Validate();
+            }
+
+        }
+
+    };
+
+    struct DecoderSettings {
+
+        // The password the payload was encrypted with, ignored if it is not encrypted
+        std::vector<byte> EncryptionPassword;
+
+        // TRUE: Extract chunks on a pool thread while the finished chunks are decrypted
+        // FALSE: Extract the whole payload, then decrypt it
+        // Note: A GCM payload is authenticated after it is decrypted, nothing is returned if that fails
+        bool Pipelined = false;
+
+    };
+
+    struct ArchiveEntry {
+
+        // Unique within an archive, at most 65535 bytes
+        std::string Name;
+
+        std::vector<byte> Data;
+
+    };
+
+    class StegEngine {
+
+    public:
+
+        static void Encode(Image& image, const std::vector<byte>& data, const EncoderSettings& settings);
+
+        // Encode for data in memory the caller owns, unencrypted data is embedded straight from it
+        // Note: Not an overload of Encode, so Encode(image, {}, settings) stays unambiguous
+        static void EncodeSpan(Image& image, std::span<const byte> data, const EncoderSettings& settings);
+
+        static std::vector<byte> Decode(const Image& image, const std::vector<byte>& key);
+
+        static std::vector<byte> Decode(const Image& image, const DecoderSettings& settings);
+
+        // Decodes into a buffer of the caller's instead of a new vector and returns the size of the data at its start
+        // output must hold the stored payload, see Probe, an encrypted payload is decrypted inside it
+        // Throws std::length_error if output is too small
+        // Note: DecoderSettings::Pipelined is ignored
+        static uint32_t DecodeInto(const Image& image, std::span<byte> output, const DecoderSettings& settings);
+
+        // Reads only the header and returns the settings it holds, without a password
+        // payloadByteCount is set to the size of the stored payload, encrypted payloads decode to fewer bytes
+        static EncoderSettings Probe(const Image& image, uint32_t& payloadByteCount);
+
+        // Encode and Decode on the library's thread pool, see StegTask.h and StegThreads.h
+        // The image must stay alive and untouched until the task finishes
+        // Note: A cancelled EncodeAsync may leave part of the payload written to the image
+        static Task<void> EncodeAsync(Image& image, std::vector<byte> data, EncoderSettings settings);
+
+        static Task<std::vector<byte>> DecodeAsync(const Image& image, DecoderSettings settings);
+
+        // Replaces bytes.size() bytes at offset of a payload hidden by Encode without encoding the whole payload again
+        // Only the index positions up to the end of the range are generated, with LocalScatter only the blocks holding it,
+        // and only the carrier bytes of the range change
+        // Encrypted payloads must be CTR, GCM or ChaCha20-Poly1305, see StegCrypt::PatchInPlace, CBC throws std::invalid_argument
+        // Note: GCM and ChaCha20-Poly1305 payloads cannot keep their nonce, they are decrypted, checked and sealed again
+        // with a fresh one, so the whole payload is read and rewritten
+        static void Patch(Image& image, uint32_t offset, const std::vector<byte>& bytes, const std::vector<byte>& key);
+
+        // Hides several named payloads that ExtractEntry retrieves one at a time
+        // A table of contents (name, offset, length) follows the header and the entries follow it
+        // With encryption the table and every entry are encrypted on their own with a random IV or nonce of their own, so
+        // equal entries do not give equal ciphertext and an entry is decrypted and authenticated without the others,
+        // the key is only derived once
+        // Note: Decode and Patch do not accept an archive
+        static void EncodeArchive(Image& image, const std::vector<ArchiveEntry>& entries, const EncoderSettings& settings);
+
+        // Names of the entries in the order they were encoded
+        static std::vector<std::string> ListEntries(const Image& image, const std::vector<byte>& key);
+
+        // Only reads the carrier bytes of the table of contents and of this entry, throws std::invalid_argument if there is no
+        // entry of that name
+        // Note: The index positions in front of the entry are still drawn unless LocalScatter is set and alpha is not skipped
+        static std::vector<byte> ExtractEntry(const Image& image, const std::string& name, const std::vector<byte>& key);
+
+        // With NormalizeImage set this is the capacity of the image once it is converted to NormalizedMode
+        static uint32_t CalculateAvailableBytes(const Image& image, const EncoderSettings& settings);
+
+        // Whether Encode can hide dataSize bytes of data with these settings, counting the IV or nonce, padding and tag
+        // Unlike a comparison with CalculateAvailableBytes this is also false for an encrypted empty payload that does not fit
+        static bool HasSpace(const Image& image, size_t dataSize, const EncoderSettings& settings);
+
+        // The byte indices 1 to indexCount - 1 of an image in the order data is hidden in them
+        // Encode and Decode seed rng with the first byte of the image and an upper bound of indexCount - 2
+        // The header always takes the first indices of this order, with LocalScatter the payload takes the order of
+        // GenerateBlockIndices drawn from the same rng once the header is written
+        static CountedVector<uint32_t> GenerateIndices(uint32_t indexCount, RNG& rng);
+
+        // The byte indices of an image in random blocks of consecutive indices, shuffled within each block
+        // headerIndices, the ones the header was written to in any order, are left out
+        static CountedVector<uint32_t> GenerateBlockIndices(uint32_t indexCount, RNG& rng, std::vector<uint32_t> headerIndices);
+
+        // Keeps the full order of up to capacity (seed, index count) pairs, so images of one size with the same first byte
+        // skip GenerateIndices, for services that encode and decode many images
+        // The cache is off (capacity 0) by default, an order takes 4 bytes per image byte and LocalScatter orders are not kept
+        static void SetIndexCacheCapacity(size_t capacity);
+
+        static void ClearIndexCache();
+
+    private:
+
+        // GenerateIndices as Encode and Decode seed it, taken from the index cache when it holds the order
+        static Ref<const CountedVector<uint32_t>> GetIndices(uint32_t indexCount, uint32_t seed);
+
+        // Reads the header and then hands out the index positions of the payload in order, only generating those it reaches
+        class PayloadCursor;
+
+        // Encode without the check for Archive, the payload is only encrypted if encrypt is set
+        static void EncodePayload(Image& image, std::span<const byte> data, const EncoderSettings& settings, bool encrypt);
+
+        // Offset and size of an entry's encrypted form in the payload
+        struct ArchiveTableEntry {
+            std::string Name;
+            uint32_t Offset;
+            uint32_t Size;
+        };
+
+        // An archive payload starts with the size of the encrypted table
+        static constexpr uint32_t ArchiveTableOffset = 4;
+
+        // Reads and decrypts the table of contents, the cursor must be at the start of the payload
+        static std::vector<ArchiveTableEntry> ReadArchiveTable(PayloadCursor& cursor, const std::vector<byte>& key);
+
+        // Header size byte, payload size and settings byte
+        static constexpr uint32_t BaseHeaderSize = 6;
+
+        // Base header plus the extended header for these settings
+        static uint32_t GetHeaderSize(const EncoderSettings& settings);
+
+        // The PixelMode the image has once Encode converted it
+        static PixelMode GetEncodedMode(const Image& image, const EncoderSettings& settings);
+
+        // Parts of an image of this size and PixelMode that can hold the header and the payload
+        static uint32_t GetAvailableParts(uint32_t pixelCount, const PixelMode& mode, const EncoderSettings& settings);
+
+        // Parts of an image of this PixelMode used up by the header
+        static uint32_t GetHeaderPartCount(const PixelMode& mode, const EncoderSettings& settings);
+
+        // Reads the header from the index positions nextIndex returns in order
+        // Returns the settings it holds and sets payloadByteCount to the size of the payload that follows
+        static EncoderSettings ReadHeader(const Image& image, const std::function<uint32_t()>& nextIndex, uint32_t& payloadByteCount);
+
+        static uint16_t GetPixelMask(uint32_t imageBitDepth, uint32_t dataBitDepth);
+
+        static byte GetPartMask(uint32_t imageBitDepth, uint32_t dataBitDepth);
+
+        // Hides payload in the image starting at indices[k] and returns the position after the last index used
+        static uint32_t EmbedPayload(Image& image, std::span<const byte> payload, const CountedVector<uint32_t>& indices, uint32_t k, const EncoderSettings& settings);
+
+        // Reads payload.size() bytes from the image starting at indices[k] and returns the position after the last index used
+        static uint32_t ExtractPayload(const Image& image, std::span<byte> payload, const CountedVector<uint32_t>& indices, uint32_t k, const EncoderSettings& settings);
+
+        // Checks the image as it will be encoded, so a normalized image is checked before it is converted
+        static bool CanEncode(const Image& image, uint32_t payloadSize, const EncoderSettings& settings);
+
+    };
+
+}
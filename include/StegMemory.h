@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Core.h"
+
+namespace Steg {
+
+    // Accounts the memory of library buffers: image rasters, index vectors, payload copies and crypto buffers
+    // Bytes are attributed to the thread that allocates them, StegTimer reports them per zone
+    // Process-wide live and peak bytes are kept as well
+    class StegMemory {
+
+    public:
+
+        // Where the calling thread stood when a zone started
+        struct ZoneMark {
+            uint64_t Allocated;
+            int64_t Live;
+            int64_t OuterPeak;
+        };
+
+        // Bytes allocated during a zone, and the most that were live at once above the level at its start
+        struct ZoneUsage {
+            uint64_t Allocated;
+            uint64_t Peak;
+        };
+
+        StegMemory() = delete;
+
+        static void Allocated(size_t size);
+
+        static void Deallocated(size_t size);
+
+        // Every byte the calling thread ever allocated
+        static uint64_t GetThreadAllocatedBytes();
+
+        // Bytes allocated and not yet freed by the calling thread
+        // This goes negative on a thread that frees buffers allocated on another one
+        static int64_t GetThreadLiveBytes();
+
+        // Bytes allocated and not yet freed by any thread
+        static uint64_t GetLiveBytes();
+
+        // The most bytes that were live at once since the start or the last ResetPeak
+        static uint64_t GetPeakBytes();
+
+        static void ResetPeak();
+
+        // Called by StegTimer when a zone starts and ends on the calling thread, zones must end in reverse order
+        static ZoneMark EnterZone();
+
+        static ZoneUsage LeaveZone(const ZoneMark& mark);
+
+    };
+
+    // Standard allocator that accounts everything it hands out in StegMemory
+    template<typename T>
+    class CountingAllocator {
+
+    public:
+
+        using value_type = T;
+
+        CountingAllocator() = default;
+
+        template<typename U>
+        CountingAllocator(const CountingAllocator<U>& other) noexcept {}
+
+        T* allocate(size_t count) {
+            T* items = std::allocator<T>().allocate(count);
+            StegMemory::Allocated(count * sizeof(T));
+            return items;
+        }
+
+        void deallocate(T* items, size_t count) noexcept {
+            StegMemory::Deallocated(count * sizeof(T));
+            std::allocator<T>().deallocate(items, count);
+        }
+
+        template<typename U>
+        bool operator==(const CountingAllocator<U>& other) const noexcept {
+            return true;
+        }
+
+    };
+
+    template<typename T>
+    using CountedVector = std::vector<T, CountingAllocator<T>>;
+
+    // Accounts a container that has to use the standard allocator, for example one returned to the caller
+    // Its capacity counts from Track until the tracker is destroyed or tracks something else
+    class MemoryTracker {
+
+    public:
+
+        MemoryTracker() = default;
+
+        template<typename Container>
+        explicit MemoryTracker(const Container& container) {
+            Track(container);
+        }
+
+        ~MemoryTracker() {
+            StegMemory::Deallocated(Size);
+        }
+
+        MemoryTracker(const MemoryTracker& other) = delete;
+
+        MemoryTracker& operator=(const MemoryTracker& other) = delete;
+
+        template<typename Container>
+        void Track(const Container& container) {
+            size_t size = container.capacity() * sizeof(typename Container::value_type);
+            StegMemory::Allocated(size);
+            StegMemory::Deallocated(Size);
+            Size = size;
+        }
+
+    private:
+
+        size_t Size = 0;
+
+    };
+
+}
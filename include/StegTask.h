@@ -0,0 +1,198 @@
+#pragma once
+
+#include "Core.h"
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <utility>
+#include <variant>
+
+namespace Steg {
+
+    // Thrown by an asynchronous operation that stopped early because its task was cancelled
+    class OperationCancelled : public std::runtime_error {
+
+    public:
+
+        OperationCancelled() : std::runtime_error("Operation cancelled") {}
+
+    };
+
+    template<typename T>
+    class Task;
+
+    namespace Detail {
+
+        // Shared by a task and the coroutine computing it, so either may go away first
+        template<typename T>
+        struct TaskState {
+            using Value = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+            std::mutex Mutex;
+            std::condition_variable Finished;
+            bool Ready = false;
+            std::optional<Value> Result;
+            std::exception_ptr Error;
+            std::coroutine_handle<> Continuation;
+            std::stop_source Stop;
+
+            // Publishes the result, then resumes the coroutine awaiting it on this thread
+            void Complete() {
+                std::coroutine_handle<> continuation;
+                {
+                    std::lock_guard<std::mutex> lock(Mutex);
+                    Ready = true;
+                    continuation = std::exchange(Continuation, nullptr);
+                }
+                Finished.notify_all();
+                if (continuation) {
+                    continuation.resume();
+                }
+            }
+        };
+
+        template<typename T>
+        class TaskPromiseBase {
+
+        public:
+
+            // Destroys the frame before completing, so its locals are freed before anyone continues with the result
+            struct FinalAwaiter {
+
+                bool await_ready() const noexcept {
+                    return false;
+                }
+
+                template<typename Promise>
+                void await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                    Ref<TaskState<T>> state = handle.promise().State;
+                    handle.destroy();
+                    state->Complete();
+                }
+
+                void await_resume() const noexcept {}
+
+            };
+
+            Task<T> get_return_object();
+
+            // Tasks start right away on the calling thread, the operations then move to the executor themselves
+            std::suspend_never initial_suspend() const noexcept {
+                return {};
+            }
+
+            FinalAwaiter final_suspend() const noexcept {
+                return {};
+            }
+
+            void unhandled_exception() {
+                State->Error = std::current_exception();
+            }
+
+            std::stop_token GetStopToken() const {
+                return State->Stop.get_token();
+            }
+
+            Ref<TaskState<T>> State = CreateRef<TaskState<T>>();
+
+        };
+
+        template<typename T>
+        class TaskPromise : public TaskPromiseBase<T> {
+
+        public:
+
+            void return_value(T value) {
+                this->State->Result.emplace(std::move(value));
+            }
+
+        };
+
+        template<>
+        class TaskPromise<void> : public TaskPromiseBase<void> {
+
+        public:
+
+            void return_void() {
+                State->Result.emplace();
+            }
+
+        };
+
+    }
+
+    // Result of an asynchronous operation running on the library's thread pool
+    // Either co_await it from a coroutine, which resumes on the worker thread that finished it, or block on Get
+    // Dropping a task does not stop its operation, call Cancel for that
+    template<typename T = void>
+    class Task {
+
+    public:
+
+        using promise_type = Detail::TaskPromise<T>;
+
+        explicit Task(Ref<Detail::TaskState<T>> state) : State(std::move(state)) {}
+
+        bool IsReady() const {
+            std::lock_guard<std::mutex> lock(State->Mutex);
+            return State->Ready;
+        }
+
+        void Wait() const {
+            std::unique_lock<std::mutex> lock(State->Mutex);
+            State->Finished.wait(lock, [&]() { return State->Ready; });
+        }
+
+        // Waits for the operation, then returns its result or rethrows its exception
+        // Note: A result is moved out, so only the first Get or co_await of a task receives it
+        T Get() {
+            Wait();
+            if (State->Error) {
+                std::rethrow_exception(State->Error);
+            }
+            if constexpr (!std::is_void_v<T>) {
+                return std::move(*State->Result);
+            }
+        }
+
+        // Asks the operation to stop at its next check, after which it fails with OperationCancelled
+        // An operation that already got past its last check still finishes normally
+        void Cancel() {
+            State->Stop.request_stop();
+        }
+
+        // Awaitable by a single coroutine
+
+        bool await_ready() const {
+            return IsReady();
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle) {
+            std::lock_guard<std::mutex> lock(State->Mutex);
+            if (State->Ready) {
+                return false;
+            }
+            State->Continuation = handle;
+            return true;
+        }
+
+        T await_resume() {
+            return Get();
+        }
+
+    private:
+
+        Ref<Detail::TaskState<T>> State;
+
+    };
+
+    template<typename T>
+    Task<T> Detail::TaskPromiseBase<T>::get_return_object() {
+        return Task<T>(State);
+    }
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Core.h"
+
+namespace Steg {
+
+    struct ThreadSettings {
+
+        // Worker threads of the pool, 0 for one per hardware thread
+        uint32_t WorkerCount = 0;
+
+        // Worker i is pinned to CpuAffinity[i % size], an empty list leaves placement to the OS
+        // Note: Only applied on Linux, ignored elsewhere
+        std::vector<uint32_t> CpuAffinity;
+
+    };
+
+    // The one work-stealing thread pool the library runs all its parallel work on:
+    // counter mode and GCM chunks, the encode and decode pipelines and the asynchronous operations
+    // It starts on first use, so it can only be configured before any parallel work has run
+    // Note: Argon2 still fills KDF lanes on threads of its own
+    class StegThreads {
+
+    public:
+
+        StegThreads() = delete;
+
+        // Throws std::runtime_error if the pool is already running
+        static void Configure(const ThreadSettings& settings);
+
+        // Starts the pool if it is not running yet
+        static uint32_t GetWorkerCount();
+
+    };
+
+}
@@ -1,37 +1,118 @@
-#pragma once
-
-#include "Core.h"
-
-namespace Steg {
-
-    class StegTimer {
-
-    public:
-
-        enum TimerLabel {
-            ENCODE,
-            ENCRYPT,
-            DECODE,
-            DECRYPT,
-            TOTAL // This one has to be last in the list
-        };
-
-        StegTimer() = delete;
-
-        static void StartTimer(TimerLabel timer);
-
-        static void EndTimer(TimerLabel timer);
-
-        static void PrintTimers();
-
-    private:
-
-        static std::array<std::chrono::steady_clock::time_point, TimerLabel::TOTAL + 1> timers;
-
-        static std::array<std::chrono::milliseconds, TimerLabel::TOTAL + 1> elapsed;
-
-        static std::string GetTimerName(TimerLabel timer);
-
-    };
-
-}
+#pragma once
+
+#include "Core.h"
+
+#include <map>
+
+namespace Steg {
+
+    // Times nested stages of the library
+    // Every thread keeps its own stack of open zones, so concurrent operations do not interfere
+    // A zone is identified by its label and the labels of the zones it is nested in on the same thread
+    // Ended zones are aggregated across threads into count/min/max/percentile statistics
+    // Every zone also reports the library buffers its thread allocated, see StegMemory
+    // Optionally every zone also counts hardware events of its thread through perf_event_open (Linux only)
+    class StegTimer {
+
+    public:
+
+        enum TimerLabel {
+            ENCODE,
+            ENCRYPT,
+            DECODE,
+            DECRYPT,
+            EMBED,
+            EXTRACT,
+            INDEX_GENERATION,
+            HEADER_WRITE,
+            PAYLOAD_EMBED,
+            KDF,
+            CIPHER,
+            PNG_LOAD,
+            PNG_SAVE,
+            PNG_COMPRESS,
+            AUTHENTICATE,
+            PIXEL_CONVERT,
+            PATCH,
+            TOTAL // This one has to be last in the list
+        };
+
+        // Durations in nanoseconds
+        // The percentiles come from a uniform sample of at most 1024 durations, the rest is exact
+        struct Statistics {
+            uint64_t Count = 0;
+            uint64_t Total = 0;
+            uint64_t Min = 0;
+            uint64_t Max = 0;
+            uint64_t P50 = 0;
+            uint64_t P99 = 0;
+
+            // Bytes allocated over all durations, and the most a single duration had live at once
+            uint64_t AllocatedBytes = 0;
+            uint64_t PeakBytes = 0;
+
+            // Hardware event totals over the durations that ended while counters were enabled
+            // Events the CPU or kernel does not provide stay zero
+            uint64_t Counted = 0;
+            uint64_t Cycles = 0;
+            uint64_t Instructions = 0;
+            uint64_t LLCMisses = 0;
+            uint64_t DTLBMisses = 0;
+            uint64_t BranchMisses = 0;
+        };
+
+        // Outermost label first
+        using ZonePath = std::vector<TimerLabel>;
+
+        StegTimer() = delete;
+
+        static void StartTimer(TimerLabel timer);
+
+        // Ends the innermost open zone with this label on the calling thread
+        // Zones opened inside it and never ended (for example after an exception) are dropped
+        static void EndTimer(TimerLabel timer);
+
+        // Prints every zone with its statistics, nested zones are indented below their parent
+        static void PrintTimers();
+
+        static std::map<ZonePath, Statistics> GetStatistics();
+
+        // Drops the statistics collected so far, zones that are still open are kept
+        static void ResetTimers();
+
+        static std::string GetTimerName(TimerLabel timer);
+
+        // Counts cycles, instructions, LLC, dTLB and branch misses in every zone started from now on
+        // Each zone costs two extra syscalls while enabled, and only the thread that started it is counted
+        // Returns false and stays disabled if the counters cannot be opened, for example outside Linux,
+        // inside a virtual machine without a PMU or under a strict perf_event_paranoid
+        static bool EnableCounters(bool enable);
+
+        static bool AreCountersEnabled();
+
+    };
+
+    // Times the enclosing scope, including when it is left by an exception
+    class ScopedTimer {
+
+    public:
+
+        explicit ScopedTimer(StegTimer::TimerLabel timer) : Label(timer) {
+            StegTimer::StartTimer(timer);
+        }
+
+        ~ScopedTimer() {
+            StegTimer::EndTimer(Label);
+        }
+
+        ScopedTimer(const ScopedTimer& other) = delete;
+
+        ScopedTimer& operator=(const ScopedTimer& other) = delete;
+
+    private:
+
+        StegTimer::TimerLabel Label;
+
+    };
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Core.h"
+
+#include "StegTimer.h"
+
+#include <ostream>
+
+namespace Steg {
+
+    // Opt-in recorder of every StegTimer zone as a Chrome trace event, loadable in Perfetto or chrome://tracing
+    // Each thread appends to its own buffer, so recording only costs an uncontended lock per zone
+    // While recording is off a zone costs a single atomic load
+    class StegTrace {
+
+    public:
+
+        StegTrace() = delete;
+
+        // Drops the events recorded so far and starts recording on every thread
+        static void Start();
+
+        // Stops recording, the recorded events are kept until the next Start
+        static void Stop();
+
+        static bool IsRecording();
+
+        // Records a zone that ended, called by StegTimer for every zone while recording
+        static void Record(StegTimer::TimerLabel label, std::chrono::steady_clock::time_point start,
+                           std::chrono::steady_clock::time_point end);
+
+        // Writes the recorded events as Chrome trace JSON, one track per thread
+        static void Write(std::ostream& stream);
+
+        static void WriteFile(const std::string& path);
+
+    };
+
+}
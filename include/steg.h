@@ -0,0 +1,116 @@
+#pragma once
+
+// C interface of the library for callers in other languages
+// Images are pixel buffers the caller owns, encoding changes them in place and nothing is copied or converted
+// Every function returns a steg_status, steg_last_error describes the last failure on the calling thread
+// Structs are only ever extended at the end, so code built against an older header keeps working
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STEG_ABI_VERSION 1
+
+typedef enum steg_status {
+    STEG_OK = 0,
+    STEG_ERROR_INVALID_ARGUMENT = 1,
+    // The output buffer of steg_decode is too small, the required size is returned in its place
+    STEG_ERROR_BUFFER_TOO_SMALL = 2,
+    // The payload does not fit in the image with these options
+    STEG_ERROR_NO_SPACE = 3,
+    // The image does not hold a payload header
+    STEG_ERROR_NO_PAYLOAD = 4,
+    STEG_ERROR_OUT_OF_MEMORY = 5,
+    // Anything else, for example a wrong password or a tampered payload
+    STEG_ERROR_FAILED = 6
+} steg_status;
+
+// Samples are channel-interleaved and 16-bit samples are big-endian (PNG byte order)
+typedef enum steg_pixel_mode {
+    STEG_PIXEL_GRAY_8 = 0,
+    STEG_PIXEL_GRAY_16 = 1,
+    STEG_PIXEL_GRAYA_8 = 2,
+    STEG_PIXEL_GRAYA_16 = 3,
+    STEG_PIXEL_RGB_8 = 4,
+    STEG_PIXEL_RGB_16 = 5,
+    STEG_PIXEL_RGBA_8 = 6,
+    STEG_PIXEL_RGBA_16 = 7
+} steg_pixel_mode;
+
+typedef enum steg_algorithm {
+    STEG_ALGO_AES128 = 0,
+    STEG_ALGO_AES192 = 1,
+    STEG_ALGO_AES256 = 2,
+    // ChaCha20-Poly1305, the cipher mode is ignored
+    STEG_ALGO_CHACHA20 = 3
+} steg_algorithm;
+
+typedef enum steg_cipher_mode {
+    STEG_CIPHER_CBC = 0,
+    STEG_CIPHER_CTR = 1,
+    STEG_CIPHER_GCM = 2
+} steg_cipher_mode;
+
+// Pixels of the caller, they must stay valid and untouched by other threads while a call uses them
+typedef struct steg_image {
+    uint8_t* pixels;
+    uint32_t width;
+    uint32_t height;
+    // Bytes from the start of one row to the next, 0 if rows are not padded
+    size_t stride;
+    steg_pixel_mode mode;
+} steg_image;
+
+// See EncoderSettings in StegEngine.h, start from steg_options_init so new fields get their defaults
+typedef struct steg_options {
+    // sizeof(steg_options) of the caller's header, set by steg_options_init
+    size_t struct_size;
+    // 1, 2, 4 or 8 bits of data per carrier byte
+    uint8_t data_depth;
+    int encode_in_alpha;
+    int local_scatter;
+    // Encrypts on a pool thread while the encrypted chunks are embedded, only applies with encrypt
+    int pipelined;
+    int encrypt;
+    const uint8_t* password;
+    size_t password_length;
+    steg_algorithm algorithm;
+    steg_cipher_mode cipher_mode;
+    // Argon2 costs, non-default values are stored in the image
+    uint32_t kdf_time_cost;
+    uint32_t kdf_memory_cost;
+    uint32_t kdf_lanes;
+} steg_options;
+
+// STEG_ABI_VERSION of the library, callers loading it at runtime compare it to their header's
+uint32_t steg_abi_version(void);
+
+// What went wrong in the last call on this thread that did not return STEG_OK, valid until the next call
+const char* steg_last_error(void);
+
+// Fills options with the library's defaults, no encryption
+void steg_options_init(steg_options* options);
+
+// Largest payload steg_encode can hide in the image with these options, NULL options are the defaults
+steg_status steg_capacity(const steg_image* image, const steg_options* options, size_t* capacity);
+
+// Hides length bytes of data in the image's pixels, NULL options are the defaults
+// Returns STEG_ERROR_NO_SPACE and leaves the pixels untouched if the data does not fit, even an empty encrypted payload
+// needs room for its IV or nonce
+steg_status steg_encode(const steg_image* image, const uint8_t* data, size_t length, const steg_options* options);
+
+// Size of the payload as stored, an upper bound of what steg_decode writes, only the header is read
+steg_status steg_payload_size(const steg_image* image, size_t* size);
+
+// Writes the hidden data to output and its size to length, the password is ignored if the payload is not encrypted
+// output must hold steg_payload_size bytes even if the data is shorter, an encrypted payload is decrypted inside it
+// With a smaller capacity nothing is decoded and length is set to the capacity required
+steg_status steg_decode(const steg_image* image, const uint8_t* password, size_t password_length,
+                        uint8_t* output, size_t capacity, size_t* length);
+
+#ifdef __cplusplus
+}
+#endif
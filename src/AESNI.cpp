@@ -0,0 +1,271 @@
+#include "AESNI.h"
+
+#include "CpuFeatures.h"
+
+#include <cstring>
+
+#if defined(STEG_X86) && (defined(__x86_64__) || defined(_M_X64))
+#define STEG_AESNI 1
+#endif
+
+#ifdef STEG_AESNI
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+using namespace Steg;
+
+#ifdef STEG_AESNI
+
+namespace {
+
+    // SubWord from FIPS-197 using the S-box inside AESKEYGENASSIST
+    STEG_TARGET("aes")
+    uint32_t SubWord(uint32_t word) {
+        __m128i assist = _mm_aeskeygenassist_si128(_mm_set_epi32(0, 0, int(word), 0), 0);
+        return uint32_t(_mm_cvtsi128_si32(assist));
+    }
+
+    // Carry-less multiplication in GF(2^128) with the GCM bit order
+    // Operands hold the big-endian value of a block, which is the byte-reflected block
+    STEG_TARGET("pclmul,sse2")
+    __m128i GaloisMultiply(__m128i a, __m128i b) {
+        __m128i low = _mm_clmulepi64_si128(a, b, 0x00);
+        __m128i middle = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+        __m128i high = _mm_clmulepi64_si128(a, b, 0x11);
+        low = _mm_xor_si128(low, _mm_slli_si128(middle, 8));
+        high = _mm_xor_si128(high, _mm_srli_si128(middle, 8));
+
+        // Shift the 256-bit product left by one since the operands are bit-reflected
+        __m128i lowCarry = _mm_srli_epi32(low, 31);
+        __m128i highCarry = _mm_srli_epi32(high, 31);
+        low = _mm_slli_epi32(low, 1);
+        high = _mm_slli_epi32(high, 1);
+        __m128i crossCarry = _mm_srli_si128(lowCarry, 12);
+        highCarry = _mm_slli_si128(highCarry, 4);
+        lowCarry = _mm_slli_si128(lowCarry, 4);
+        low = _mm_or_si128(low, lowCarry);
+        high = _mm_or_si128(_mm_or_si128(high, highCarry), crossCarry);
+
+        // Reduce modulo x^128 + x^7 + x^2 + x + 1
+        __m128i first = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)),
+                                      _mm_slli_epi32(low, 25));
+        __m128i firstHigh = _mm_srli_si128(first, 4);
+        low = _mm_xor_si128(low, _mm_slli_si128(first, 12));
+        __m128i second = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)),
+                                       _mm_srli_epi32(low, 7));
+        second = _mm_xor_si128(second, firstHigh);
+        low = _mm_xor_si128(low, second);
+        return _mm_xor_si128(high, low);
+    }
+
+    // Block bytes to the big-endian value of the block
+    STEG_TARGET("ssse3")
+    __m128i LoadReflected(const byte* data) {
+        const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+        return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), reverse);
+    }
+
+}
+
+bool AESNI::IsSupported() {
+    const CpuFeatures& features = CpuFeatures::Get();
+    return features.AES && features.PCLMUL && features.SSSE3;
+}
+
+uint32_t AESNI::ExpandKey(const byte* key, uint32_t keyLength, byte* roundKeys) {
+    uint32_t keyWords = keyLength / 4;
+    uint32_t rounds = keyWords + 6;
+    uint32_t totalWords = 4 * (rounds + 1);
+
+    // Words are kept in memory order, so RotWord is a rotate right by one byte
+    uint32_t words[60];
+    std::memcpy(words, key, keyLength);
+
+    uint32_t roundConstant = 1;
+    for (uint32_t i = keyWords; i < totalWords; i++) {
+        uint32_t temp = words[i - 1];
+        if (i % keyWords == 0) {
+            temp = SubWord((temp >> 8) | (temp << 24)) ^ roundConstant;
+            roundConstant = (roundConstant << 1) ^ ((roundConstant >> 7) * 0x11b);
+        } else if (keyWords > 6 && i % keyWords == 4) {
+            temp = SubWord(temp);
+        }
+        words[i] = words[i - keyWords] ^ temp;
+    }
+
+    std::memcpy(roundKeys, words, totalWords * 4);
+    return rounds;
+}
+
+STEG_TARGET("aes,sse2")
+void AESNI::EncryptBlocks(const byte* roundKeys, uint32_t rounds, byte* blocks, size_t count) {
+    __m128i keys[15];
+    for (uint32_t r = 0; r <= rounds; r++) {
+        keys[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(roundKeys + 16 * r));
+    }
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i state[8];
+        for (int k = 0; k < 8; k++) {
+            state[k] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * (i + k))), keys[0]);
+        }
+        for (uint32_t r = 1; r < rounds; r++) {
+            for (int k = 0; k < 8; k++) {
+                state[k] = _mm_aesenc_si128(state[k], keys[r]);
+            }
+        }
+        for (int k = 0; k < 8; k++) {
+            state[k] = _mm_aesenclast_si128(state[k], keys[rounds]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(blocks + 16 * (i + k)), state[k]);
+        }
+    }
+
+    for (; i < count; i++) {
+        __m128i state = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * i)), keys[0]);
+        for (uint32_t r = 1; r < rounds; r++) {
+            state = _mm_aesenc_si128(state, keys[r]);
+        }
+        state = _mm_aesenclast_si128(state, keys[rounds]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(blocks + 16 * i), state);
+    }
+}
+
+STEG_TARGET("aes,sse2")
+void AESNI::InvertKey(const byte* roundKeys, uint32_t rounds, byte* decryptKeys) {
+    auto load = [&](uint32_t r) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(roundKeys + 16 * r));
+    };
+    auto store = [&](uint32_t r, __m128i key) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(decryptKeys + 16 * r), key);
+    };
+
+    // Reverse order with InvMixColumns applied to the inner keys
+    store(0, load(rounds));
+    for (uint32_t r = 1; r < rounds; r++) {
+        store(r, _mm_aesimc_si128(load(rounds - r)));
+    }
+    store(rounds, load(0));
+}
+
+STEG_TARGET("aes,sse2")
+void AESNI::EncryptCBC(const byte* roundKeys, uint32_t rounds, const byte* iv, byte* blocks, size_t count) {
+    __m128i keys[15];
+    for (uint32_t r = 0; r <= rounds; r++) {
+        keys[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(roundKeys + 16 * r));
+    }
+
+    __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+    for (size_t i = 0; i < count; i++) {
+        __m128i state = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * i));
+        state = _mm_xor_si128(_mm_xor_si128(state, previous), keys[0]);
+        for (uint32_t r = 1; r < rounds; r++) {
+            state = _mm_aesenc_si128(state, keys[r]);
+        }
+        previous = _mm_aesenclast_si128(state, keys[rounds]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(blocks + 16 * i), previous);
+    }
+}
+
+STEG_TARGET("aes,sse2")
+void AESNI::DecryptCBC(const byte* decryptKeys, uint32_t rounds, const byte* iv, byte* blocks, size_t count) {
+    __m128i keys[15];
+    for (uint32_t r = 0; r <= rounds; r++) {
+        keys[r] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(decryptKeys + 16 * r));
+    }
+
+    __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i cipher[8];
+        __m128i state[8];
+        for (int k = 0; k < 8; k++) {
+            cipher[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * (i + k)));
+            state[k] = _mm_xor_si128(cipher[k], keys[0]);
+        }
+        for (uint32_t r = 1; r < rounds; r++) {
+            for (int k = 0; k < 8; k++) {
+                state[k] = _mm_aesdec_si128(state[k], keys[r]);
+            }
+        }
+        for (int k = 0; k < 8; k++) {
+            state[k] = _mm_aesdeclast_si128(state[k], keys[rounds]);
+            state[k] = _mm_xor_si128(state[k], k == 0 ? previous : cipher[k - 1]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(blocks + 16 * (i + k)), state[k]);
+        }
+        previous = cipher[7];
+    }
+
+    for (; i < count; i++) {
+        __m128i cipher = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocks + 16 * i));
+        __m128i state = _mm_xor_si128(cipher, keys[0]);
+        for (uint32_t r = 1; r < rounds; r++) {
+            state = _mm_aesdec_si128(state, keys[r]);
+        }
+        state = _mm_xor_si128(_mm_aesdeclast_si128(state, keys[rounds]), previous);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(blocks + 16 * i), state);
+        previous = cipher;
+    }
+}
+
+STEG_TARGET("pclmul,ssse3")
+void AESNI::GHashBlocks(uint64_t state[2], const uint64_t hashPowers[4][2], const byte* data, size_t blockCount) {
+    __m128i powers[4];
+    for (int k = 0; k < 4; k++) {
+        powers[k] = _mm_set_epi64x(int64_t(hashPowers[k][0]), int64_t(hashPowers[k][1]));
+    }
+    __m128i y = _mm_set_epi64x(int64_t(state[0]), int64_t(state[1]));
+
+    // Four blocks per step: Y' = (Y ^ X0) H^4 ^ X1 H^3 ^ X2 H^2 ^ X3 H
+    // The four products are independent so their latencies overlap
+    size_t i = 0;
+    for (; i + 4 <= blockCount; i += 4) {
+        const byte* block = data + 16 * i;
+        __m128i product = GaloisMultiply(_mm_xor_si128(y, LoadReflected(block)), powers[3]);
+        product = _mm_xor_si128(product, GaloisMultiply(LoadReflected(block + 16), powers[2]));
+        product = _mm_xor_si128(product, GaloisMultiply(LoadReflected(block + 32), powers[1]));
+        product = _mm_xor_si128(product, GaloisMultiply(LoadReflected(block + 48), powers[0]));
+        y = product;
+    }
+
+    for (; i < blockCount; i++) {
+        y = GaloisMultiply(_mm_xor_si128(y, LoadReflected(data + 16 * i)), powers[0]);
+    }
+
+    state[0] = uint64_t(_mm_cvtsi128_si64(_mm_unpackhi_epi64(y, y)));
+    state[1] = uint64_t(_mm_cvtsi128_si64(y));
+}
+
+#else
+
+bool AESNI::IsSupported() {
+    return false;
+}
+
+uint32_t AESNI::ExpandKey(const byte* key, uint32_t keyLength, byte* roundKeys) {
+    throw std::runtime_error("AES-NI is not available on this architecture");
+}
+
+void AESNI::EncryptBlocks(const byte* roundKeys, uint32_t rounds, byte* blocks, size_t count) {
+    throw std::runtime_error("AES-NI is not available on this architecture");
+}
+
+void AESNI::InvertKey(const byte* roundKeys, uint32_t rounds, byte* decryptKeys) {
+    throw std::runtime_error("AES-NI is not available on this architecture");
+}
+
+void AESNI::EncryptCBC(const byte* roundKeys, uint32_t rounds, const byte* iv, byte* blocks, size_t count) {
+    throw std::runtime_error("AES-NI is not available on this architecture");
+}
+
+void AESNI::DecryptCBC(const byte* decryptKeys, uint32_t rounds, const byte* iv, byte* blocks, size_t count) {
+    throw std::runtime_error("AES-NI is not available on this architecture");
+}
+
+void AESNI::GHashBlocks(uint64_t state[2], const uint64_t hashPowers[4][2], const byte* data, size_t blockCount) {
+    throw std::runtime_error("PCLMULQDQ is not available on this architecture");
+}
+
+#endif
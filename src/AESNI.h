@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Core.h"
+
+// AES-NI and PCLMULQDQ kernels
+// Only call these after IsSupported() returns true
+namespace Steg::AESNI {
+
+    // True on x86-64 hosts with AES-NI, PCLMULQDQ and SSSE3
+    bool IsSupported();
+
+    // Writes the (rounds + 1) round keys of the FIPS-197 key schedule, 16 bytes each
+    // Returns the number of rounds (10, 12 or 14)
+    uint32_t ExpandKey(const byte* key, uint32_t keyLength, byte* roundKeys);
+
+    // Round keys of the equivalent inverse cipher, for AESDEC
+    void InvertKey(const byte* roundKeys, uint32_t rounds, byte* decryptKeys);
+
+    // Encrypts count 16 byte blocks in place, 8 at a time to hide the latency of AESENC
+    void EncryptBlocks(const byte* roundKeys, uint32_t rounds, byte* blocks, size_t count);
+
+    // CBC encryption is serial, every block waits for the previous ciphertext
+    void EncryptCBC(const byte* roundKeys, uint32_t rounds, const byte* iv, byte* blocks, size_t count);
+
+    // CBC decryption only depends on ciphertext, so it runs 8 blocks at a time like EncryptBlocks
+    void DecryptCBC(const byte* decryptKeys, uint32_t rounds, const byte* iv, byte* blocks, size_t count);
+
+    // Folds whole blocks of data into the GHASH state (High, Low as big-endian halves)
+    // hashPowers holds H, H^2, H^3, H^4 in the same representation
+    void GHashBlocks(uint64_t state[2], const uint64_t hashPowers[4][2], const byte* data, size_t blockCount);
+
+}
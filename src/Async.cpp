@@ -0,0 +1,24 @@
+#include "Async.h"
+
+using namespace Steg;
+
+namespace {
+
+    // Stop token of the task whose coroutine this thread is running, empty outside of one
+    thread_local std::stop_token CurrentToken;
+
+}
+
+/* Cancellation */
+
+void Cancellation::ThrowIfRequested() {
+    if (CurrentToken.stop_requested()) {
+        throw OperationCancelled();
+    }
+}
+
+Cancellation::Scope::Scope(std::stop_token token) : Previous(std::exchange(CurrentToken, std::move(token))) {}
+
+Cancellation::Scope::~Scope() {
+    CurrentToken = std::move(Previous);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Core.h"
+#include "StegTask.h"
+#include "ThreadPool.h"
+
+namespace Steg {
+
+    // Lets the blocking operations notice that the task running them was cancelled
+    class Cancellation {
+
+    public:
+
+        Cancellation() = delete;
+
+        // Throws OperationCancelled if the task running on this thread was cancelled
+        // Operations call this between stages, where stopping leaves nothing half done that the caller cannot discard
+        static void ThrowIfRequested();
+
+        // Makes token the calling thread's stop token while it lives
+        class Scope {
+
+        public:
+
+            explicit Scope(std::stop_token token);
+
+            ~Scope();
+
+            Scope(const Scope& other) = delete;
+
+            Scope& operator=(const Scope& other) = delete;
+
+        private:
+
+            std::stop_token Previous;
+
+        };
+
+    };
+
+    // Awaited first by every asynchronous operation to continue on a pool worker under its task's stop token
+    // A task cancelled while it was still queued fails here without starting
+    class ResumeOnPool {
+
+    public:
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        template<typename T>
+        void await_suspend(std::coroutine_handle<Detail::TaskPromise<T>> handle) {
+            std::stop_token token = handle.promise().GetStopToken();
+            ThreadPool::Get().Submit([handle, token]() {
+                Cancellation::Scope scope(token);
+                handle.resume();
+            });
+        }
+
+        void await_resume() const {
+            Cancellation::ThrowIfRequested();
+        }
+
+    };
+
+}
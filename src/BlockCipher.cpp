@@ -0,0 +1,89 @@
+#include "BlockCipher.h"
+
+#include "AESNI.h"
+#include "StegCrypt.h"
+
+#include <algorithm>
+
+using namespace Steg;
+
+BlockCipher::BlockCipher(const byte* key, uint32_t keyLength) : KeyLength(keyLength), Hardware(UseHardware()) {
+    if (keyLength != 16 && keyLength != 24 && keyLength != 32) {
+        throw std::invalid_argument("Unsupported AES key length: " + std::to_string(keyLength));
+    }
+
+    if (Hardware) {
+        Rounds = AESNI::ExpandKey(key, keyLength, RoundKeys.data());
+        AESNI::InvertKey(RoundKeys.data(), Rounds, DecryptKeys.data());
+        return;
+    }
+
+    std::copy(key, key + keyLength, Key.begin());
+    if (keyLength == 16) {
+        AES128_init_ctx(&Context, key);
+    } else if (keyLength == 24) {
+        AES192_init_ctx(&Context, key);
+    } else {
+        AES256_init_ctx(&Context, key);
+    }
+}
+
+void BlockCipher::EncryptBlocks(byte* blocks, size_t count) const {
+    if (Hardware) {
+        AESNI::EncryptBlocks(RoundKeys.data(), Rounds, blocks, count);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        byte* block = blocks + i * BlockSize;
+        if (KeyLength == 16) {
+            AES128_ECB_encrypt(&Context, block);
+        } else if (KeyLength == 24) {
+            AES192_ECB_encrypt(&Context, block);
+        } else {
+            AES256_ECB_encrypt(&Context, block);
+        }
+    }
+}
+
+void BlockCipher::EncryptCBC(const byte* iv, byte* blocks, size_t count) const {
+    if (Hardware) {
+        AESNI::EncryptCBC(RoundKeys.data(), Rounds, iv, blocks, count);
+        return;
+    }
+
+    AES_ctx context;
+    if (KeyLength == 16) {
+        AES128_init_ctx_iv(&context, Key.data(), iv);
+        AES128_CBC_encrypt_buffer(&context, blocks, count * BlockSize);
+    } else if (KeyLength == 24) {
+        AES192_init_ctx_iv(&context, Key.data(), iv);
+        AES192_CBC_encrypt_buffer(&context, blocks, count * BlockSize);
+    } else {
+        AES256_init_ctx_iv(&context, Key.data(), iv);
+        AES256_CBC_encrypt_buffer(&context, blocks, count * BlockSize);
+    }
+}
+
+void BlockCipher::DecryptCBC(const byte* iv, byte* blocks, size_t count) const {
+    if (Hardware) {
+        AESNI::DecryptCBC(DecryptKeys.data(), Rounds, iv, blocks, count);
+        return;
+    }
+
+    AES_ctx context;
+    if (KeyLength == 16) {
+        AES128_init_ctx_iv(&context, Key.data(), iv);
+        AES128_CBC_decrypt_buffer(&context, blocks, count * BlockSize);
+    } else if (KeyLength == 24) {
+        AES192_init_ctx_iv(&context, Key.data(), iv);
+        AES192_CBC_decrypt_buffer(&context, blocks, count * BlockSize);
+    } else {
+        AES256_init_ctx_iv(&context, Key.data(), iv);
+        AES256_CBC_decrypt_buffer(&context, blocks, count * BlockSize);
+    }
+}
+
+bool BlockCipher::UseHardware() {
+    return StegCrypt::GetBackend() == StegCrypt::Backend::BACKEND_AESNI;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Core.h"
+
+#include "aes.h"
+
+namespace Steg {
+
+    // The AES block function for one expanded key, on the backend chosen by StegCrypt::SetBackend
+    class BlockCipher {
+
+    public:
+
+        static constexpr uint32_t BlockSize = 16;
+
+        // keyLength is 16, 24 or 32 bytes
+        BlockCipher(const byte* key, uint32_t keyLength);
+
+        // Encrypts count consecutive blocks in place
+        void EncryptBlocks(byte* blocks, size_t count) const;
+
+        // Encrypts or decrypts count consecutive blocks in place, chained from the 16 byte iv
+        void EncryptCBC(const byte* iv, byte* blocks, size_t count) const;
+
+        void DecryptCBC(const byte* iv, byte* blocks, size_t count) const;
+
+        // True when the AES-NI backend is selected
+        static bool UseHardware();
+
+    private:
+
+        uint32_t KeyLength;
+        bool Hardware;
+
+        // Portable backend
+        // The aes.h CBC functions take the IV at initialization, so the key is kept to build a context per call
+        AES_ctx Context;
+        std::array<byte, 32> Key;
+
+        // AES-NI backend
+        std::array<byte, 15 * BlockSize> RoundKeys;
+        std::array<byte, 15 * BlockSize> DecryptKeys;
+        uint32_t Rounds = 0;
+
+    };
+
+}
@@ -0,0 +1,115 @@
+#include "BlockScatter.h"
+
+#include "Parallel.h"
+
+#include <algorithm>
+
+using namespace Steg;
+
+BlockScatter::BlockScatter(uint32_t indexCount, RNG& rng, std::vector<uint32_t> reserved) : IndexCount(indexCount), Reserved(std::move(reserved)) {
+
+    // Index 0 holds the seed, so block b covers the indices 1 + b * BlockSize onwards
+    uint32_t blockCount = (indexCount - 1 + BlockSize - 1) / BlockSize;
+
+    // Shuffle the blocks the way GenerateIndices shuffles indices
+    Order.resize(blockCount);
+    for (uint32_t i = 0; i < blockCount; i++) {
+        Order[i] = i;
+    }
+    for (uint32_t i = 0; i + 1 < blockCount; i++) {
+        uint32_t j = i + (rng.Next() % (blockCount - i));
+        std::swap(Order[i], Order[j]);
+    }
+
+    Seeds.resize(blockCount);
+    for (uint32_t i = 0; i < blockCount; i++) {
+        Seeds[i] = rng.Next();
+    }
+
+    // Blocks holding reserved indices are shorter, the last block may be short too
+    std::vector<uint32_t> sizes(blockCount, BlockSize);
+    if (blockCount > 0) {
+        sizes.back() = indexCount - 1 - (blockCount - 1) * BlockSize;
+    }
+    for (uint32_t index : Reserved) {
+        sizes[(index - 1) / BlockSize]--;
+    }
+
+    Offsets.resize(blockCount + 1);
+    Offsets[0] = 0;
+    for (uint32_t i = 0; i < blockCount; i++) {
+        Offsets[i + 1] = Offsets[i] + sizes[Order[i]];
+    }
+
+}
+
+CountedVector<uint32_t> BlockScatter::Generate() const {
+    CountedVector<uint32_t> indices(GetSize());
+    ParallelFor(Order.size(), 16, [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; block++) {
+            FillBlock(uint32_t(block), indices.data() + Offsets[block]);
+        }
+    });
+    return indices;
+}
+
+void BlockScatter::FillBlock(uint32_t block, uint32_t* indices) const {
+
+    // Collect the indices of the block that are not reserved
+    uint32_t blockNumber = Order[block];
+    uint32_t first = 1 + blockNumber * BlockSize;
+    uint32_t last = std::min(first + BlockSize, IndexCount);
+    auto reserved = std::lower_bound(Reserved.begin(), Reserved.end(), first);
+    uint32_t count = 0;
+    for (uint32_t index = first; index < last; index++) {
+        if (reserved != Reserved.end() && *reserved == index) {
+            reserved++;
+        } else {
+            indices[count++] = index;
+        }
+    }
+
+    // The whole block fits in the L1 cache, so the swaps stay cheap
+    // A bound below the engine's range takes one draw per number
+    RNG rng(Seeds[blockNumber], BlockSize - 1);
+    for (uint32_t i = 0; i + 1 < count; i++) {
+        uint32_t j = i + (rng.Next() % (count - i));
+        std::swap(indices[i], indices[j]);
+    }
+
+}
+
+BlockScatter::Cursor::Cursor(const BlockScatter& scatter) : Scatter(scatter), Indices(BlockSize) {}
+
+uint32_t BlockScatter::Cursor::Next() {
+    if (Position >= Scatter.GetSize()) {
+        throw std::runtime_error("Payload exceeds the image capacity");
+    }
+
+    // Move on to the block holding Position, skipping blocks that were reserved entirely
+    while (Position >= Scatter.Offsets[Block + 1]) {
+        Block++;
+        Filled = false;
+    }
+    if (!Filled) {
+        Scatter.FillBlock(Block, Indices.data());
+        Filled = true;
+    }
+
+    return Indices[Position++ - Scatter.Offsets[Block]];
+}
+
+void BlockScatter::Cursor::Skip(uint32_t count) {
+    if (count > Remaining()) {
+        throw std::runtime_error("Payload exceeds the image capacity");
+    }
+    Position += count;
+
+    // The block is found again on the next call, it is only regenerated if it changed
+    uint32_t block = uint32_t(std::upper_bound(Scatter.Offsets.begin(), Scatter.Offsets.end(), Position) - Scatter.Offsets.begin()) - 1;
+    block = std::min<uint32_t>(block, uint32_t(Scatter.Order.size()) - 1);
+    if (block != Block) {
+        Block = block;
+        Filled = false;
+    }
+}
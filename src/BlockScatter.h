@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Core.h"
+#include "RNG.h"
+#include "StegMemory.h"
+
+namespace Steg {
+
+    // The order payload parts are hidden in when EncoderSettings::LocalScatter is set
+    // The byte indices 1 to indexCount - 1 are cut into blocks of BlockSize consecutive indices, the blocks are put in
+    // random order and the indices within each block are shuffled, so consecutive parts land on the same page
+    // Every block is shuffled by an RNG of its own seeded from the main one, so any block can be generated without the rest
+    class BlockScatter {
+
+    public:
+
+        // One page of an 8-bit image
+        static constexpr uint32_t BlockSize = 4096;
+
+        // Draws the block order and one seed per block from rng
+        // reserved holds the sorted indices left out of the order, the ones the header was written to
+        BlockScatter(uint32_t indexCount, RNG& rng, std::vector<uint32_t> reserved);
+
+        // Number of indices in the order
+        uint32_t GetSize() const {
+            return Offsets.back();
+        }
+
+        // The whole order, the blocks are shuffled in parallel
+        CountedVector<uint32_t> Generate() const;
+
+        // Hands out the order one index at a time and only generates the blocks it reaches
+        class Cursor {
+
+        public:
+
+            explicit Cursor(const BlockScatter& scatter);
+
+            uint32_t Next();
+
+            // Moves past count indices without generating the blocks in between
+            void Skip(uint32_t count);
+
+            uint32_t Remaining() const {
+                return Scatter.GetSize() - Position;
+            }
+
+        private:
+
+            const BlockScatter& Scatter;
+
+            // Position in the order and the block it is in
+            uint32_t Position = 0;
+            uint32_t Block = 0;
+            bool Filled = false;
+
+            std::vector<uint32_t> Indices;
+
+        };
+
+    private:
+
+        // Writes the shuffled indices of the block at position block of the block order to indices
+        void FillBlock(uint32_t block, uint32_t* indices) const;
+
+        uint32_t IndexCount;
+
+        // Block numbers in the order they are visited
+        std::vector<uint32_t> Order;
+
+        // Seed of each block number
+        std::vector<uint32_t> Seeds;
+
+        // Position in the order of the first index of each visited block, followed by the size of the order
+        std::vector<uint32_t> Offsets;
+
+        std::vector<uint32_t> Reserved;
+
+    };
+
+}
@@ -0,0 +1,172 @@
+#include "BufferAllocator.h"
+
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+using namespace Steg;
+
+namespace {
+
+    // Smallest size class handed out by the pool
+    constexpr size_t MinSizeClass = 4096;
+
+    size_t RoundToAlignment(size_t size) {
+        return (size + BufferAllocator::Alignment - 1) & ~(BufferAllocator::Alignment - 1);
+    }
+
+    byte* AlignedAlloc(size_t size) {
+#ifdef _WIN32
+        void* buffer = _aligned_malloc(size, BufferAllocator::Alignment);
+#else
+        void* buffer = std::aligned_alloc(BufferAllocator::Alignment, size);
+#endif
+        if (buffer == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<byte*>(buffer);
+    }
+
+    void AlignedFree(byte* buffer) {
+#ifdef _WIN32
+        _aligned_free(buffer);
+#else
+        std::free(buffer);
+#endif
+    }
+
+}
+
+/* DefaultBufferAllocator */
+
+byte* DefaultBufferAllocator::Allocate(size_t size, bool zeroed) {
+    byte* buffer = AlignedAlloc(RoundToAlignment(size));
+    if (zeroed) {
+        std::memset(buffer, 0, size);
+    }
+    return buffer;
+}
+
+void DefaultBufferAllocator::Deallocate(byte* buffer, size_t) {
+    AlignedFree(buffer);
+}
+
+/* PooledBufferAllocator */
+
+PooledBufferAllocator::PooledBufferAllocator(size_t maxCachedBytes, bool useHugePages)
+        : MaxCachedBytes(maxCachedBytes), UseHugePages(useHugePages) {}
+
+PooledBufferAllocator::~PooledBufferAllocator() {
+    Trim();
+}
+
+byte* PooledBufferAllocator::Allocate(size_t size, bool zeroed) {
+    size_t sizeClass = GetSizeClass(size);
+
+    // Reuse a cached buffer of the same class if there is one
+    byte* buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        auto freeList = FreeLists.find(sizeClass);
+        if (freeList != FreeLists.end() && !freeList->second.empty()) {
+            buffer = freeList->second.back();
+            freeList->second.pop_back();
+            CachedBytes -= sizeClass;
+        }
+    }
+
+    if (buffer == nullptr) {
+        buffer = AllocateFromSystem(sizeClass);
+
+        // Freshly mapped pages are already zero
+        bool mapped = UseHugePages && sizeClass >= HugePageSize;
+#ifndef __linux__
+        mapped = false;
+#endif
+        if (zeroed && !mapped) {
+            std::memset(buffer, 0, size);
+        }
+    } else if (zeroed) {
+        std::memset(buffer, 0, size);
+    }
+
+    return buffer;
+}
+
+void PooledBufferAllocator::Deallocate(byte* buffer, size_t size) {
+    size_t sizeClass = GetSizeClass(size);
+
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (CachedBytes + sizeClass <= MaxCachedBytes) {
+            FreeLists[sizeClass].push_back(buffer);
+            CachedBytes += sizeClass;
+            return;
+        }
+    }
+
+    // The pool is full so this buffer goes back to the system
+    FreeToSystem(buffer, sizeClass);
+}
+
+void PooledBufferAllocator::Trim() {
+    std::unordered_map<size_t, std::vector<byte*>> freeLists;
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        freeLists.swap(FreeLists);
+        CachedBytes = 0;
+    }
+
+    for (auto& [sizeClass, buffers] : freeLists) {
+        for (byte* buffer : buffers) {
+            FreeToSystem(buffer, sizeClass);
+        }
+    }
+}
+
+size_t PooledBufferAllocator::GetCachedBytes() const {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return CachedBytes;
+}
+
+size_t PooledBufferAllocator::GetSizeClass(size_t size) {
+    if (size <= MinSizeClass) {
+        return MinSizeClass;
+    }
+
+    // Ex: 4097 => floor(log2(4096)) = 12 => step of 1024 => 5120
+    uint32_t shift = std::bit_width(size - 1) - 1;
+    size_t step = size_t(1) << (shift - 2);
+    return (size + step - 1) & ~(step - 1);
+}
+
+byte* PooledBufferAllocator::AllocateFromSystem(size_t sizeClass) {
+#ifdef __linux__
+    if (UseHugePages && sizeClass >= HugePageSize) {
+        void* buffer = mmap(nullptr, sizeClass, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+
+        // This is only a hint, the kernel may still use regular pages
+        madvise(buffer, sizeClass, MADV_HUGEPAGE);
+        return static_cast<byte*>(buffer);
+    }
+#endif
+    return AlignedAlloc(sizeClass);
+}
+
+void PooledBufferAllocator::FreeToSystem(byte* buffer, size_t sizeClass) {
+#ifdef __linux__
+    if (UseHugePages && sizeClass >= HugePageSize) {
+        munmap(buffer, sizeClass);
+        return;
+    }
+#endif
+    AlignedFree(buffer);
+}
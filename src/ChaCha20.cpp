@@ -0,0 +1,479 @@
+#include "ChaCha20.h"
+
+#include "CpuFeatures.h"
+
+#include <bit>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STEG_SSE2 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+using namespace Steg;
+
+namespace {
+
+    uint32_t LoadLE32(const byte* bytes) {
+        return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) | (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+    }
+
+    uint64_t LoadLE64(const byte* bytes) {
+        return uint64_t(LoadLE32(bytes)) | (uint64_t(LoadLE32(bytes + 4)) << 32);
+    }
+
+    void StoreLE32(byte* bytes, uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            bytes[i] = byte(value >> (8 * i));
+        }
+    }
+
+    void StoreLE64(byte* bytes, uint64_t value) {
+        StoreLE32(bytes, uint32_t(value));
+        StoreLE32(bytes + 4, uint32_t(value >> 32));
+    }
+
+    void QuarterRound(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d) {
+        a += b; d ^= a; d = std::rotl(d, 16);
+        c += d; b ^= c; b = std::rotl(b, 12);
+        a += b; d ^= a; d = std::rotl(d, 8);
+        c += d; b ^= c; b = std::rotl(b, 7);
+    }
+
+#ifdef STEG_SSE2
+
+    // The SIMD kernels keep word i of several consecutive blocks in one register
+    // so every quarter round works on all of the blocks at once
+
+    template<int Bits>
+    __m128i RotateSse2(__m128i value) {
+        return _mm_or_si128(_mm_slli_epi32(value, Bits), _mm_srli_epi32(value, 32 - Bits));
+    }
+
+    void QuarterRoundSse2(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+        a = _mm_add_epi32(a, b); d = RotateSse2<16>(_mm_xor_si128(d, a));
+        c = _mm_add_epi32(c, d); b = RotateSse2<12>(_mm_xor_si128(b, c));
+        a = _mm_add_epi32(a, b); d = RotateSse2<8>(_mm_xor_si128(d, a));
+        c = _mm_add_epi32(c, d); b = RotateSse2<7>(_mm_xor_si128(b, c));
+    }
+
+    void XorStoreSse2(byte* data, __m128i keystream) {
+        __m128i* address = reinterpret_cast<__m128i*>(data);
+        _mm_storeu_si128(address, _mm_xor_si128(_mm_loadu_si128(address), keystream));
+    }
+
+    // Returns the number of blocks processed, a multiple of 4
+    size_t XorBlocksSse2(const uint32_t* state, uint32_t counter, byte* data, size_t blockCount) {
+        size_t block = 0;
+        for (; block + 4 <= blockCount; block += 4) {
+            __m128i input[16];
+            for (int i = 0; i < 16; i++) {
+                input[i] = _mm_set1_epi32(int(state[i]));
+            }
+            input[12] = _mm_add_epi32(_mm_set1_epi32(int(counter + uint32_t(block))), _mm_setr_epi32(0, 1, 2, 3));
+
+            __m128i x[16];
+            for (int i = 0; i < 16; i++) {
+                x[i] = input[i];
+            }
+            for (int round = 0; round < 10; round++) {
+                QuarterRoundSse2(x[0], x[4], x[8], x[12]);
+                QuarterRoundSse2(x[1], x[5], x[9], x[13]);
+                QuarterRoundSse2(x[2], x[6], x[10], x[14]);
+                QuarterRoundSse2(x[3], x[7], x[11], x[15]);
+                QuarterRoundSse2(x[0], x[5], x[10], x[15]);
+                QuarterRoundSse2(x[1], x[6], x[11], x[12]);
+                QuarterRoundSse2(x[2], x[7], x[8], x[13]);
+                QuarterRoundSse2(x[3], x[4], x[9], x[14]);
+            }
+            for (int i = 0; i < 16; i++) {
+                x[i] = _mm_add_epi32(x[i], input[i]);
+            }
+
+            // Transpose each group of 4 words so the registers hold 16 contiguous bytes of one block
+            byte* output = data + block * ChaCha20::BlockSize;
+            for (int group = 0; group < 4; group++) {
+                __m128i* words = &x[4 * group];
+                __m128i low01 = _mm_unpacklo_epi32(words[0], words[1]);
+                __m128i low23 = _mm_unpacklo_epi32(words[2], words[3]);
+                __m128i high01 = _mm_unpackhi_epi32(words[0], words[1]);
+                __m128i high23 = _mm_unpackhi_epi32(words[2], words[3]);
+                XorStoreSse2(output + 0 * ChaCha20::BlockSize + 16 * group, _mm_unpacklo_epi64(low01, low23));
+                XorStoreSse2(output + 1 * ChaCha20::BlockSize + 16 * group, _mm_unpackhi_epi64(low01, low23));
+                XorStoreSse2(output + 2 * ChaCha20::BlockSize + 16 * group, _mm_unpacklo_epi64(high01, high23));
+                XorStoreSse2(output + 3 * ChaCha20::BlockSize + 16 * group, _mm_unpackhi_epi64(high01, high23));
+            }
+        }
+        return block;
+    }
+
+    // Rotations by whole bytes are a single byte shuffle
+    STEG_TARGET("avx2")
+    __m256i RotateAvx2(__m256i value, int bits) {
+        if (bits == 16) {
+            const __m256i shuffle = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                                     2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+            return _mm256_shuffle_epi8(value, shuffle);
+        } else if (bits == 8) {
+            const __m256i shuffle = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                                     3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+            return _mm256_shuffle_epi8(value, shuffle);
+        } else if (bits == 12) {
+            return _mm256_or_si256(_mm256_slli_epi32(value, 12), _mm256_srli_epi32(value, 20));
+        } else {
+            return _mm256_or_si256(_mm256_slli_epi32(value, 7), _mm256_srli_epi32(value, 25));
+        }
+    }
+
+    STEG_TARGET("avx2")
+    void QuarterRoundAvx2(__m256i& a, __m256i& b, __m256i& c, __m256i& d) {
+        a = _mm256_add_epi32(a, b); d = RotateAvx2(_mm256_xor_si256(d, a), 16);
+        c = _mm256_add_epi32(c, d); b = RotateAvx2(_mm256_xor_si256(b, c), 12);
+        a = _mm256_add_epi32(a, b); d = RotateAvx2(_mm256_xor_si256(d, a), 8);
+        c = _mm256_add_epi32(c, d); b = RotateAvx2(_mm256_xor_si256(b, c), 7);
+    }
+
+    STEG_TARGET("avx2")
+    void XorStoreAvx2(byte* data, __m256i keystream) {
+        __m256i* address = reinterpret_cast<__m256i*>(data);
+        _mm256_storeu_si256(address, _mm256_xor_si256(_mm256_loadu_si256(address), keystream));
+    }
+
+    // Returns the number of blocks processed, a multiple of 8
+    STEG_TARGET("avx2")
+    size_t XorBlocksAvx2(const uint32_t* state, uint32_t counter, byte* data, size_t blockCount) {
+        size_t block = 0;
+        for (; block + 8 <= blockCount; block += 8) {
+            __m256i input[16];
+            for (int i = 0; i < 16; i++) {
+                input[i] = _mm256_set1_epi32(int(state[i]));
+            }
+            input[12] = _mm256_add_epi32(_mm256_set1_epi32(int(counter + uint32_t(block))), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+            __m256i x[16];
+            for (int i = 0; i < 16; i++) {
+                x[i] = input[i];
+            }
+            for (int round = 0; round < 10; round++) {
+                QuarterRoundAvx2(x[0], x[4], x[8], x[12]);
+                QuarterRoundAvx2(x[1], x[5], x[9], x[13]);
+                QuarterRoundAvx2(x[2], x[6], x[10], x[14]);
+                QuarterRoundAvx2(x[3], x[7], x[11], x[15]);
+                QuarterRoundAvx2(x[0], x[5], x[10], x[15]);
+                QuarterRoundAvx2(x[1], x[6], x[11], x[12]);
+                QuarterRoundAvx2(x[2], x[7], x[8], x[13]);
+                QuarterRoundAvx2(x[3], x[4], x[9], x[14]);
+            }
+            for (int i = 0; i < 16; i++) {
+                x[i] = _mm256_add_epi32(x[i], input[i]);
+            }
+
+            // The transpose works within 128-bit lanes, so the low lanes hold blocks 0-3 and the high lanes blocks 4-7
+            __m256i rows[4][4];
+            for (int group = 0; group < 4; group++) {
+                __m256i* words = &x[4 * group];
+                __m256i low01 = _mm256_unpacklo_epi32(words[0], words[1]);
+                __m256i low23 = _mm256_unpacklo_epi32(words[2], words[3]);
+                __m256i high01 = _mm256_unpackhi_epi32(words[0], words[1]);
+                __m256i high23 = _mm256_unpackhi_epi32(words[2], words[3]);
+                rows[0][group] = _mm256_unpacklo_epi64(low01, low23);
+                rows[1][group] = _mm256_unpackhi_epi64(low01, low23);
+                rows[2][group] = _mm256_unpacklo_epi64(high01, high23);
+                rows[3][group] = _mm256_unpackhi_epi64(high01, high23);
+            }
+
+            // Pair up the lanes of adjacent groups into 32 contiguous bytes of one block
+            byte* output = data + block * ChaCha20::BlockSize;
+            for (int i = 0; i < 4; i++) {
+                byte* low = output + i * ChaCha20::BlockSize;
+                byte* high = output + (i + 4) * ChaCha20::BlockSize;
+                XorStoreAvx2(low, _mm256_permute2x128_si256(rows[i][0], rows[i][1], 0x20));
+                XorStoreAvx2(low + 32, _mm256_permute2x128_si256(rows[i][2], rows[i][3], 0x20));
+                XorStoreAvx2(high, _mm256_permute2x128_si256(rows[i][0], rows[i][1], 0x31));
+                XorStoreAvx2(high + 32, _mm256_permute2x128_si256(rows[i][2], rows[i][3], 0x31));
+            }
+        }
+        return block;
+    }
+
+#endif
+
+}
+
+ChaCha20::ChaCha20(const byte* key, const byte* nonce) {
+    // "expand 32-byte k"
+    State[0] = 0x61707865;
+    State[1] = 0x3320646e;
+    State[2] = 0x79622d32;
+    State[3] = 0x6b206574;
+    for (int i = 0; i < 8; i++) {
+        State[4 + i] = LoadLE32(key + 4 * i);
+    }
+    State[12] = 0;
+    for (int i = 0; i < 3; i++) {
+        State[13 + i] = LoadLE32(nonce + 4 * i);
+    }
+}
+
+void ChaCha20::Block(uint32_t counter, byte* output) const {
+    std::array<uint32_t, 16> x = State;
+    x[12] = counter;
+    for (int round = 0; round < 10; round++) {
+        QuarterRound(x[0], x[4], x[8], x[12]);
+        QuarterRound(x[1], x[5], x[9], x[13]);
+        QuarterRound(x[2], x[6], x[10], x[14]);
+        QuarterRound(x[3], x[7], x[11], x[15]);
+        QuarterRound(x[0], x[5], x[10], x[15]);
+        QuarterRound(x[1], x[6], x[11], x[12]);
+        QuarterRound(x[2], x[7], x[8], x[13]);
+        QuarterRound(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++) {
+        uint32_t input = i == 12 ? counter : State[i];
+        StoreLE32(output + 4 * i, x[i] + input);
+    }
+}
+
+void ChaCha20::Xor(uint32_t counter, byte* data, size_t length) const {
+
+    // Whole blocks go through the widest kernel the CPU supports
+    size_t blockCount = length / BlockSize;
+    size_t block = 0;
+#ifdef STEG_SSE2
+    if (CpuFeatures::Get().AVX2) {
+        block += XorBlocksAvx2(State.data(), counter, data, blockCount);
+    }
+    block += XorBlocksSse2(State.data(), counter + uint32_t(block), data + block * BlockSize, blockCount - block);
+#endif
+
+    // The remaining blocks and a trailing partial block
+    std::array<byte, BlockSize> keystream;
+    for (size_t offset = block * BlockSize; offset < length; offset += BlockSize) {
+        Block(counter + uint32_t(offset / BlockSize), keystream.data());
+        size_t bytes = std::min<size_t>(BlockSize, length - offset);
+        for (size_t i = 0; i < bytes; i++) {
+            data[offset + i] ^= keystream[i];
+        }
+    }
+
+}
+
+// Poly1305 follows the 64-bit and 32-bit variants of poly1305-donna
+// The accumulator is only partially reduced until Finish
+
+#if defined(__SIZEOF_INT128__)
+
+namespace {
+
+    using uint128_t = unsigned __int128;
+
+    constexpr uint64_t Mask44 = (uint64_t(1) << 44) - 1;
+    constexpr uint64_t Mask42 = (uint64_t(1) << 42) - 1;
+
+}
+
+Poly1305::Poly1305(const byte* key) {
+    // r is clamped as the RFC requires
+    uint64_t t0 = LoadLE64(key);
+    uint64_t t1 = LoadLE64(key + 8);
+    R[0] = t0 & 0xffc0fffffff;
+    R[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+    R[2] = (t1 >> 24) & 0x00ffffffc0f;
+    Pad[0] = LoadLE64(key + 16);
+    Pad[1] = LoadLE64(key + 24);
+}
+
+void Poly1305::Blocks(const byte* data, size_t blockCount, bool finalBlock) {
+    uint64_t highBit = finalBlock ? 0 : uint64_t(1) << 40;
+    uint64_t r0 = R[0], r1 = R[1], r2 = R[2];
+    uint64_t h0 = H[0], h1 = H[1], h2 = H[2];
+
+    // 2^130 = 5 (mod p), and the limbs above 2^130 are 2 bits past a limb boundary
+    uint64_t s1 = r1 * (5 << 2);
+    uint64_t s2 = r2 * (5 << 2);
+
+    for (size_t i = 0; i < blockCount; i++, data += 16) {
+        uint64_t t0 = LoadLE64(data);
+        uint64_t t1 = LoadLE64(data + 8);
+        h0 += t0 & Mask44;
+        h1 += ((t0 >> 44) | (t1 << 20)) & Mask44;
+        h2 += ((t1 >> 24) & Mask42) | highBit;
+
+        uint128_t d0 = uint128_t(h0) * r0 + uint128_t(h1) * s2 + uint128_t(h2) * s1;
+        uint128_t d1 = uint128_t(h0) * r1 + uint128_t(h1) * r0 + uint128_t(h2) * s2;
+        uint128_t d2 = uint128_t(h0) * r2 + uint128_t(h1) * r1 + uint128_t(h2) * r0;
+
+        uint64_t carry = uint64_t(d0 >> 44);
+        h0 = uint64_t(d0) & Mask44;
+        d1 += carry;
+        carry = uint64_t(d1 >> 44);
+        h1 = uint64_t(d1) & Mask44;
+        d2 += carry;
+        carry = uint64_t(d2 >> 42);
+        h2 = uint64_t(d2) & Mask42;
+        h0 += carry * 5;
+        carry = h0 >> 44;
+        h0 &= Mask44;
+        h1 += carry;
+    }
+
+    H[0] = h0;
+    H[1] = h1;
+    H[2] = h2;
+}
+
+void Poly1305::Finish(byte* tag) {
+    if (Buffered > 0) {
+        Buffer[Buffered++] = 1;
+        std::fill(Buffer.begin() + Buffered, Buffer.end(), 0);
+        Blocks(Buffer.data(), 1, true);
+        Buffered = 0;
+    }
+
+    // Fully carry the accumulator
+    uint64_t h0 = H[0], h1 = H[1], h2 = H[2];
+    uint64_t carry = h1 >> 44; h1 &= Mask44;
+    h2 += carry; carry = h2 >> 42; h2 &= Mask42;
+    h0 += carry * 5; carry = h0 >> 44; h0 &= Mask44;
+    h1 += carry; carry = h1 >> 44; h1 &= Mask44;
+    h2 += carry; carry = h2 >> 42; h2 &= Mask42;
+    h0 += carry * 5; carry = h0 >> 44; h0 &= Mask44;
+    h1 += carry;
+
+    // g = h - p, selected without branching when h >= p
+    uint64_t g0 = h0 + 5; carry = g0 >> 44; g0 &= Mask44;
+    uint64_t g1 = h1 + carry; carry = g1 >> 44; g1 &= Mask44;
+    uint64_t g2 = h2 + carry - (uint64_t(1) << 42);
+    uint64_t select = (g2 >> 63) - 1;
+    h0 = (h0 & ~select) | (g0 & select);
+    h1 = (h1 & ~select) | (g1 & select);
+    h2 = (h2 & ~select) | (g2 & select);
+
+    // tag = (h + s) mod 2^128
+    h0 += Pad[0] & Mask44; carry = h0 >> 44; h0 &= Mask44;
+    h1 += (((Pad[0] >> 44) | (Pad[1] << 20)) & Mask44) + carry; carry = h1 >> 44; h1 &= Mask44;
+    h2 += ((Pad[1] >> 24) & Mask42) + carry; h2 &= Mask42;
+
+    StoreLE64(tag, h0 | (h1 << 44));
+    StoreLE64(tag + 8, (h1 >> 20) | (h2 << 24));
+}
+
+#else
+
+namespace {
+
+    constexpr uint64_t Mask26 = (uint64_t(1) << 26) - 1;
+
+}
+
+Poly1305::Poly1305(const byte* key) {
+    // r is clamped as the RFC requires
+    R[0] = LoadLE32(key) & 0x3ffffff;
+    R[1] = (LoadLE32(key + 3) >> 2) & 0x3ffff03;
+    R[2] = (LoadLE32(key + 6) >> 4) & 0x3ffc0ff;
+    R[3] = (LoadLE32(key + 9) >> 6) & 0x3f03fff;
+    R[4] = (LoadLE32(key + 12) >> 8) & 0x00fffff;
+    Pad[0] = LoadLE64(key + 16);
+    Pad[1] = LoadLE64(key + 24);
+}
+
+void Poly1305::Blocks(const byte* data, size_t blockCount, bool finalBlock) {
+    uint64_t highBit = finalBlock ? 0 : uint64_t(1) << 24;
+    uint64_t r0 = R[0], r1 = R[1], r2 = R[2], r3 = R[3], r4 = R[4];
+    uint64_t h0 = H[0], h1 = H[1], h2 = H[2], h3 = H[3], h4 = H[4];
+
+    // 2^130 = 5 (mod p)
+    uint64_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+
+    for (size_t i = 0; i < blockCount; i++, data += 16) {
+        h0 += LoadLE32(data) & Mask26;
+        h1 += (LoadLE32(data + 3) >> 2) & Mask26;
+        h2 += (LoadLE32(data + 6) >> 4) & Mask26;
+        h3 += (LoadLE32(data + 9) >> 6) & Mask26;
+        h4 += (LoadLE32(data + 12) >> 8) | highBit;
+
+        uint64_t d0 = h0 * r0 + h1 * s4 + h2 * s3 + h3 * s2 + h4 * s1;
+        uint64_t d1 = h0 * r1 + h1 * r0 + h2 * s4 + h3 * s3 + h4 * s2;
+        uint64_t d2 = h0 * r2 + h1 * r1 + h2 * r0 + h3 * s4 + h4 * s3;
+        uint64_t d3 = h0 * r3 + h1 * r2 + h2 * r1 + h3 * r0 + h4 * s4;
+        uint64_t d4 = h0 * r4 + h1 * r3 + h2 * r2 + h3 * r1 + h4 * r0;
+
+        uint64_t carry = d0 >> 26; h0 = d0 & Mask26;
+        d1 += carry; carry = d1 >> 26; h1 = d1 & Mask26;
+        d2 += carry; carry = d2 >> 26; h2 = d2 & Mask26;
+        d3 += carry; carry = d3 >> 26; h3 = d3 & Mask26;
+        d4 += carry; carry = d4 >> 26; h4 = d4 & Mask26;
+        h0 += carry * 5; carry = h0 >> 26; h0 &= Mask26;
+        h1 += carry;
+    }
+
+    H = {h0, h1, h2, h3, h4};
+}
+
+void Poly1305::Finish(byte* tag) {
+    if (Buffered > 0) {
+        Buffer[Buffered++] = 1;
+        std::fill(Buffer.begin() + Buffered, Buffer.end(), 0);
+        Blocks(Buffer.data(), 1, true);
+        Buffered = 0;
+    }
+
+    // Fully carry the accumulator
+    uint64_t h0 = H[0], h1 = H[1], h2 = H[2], h3 = H[3], h4 = H[4];
+    uint64_t carry = h1 >> 26; h1 &= Mask26;
+    h2 += carry; carry = h2 >> 26; h2 &= Mask26;
+    h3 += carry; carry = h3 >> 26; h3 &= Mask26;
+    h4 += carry; carry = h4 >> 26; h4 &= Mask26;
+    h0 += carry * 5; carry = h0 >> 26; h0 &= Mask26;
+    h1 += carry;
+
+    // g = h - p, selected without branching when h >= p
+    uint64_t g0 = h0 + 5; carry = g0 >> 26; g0 &= Mask26;
+    uint64_t g1 = h1 + carry; carry = g1 >> 26; g1 &= Mask26;
+    uint64_t g2 = h2 + carry; carry = g2 >> 26; g2 &= Mask26;
+    uint64_t g3 = h3 + carry; carry = g3 >> 26; g3 &= Mask26;
+    uint64_t g4 = h4 + carry - (uint64_t(1) << 26);
+    uint64_t select = (g4 >> 63) - 1;
+    h0 = (h0 & ~select) | (g0 & select);
+    h1 = (h1 & ~select) | (g1 & select);
+    h2 = (h2 & ~select) | (g2 & select);
+    h3 = (h3 & ~select) | (g3 & select);
+    h4 = (h4 & ~select) | (g4 & select);
+
+    // tag = (h + s) mod 2^128
+    uint64_t low = h0 | (h1 << 26) | (h2 << 52);
+    uint64_t high = (h2 >> 12) | (h3 << 14) | (h4 << 40);
+    uint64_t sum = low + Pad[0];
+    high += Pad[1] + (sum < low ? 1 : 0);
+
+    StoreLE64(tag, sum);
+    StoreLE64(tag + 8, high);
+}
+
+#endif
+
+void Poly1305::Update(const byte* data, size_t length) {
+
+    // Complete a block left over from the previous call
+    if (Buffered > 0) {
+        size_t bytes = std::min(length, Buffer.size() - Buffered);
+        std::copy(data, data + bytes, Buffer.begin() + Buffered);
+        Buffered += bytes;
+        data += bytes;
+        length -= bytes;
+        if (Buffered < Buffer.size()) {
+            return;
+        }
+        Blocks(Buffer.data(), 1, false);
+        Buffered = 0;
+    }
+
+    size_t blockCount = length / 16;
+    Blocks(data, blockCount, false);
+
+    // Keep the trailing partial block for the next call or Finish
+    size_t rest = length % 16;
+    std::copy(data + blockCount * 16, data + length, Buffer.begin());
+    Buffered = rest;
+
+}
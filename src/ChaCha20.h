@@ -0,0 +1,69 @@
+#pragma once
+
+#include "Core.h"
+
+namespace Steg {
+
+    // ChaCha20 stream cipher from RFC 8439 with a 256-bit key, 96-bit nonce and 32-bit block counter
+    // Keystream blocks are generated 8 at a time with AVX2 or 4 at a time with SSE2 when the CPU has them
+    class ChaCha20 {
+
+    public:
+
+        static constexpr uint32_t KeySize = 32;
+
+        static constexpr uint32_t NonceSize = 12;
+
+        static constexpr uint32_t BlockSize = 64;
+
+        ChaCha20(const byte* key, const byte* nonce);
+
+        // Writes the 64 byte keystream block for counter
+        void Block(uint32_t counter, byte* output) const;
+
+        // XORs data with the keystream starting at the beginning of block counter
+        void Xor(uint32_t counter, byte* data, size_t length) const;
+
+    private:
+
+        // Words 0-3 are constants, 4-11 the key, 12 the counter and 13-15 the nonce
+        std::array<uint32_t, 16> State;
+
+    };
+
+    // Poly1305 one-time authenticator from RFC 8439
+    // A key must only ever authenticate one message
+    class Poly1305 {
+
+    public:
+
+        static constexpr uint32_t KeySize = 32;
+
+        static constexpr uint32_t TagSize = 16;
+
+        explicit Poly1305(const byte* key);
+
+        // The message may be split across calls at any byte
+        void Update(const byte* data, size_t length);
+
+        // Writes the tag, no more data can be added afterwards
+        void Finish(byte* tag);
+
+    private:
+
+        // Folds whole 16 byte blocks into the accumulator, finalBlock is set for a padded partial block
+        void Blocks(const byte* data, size_t blockCount, bool finalBlock);
+
+        // Limbs of r and the accumulator, 44/44/42 bits with 128-bit products or 5 x 26 bits without
+        std::array<uint64_t, 5> R = {};
+        std::array<uint64_t, 5> H = {};
+
+        // s, added to the accumulator at the end
+        std::array<uint64_t, 2> Pad = {};
+
+        std::array<byte, 16> Buffer = {};
+        size_t Buffered = 0;
+
+    };
+
+}
@@ -0,0 +1,83 @@
+#include "CpuFeatures.h"
+
+#ifdef STEG_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+using namespace Steg;
+
+namespace {
+
+#ifdef STEG_X86
+
+    void CpuId(uint32_t leaf, uint32_t subLeaf, uint32_t registers[4]) {
+#ifdef _MSC_VER
+        int values[4];
+        __cpuidex(values, int(leaf), int(subLeaf));
+        for (int i = 0; i < 4; i++) {
+            registers[i] = uint32_t(values[i]);
+        }
+#else
+        __cpuid_count(leaf, subLeaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+    }
+
+    // The OS has to save the YMM registers on context switches before AVX can be used
+    bool OsSavesYmm() {
+#ifdef _MSC_VER
+        uint64_t xcr0 = _xgetbv(0);
+#else
+        uint32_t eax, edx;
+        __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        uint64_t xcr0 = (uint64_t(edx) << 32) | eax;
+#endif
+        return (xcr0 & 0b110) == 0b110;
+    }
+
+    CpuFeatures Detect() {
+        CpuFeatures features;
+
+        uint32_t registers[4];
+        CpuId(0, 0, registers);
+        uint32_t maxLeaf = registers[0];
+        if (maxLeaf < 1) {
+            return features;
+        }
+
+        // Leaf 1, ECX
+        CpuId(1, 0, registers);
+        uint32_t ecx = registers[2];
+        features.SSSE3 = ecx & (1 << 9);
+        features.SSE41 = ecx & (1 << 19);
+        features.PCLMUL = ecx & (1 << 1);
+        features.AES = ecx & (1 << 25);
+        bool osxsave = ecx & (1 << 27);
+        bool avx = ecx & (1 << 28);
+
+        // Leaf 7, EBX
+        if (maxLeaf >= 7 && avx && osxsave && OsSavesYmm()) {
+            CpuId(7, 0, registers);
+            features.AVX2 = registers[1] & (1 << 5);
+        }
+
+        return features;
+    }
+
+#else
+
+    CpuFeatures Detect() {
+        return CpuFeatures();
+    }
+
+#endif
+
+}
+
+const CpuFeatures& CpuFeatures::Get() {
+    static const CpuFeatures features = Detect();
+    return features;
+}
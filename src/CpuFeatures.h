@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Core.h"
+
+// Marks a function as compiled for an instruction set extension so it can be selected at runtime
+// MSVC does not need this since it allows intrinsics in any function
+#if defined(__GNUC__) || defined(__clang__)
+#define STEG_TARGET(features) __attribute__((target(features)))
+#else
+#define STEG_TARGET(features)
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define STEG_X86 1
+#endif
+
+namespace Steg {
+
+    // Instruction set extensions of the host CPU, detected once with CPUID
+    struct CpuFeatures {
+
+        bool SSSE3 = false;
+        bool SSE41 = false;
+        bool AVX2 = false;
+        bool AES = false;
+        bool PCLMUL = false;
+
+        static const CpuFeatures& Get();
+
+    };
+
+}
@@ -0,0 +1,175 @@
+#include "GHash.h"
+
+#include "AESNI.h"
+#include "BlockCipher.h"
+
+#include <algorithm>
+
+using namespace Steg;
+
+namespace {
+
+    // Reduction of the 4 bits shifted out of the low end of the state
+    constexpr std::array<uint64_t, 16> Last4 = {
+            0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+            0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+    };
+
+    uint64_t LoadBigEndian64(const byte* data) {
+        uint64_t value = 0;
+        for (int i = 0; i < 8; i++) {
+            value = (value << 8) | data[i];
+        }
+        return value;
+    }
+
+    void StoreBigEndian64(uint64_t value, byte* data) {
+        for (int i = 7; i >= 0; i--) {
+            data[i] = byte(value & 0xFF);
+            value >>= 8;
+        }
+    }
+
+    byte GetByte(const GHash::Element& element, int index) {
+        uint64_t half = index < 8 ? element.High : element.Low;
+        return byte(half >> (56 - 8 * (index % 8)));
+    }
+
+}
+
+GHash::GHash(const byte* hashKey) : Key(Load(hashKey)), Hardware(BlockCipher::UseHardware()) {
+
+    if (Hardware) {
+        Element power = Key;
+        for (int i = 0; i < 4; i++) {
+            Powers[i][0] = power.High;
+            Powers[i][1] = power.Low;
+            power = Multiply(power, Key);
+        }
+        return;
+    }
+
+    // TableX[i] holds i * H where the 4 bits of i are the leading coefficients
+    uint64_t high = Key.High;
+    uint64_t low = Key.Low;
+    TableHigh[0] = 0;
+    TableLow[0] = 0;
+    TableHigh[8] = high;
+    TableLow[8] = low;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t reduce = (low & 1) * 0xe1000000;
+        low = (high << 63) | (low >> 1);
+        high = (high >> 1) ^ (reduce << 32);
+        TableHigh[i] = high;
+        TableLow[i] = low;
+    }
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; j++) {
+            TableHigh[i + j] = TableHigh[i] ^ TableHigh[j];
+            TableLow[i + j] = TableLow[i] ^ TableLow[j];
+        }
+    }
+
+}
+
+void GHash::Update(Element& state, const byte* data, size_t length) const {
+    size_t i = 0;
+    if (Hardware) {
+        uint64_t halves[2] = {state.High, state.Low};
+        AESNI::GHashBlocks(halves, Powers, data, length / 16);
+        state = {halves[0], halves[1]};
+        i = length - length % 16;
+    }
+
+    for (; i + 16 <= length; i += 16) {
+        Element block = Load(data + i);
+        state.High ^= block.High;
+        state.Low ^= block.Low;
+        state = MultiplyH(state);
+    }
+
+    if (i < length) {
+        std::array<byte, 16> last = {};
+        std::copy(data + i, data + length, last.begin());
+        Update(state, last.data(), last.size());
+    }
+}
+
+void GHash::UpdateLengths(Element& state, uint64_t aadLength, uint64_t dataLength) const {
+    std::array<byte, 16> lengths;
+    Store({aadLength * 8, dataLength * 8}, lengths.data());
+    Update(state, lengths.data(), lengths.size());
+}
+
+GHash::Element GHash::Combine(const Element& stateA, const Element& stateB, uint64_t blockCountB) const {
+    Element shifted = Multiply(stateA, PowerH(blockCountB));
+    return {shifted.High ^ stateB.High, shifted.Low ^ stateB.Low};
+}
+
+GHash::Element GHash::Load(const byte* block) {
+    return {LoadBigEndian64(block), LoadBigEndian64(block + 8)};
+}
+
+void GHash::Store(const Element& element, byte* block) {
+    StoreBigEndian64(element.High, block);
+    StoreBigEndian64(element.Low, block + 8);
+}
+
+GHash::Element GHash::Multiply(const Element& a, const Element& b) {
+    Element result;
+    Element v = b;
+    for (int i = 0; i < 128; i++) {
+        uint64_t bit = i < 64 ? (a.High >> (63 - i)) & 1 : (a.Low >> (127 - i)) & 1;
+        if (bit) {
+            result.High ^= v.High;
+            result.Low ^= v.Low;
+        }
+        uint64_t carry = v.Low & 1;
+        v.Low = (v.Low >> 1) | (v.High << 63);
+        v.High = (v.High >> 1) ^ (carry * 0xe100000000000000);
+    }
+    return result;
+}
+
+GHash::Element GHash::MultiplyH(const Element& x) const {
+    byte low = GetByte(x, 15) & 0xF;
+    uint64_t high = TableHigh[low];
+    uint64_t lowHalf = TableLow[low];
+
+    for (int i = 15; i >= 0; i--) {
+        byte value = GetByte(x, i);
+        byte lowNibble = value & 0xF;
+        byte highNibble = value >> 4;
+
+        if (i != 15) {
+            byte remainder = lowHalf & 0xF;
+            lowHalf = (high << 60) | (lowHalf >> 4);
+            high = (high >> 4) ^ (Last4[remainder] << 48);
+            high ^= TableHigh[lowNibble];
+            lowHalf ^= TableLow[lowNibble];
+        }
+
+        byte remainder = lowHalf & 0xF;
+        lowHalf = (high << 60) | (lowHalf >> 4);
+        high = (high >> 4) ^ (Last4[remainder] << 48);
+        high ^= TableHigh[highNibble];
+        lowHalf ^= TableLow[highNibble];
+    }
+
+    return {high, lowHalf};
+}
+
+GHash::Element GHash::PowerH(uint64_t n) const {
+
+    // The multiplicative identity is the block with only the x^0 coefficient set, which is the leading bit
+    Element result = {uint64_t(1) << 63, 0};
+    Element base = Key;
+    while (n > 0) {
+        if (n & 1) {
+            result = Multiply(result, base);
+        }
+        base = Multiply(base, base);
+        n >>= 1;
+    }
+    return result;
+}
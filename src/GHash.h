@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Core.h"
+
+namespace Steg {
+
+    // GHASH from GCM (NIST SP 800-38D) using PCLMULQDQ when the AES-NI backend is selected, Shoup's 4-bit tables otherwise
+    // GHASH is linear, so independent ranges can be hashed separately and combined with Combine
+    class GHash {
+
+    public:
+
+        // An element of GF(2^128) as two big-endian halves
+        struct Element {
+            uint64_t High = 0;
+            uint64_t Low = 0;
+        };
+
+        // hashKey is the 16 byte block E(K, 0^128)
+        explicit GHash(const byte* hashKey);
+
+        // Folds whole blocks into state, a trailing partial block is padded with zeros
+        void Update(Element& state, const byte* data, size_t length) const;
+
+        // Folds the 128-bit length block (bit lengths of the AAD and ciphertext) into state
+        void UpdateLengths(Element& state, uint64_t aadLength, uint64_t dataLength) const;
+
+        // The state of hashing A then B, given the states of hashing each one alone from zero
+        // blockCountB is the number of blocks (including a padded partial block) hashed into stateB
+        Element Combine(const Element& stateA, const Element& stateB, uint64_t blockCountB) const;
+
+        static Element Load(const byte* block);
+
+        static void Store(const Element& element, byte* block);
+
+        // Generic multiplication in GF(2^128), slower than the table based multiply by H
+        static Element Multiply(const Element& a, const Element& b);
+
+    private:
+
+        Element MultiplyH(const Element& x) const;
+
+        // H^n by square and multiply
+        Element PowerH(uint64_t n) const;
+
+        Element Key;
+
+        // Portable backend
+        std::array<uint64_t, 16> TableHigh;
+        std::array<uint64_t, 16> TableLow;
+
+        // PCLMULQDQ backend: H, H^2, H^3, H^4
+        bool Hardware;
+        uint64_t Powers[4][2];
+
+    };
+
+}
@@ -1,50 +1,61 @@
-#include "Image.h"
-#include "GrayImage.h"
-#include "lodepng.h"
-
-using namespace Steg;
-
-GrayImage::GrayImage(uint32_t width, uint32_t height, uint32_t bitDepth, bool hasAlpha)
-        : Image(width, height, Image::GetGrayMode(bitDepth, hasAlpha)), BitDepth(bitDepth), HasAlpha(hasAlpha) {}
-
-GrayImage::GrayImage(const Image& other)
-        : Image(other), BitDepth(other.GetBitDepth()), HasAlpha(other.HasAlpha()) {}
-
-GrayColor GrayImage::GetColor(uint32_t x, uint32_t y) {
-    uint64_t color = Image::GetColor(x, y);
-    GrayColor result(0, 0);
-    if (BitDepth == 8) {
-        if (HasAlpha) {
-            result.Alpha = color & 0xFF;
-            color >>= 8;
-        }
-        result.Value = color & 0xFF;
-    } else if (BitDepth == 16) {
-        if (HasAlpha) {
-            result.Alpha = color & 0xFFFF;
-            color >>= 16;
-        }
-        result.Value = color & 0xFFFF;
-    } else {
-        throw std::invalid_argument("Invalid Image bit depth: " + BitDepth);
-    }
-    return result;
-}
-
-void GrayImage::SetColor(uint32_t x, uint32_t y, uint16_t value) {
-    uint64_t color = value;
-    Image::SetColor(x, y, color);
-}
-
-void GrayImage::SetColor(uint32_t x, uint32_t y, uint16_t value, uint16_t alpha) {
-    uint64_t color = value;
-    if (BitDepth == 8) {
-        color <<= 8;
-    } else if (BitDepth == 16) {
-        color <<= 16;
-    } else {
-        throw std::invalid_argument("Invalid Image bit depth: " + BitDepth);
-    }
-    color |= alpha;
-    Image::SetColor(x, y, color);
-}
+#include "Image.h"
+#include "GrayImage.h"
+#include "lodepng.h"
+
+using namespace Steg;
+
+GrayImage::GrayImage(uint32_t width, uint32_t height, uint32_t bitDepth, bool hasAlpha)
+        : Image(width, height, Image::GetGrayMode(bitDepth, hasAlpha)) {}
+
+GrayImage::GrayImage(const Image& other)
+        : Image(other) {}
+
+void GrayImage::ConvertTo(const PixelMode& mode) {
+    if (GetChannelCount(mode) > 2) {
+        throw std::invalid_argument("Invalid Gray Pixel Mode");
+    }
+    Image::ConvertTo(mode);
+}
+
+GrayColor GrayImage::GetColor(uint32_t x, uint32_t y) {
+    return DispatchPixelMode(GetPixelMode(), [&]<PixelMode M>() {
+        if constexpr (!PixelTraits<M>::IsGray) {
+            throw std::invalid_argument("Invalid Gray Pixel Mode");
+            return GrayColor(0, 0);
+        } else {
+            // Read through the const overload so reading does not mark the row for the next save
+            auto pixel = std::as_const(*this).Row<M>(y)[x];
+            uint16_t alpha = 0;
+            if constexpr (PixelTraits<M>::HasAlpha) {
+                alpha = pixel.GetAlpha();
+            }
+            return GrayColor(pixel.Get(0), alpha);
+        }
+    });
+}
+
+void GrayImage::SetColor(uint32_t x, uint32_t y, uint16_t value) {
+    // The depth is read from the mode, which ConvertTo may have changed since construction
+    if (GetChannelCount() > 2) {
+        throw std::invalid_argument("Invalid Gray Pixel Mode");
+    }
+    uint64_t color = value;
+    Image::SetColor(x, y, color);
+}
+
+void GrayImage::SetColor(uint32_t x, uint32_t y, uint16_t value, uint16_t alpha) {
+    if (GetChannelCount() > 2) {
+        throw std::invalid_argument("Invalid Gray Pixel Mode");
+    }
+    uint64_t color = value;
+    uint32_t bitDepth = GetBitDepth();
+    if (bitDepth == 8) {
+        color <<= 8;
+    } else if (bitDepth == 16) {
+        color <<= 16;
+    } else {
+        throw std::invalid_argument("Invalid Image bit depth: " + std::to_string(bitDepth));
+    }
+    color |= alpha;
+    Image::SetColor(x, y, color);
+}
@@ -1,331 +1,557 @@
-#include "Image.h"
-#include "lodepng.h"
-
-using namespace Steg;
-
-Image::Image(uint32_t width, uint32_t height, const PixelMode& mode)
-        : Width(width), Height(height), PixelCount(width * height), Mode(mode) {
-    Data.resize(PixelCount * GetPixelWidth(mode), 0);
-}
-
-Image::Image(const std::string& imagePath) {
-    std::vector<byte> file;
-    lodepng::State state;
-
-    uint32_t error = lodepng::load_file(file, imagePath);
-    if (error) {
-        throw std::runtime_error("Could not load image file: " + imagePath);
-    }
-
-    error = lodepng::decode(Data, Width, Height, state, file);
-    if (error) {
-        throw std::runtime_error("Could not load image file: " + imagePath);
-    }
-
-    PixelCount = Width * Height;
-
-    auto colorType = state.info_raw.colortype;
-    auto bitDepth = state.info_raw.bitdepth;
-    switch (colorType) {
-        case LCT_GREY:
-            if (bitDepth == 8) {
-                Mode = PixelMode::GRAY_8;
-            } else if (bitDepth == 16) {
-                Mode = PixelMode::GRAY_16;
-            } else {
-                Mode = PixelMode::INVALID;
-            }
-            break;
-        case LCT_GREY_ALPHA:
-            if (bitDepth == 8) {
-                Mode = PixelMode::GRAYA_8;
-            } else if (bitDepth == 16) {
-                Mode = PixelMode::GRAYA_16;
-            } else {
-                Mode = PixelMode::INVALID;
-            }
-            break;
-        case LCT_RGB:
-            if (bitDepth == 8) {
-                Mode = PixelMode::RGB_8;
-            } else if (bitDepth == 16) {
-                Mode = PixelMode::RGB_16;
-            } else {
-                Mode = PixelMode::INVALID;
-            }
-            break;
-        case LCT_RGBA:
-            if (bitDepth == 8) {
-                Mode = PixelMode::RGBA_8;
-            } else if (bitDepth == 16) {
-                Mode = PixelMode::RGBA_16;
-            } else {
-                Mode = PixelMode::INVALID;
-            }
-            break;
-        default:
-            Mode = PixelMode::INVALID;
-            throw std::invalid_argument("Invalid LodePNG Color Type: " + colorType);
-    }
-
-}
-
-void Image::SaveImage(const std::string& imagePath) const {
-    LodePNGColorType type;
-    uint32_t depth;
-    switch (Mode) {
-        default:
-        case PixelMode::GRAY_8:
-            type = LodePNGColorType::LCT_GREY;
-            depth = 8;
-            break;
-        case PixelMode::GRAY_16:
-            type = LodePNGColorType::LCT_GREY;
-            depth = 16;
-            break;
-        case PixelMode::GRAYA_8:
-            type = LodePNGColorType::LCT_GREY_ALPHA;
-            depth = 8;
-            break;
-        case PixelMode::GRAYA_16:
-            type = LodePNGColorType::LCT_GREY_ALPHA;
-            depth = 16;
-            break;
-        case PixelMode::RGB_8:
-            type = LodePNGColorType::LCT_RGB;
-            depth = 8;
-            break;
-        case PixelMode::RGB_16:
-            type = LodePNGColorType::LCT_RGB;
-            depth = 16;
-            break;
-        case PixelMode::RGBA_8:
-            type = LodePNGColorType::LCT_RGBA;
-            depth = 8;
-            break;
-        case PixelMode::RGBA_16:
-            type = LodePNGColorType::LCT_RGBA;
-            depth = 16;
-            break;
-    }
-
-    if (depth == 16) {
-        throw std::invalid_argument("16-bit image saving is not available yet");
-    }
-
-    unsigned error = lodepng::encode(imagePath, Data, Width, Height, type, depth);
-    if (error) {
-        throw std::runtime_error("Could not encode and save file to " + imagePath);
-    }
-}
-
-// TODO This type is insufficient for 16 bit modes
-uint64_t Image::GetColor(uint32_t x, uint32_t y) const {
-    uint32_t bitDepth = GetBitDepth(Mode);
-    uint32_t channels = GetChannelCount(Mode);
-
-    uint32_t pixelIndex = (y * Width + x) * GetPixelWidth(Mode);
-
-    uint64_t color = 0;
-    if (bitDepth == 8) {
-        for (uint32_t i = 0; i < channels; i++) {
-            color <<= 8;
-            byte value = Data[pixelIndex + i];
-            color |= value;
-        }
-    } else if (bitDepth == 16) {
-        for (uint32_t i = 0; i < channels; i++) {
-            color <<= 16;
-            byte value0 = Data[pixelIndex + (2 * i)];
-            byte value1 = Data[pixelIndex + (2 * i) + 1];
-            color |= value0;
-            color <<= 8;
-            color |= value1;
-        }
-    }
-    return color;
-
-}
-
-byte Image::GetByte(uint32_t index) const {
-    return Data[index];
-}
-
-bool Image::IsAlphaIndex(uint32_t index) const {
-    switch (Mode) {
-        case PixelMode::RGBA_8:
-            if (index % 4 == 3) {
-                return true;
-            }
-            return false;
-        case PixelMode::RGBA_16:
-            if ((index / 2) % 4 == 3) {
-                return true;
-            }
-            return false;
-        case PixelMode::GRAYA_8:
-            if (index % 2 == 1) {
-                return true;
-            }
-            return false;
-        case PixelMode::GRAYA_16:
-            if ((index / 2) % 2 == 1) {
-                return true;
-            }
-            return false;
-        default:
-            return false;
-    }
-}
-
-// TODO This type is insufficient for 16 bit modes
-void Image::SetColor(uint32_t x, uint32_t y, uint64_t color) {
-    uint32_t bitDepth = GetBitDepth(Mode);
-    uint32_t channels = GetChannelCount(Mode);
-
-    uint32_t pixelIndex = (y * Width + x) * GetPixelWidth(Mode);
-
-    if (bitDepth == 8) {
-        for (uint32_t i = 0; i < channels; i++) {
-            byte value = (color >> (8 * (channels - 1 - i))) & 0xFF;
-            Data[pixelIndex + i] = value;
-        }
-    } else if (bitDepth == 16) {
-        for (uint32_t i = 0; i < channels; i++) {
-            uint16_t value = (color >> (16 * (channels - 1 - i))) & 0xFFFF;
-            Data[pixelIndex + (2 * i)] = value & 0xFF00;
-            Data[pixelIndex + (2 * i) + 1] = value & 0x00FF;
-        }
-    }
-}
-
-void Image::SetByte(uint32_t index, byte value) {
-    Data[index] = value;
-}
-
-/* Public Getter Methods */
-
-uint32_t Image::GetWidth() const {
-    return Width;
-}
-
-uint32_t Image::GetHeight() const {
-    return Height;
-}
-
-PixelMode Image::GetPixelMode() const {
-    return Mode;
-}
-
-uint32_t Image::GetBitDepth() const {
-    return GetBitDepth(Mode);
-}
-
-uint32_t Image::GetChannelCount() const {
-    return GetChannelCount(Mode);
-}
-
-uint32_t Image::GetPixelWidth() const {
-    return GetPixelWidth(Mode);
-}
-
-bool Image::HasAlpha() const {
-    return HasAlpha(Mode);
-}
-
-/* Protected Methods */
-
-PixelMode Image::GetGrayMode(uint32_t bitDepth, bool hasAlpha) {
-    if (bitDepth == 8) {
-        if (hasAlpha) {
-            return PixelMode::GRAYA_8;
-        } else {
-            return PixelMode::GRAY_8;
-        }
-    } else if (bitDepth == 16) {
-        if (hasAlpha) {
-            return PixelMode::GRAYA_16;
-        } else {
-            return PixelMode::GRAY_16;
-        }
-    } else {
-        throw std::invalid_argument("Invalid Image bit depth: " + bitDepth);
-        return PixelMode::INVALID;
-    }
-}
-
-PixelMode Image::GetRGBMode(uint32_t bitDepth, bool hasAlpha) {
-    if (bitDepth == 8) {
-        if (hasAlpha) {
-            return PixelMode::RGBA_8;
-        } else {
-            return PixelMode::RGB_8;
-        }
-    } else if (bitDepth == 16) {
-        if (hasAlpha) {
-            return PixelMode::RGBA_16;
-        } else {
-            return PixelMode::RGB_16;
-        }
-    } else {
-        throw std::invalid_argument("Invalid Image bit depth: " + bitDepth);
-        return PixelMode::INVALID;
-    }
-}
-
-uint32_t Image::GetBitDepth(const PixelMode& mode) {
-    switch (mode) {
-        case PixelMode::GRAY_8:     // ------VV
-        case PixelMode::GRAYA_8:    // ----VVAA
-        case PixelMode::RGB_8:      // --RRGGBB
-        case PixelMode::RGBA_8:     // RRGGBBAA
-            return 8;
-        case PixelMode::GRAY_16:
-        case PixelMode::GRAYA_16:
-        case PixelMode::RGB_16:
-        case PixelMode::RGBA_16:
-            return 16;
-        default:
-            throw std::invalid_argument("Unsupported Pixel Mode");
-    }
-}
-
-uint32_t Image::GetChannelCount(const PixelMode& mode) {
-    switch (mode) {
-        case PixelMode::GRAY_8:
-        case PixelMode::GRAY_16:
-            return 1;
-        case PixelMode::GRAYA_8:
-        case PixelMode::GRAYA_16:
-            return 2;
-        case PixelMode::RGB_8:
-        case PixelMode::RGB_16:
-            return 3;
-        case PixelMode::RGBA_8:
-        case PixelMode::RGBA_16:
-            return 4;
-        default:
-            throw std::invalid_argument("Unsupported Pixel Mode");
-    }
-}
-
-uint32_t Image::GetPixelWidth(const PixelMode& mode) {
-    return GetBitDepth(mode) * GetChannelCount(mode) / 8;
-}
-
-bool Image::HasAlpha(const PixelMode& mode) {
-    switch (mode) {
-        case PixelMode::GRAY_8:
-        case PixelMode::GRAY_16:
-        case PixelMode::RGB_8:
-        case PixelMode::RGB_16:
-            return false;
-        case PixelMode::GRAYA_8:
-        case PixelMode::GRAYA_16:
-        case PixelMode::RGBA_8:
-        case PixelMode::RGBA_16:
-            return true;
-        default:
-            throw std::invalid_argument("Unsupported Pixel Mode");
-    }
-}
+#include "Image.h"
+#include "Async.h"
+#include "PixelConvert.h"
+#include "PNGBlocks.h"
+#include "StegMemory.h"
+#include "StegTimer.h"
+#include "lodepng.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+using namespace Steg;
+
+namespace {
+
+    // Every image reads the allocator when it allocates, so it is swapped atomically rather than under a lock
+    // Standard libraries without std::atomic<std::shared_ptr> still have the atomic free functions for shared_ptr
+#ifdef __cpp_lib_atomic_shared_ptr
+
+    // Function-local so images created during static initialization still get an allocator
+    std::atomic<Ref<BufferAllocator>>& CurrentAllocator() {
+        static std::atomic<Ref<BufferAllocator>> allocator(CreateRef<DefaultBufferAllocator>());
+        return allocator;
+    }
+
+    Ref<BufferAllocator> LoadAllocator() {
+        return CurrentAllocator().load(std::memory_order_acquire);
+    }
+
+    void StoreAllocator(const Ref<BufferAllocator>& allocator) {
+        CurrentAllocator().store(allocator, std::memory_order_release);
+    }
+
+#else
+
+    // Function-local so images created during static initialization still get an allocator
+    Ref<BufferAllocator>& CurrentAllocator() {
+        static Ref<BufferAllocator> allocator = CreateRef<DefaultBufferAllocator>();
+        return allocator;
+    }
+
+    Ref<BufferAllocator> LoadAllocator() {
+        return std::atomic_load_explicit(&CurrentAllocator(), std::memory_order_acquire);
+    }
+
+    void StoreAllocator(const Ref<BufferAllocator>& allocator) {
+        std::atomic_store_explicit(&CurrentAllocator(), allocator, std::memory_order_release);
+    }
+
+#endif
+
+}
+
+Image::Image(uint32_t width, uint32_t height, const PixelMode& mode)
+        : Width(width), Height(height), PixelCount(width * height), Mode(mode),
+          RowSize(size_t(width) * GetPixelWidth(mode)), Stride(RowSize),
+          Data(RowSize * height, true, GetAllocator()),
+          Blocks(PNGBlocks::Create(width, height, mode)) {}
+
+Image::Image(byte* pixels, uint32_t width, uint32_t height, size_t stride, const PixelMode& mode)
+        : Width(width), Height(height), PixelCount(width * height), Mode(mode),
+          RowSize(size_t(width) * GetPixelWidth(mode)), Stride(stride) {
+
+    // Byte indices are 32-bit
+    if (uint64_t(RowSize) * height > UINT32_MAX) {
+        throw std::invalid_argument("Image is too large");
+    }
+    if (stride < RowSize) {
+        throw std::invalid_argument("Stride is shorter than a row of pixels");
+    }
+    if (pixels == nullptr && PixelCount != 0) {
+        throw std::invalid_argument("Pixels must not be null");
+    }
+
+    // The last row does not need its padding
+    Data = ImageBuffer(pixels, height == 0 ? 0 : stride * (height - 1) + RowSize);
+
+}
+
+// A wrapped image's copy owns its pixels, so it can keep compressed rows for its saves like any other image
+Image::Image(const Image& other)
+        : Width(other.Width), Height(other.Height), PixelCount(other.PixelCount), Mode(other.Mode),
+          RowSize(other.RowSize), Stride(other.RowSize),
+          Data(other.Data.IsBorrowed() ? other.PackRows() : other.Data),
+          Blocks(other.Blocks ? CreateScope<PNGBlocks>(*other.Blocks) :
+                 other.Data.IsBorrowed() ? PNGBlocks::Create(Width, Height, Mode) : nullptr) {}
+
+Image::Image(Image&& other) noexcept = default;
+
+Image::~Image() = default;
+
+Image Image::Wrap(byte* pixels, uint32_t width, uint32_t height, size_t stride, const PixelMode& mode) {
+    return Image(pixels, width, height, stride, mode);
+}
+
+Image::Image(const std::string& imagePath) {
+    ScopedTimer timer(StegTimer::TimerLabel::PNG_LOAD);
+
+    std::vector<byte> file;
+    uint32_t error = lodepng::load_file(file, imagePath);
+    if (error) {
+        throw std::runtime_error("Could not load image file: " + imagePath);
+    }
+    MemoryTracker fileMemory(file);
+
+    if (ReadPNG(file) != 0) {
+        throw std::runtime_error("Could not load image file: " + imagePath);
+    }
+}
+
+Image::Image(std::span<const byte> pngData) {
+    ScopedTimer timer(StegTimer::TimerLabel::PNG_LOAD);
+
+    if (ReadPNG(pngData) != 0) {
+        throw std::runtime_error("Could not decode PNG data");
+    }
+}
+
+Task<Image> Image::LoadImageAsync(std::string imagePath) {
+    co_await ResumeOnPool();
+    co_return Image(imagePath);
+}
+
+Task<void> Image::SaveImageAsync(std::string imagePath) const {
+    co_await ResumeOnPool();
+    SaveImage(imagePath);
+}
+
+uint32_t Image::ReadPNG(std::span<const byte> pngData) {
+    lodepng::State state;
+
+    // Decode to the color type of the file so an image keeps the mode it was saved in
+    // 16-bit files come out as 8-bit because 16-bit images cannot be saved yet
+    // Palette files expand to RGBA and sub-8-bit grey files to 8-bit grey
+    unsigned fileWidth, fileHeight;
+    uint32_t error = lodepng_inspect(&fileWidth, &fileHeight, &state, pngData.data(), pngData.size());
+    if (error) {
+        return error;
+    }
+    if (state.info_png.color.colortype != LCT_PALETTE) {
+        state.info_raw.colortype = state.info_png.color.colortype;
+    }
+    state.info_raw.bitdepth = 8;
+
+    // LodePNG decodes into its own vector, which is then copied into a buffer from the allocator
+    // The decoded pixels overwrite the whole buffer so it does not need to be zeroed
+    std::vector<byte> pixels;
+    error = lodepng::decode(pixels, Width, Height, state, pngData.data(), pngData.size());
+    if (error) {
+        return error;
+    }
+    MemoryTracker pixelsMemory(pixels);
+
+    Data = ImageBuffer(pixels.size(), false, GetAllocator());
+    std::copy(pixels.begin(), pixels.end(), Data.GetData());
+
+    PixelCount = Width * Height;
+    RowSize = Height == 0 ? 0 : pixels.size() / Height;
+    Stride = RowSize;
+
+    auto colorType = state.info_raw.colortype;
+    auto bitDepth = state.info_raw.bitdepth;
+    switch (colorType) {
+        case LCT_GREY:
+            if (bitDepth == 8) {
+                Mode = PixelMode::GRAY_8;
+            } else if (bitDepth == 16) {
+                Mode = PixelMode::GRAY_16;
+            } else {
+                Mode = PixelMode::INVALID;
+            }
+            break;
+        case LCT_GREY_ALPHA:
+            if (bitDepth == 8) {
+                Mode = PixelMode::GRAYA_8;
+            } else if (bitDepth == 16) {
+                Mode = PixelMode::GRAYA_16;
+            } else {
+                Mode = PixelMode::INVALID;
+            }
+            break;
+        case LCT_RGB:
+            if (bitDepth == 8) {
+                Mode = PixelMode::RGB_8;
+            } else if (bitDepth == 16) {
+                Mode = PixelMode::RGB_16;
+            } else {
+                Mode = PixelMode::INVALID;
+            }
+            break;
+        case LCT_RGBA:
+            if (bitDepth == 8) {
+                Mode = PixelMode::RGBA_8;
+            } else if (bitDepth == 16) {
+                Mode = PixelMode::RGBA_16;
+            } else {
+                Mode = PixelMode::INVALID;
+            }
+            break;
+        default:
+            Mode = PixelMode::INVALID;
+            throw std::invalid_argument("Invalid LodePNG Color Type: " + colorType);
+    }
+
+    // A PNG this library wrote keeps its compressed rows, so saving it again only compresses what changed
+    Blocks = PNGBlocks::Read(pngData, Width, Height, Mode);
+    if (!Blocks) {
+        Blocks = PNGBlocks::Create(Width, Height, Mode);
+    }
+
+    return 0;
+}
+
+void Image::SaveImage(const std::string& imagePath) const {
+    ScopedTimer timer(StegTimer::TimerLabel::PNG_SAVE);
+
+    std::vector<byte> png = WritePNG();
+    MemoryTracker pngMemory(png);
+
+    unsigned error = lodepng::save_file(png, imagePath);
+    if (error) {
+        throw std::runtime_error("Could not encode and save file to " + imagePath);
+    }
+}
+
+std::vector<byte> Image::EncodePNG() const {
+    ScopedTimer timer(StegTimer::TimerLabel::PNG_SAVE);
+    return WritePNG();
+}
+
+std::vector<byte> Image::WritePNG() const {
+    LodePNGColorType type;
+    uint32_t depth;
+    switch (Mode) {
+        default:
+        case PixelMode::GRAY_8:
+            type = LodePNGColorType::LCT_GREY;
+            depth = 8;
+            break;
+        case PixelMode::GRAY_16:
+            type = LodePNGColorType::LCT_GREY;
+            depth = 16;
+            break;
+        case PixelMode::GRAYA_8:
+            type = LodePNGColorType::LCT_GREY_ALPHA;
+            depth = 8;
+            break;
+        case PixelMode::GRAYA_16:
+            type = LodePNGColorType::LCT_GREY_ALPHA;
+            depth = 16;
+            break;
+        case PixelMode::RGB_8:
+            type = LodePNGColorType::LCT_RGB;
+            depth = 8;
+            break;
+        case PixelMode::RGB_16:
+            type = LodePNGColorType::LCT_RGB;
+            depth = 16;
+            break;
+        case PixelMode::RGBA_8:
+            type = LodePNGColorType::LCT_RGBA;
+            depth = 8;
+            break;
+        case PixelMode::RGBA_16:
+            type = LodePNGColorType::LCT_RGBA;
+            depth = 16;
+            break;
+    }
+
+    if (depth == 16) {
+        throw std::invalid_argument("16-bit image saving is not available yet");
+    }
+
+    if (Blocks) {
+        return Blocks->Write(Data.GetData());
+    }
+
+    // LodePNG takes rows without padding
+    ImageBuffer packed;
+    const byte* pixels = Data.GetData();
+    if (Stride != RowSize) {
+        packed = PackRows();
+        pixels = packed.GetData();
+    }
+
+    std::vector<byte> png;
+    unsigned error = lodepng::encode(png, pixels, Width, Height, type, depth);
+    if (error) {
+        throw std::runtime_error("Could not encode PNG image");
+    }
+    return png;
+}
+
+// TODO This type is insufficient for 16 bit modes
+uint64_t Image::GetColor(uint32_t x, uint32_t y) const {
+    return DispatchPixelMode(Mode, [&]<PixelMode M>() {
+        auto pixel = Row<M>(y)[x];
+
+        // Channels are packed most significant first
+        uint64_t color = 0;
+        for (uint32_t i = 0; i < PixelTraits<M>::ChannelCount; i++) {
+            color <<= PixelTraits<M>::BitDepth;
+            color |= pixel.Get(i);
+        }
+        return color;
+    });
+}
+
+byte Image::GetByte(uint32_t index) const {
+    return Data[GetOffset(index)];
+}
+
+bool Image::IsAlphaIndex(uint32_t index) const {
+    switch (Mode) {
+        case PixelMode::RGBA_8:
+            if (index % 4 == 3) {
+                return true;
+            }
+            return false;
+        case PixelMode::RGBA_16:
+            if ((index / 2) % 4 == 3) {
+                return true;
+            }
+            return false;
+        case PixelMode::GRAYA_8:
+            if (index % 2 == 1) {
+                return true;
+            }
+            return false;
+        case PixelMode::GRAYA_16:
+            if ((index / 2) % 2 == 1) {
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+// TODO This type is insufficient for 16 bit modes
+void Image::SetColor(uint32_t x, uint32_t y, uint64_t color) {
+    DispatchPixelMode(Mode, [&]<PixelMode M>() {
+        using Traits = PixelTraits<M>;
+        auto pixel = Row<M>(y)[x];
+
+        // Channels are packed most significant first
+        constexpr uint64_t sampleMask = (uint64_t(1) << Traits::BitDepth) - 1;
+        for (uint32_t i = 0; i < Traits::ChannelCount; i++) {
+            uint32_t shiftAmount = Traits::BitDepth * (Traits::ChannelCount - 1 - i);
+            pixel.Set(i, typename Traits::Sample((color >> shiftAmount) & sampleMask));
+        }
+    });
+}
+
+void Image::SetByte(uint32_t index, byte value) {
+    // Writing a byte back unchanged, which embedding often does, leaves its row clean
+    byte& current = Data[GetOffset(index)];
+    if (current != value) {
+        current = value;
+        if (Blocks) {
+            Blocks->MarkByte(index);
+        }
+    }
+}
+
+void Image::ConvertTo(const PixelMode& mode) {
+    if (mode == Mode) {
+        return;
+    }
+
+    ScopedTimer timer(StegTimer::TimerLabel::PIXEL_CONVERT);
+
+    // PixelConvert takes rows without padding
+    ImageBuffer packed;
+    const byte* pixels = Data.GetData();
+    if (Stride != RowSize) {
+        packed = PackRows();
+        pixels = packed.GetData();
+    }
+
+    // Every byte of the new buffer is written so it does not need to be zeroed
+    ImageBuffer converted(size_t(PixelCount) * GetPixelWidth(mode), false, GetAllocator());
+    PixelConvert::Convert(pixels, converted.GetData(), PixelCount, Mode, mode);
+
+    Data = std::move(converted);
+    Mode = mode;
+    RowSize = size_t(Width) * GetPixelWidth(mode);
+    Stride = RowSize;
+    Blocks = PNGBlocks::Create(Width, Height, mode);
+}
+
+/* Public Getter Methods */
+
+uint32_t Image::GetWidth() const {
+    return Width;
+}
+
+uint32_t Image::GetHeight() const {
+    return Height;
+}
+
+PixelMode Image::GetPixelMode() const {
+    return Mode;
+}
+
+uint32_t Image::GetBitDepth() const {
+    return GetBitDepth(Mode);
+}
+
+uint32_t Image::GetChannelCount() const {
+    return GetChannelCount(Mode);
+}
+
+uint32_t Image::GetPixelWidth() const {
+    return GetPixelWidth(Mode);
+}
+
+bool Image::HasAlpha() const {
+    return HasAlpha(Mode);
+}
+
+void Image::SetAllocator(const Ref<BufferAllocator>& allocator) {
+    if (!allocator) {
+        throw std::invalid_argument("Image allocator must not be null");
+    }
+    StoreAllocator(allocator);
+}
+
+Ref<BufferAllocator> Image::GetAllocator() {
+    return LoadAllocator();
+}
+
+/* Protected Methods */
+
+PixelMode Image::GetGrayMode(uint32_t bitDepth, bool hasAlpha) {
+    if (bitDepth == 8) {
+        if (hasAlpha) {
+            return PixelMode::GRAYA_8;
+        } else {
+            return PixelMode::GRAY_8;
+        }
+    } else if (bitDepth == 16) {
+        if (hasAlpha) {
+            return PixelMode::GRAYA_16;
+        } else {
+            return PixelMode::GRAY_16;
+        }
+    } else {
+        throw std::invalid_argument("Invalid Image bit depth: " + bitDepth);
+        return PixelMode::INVALID;
+    }
+}
+
+PixelMode Image::GetRGBMode(uint32_t bitDepth, bool hasAlpha) {
+    if (bitDepth == 8) {
+        if (hasAlpha) {
+            return PixelMode::RGBA_8;
+        } else {
+            return PixelMode::RGB_8;
+        }
+    } else if (bitDepth == 16) {
+        if (hasAlpha) {
+            return PixelMode::RGBA_16;
+        } else {
+            return PixelMode::RGB_16;
+        }
+    } else {
+        throw std::invalid_argument("Invalid Image bit depth: " + bitDepth);
+        return PixelMode::INVALID;
+    }
+}
+
+uint32_t Image::GetBitDepth(const PixelMode& mode) {
+    switch (mode) {
+        case PixelMode::GRAY_8:     // ------VV
+        case PixelMode::GRAYA_8:    // ----VVAA
+        case PixelMode::RGB_8:      // --RRGGBB
+        case PixelMode::RGBA_8:     // RRGGBBAA
+            return 8;
+        case PixelMode::GRAY_16:
+        case PixelMode::GRAYA_16:
+        case PixelMode::RGB_16:
+        case PixelMode::RGBA_16:
+            return 16;
+        default:
+            throw std::invalid_argument("Unsupported Pixel Mode");
+    }
+}
+
+uint32_t Image::GetChannelCount(const PixelMode& mode) {
+    switch (mode) {
+        case PixelMode::GRAY_8:
+        case PixelMode::GRAY_16:
+            return 1;
+        case PixelMode::GRAYA_8:
+        case PixelMode::GRAYA_16:
+            return 2;
+        case PixelMode::RGB_8:
+        case PixelMode::RGB_16:
+            return 3;
+        case PixelMode::RGBA_8:
+        case PixelMode::RGBA_16:
+            return 4;
+        default:
+            throw std::invalid_argument("Unsupported Pixel Mode");
+    }
+}
+
+uint32_t Image::GetPixelWidth(const PixelMode& mode) {
+    return GetBitDepth(mode) * GetChannelCount(mode) / 8;
+}
+
+bool Image::HasAlpha(const PixelMode& mode) {
+    switch (mode) {
+        case PixelMode::GRAY_8:
+        case PixelMode::GRAY_16:
+        case PixelMode::RGB_8:
+        case PixelMode::RGB_16:
+            return false;
+        case PixelMode::GRAYA_8:
+        case PixelMode::GRAYA_16:
+        case PixelMode::RGBA_8:
+        case PixelMode::RGBA_16:
+            return true;
+        default:
+            throw std::invalid_argument("Unsupported Pixel Mode");
+    }
+}
+
+/* Private Methods */
+
+ImageBuffer Image::PackRows() const {
+    ImageBuffer packed(RowSize * Height, false, GetAllocator());
+    for (uint32_t y = 0; y < Height; y++) {
+        std::copy_n(Data.GetData() + y * Stride, RowSize, packed.GetData() + y * RowSize);
+    }
+    return packed;
+}
+
+void Image::CheckPixelMode(const PixelMode& mode) const {
+    if (mode != Mode) {
+        throw std::invalid_argument("Requested Pixel Mode does not match the image");
+    }
+}
+
+void Image::MarkRow(uint32_t y) {
+    if (Blocks) {
+        Blocks->MarkRow(y);
+    }
+}
+
+void Image::MarkAllRows() {
+    if (Blocks) {
+        Blocks->MarkAll();
+    }
+}
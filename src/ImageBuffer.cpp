@@ -0,0 +1,48 @@
+#include "ImageBuffer.h"
+
+#include "StegMemory.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace Steg;
+
+ImageBuffer::ImageBuffer() : Data(nullptr), Size(0) {}
+
+ImageBuffer::ImageBuffer(size_t size, bool zeroed, const Ref<BufferAllocator>& allocator)
+        : Data(nullptr), Size(size), Allocator(allocator) {
+    if (Size != 0) {
+        Data = Allocator->Allocate(Size, zeroed);
+        StegMemory::Allocated(Size);
+    }
+}
+
+ImageBuffer::ImageBuffer(byte* data, size_t size) : Data(data), Size(size) {}
+
+ImageBuffer::ImageBuffer(const ImageBuffer& other)
+        : Data(nullptr), Size(other.Size),
+          Allocator(other.Allocator ? other.Allocator : CreateRef<DefaultBufferAllocator>()) {
+    if (Size != 0) {
+        Data = Allocator->Allocate(Size, false);
+        StegMemory::Allocated(Size);
+        std::copy_n(other.Data, Size, Data);
+    }
+}
+
+ImageBuffer::ImageBuffer(ImageBuffer&& other) noexcept
+        : Data(std::exchange(other.Data, nullptr)), Size(std::exchange(other.Size, 0)),
+          Allocator(std::move(other.Allocator)) {}
+
+ImageBuffer& ImageBuffer::operator=(ImageBuffer other) noexcept {
+    std::swap(Data, other.Data);
+    std::swap(Size, other.Size);
+    std::swap(Allocator, other.Allocator);
+    return *this;
+}
+
+ImageBuffer::~ImageBuffer() {
+    if (Data != nullptr && Allocator) {
+        Allocator->Deallocate(Data, Size);
+        StegMemory::Deallocated(Size);
+    }
+}
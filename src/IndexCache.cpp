@@ -0,0 +1,57 @@
+#include "IndexCache.h"
+
+using namespace Steg;
+
+IndexCache::IndexCache(size_t capacity) : Capacity(capacity) {}
+
+Ref<const CountedVector<uint32_t>> IndexCache::Find(uint32_t seed, uint32_t indexCount) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    for (auto it = Entries.begin(); it != Entries.end(); ++it) {
+        if (it->Seed == seed && it->IndexCount == indexCount) {
+
+            // Move the entry to the front so it is evicted last
+            Entries.splice(Entries.begin(), Entries, it);
+            return it->Indices;
+        }
+    }
+    return nullptr;
+}
+
+void IndexCache::Insert(uint32_t seed, uint32_t indexCount, const Ref<const CountedVector<uint32_t>>& indices) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (Capacity == 0) {
+        return;
+    }
+
+    // Another thread may have generated the same order in the meantime
+    for (const Entry& entry : Entries) {
+        if (entry.Seed == seed && entry.IndexCount == indexCount) {
+            return;
+        }
+    }
+
+    Entries.push_front({seed, indexCount, indices});
+    Evict();
+}
+
+void IndexCache::SetCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Capacity = capacity;
+    Evict();
+}
+
+size_t IndexCache::GetCapacity() const {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return Capacity;
+}
+
+void IndexCache::Clear() {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Entries.clear();
+}
+
+void IndexCache::Evict() {
+    while (Entries.size() > Capacity) {
+        Entries.pop_back();
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Core.h"
+
+#include "StegMemory.h"
+
+#include <list>
+#include <mutex>
+
+namespace Steg {
+
+    // Least recently used cache of the full index orders GenerateIndices draws, so a service encoding and decoding images
+    // of one size only shuffles once per seed
+    // An order is fully determined by the seed (the first byte of the image) and the index count
+    // Orders are shared and never modified, an evicted order stays alive until the last caller using it lets go
+    class IndexCache {
+
+    public:
+
+        // A capacity of 0 disables the cache
+        explicit IndexCache(size_t capacity = 0);
+
+        IndexCache(const IndexCache& other) = delete;
+
+        IndexCache& operator=(const IndexCache& other) = delete;
+
+        // nullptr if the order is not cached
+        Ref<const CountedVector<uint32_t>> Find(uint32_t seed, uint32_t indexCount);
+
+        // Stores an order, evicting the least recently used entries past the capacity
+        void Insert(uint32_t seed, uint32_t indexCount, const Ref<const CountedVector<uint32_t>>& indices);
+
+        // Evicts entries until at most capacity remain
+        void SetCapacity(size_t capacity);
+
+        size_t GetCapacity() const;
+
+        void Clear();
+
+    private:
+
+        struct Entry {
+            uint32_t Seed;
+            uint32_t IndexCount;
+            Ref<const CountedVector<uint32_t>> Indices;
+        };
+
+        // Caller must hold Mutex
+        void Evict();
+
+        mutable std::mutex Mutex;
+        size_t Capacity;
+
+        // Most recently used first
+        std::list<Entry> Entries;
+
+    };
+
+}
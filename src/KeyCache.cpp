@@ -0,0 +1,72 @@
+#include "KeyCache.h"
+
+using namespace Steg;
+
+KeyCache::KeyCache(size_t capacity) : Capacity(capacity) {}
+
+KeyCache::~KeyCache() {
+    Clear();
+}
+
+bool KeyCache::Find(const std::vector<byte>& password, const std::vector<byte>& salt, const KDFParams& kdf, std::vector<byte>& key) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    for (auto it = Entries.begin(); it != Entries.end(); ++it) {
+        if (it->Password == password && it->Salt == salt && it->KDF == kdf) {
+
+            // Move the entry to the front so it is evicted last
+            Entries.splice(Entries.begin(), Entries, it);
+            key = it->Key;
+            return true;
+        }
+    }
+    return false;
+}
+
+void KeyCache::Insert(const std::vector<byte>& password, const std::vector<byte>& salt, const KDFParams& kdf, const std::vector<byte>& key) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (Capacity == 0) {
+        return;
+    }
+
+    // Another thread may have derived the same key in the meantime
+    for (const Entry& entry : Entries) {
+        if (entry.Password == password && entry.Salt == salt && entry.KDF == kdf) {
+            return;
+        }
+    }
+
+    Entries.push_front({password, salt, kdf, key});
+    Evict(Entries.size() > Capacity ? Entries.size() - Capacity : 0);
+}
+
+void KeyCache::SetCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Capacity = capacity;
+    Evict(Entries.size() > Capacity ? Entries.size() - Capacity : 0);
+}
+
+size_t KeyCache::GetCapacity() const {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return Capacity;
+}
+
+void KeyCache::Clear() {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Evict(Entries.size());
+}
+
+void KeyCache::Wipe(std::vector<byte>& bytes) {
+    volatile byte* data = bytes.data();
+    for (size_t i = 0; i < bytes.size(); i++) {
+        data[i] = 0;
+    }
+}
+
+void KeyCache::Evict(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        Entry& entry = Entries.back();
+        Wipe(entry.Password);
+        Wipe(entry.Key);
+        Entries.pop_back();
+    }
+}
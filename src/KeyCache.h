@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Core.h"
+
+#include "StegCrypt.h"
+
+#include <list>
+#include <mutex>
+
+namespace Steg {
+
+    // Least recently used cache of derived keys, so repeated operations with one password only run the KDF once
+    // Passwords and keys held by the cache are overwritten with zeros when they are evicted or cleared
+    // Lookups scan every entry, the cache is meant to hold a handful of passwords
+    class KeyCache {
+
+    public:
+
+        // A capacity of 0 disables the cache
+        explicit KeyCache(size_t capacity = 0);
+
+        ~KeyCache();
+
+        KeyCache(const KeyCache& other) = delete;
+
+        KeyCache& operator=(const KeyCache& other) = delete;
+
+        // Copies the key derived from password, salt and kdf into key, returns false if it is not cached
+        bool Find(const std::vector<byte>& password, const std::vector<byte>& salt, const KDFParams& kdf, std::vector<byte>& key);
+
+        // Stores a derived key, evicting the least recently used entries past the capacity
+        void Insert(const std::vector<byte>& password, const std::vector<byte>& salt, const KDFParams& kdf, const std::vector<byte>& key);
+
+        // Evicts entries until at most capacity remain
+        void SetCapacity(size_t capacity);
+
+        size_t GetCapacity() const;
+
+        void Clear();
+
+        // Overwrites bytes with zeros in a way the compiler cannot remove as a dead store
+        static void Wipe(std::vector<byte>& bytes);
+
+    private:
+
+        struct Entry {
+            std::vector<byte> Password;
+            std::vector<byte> Salt;
+            KDFParams KDF;
+            std::vector<byte> Key;
+        };
+
+        // Caller must hold Mutex
+        void Evict(size_t count);
+
+        mutable std::mutex Mutex;
+        size_t Capacity;
+
+        // Most recently used first
+        std::list<Entry> Entries;
+
+    };
+
+}
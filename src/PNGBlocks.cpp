@@ -0,0 +1,435 @@
+#include "PNGBlocks.h"
+#include "Parallel.h"
+#include "StegTimer.h"
+
+#include <algorithm>
+
+#ifdef STEG_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace Steg;
+
+namespace {
+
+    // PNG filter types, see the PNG specification section 9
+    enum Filter : byte {
+        FILTER_NONE,
+        FILTER_SUB,
+        FILTER_UP,
+        FILTER_AVERAGE,
+        FILTER_PAETH,
+        FILTER_COUNT
+    };
+
+    constexpr byte Signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+
+    // CMF and FLG of a 32K window at the default level
+    constexpr byte ZlibHeader[2] = { 0x78, 0x9C };
+
+    // An empty final block with fixed codes, the 4 byte Adler-32 follows it
+    constexpr byte FinalBlock[2] = { 0x03, 0x00 };
+
+    // The empty stored block a full flush ends with
+    constexpr byte FlushMarker[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+    byte GetColorType(PixelMode mode) {
+        switch (mode) {
+            case PixelMode::GRAY_8:
+                return 0;
+            case PixelMode::RGB_8:
+                return 2;
+            case PixelMode::GRAYA_8:
+                return 4;
+            case PixelMode::RGBA_8:
+                return 6;
+            default:
+                return 0xFF;
+        }
+    }
+
+    uint32_t ReadUint32(const byte* data) {
+        return (uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) | (uint32_t(data[2]) << 8) | uint32_t(data[3]);
+    }
+
+    void AppendUint32(std::vector<byte>& out, uint32_t value) {
+        out.push_back(byte(value >> 24));
+        out.push_back(byte(value >> 16));
+        out.push_back(byte(value >> 8));
+        out.push_back(byte(value));
+    }
+
+    byte Paeth(int a, int b, int c) {
+        int p = a + b - c;
+        int pa = std::abs(p - a);
+        int pb = std::abs(p - b);
+        int pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) {
+            return byte(a);
+        } else if (pb <= pc) {
+            return byte(b);
+        }
+        return byte(c);
+    }
+
+    void ApplyFilter(byte filter, const byte* row, const byte* above, size_t size, size_t pixelWidth, byte* out) {
+        switch (filter) {
+            case FILTER_SUB:
+                std::copy(row, row + std::min(pixelWidth, size), out);
+                for (size_t i = pixelWidth; i < size; i++) {
+                    out[i] = byte(row[i] - row[i - pixelWidth]);
+                }
+                break;
+            case FILTER_UP:
+                for (size_t i = 0; i < size; i++) {
+                    out[i] = byte(row[i] - above[i]);
+                }
+                break;
+            case FILTER_AVERAGE:
+                for (size_t i = 0; i < size; i++) {
+                    int left = i >= pixelWidth ? row[i - pixelWidth] : 0;
+                    out[i] = byte(row[i] - (left + above[i]) / 2);
+                }
+                break;
+            case FILTER_PAETH:
+                for (size_t i = 0; i < size; i++) {
+                    if (i >= pixelWidth) {
+                        out[i] = byte(row[i] - Paeth(row[i - pixelWidth], above[i], above[i - pixelWidth]));
+                    } else {
+                        out[i] = byte(row[i] - above[i]);
+                    }
+                }
+                break;
+            default:
+                std::copy(row, row + size, out);
+                break;
+        }
+    }
+
+    // Writes the filter type and the filtered row to out, above is nullptr for a row that may not refer to the row above
+    // The filter with the smallest sum of absolute signed differences wins, the usual heuristic for truecolor and gray
+    void FilterRow(const byte* row, const byte* above, size_t size, size_t pixelWidth, byte* out, std::vector<byte>& scratch) {
+        scratch.resize(size);
+        uint64_t bestSum = UINT64_MAX;
+
+        byte filterCount = above != nullptr ? FILTER_COUNT : FILTER_UP;
+        for (byte filter = FILTER_NONE; filter < filterCount; filter++) {
+            ApplyFilter(filter, row, above, size, pixelWidth, scratch.data());
+
+            uint64_t sum = 0;
+            for (byte value : scratch) {
+                sum += value < 128 ? value : 256 - value;
+            }
+            if (sum < bestSum) {
+                bestSum = sum;
+                out[0] = filter;
+                std::copy(scratch.begin(), scratch.end(), out + 1);
+            }
+        }
+    }
+
+}
+
+/* PNGBlocks */
+
+PNGBlocks::PNGBlocks(uint32_t width, uint32_t height, PixelMode mode)
+        : Width(width), Height(height), ColorType(GetColorType(mode)) {
+    PixelWidth = DispatchPixelMode(mode, []<PixelMode M>() { return size_t(PixelTraits<M>::PixelWidth); });
+    RowSize = size_t(width) * PixelWidth;
+    RowsPerBlock = uint32_t(std::clamp<size_t>(TargetBlockSize / (RowSize + 1), 1, std::max<uint32_t>(height, 1)));
+    BlockBytes = std::max<size_t>(size_t(RowsPerBlock) * RowSize, 1);
+
+    size_t blockCount = (size_t(height) + RowsPerBlock - 1) / RowsPerBlock;
+    Blocks.resize(blockCount);
+    Dirty.assign(blockCount, 1);
+}
+
+PNGBlocks::PNGBlocks(const PNGBlocks& other)
+        : Width(other.Width), Height(other.Height), ColorType(other.ColorType), PixelWidth(other.PixelWidth),
+          RowSize(other.RowSize), RowsPerBlock(other.RowsPerBlock), BlockBytes(other.BlockBytes) {
+    std::lock_guard<std::mutex> lock(other.Mutex);
+    Blocks = other.Blocks;
+    Dirty = other.Dirty;
+}
+
+void PNGBlocks::MarkAll() {
+    std::fill(Dirty.begin(), Dirty.end(), 1);
+}
+
+uint32_t PNGBlocks::GetBlockRows(size_t index) const {
+    return std::min<uint32_t>(RowsPerBlock, Height - uint32_t(index) * RowsPerBlock);
+}
+
+#ifdef STEG_ZLIB
+
+namespace {
+
+    // Raw deflate and inflate streams, each pool task uses its own
+    struct Deflater {
+
+        z_stream Stream = {};
+
+        Deflater() {
+            if (deflateInit2(&Stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                throw std::runtime_error("Could not initialize zlib");
+            }
+        }
+
+        ~Deflater() {
+            deflateEnd(&Stream);
+        }
+
+    };
+
+    struct Inflater {
+
+        z_stream Stream = {};
+
+        Inflater() {
+            if (inflateInit2(&Stream, -MAX_WBITS) != Z_OK) {
+                throw std::runtime_error("Could not initialize zlib");
+            }
+        }
+
+        ~Inflater() {
+            inflateEnd(&Stream);
+        }
+
+    };
+
+}
+
+Scope<PNGBlocks> PNGBlocks::Create(uint32_t width, uint32_t height, PixelMode mode) {
+    if (GetColorType(mode) == 0xFF || width == 0 || height == 0) {
+        return nullptr;
+    }
+    return Scope<PNGBlocks>(new PNGBlocks(width, height, mode));
+}
+
+Scope<PNGBlocks> PNGBlocks::Read(std::span<const byte> png, uint32_t width, uint32_t height, PixelMode mode) {
+    Scope<PNGBlocks> blocks = Create(width, height, mode);
+    if (!blocks || png.size() < sizeof(Signature) || !std::equal(Signature, Signature + sizeof(Signature), png.begin())) {
+        return nullptr;
+    }
+
+    // The decoder already checked the chunk CRCs, only the layout is left to check
+    std::vector<std::span<const byte>> chunks;
+    size_t offset = sizeof(Signature);
+    while (offset + 12 <= png.size()) {
+        uint32_t length = ReadUint32(&png[offset]);
+        if (length > png.size() - offset - 12) {
+            return nullptr;
+        }
+
+        std::string_view type(reinterpret_cast<const char*>(&png[offset + 4]), 4);
+        std::span<const byte> data = png.subspan(offset + 8, length);
+        if (type == "IHDR") {
+            // 8-bit samples, the color type the blocks were made for and no interlacing
+            if (length != 13 || ReadUint32(&data[0]) != width || ReadUint32(&data[4]) != height ||
+                data[8] != 8 || data[9] != blocks->ColorType || data[12] != 0) {
+                return nullptr;
+            }
+        } else if (type == "IDAT") {
+            chunks.push_back(data);
+        }
+        offset += 12 + size_t(length);
+    }
+
+    // One chunk per block, the first starting with the zlib header and the last ending with the final block and Adler-32
+    size_t blockCount = blocks->Blocks.size();
+    if (chunks.size() != blockCount || chunks.front().size() < sizeof(ZlibHeader) ||
+        (chunks.front()[0] & 0x0F) != Z_DEFLATED || (chunks.front()[1] & 0x20) != 0) {
+        return nullptr;
+    }
+    chunks.front() = chunks.front().subspan(sizeof(ZlibHeader));
+
+    constexpr size_t trailerSize = sizeof(FinalBlock) + 4;
+    if (chunks.back().size() < trailerSize) {
+        return nullptr;
+    }
+    std::span<const byte> trailer = chunks.back().last(trailerSize);
+    if (!std::equal(FinalBlock, FinalBlock + sizeof(FinalBlock), trailer.begin())) {
+        return nullptr;
+    }
+    uint32_t adler = ReadUint32(&trailer[sizeof(FinalBlock)]);
+    chunks.back() = chunks.back().first(chunks.back().size() - trailerSize);
+
+    for (const auto& chunk : chunks) {
+        if (chunk.size() < sizeof(FlushMarker) || !std::equal(FlushMarker, FlushMarker + sizeof(FlushMarker), chunk.end() - sizeof(FlushMarker))) {
+            return nullptr;
+        }
+    }
+
+    // Every block has to inflate on its own to exactly its rows, which also proves it never refers back into the one before
+    std::vector<uint8_t> valid(blockCount, 0);
+    ParallelFor(blockCount, 4, [&](size_t begin, size_t end) {
+        Inflater inflater;
+        std::vector<byte> filtered;
+        for (size_t i = begin; i < end; i++) {
+            size_t expected = size_t(blocks->GetBlockRows(i)) * (blocks->RowSize + 1);
+
+            // One spare byte so a block holding too much does not pass
+            filtered.resize(expected + 1);
+            z_stream& stream = inflater.Stream;
+            inflateReset(&stream);
+            stream.next_in = const_cast<Bytef*>(chunks[i].data());
+            stream.avail_in = uInt(chunks[i].size());
+            stream.next_out = filtered.data();
+            stream.avail_out = uInt(filtered.size());
+            int result = inflate(&stream, Z_SYNC_FLUSH);
+            if (result != Z_OK || stream.avail_in != 0 || stream.total_out != expected) {
+                continue;
+            }
+
+            Block& block = blocks->Blocks[i];
+            block.Data.assign(chunks[i].begin(), chunks[i].end());
+            block.Adler = adler32(1, filtered.data(), uInt(expected));
+            block.Crc = crc32(0, block.Data.data(), uInt(block.Data.size()));
+            valid[i] = 1;
+        }
+    });
+
+    if (std::find(valid.begin(), valid.end(), 0) != valid.end()) {
+        return nullptr;
+    }
+
+    uint32_t combined = blocks->Blocks[0].Adler;
+    for (size_t i = 1; i < blockCount; i++) {
+        combined = adler32_combine(combined, blocks->Blocks[i].Adler, z_off_t(blocks->GetBlockRows(i)) * (blocks->RowSize + 1));
+    }
+    if (combined != adler) {
+        return nullptr;
+    }
+
+    std::fill(blocks->Dirty.begin(), blocks->Dirty.end(), 0);
+    return blocks;
+}
+
+std::vector<byte> PNGBlocks::Write(const byte* pixels) {
+    std::lock_guard<std::mutex> lock(Mutex);
+
+    std::vector<size_t> dirty;
+    for (size_t i = 0; i < Dirty.size(); i++) {
+        if (Dirty[i]) {
+            dirty.push_back(i);
+        }
+    }
+
+    // Blocks are independent, so the dirty ones compress in parallel
+    if (!dirty.empty()) {
+        ScopedTimer timer(StegTimer::TimerLabel::PNG_COMPRESS);
+
+        ParallelFor(dirty.size(), 4, [&](size_t begin, size_t end) {
+            Deflater deflater;
+            std::vector<byte> filtered;
+            for (size_t i = begin; i < end; i++) {
+                Compress(dirty[i], pixels, filtered, deflater.Stream);
+            }
+        });
+        std::fill(Dirty.begin(), Dirty.end(), 0);
+    }
+
+    uint32_t adler = Blocks[0].Adler;
+    size_t dataSize = 0;
+    for (size_t i = 0; i < Blocks.size(); i++) {
+        if (i > 0) {
+            adler = adler32_combine(adler, Blocks[i].Adler, z_off_t(GetBlockRows(i)) * (RowSize + 1));
+        }
+        dataSize += Blocks[i].Data.size();
+    }
+
+    // Signature, IHDR, one IDAT per block and IEND
+    std::vector<byte> png;
+    png.reserve(sizeof(Signature) + 25 + dataSize + Blocks.size() * 12 + sizeof(ZlibHeader) + sizeof(FinalBlock) + 4 + 12);
+    png.insert(png.end(), Signature, Signature + sizeof(Signature));
+
+    auto appendChunk = [&](const char* type, std::span<const byte> prefix, const Block* block, std::span<const byte> suffix) {
+        size_t blockSize = block != nullptr ? block->Data.size() : 0;
+        AppendUint32(png, uint32_t(prefix.size() + blockSize + suffix.size()));
+
+        size_t start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), prefix.begin(), prefix.end());
+        uint32_t crc = crc32(0, &png[start], uInt(png.size() - start));
+
+        // A clean block's CRC is reused rather than computed over its data again
+        if (block != nullptr) {
+            png.insert(png.end(), block->Data.begin(), block->Data.end());
+            crc = crc32_combine(crc, block->Crc, z_off_t(blockSize));
+        }
+        if (!suffix.empty()) {
+            png.insert(png.end(), suffix.begin(), suffix.end());
+            crc = crc32(crc, suffix.data(), uInt(suffix.size()));
+        }
+        AppendUint32(png, crc);
+    };
+
+    std::vector<byte> header;
+    AppendUint32(header, Width);
+    AppendUint32(header, Height);
+    header.insert(header.end(), { 8, ColorType, 0, 0, 0 });
+    appendChunk("IHDR", header, nullptr, {});
+
+    std::vector<byte> trailer(FinalBlock, FinalBlock + sizeof(FinalBlock));
+    AppendUint32(trailer, adler);
+    for (size_t i = 0; i < Blocks.size(); i++) {
+        std::span<const byte> prefix = i == 0 ? std::span<const byte>(ZlibHeader) : std::span<const byte>();
+        std::span<const byte> suffix = i + 1 == Blocks.size() ? std::span<const byte>(trailer) : std::span<const byte>();
+        appendChunk("IDAT", prefix, &Blocks[i], suffix);
+    }
+
+    appendChunk("IEND", {}, nullptr, {});
+    return png;
+}
+
+void PNGBlocks::Compress(size_t index, const byte* pixels, std::vector<byte>& filtered, z_stream_s& stream) {
+    uint32_t firstRow = uint32_t(index) * RowsPerBlock;
+    uint32_t rowCount = GetBlockRows(index);
+
+    filtered.resize(size_t(rowCount) * (RowSize + 1));
+    std::vector<byte> scratch;
+    for (uint32_t y = 0; y < rowCount; y++) {
+        const byte* row = pixels + size_t(firstRow + y) * RowSize;
+        const byte* above = y > 0 ? row - RowSize : nullptr;
+        FilterRow(row, above, RowSize, PixelWidth, &filtered[size_t(y) * (RowSize + 1)], scratch);
+    }
+
+    // Starting from a reset stream keeps the block from referring back into another one
+    Block& block = Blocks[index];
+    deflateReset(&stream);
+    block.Data.resize(deflateBound(&stream, uLong(filtered.size())) + 16);
+    stream.next_in = filtered.data();
+    stream.avail_in = uInt(filtered.size());
+    stream.next_out = block.Data.data();
+    stream.avail_out = uInt(block.Data.size());
+
+    // The full flush ends the block on a byte boundary with an empty stored block and no final bit
+    if (deflate(&stream, Z_FULL_FLUSH) != Z_OK || stream.avail_in != 0 || stream.avail_out == 0) {
+        throw std::runtime_error("Could not compress PNG scanlines");
+    }
+    block.Data.resize(block.Data.size() - stream.avail_out);
+    block.Data.shrink_to_fit();
+
+    block.Adler = adler32(1, filtered.data(), uInt(filtered.size()));
+    block.Crc = crc32(0, block.Data.data(), uInt(block.Data.size()));
+}
+
+#else
+
+Scope<PNGBlocks> PNGBlocks::Create(uint32_t, uint32_t, PixelMode) {
+    return nullptr;
+}
+
+Scope<PNGBlocks> PNGBlocks::Read(std::span<const byte>, uint32_t, uint32_t, PixelMode) {
+    return nullptr;
+}
+
+std::vector<byte> PNGBlocks::Write(const byte*) {
+    throw std::runtime_error("Incremental PNG saving needs zlib");
+}
+
+void PNGBlocks::Compress(size_t, const byte*, std::vector<byte>&, z_stream_s&) {
+    throw std::runtime_error("Incremental PNG saving needs zlib");
+}
+
+#endif
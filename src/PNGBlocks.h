@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Core.h"
+#include "PixelMode.h"
+
+#include <mutex>
+#include <span>
+
+// zlib's stream type, so this header does not need zlib.h
+struct z_stream_s;
+
+namespace Steg {
+
+    // The compressed scanlines of an 8-bit image's PNG, kept between saves so a save only recompresses the rows that changed
+    // Rows are grouped into blocks of about TargetBlockSize filtered bytes, each deflated on its own and ended with a
+    // full flush, so the blocks are byte aligned, never refer back into each other and each fills one IDAT chunk
+    // The first row of a block is filtered without the row above it for the same reason
+    // The file is an ordinary PNG, the zlib header and trailer ride along in the first and last IDAT chunk
+    // Note: Only available when the library is built with zlib, Create and Read return nullptr otherwise
+    class PNGBlocks {
+
+    public:
+
+        // Filtered bytes per block, a block never holds less than one row
+        // The size of the deflate window, smaller blocks lose noticeably more compression to not referring back
+        static constexpr size_t TargetBlockSize = 32 * 1024;
+
+        // Every block starts out dirty, nullptr for 16-bit modes or without zlib
+        static Scope<PNGBlocks> Create(uint32_t width, uint32_t height, PixelMode mode);
+
+        // Takes over the blocks of a PNG that Write produced, every block starts out clean
+        // nullptr if the file has any other layout, then the first save compresses every row
+        static Scope<PNGBlocks> Read(std::span<const byte> png, uint32_t width, uint32_t height, PixelMode mode);
+
+        PNGBlocks(const PNGBlocks& other);
+
+        PNGBlocks& operator=(const PNGBlocks& other) = delete;
+
+        // Called for every write to the raster, index is a byte offset like Image::SetByte's
+        void MarkByte(size_t index) {
+            Dirty[index / BlockBytes] = 1;
+        }
+
+        void MarkRow(uint32_t y) {
+            Dirty[y / RowsPerBlock] = 1;
+        }
+
+        void MarkAll();
+
+        // Recompresses the dirty blocks from pixels, which holds Height rows of RowSize bytes, and returns the PNG file
+        // Safe to call from several threads at once, as long as nobody writes to the pixels meanwhile
+        std::vector<byte> Write(const byte* pixels);
+
+    private:
+
+        struct Block {
+
+            // Raw deflate data ending with the full flush marker
+            std::vector<byte> Data;
+
+            // Of the filtered rows the block inflates to
+            uint32_t Adler = 1;
+
+            // Of Data alone, the chunk CRC is combined from it
+            uint32_t Crc = 0;
+
+        };
+
+        PNGBlocks(uint32_t width, uint32_t height, PixelMode mode);
+
+        // Filters and deflates one block from the pixels
+        void Compress(size_t index, const byte* pixels, std::vector<byte>& filtered, z_stream_s& stream);
+
+        uint32_t GetBlockRows(size_t index) const;
+
+
+        uint32_t Width;
+        uint32_t Height;
+        byte ColorType;
+
+        // Unfiltered bytes per pixel and per row, and rows and raster bytes per block
+        size_t PixelWidth;
+        size_t RowSize;
+        uint32_t RowsPerBlock;
+        size_t BlockBytes;
+
+        std::vector<Block> Blocks;
+
+        // One flag per block, plain bytes so marking never touches a neighbouring flag
+        std::vector<uint8_t> Dirty;
+
+        // Serializes Write, which updates Blocks
+        mutable std::mutex Mutex;
+
+    };
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Core.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace Steg {
+
+    // Splits [0, count) into contiguous ranges of at least minPerTask items and runs function(begin, end) on each
+    // The ranges are jobs on the library's thread pool, the calling thread runs the first range itself
+    // and then any range no worker has picked up yet, so small inputs and a busy pool never wait on other threads
+    // An exception from a range is rethrown once every range has finished
+    template<typename Function>
+    void ParallelFor(size_t count, size_t minPerTask, Function&& function) {
+        size_t maxTasks = ThreadPool::Get().GetWorkerCount();
+        size_t taskCount = std::clamp<size_t>(count / std::max<size_t>(minPerTask, 1), 1, maxTasks);
+        size_t perTask = (count + taskCount - 1) / taskCount;
+
+        TaskGroup group;
+        for (size_t task = 1; task < taskCount; task++) {
+            size_t begin = task * perTask;
+            size_t end = std::min(count, begin + perTask);
+            if (begin < end) {
+                group.Run([&function, begin, end]() { function(begin, end); });
+            }
+        }
+
+        function(size_t(0), std::min(count, perTask));
+
+        group.Wait();
+    }
+
+}
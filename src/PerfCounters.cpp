@@ -0,0 +1,115 @@
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+using namespace Steg;
+
+#ifdef __linux__
+
+namespace {
+
+    // Cache events are encoded as cache | operation << 8 | result << 16
+    constexpr uint64_t CacheEvent(uint64_t cache) {
+        return cache | (uint64_t(PERF_COUNT_HW_CACHE_OP_READ) << 8) | (uint64_t(PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+    }
+
+    int OpenEvent(uint32_t type, uint64_t config, int groupDescriptor) {
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = type;
+        attributes.config = config;
+        attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // User space only, which is all perf_event_paranoid 2 allows and all the library runs anyway
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+
+        // Only the calling thread on whichever CPU it runs on
+        return int(syscall(SYS_perf_event_open, &attributes, 0, -1, groupDescriptor, 0));
+    }
+
+}
+
+PerfCounters::PerfCounters() {
+    Descriptors.fill(-1);
+
+    // Without the leader there is no group to add the other events to
+    Descriptors[CYCLES] = OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (Descriptors[CYCLES] < 0) {
+        return;
+    }
+
+    // A missing event, for example dTLB misses on some virtual machines, leaves the rest usable
+    Descriptors[INSTRUCTIONS] = OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, Descriptors[CYCLES]);
+    Descriptors[LLC_MISSES] = OpenEvent(PERF_TYPE_HW_CACHE, CacheEvent(PERF_COUNT_HW_CACHE_LL), Descriptors[CYCLES]);
+    Descriptors[DTLB_MISSES] = OpenEvent(PERF_TYPE_HW_CACHE, CacheEvent(PERF_COUNT_HW_CACHE_DTLB), Descriptors[CYCLES]);
+    Descriptors[BRANCH_MISSES] = OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, Descriptors[CYCLES]);
+}
+
+PerfCounters::~PerfCounters() {
+    for (int descriptor : Descriptors) {
+        if (descriptor >= 0) {
+            close(descriptor);
+        }
+    }
+}
+
+PerfCounters::Values PerfCounters::Read() const {
+    Values values = {};
+    if (!IsAvailable()) {
+        return values;
+    }
+
+    // Event count, time enabled, time running, then one value per opened event in the order they were opened
+    uint64_t buffer[3 + COUNT];
+    if (read(Descriptors[CYCLES], buffer, sizeof(buffer)) < ssize_t(3 * sizeof(uint64_t))) {
+        return values;
+    }
+    uint64_t enabled = buffer[1];
+    uint64_t running = buffer[2];
+
+    size_t next = 0;
+    for (size_t i = 0; i < COUNT && next < buffer[0]; i++) {
+        if (Descriptors[i] < 0) {
+            continue;
+        }
+        uint64_t value = buffer[3 + next++];
+
+        // The group only counted for running out of enabled nanoseconds
+        if (running > 0 && running < enabled) {
+            value = uint64_t(double(value) * double(enabled) / double(running));
+        }
+        values[i] = value;
+    }
+    return values;
+}
+
+#else
+
+PerfCounters::PerfCounters() {
+    Descriptors.fill(-1);
+}
+
+PerfCounters::~PerfCounters() = default;
+
+PerfCounters::Values PerfCounters::Read() const {
+    return {};
+}
+
+#endif
+
+PerfCounters& PerfCounters::ForThread() {
+    thread_local PerfCounters counters;
+    return counters;
+}
+
+bool PerfCounters::IsAvailable() const {
+    return Descriptors[CYCLES] >= 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Core.h"
+
+namespace Steg {
+
+    // Hardware event counts of the calling thread, read through perf_event_open on Linux
+    // The events are opened as one group so they are always scheduled together and read with a single syscall
+    // Events the CPU, the kernel or its perf_event_paranoid setting do not allow read as zero
+    class PerfCounters {
+
+    public:
+
+        enum Counter {
+            CYCLES,
+            INSTRUCTIONS,
+            LLC_MISSES,
+            DTLB_MISSES,
+            BRANCH_MISSES,
+            COUNT // This one has to be last in the list
+        };
+
+        using Values = std::array<uint64_t, COUNT>;
+
+        // Counters of the calling thread, opened the first time the thread asks for them
+        static PerfCounters& ForThread();
+
+        ~PerfCounters();
+
+        PerfCounters(const PerfCounters& other) = delete;
+
+        PerfCounters& operator=(const PerfCounters& other) = delete;
+
+        // True if at least the cycle counter could be opened
+        bool IsAvailable() const;
+
+        // Counts since the group was opened, scaled up if the kernel had to multiplex it with other groups
+        Values Read() const;
+
+    private:
+
+        PerfCounters();
+
+        // -1 for events that could not be opened, CYCLES leads the group
+        std::array<int, COUNT> Descriptors;
+
+    };
+
+}
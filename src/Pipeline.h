@@ -0,0 +1,159 @@
+#pragma once
+
+#include "Core.h"
+
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <thread>
+
+namespace Steg {
+
+    // Lock-free queue between exactly one producer thread and one consumer thread
+    // Push and Pop block (without spinning) while the ring is full or empty
+    template<typename T, size_t Capacity>
+    class SpscRing {
+
+        static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+
+        void Push(const T& item) {
+            size_t tail = Tail.load(std::memory_order_relaxed);
+            size_t head = Head.load(std::memory_order_acquire);
+            while (tail - head == Capacity) {
+                Head.wait(head, std::memory_order_acquire);
+                head = Head.load(std::memory_order_acquire);
+            }
+
+            Items[tail % Capacity] = item;
+            Tail.store(tail + 1, std::memory_order_release);
+            Tail.notify_one();
+        }
+
+        T Pop() {
+            size_t head = Head.load(std::memory_order_relaxed);
+            size_t tail = Tail.load(std::memory_order_acquire);
+            while (tail == head) {
+                Tail.wait(tail, std::memory_order_acquire);
+                tail = Tail.load(std::memory_order_acquire);
+            }
+
+            T item = Items[head % Capacity];
+            Head.store(head + 1, std::memory_order_release);
+            Head.notify_one();
+            return item;
+        }
+
+    private:
+
+        // Separate cache lines so the two threads do not invalidate each other's index
+        alignas(64) std::atomic<size_t> Head = 0;
+        alignas(64) std::atomic<size_t> Tail = 0;
+        std::array<T, Capacity> Items;
+
+    };
+
+    // A range of bytes inside the buffer a pipeline works on
+    struct Chunk {
+        size_t Offset = 0;
+        size_t Size = 0;
+    };
+
+    namespace Detail {
+
+        // Thrown inside the producer to unwind it once the consumer has failed
+        struct PipelineCancelled {};
+
+    }
+
+    // Runs produce(emit) as a job on the thread pool and consume(chunk) on the calling thread for every chunk emitted, in order
+    // Only chunk descriptors travel through the ring, the bytes stay in a buffer both sides can see
+    // If no worker picks up the producer in time, this thread runs it and consumes every chunk as it is emitted,
+    // so a pipeline never waits on a pool that is busy with other work
+    // An exception on either side stops both stages and is rethrown on the calling thread
+    template<typename Producer, typename Consumer>
+    void RunPipeline(Producer&& produce, Consumer&& consume) {
+
+        // How long the consumer gives an idle worker to pick up the producer before running it itself
+        constexpr auto StartTimeout = std::chrono::milliseconds(1);
+
+        // An empty chunk marks the end of the stream
+        SpscRing<Chunk, 16> ring;
+        std::atomic<bool> cancelled = false;
+        std::atomic<bool> claimed = false;
+        std::exception_ptr producerError;
+
+        TaskGroup group;
+        group.Run([&]() {
+            if (claimed.exchange(true)) {
+                return;
+            }
+
+            auto emit = [&](const Chunk& chunk) {
+                if (cancelled.load(std::memory_order_relaxed)) {
+                    throw Detail::PipelineCancelled();
+                }
+                if (chunk.Size > 0) {
+                    ring.Push(chunk);
+                }
+            };
+
+            try {
+                produce(emit);
+            } catch (const Detail::PipelineCancelled&) {
+            } catch (...) {
+                producerError = std::current_exception();
+            }
+            ring.Push(Chunk());
+        });
+
+        // Give a worker the chance to start the producer, unless none of them is idle
+        auto deadline = std::chrono::steady_clock::now() + StartTimeout;
+        if (ThreadPool::Get().HasIdleWorker()) {
+            while (!claimed.load() && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::yield();
+            }
+        }
+
+        if (!claimed.exchange(true)) {
+
+            // Both stages on this thread, one chunk at a time
+            produce([&](const Chunk& chunk) {
+                if (chunk.Size > 0) {
+                    consume(chunk);
+                }
+            });
+            group.Wait();
+            return;
+
+        }
+
+        // After a failure the remaining chunks are drained so the producer is never left blocked on a full ring
+        std::exception_ptr consumerError;
+        for (Chunk chunk = ring.Pop(); chunk.Size > 0; chunk = ring.Pop()) {
+            if (consumerError) {
+                continue;
+            }
+            try {
+                consume(chunk);
+            } catch (...) {
+                consumerError = std::current_exception();
+                cancelled = true;
+            }
+        }
+
+        group.Wait();
+
+        if (producerError) {
+            std::rethrow_exception(producerError);
+        }
+        if (consumerError) {
+            std::rethrow_exception(consumerError);
+        }
+
+    }
+
+}
@@ -0,0 +1,408 @@
+#include "PixelConvert.h"
+
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STEG_SSE2 1
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+using namespace Steg;
+
+namespace {
+
+    // Pixels converted per step when a conversion needs an intermediate buffer
+    // Small enough that the intermediate stays in L1/L2
+    constexpr size_t ChunkPixels = 2048;
+
+    /* Scalar Kernels */
+
+    template<uint32_t Depth>
+    uint32_t LoadSample(const byte* data, size_t index) {
+        if constexpr (Depth == 8) {
+            return data[index];
+        } else {
+            return (uint32_t(data[2 * index]) << 8) | data[2 * index + 1];
+        }
+    }
+
+    template<uint32_t Depth>
+    void StoreSample(byte* data, size_t index, uint32_t value) {
+        if constexpr (Depth == 8) {
+            data[index] = byte(value);
+        } else {
+            data[2 * index] = byte(value >> 8);
+            data[2 * index + 1] = byte(value & 0xFF);
+        }
+    }
+
+    // BT.601 luma with weights scaled to sum to 2^Depth
+    template<uint32_t Depth>
+    uint32_t Luma(uint32_t red, uint32_t green, uint32_t blue) {
+        if constexpr (Depth == 8) {
+            return (red * 77 + green * 150 + blue * 29 + 128) >> 8;
+        } else {
+            return uint32_t((uint64_t(red) * 19595 + uint64_t(green) * 38470 + uint64_t(blue) * 7471 + 32768) >> 16);
+        }
+    }
+
+    // Converts pixels [begin, count) between channel layouts of the same bit depth
+    template<uint32_t Depth, uint32_t From, uint32_t To>
+    void ConvertLayoutScalar(const byte* input, byte* output, size_t begin, size_t count) {
+        constexpr uint32_t opaque = (uint32_t(1) << Depth) - 1;
+        constexpr bool fromGray = From <= 2;
+        constexpr bool fromAlpha = From == 2 || From == 4;
+
+        for (size_t i = begin; i < count; i++) {
+            size_t in = i * From;
+            size_t out = i * To;
+
+            uint32_t red = LoadSample<Depth>(input, in);
+            uint32_t green = fromGray ? red : LoadSample<Depth>(input, in + 1);
+            uint32_t blue = fromGray ? red : LoadSample<Depth>(input, in + 2);
+            uint32_t alpha = fromAlpha ? LoadSample<Depth>(input, in + From - 1) : opaque;
+
+            if constexpr (To <= 2) {
+                uint32_t gray = fromGray ? red : Luma<Depth>(red, green, blue);
+                StoreSample<Depth>(output, out, gray);
+            } else {
+                StoreSample<Depth>(output, out, red);
+                StoreSample<Depth>(output, out + 1, green);
+                StoreSample<Depth>(output, out + 2, blue);
+            }
+            if constexpr (To == 2 || To == 4) {
+                StoreSample<Depth>(output, out + To - 1, alpha);
+            }
+        }
+    }
+
+    using LayoutKernel = void (*)(const byte*, byte*, size_t, size_t);
+
+    template<uint32_t Depth>
+    LayoutKernel GetLayoutKernel(uint32_t from, uint32_t to) {
+        static constexpr LayoutKernel kernels[4][4] = {
+                {ConvertLayoutScalar<Depth, 1, 1>, ConvertLayoutScalar<Depth, 1, 2>,
+                        ConvertLayoutScalar<Depth, 1, 3>, ConvertLayoutScalar<Depth, 1, 4>},
+                {ConvertLayoutScalar<Depth, 2, 1>, ConvertLayoutScalar<Depth, 2, 2>,
+                        ConvertLayoutScalar<Depth, 2, 3>, ConvertLayoutScalar<Depth, 2, 4>},
+                {ConvertLayoutScalar<Depth, 3, 1>, ConvertLayoutScalar<Depth, 3, 2>,
+                        ConvertLayoutScalar<Depth, 3, 3>, ConvertLayoutScalar<Depth, 3, 4>},
+                {ConvertLayoutScalar<Depth, 4, 1>, ConvertLayoutScalar<Depth, 4, 2>,
+                        ConvertLayoutScalar<Depth, 4, 3>, ConvertLayoutScalar<Depth, 4, 4>}
+        };
+        return kernels[from - 1][to - 1];
+    }
+
+    /* SIMD Kernels */
+    // Each kernel converts as many leading pixels as it safely can and returns that count
+    // The scalar kernels finish the remainder
+
+#ifdef STEG_SSE2
+
+    // Keeps the even bytes: the high byte of big-endian 16-bit samples or the value of GRAYA_8 pixels
+    size_t EvenBytesSse2(const byte* input, byte* output, size_t count) {
+        const __m128i mask = _mm_set1_epi16(0x00FF);
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2 * i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2 * i + 16));
+            __m128i packed = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), packed);
+        }
+        return i;
+    }
+
+    // Writes every byte twice, which is v * 257 as a big-endian 16-bit sample
+    size_t DuplicateBytesSse2(const byte* input, byte* output, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * i), _mm_unpacklo_epi8(v, v));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * i + 16), _mm_unpackhi_epi8(v, v));
+        }
+        return i;
+    }
+
+    // GRAY_8 -> GRAYA_8
+    size_t GrayToGrayAlphaSse2(const byte* input, byte* output, size_t count) {
+        const __m128i opaque = _mm_set1_epi8(char(0xFF));
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * i), _mm_unpacklo_epi8(v, opaque));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * i + 16), _mm_unpackhi_epi8(v, opaque));
+        }
+        return i;
+    }
+
+    // GRAY_8 -> RGBA_8
+    size_t GrayToRgbaSse2(const byte* input, byte* output, size_t count) {
+        const __m128i opaque = _mm_set1_epi8(char(0xFF));
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+            __m128i valueValue[2] = {_mm_unpacklo_epi8(v, v), _mm_unpackhi_epi8(v, v)};
+            __m128i valueAlpha[2] = {_mm_unpacklo_epi8(v, opaque), _mm_unpackhi_epi8(v, opaque)};
+            byte* out = output + 4 * i;
+            for (int half = 0; half < 2; half++) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32 * half),
+                                 _mm_unpacklo_epi16(valueValue[half], valueAlpha[half]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 32 * half + 16),
+                                 _mm_unpackhi_epi16(valueValue[half], valueAlpha[half]));
+            }
+        }
+        return i;
+    }
+
+    // GRAYA_8 -> RGBA_8
+    size_t GrayAlphaToRgbaSse2(const byte* input, byte* output, size_t count) {
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m128i valueAlpha = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 2 * i));
+            __m128i value = _mm_and_si128(valueAlpha, low);
+            __m128i valueValue = _mm_or_si128(value, _mm_slli_epi16(value, 8));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 4 * i), _mm_unpacklo_epi16(valueValue, valueAlpha));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 4 * i + 16), _mm_unpackhi_epi16(valueValue, valueAlpha));
+        }
+        return i;
+    }
+
+    // Luma of 4 RGBA_8 pixels as 32-bit lanes, matching Luma<8>
+    inline __m128i LumaRgbaSse2(__m128i pixels) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i weights = _mm_set_epi16(0, 29, 150, 77, 0, 29, 150, 77);
+
+        // [R*77 + G*150, B*29] for 2 pixels per register
+        __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+        __m128i high = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+        low = _mm_add_epi32(low, _mm_srli_epi64(low, 32));
+        high = _mm_add_epi32(high, _mm_srli_epi64(high, 32));
+
+        // Sums are in lanes 0 and 2, gather them into 4 consecutive lanes
+        low = _mm_shuffle_epi32(low, _MM_SHUFFLE(3, 3, 2, 0));
+        high = _mm_shuffle_epi32(high, _MM_SHUFFLE(3, 3, 2, 0));
+        __m128i luma = _mm_unpacklo_epi64(low, high);
+        return _mm_srli_epi32(_mm_add_epi32(luma, _mm_set1_epi32(128)), 8);
+    }
+
+    // 16 lumas from 16 RGBA_8 pixels
+    inline __m128i LumaRgba16PixelsSse2(const __m128i pixels[4]) {
+        __m128i low = _mm_packs_epi32(LumaRgbaSse2(pixels[0]), LumaRgbaSse2(pixels[1]));
+        __m128i high = _mm_packs_epi32(LumaRgbaSse2(pixels[2]), LumaRgbaSse2(pixels[3]));
+        return _mm_packus_epi16(low, high);
+    }
+
+    // RGBA_8 -> GRAY_8
+    size_t RgbaToGraySse2(const byte* input, byte* output, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i pixels[4];
+            for (int k = 0; k < 4; k++) {
+                pixels[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 4 * i + 16 * k));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), LumaRgba16PixelsSse2(pixels));
+        }
+        return i;
+    }
+
+    // RGBA_8 -> GRAYA_8
+    size_t RgbaToGrayAlphaSse2(const byte* input, byte* output, size_t count) {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i pixels[4];
+            __m128i alpha[4];
+            for (int k = 0; k < 4; k++) {
+                pixels[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 4 * i + 16 * k));
+                alpha[k] = _mm_srli_epi32(pixels[k], 24);
+            }
+            __m128i value = LumaRgba16PixelsSse2(pixels);
+            __m128i alphas = _mm_packus_epi16(_mm_packs_epi32(alpha[0], alpha[1]), _mm_packs_epi32(alpha[2], alpha[3]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * i), _mm_unpacklo_epi8(value, alphas));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 2 * i + 16), _mm_unpackhi_epi8(value, alphas));
+        }
+        return i;
+    }
+
+    // RGBA_8 -> RGB_8
+    // The loop stops early because every store writes 4 bytes past the 12 it converts
+    STEG_TARGET("ssse3")
+    size_t RgbaToRgbSsse3(const byte* input, byte* output, size_t count) {
+        const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        size_t i = 0;
+        for (; i + 6 <= count; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + 4 * i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 3 * i), _mm_shuffle_epi8(v, shuffle));
+        }
+        return i;
+    }
+
+    // 4 RGB_8 pixels starting at input spread into RGBA_8 lanes with the given alpha
+    STEG_TARGET("ssse3")
+    inline __m128i LoadRgbAsRgbaSsse3(const byte* input, __m128i alpha) {
+        const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+        return _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha);
+    }
+
+    // RGB_8 -> RGBA_8
+    // The loop stops early because every load reads 4 bytes past the 12 it converts
+    STEG_TARGET("ssse3")
+    size_t RgbToRgbaSsse3(const byte* input, byte* output, size_t count) {
+        const __m128i opaque = _mm_set1_epi32(int(0xFF000000));
+        size_t i = 0;
+        for (; i + 6 <= count; i += 4) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 4 * i), LoadRgbAsRgbaSsse3(input + 3 * i, opaque));
+        }
+        return i;
+    }
+
+    // RGB_8 -> GRAY_8
+    STEG_TARGET("ssse3")
+    size_t RgbToGraySsse3(const byte* input, byte* output, size_t count) {
+        const __m128i zero = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 18 <= count; i += 16) {
+            __m128i pixels[4];
+            for (int k = 0; k < 4; k++) {
+                pixels[k] = LoadRgbAsRgbaSsse3(input + 3 * i + 12 * k, zero);
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), LumaRgba16PixelsSse2(pixels));
+        }
+        return i;
+    }
+
+    // GRAY_8 -> RGB_8
+    STEG_TARGET("ssse3")
+    size_t GrayToRgbSsse3(const byte* input, byte* output, size_t count) {
+        const __m128i shuffles[3] = {
+                _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5),
+                _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10),
+                _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15)
+        };
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+            for (int k = 0; k < 3; k++) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 3 * i + 16 * k), _mm_shuffle_epi8(v, shuffles[k]));
+            }
+        }
+        return i;
+    }
+
+#endif
+
+    size_t ConvertLayoutSimd8(const byte* input, byte* output, size_t count, uint32_t from, uint32_t to) {
+#ifdef STEG_SSE2
+        if (from == 2 && to == 1) {
+            return EvenBytesSse2(input, output, count);
+        } else if (from == 1 && to == 2) {
+            return GrayToGrayAlphaSse2(input, output, count);
+        } else if (from == 1 && to == 4) {
+            return GrayToRgbaSse2(input, output, count);
+        } else if (from == 2 && to == 4) {
+            return GrayAlphaToRgbaSse2(input, output, count);
+        } else if (from == 4 && to == 1) {
+            return RgbaToGraySse2(input, output, count);
+        } else if (from == 4 && to == 2) {
+            return RgbaToGrayAlphaSse2(input, output, count);
+        }
+
+        if (CpuFeatures::Get().SSSE3) {
+            if (from == 4 && to == 3) {
+                return RgbaToRgbSsse3(input, output, count);
+            } else if (from == 3 && to == 4) {
+                return RgbToRgbaSsse3(input, output, count);
+            } else if (from == 3 && to == 1) {
+                return RgbToGraySsse3(input, output, count);
+            } else if (from == 1 && to == 3) {
+                return GrayToRgbSsse3(input, output, count);
+            }
+        }
+#endif
+        return 0;
+    }
+
+    size_t ConvertDepthSimd(const byte* input, byte* output, size_t sampleCount, uint32_t from) {
+#ifdef STEG_SSE2
+        if (from == 16) {
+            return EvenBytesSse2(input, output, sampleCount);
+        } else {
+            return DuplicateBytesSse2(input, output, sampleCount);
+        }
+#else
+        return 0;
+#endif
+    }
+
+    /* Stages */
+
+    void ConvertLayout(const byte* input, byte* output, size_t count, uint32_t depth, uint32_t from, uint32_t to) {
+        if (depth == 8) {
+            size_t converted = ConvertLayoutSimd8(input, output, count, from, to);
+            GetLayoutKernel<8>(from, to)(input, output, converted, count);
+        } else {
+            GetLayoutKernel<16>(from, to)(input, output, 0, count);
+        }
+    }
+
+    void ConvertDepth(const byte* input, byte* output, size_t sampleCount, uint32_t from) {
+        size_t i = ConvertDepthSimd(input, output, sampleCount, from);
+        if (from == 16) {
+            for (; i < sampleCount; i++) {
+                output[i] = input[2 * i];
+            }
+        } else {
+            for (; i < sampleCount; i++) {
+                output[2 * i] = input[i];
+                output[2 * i + 1] = input[i];
+            }
+        }
+    }
+
+}
+
+void PixelConvert::Convert(const byte* input, byte* output, size_t pixelCount, PixelMode from, PixelMode to) {
+    if (pixelCount == 0) {
+        return;
+    }
+
+    auto layoutOf = [](PixelMode mode) {
+        return DispatchPixelMode(mode, []<PixelMode M>() {
+            return std::pair<uint32_t, uint32_t>(PixelTraits<M>::BitDepth, PixelTraits<M>::ChannelCount);
+        });
+    };
+    auto [fromDepth, fromChannels] = layoutOf(from);
+    auto [toDepth, toChannels] = layoutOf(to);
+
+    // Single stage conversions go straight from input to output
+    if (fromDepth == toDepth && fromChannels == toChannels) {
+        std::memcpy(output, input, pixelCount * fromChannels * fromDepth / 8);
+        return;
+    } else if (fromDepth == toDepth) {
+        ConvertLayout(input, output, pixelCount, fromDepth, fromChannels, toChannels);
+        return;
+    } else if (fromChannels == toChannels) {
+        ConvertDepth(input, output, pixelCount * fromChannels, fromDepth);
+        return;
+    }
+
+    // Two stage conversions run chunk by chunk through an 8-bit intermediate that stays in cache
+    std::vector<byte> intermediate(ChunkPixels * 4);
+    for (size_t begin = 0; begin < pixelCount; begin += ChunkPixels) {
+        size_t count = std::min(ChunkPixels, pixelCount - begin);
+        const byte* in = input + begin * fromChannels * fromDepth / 8;
+        byte* out = output + begin * toChannels * toDepth / 8;
+        if (fromDepth == 16) {
+            ConvertDepth(in, intermediate.data(), count * fromChannels, 16);
+            ConvertLayout(intermediate.data(), out, count, 8, fromChannels, toChannels);
+        } else {
+            ConvertLayout(in, intermediate.data(), count, 8, fromChannels, toChannels);
+            ConvertDepth(intermediate.data(), out, count * toChannels, 8);
+        }
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "Core.h"
+#include "PixelMode.h"
+
+namespace Steg::PixelConvert {
+
+    // Converts pixelCount interleaved pixels from one mode to another
+    // Bit depth changes happen at the wider depth side last: 16 -> 8 reduces depth before changing channels,
+    // 8 -> 16 changes channels before widening, so color math runs on 8-bit samples whenever possible
+    // 16 -> 8 keeps the high byte, 8 -> 16 replicates the byte (v * 257)
+    // Gray is computed as BT.601 luma, removed alpha is discarded and added alpha is opaque
+    void Convert(const byte* input, byte* output, size_t pixelCount, PixelMode from, PixelMode to);
+
+}
@@ -1,66 +1,70 @@
-#include "Image.h"
-#include "RGBImage.h"
-#include "lodepng.h"
-
-using namespace Steg;
-
-RGBImage::RGBImage(uint32_t width, uint32_t height, uint32_t bitDepth, bool hasAlpha)
-        : Image(width, height, Image::GetRGBMode(bitDepth, hasAlpha)), BitDepth(bitDepth), HasAlpha(hasAlpha) {}
-
-RGBImage::RGBImage(const Image& other)
-        : Image(other), BitDepth(other.GetBitDepth()), HasAlpha(other.HasAlpha()) {}
-
-RGBColor RGBImage::GetColor(uint32_t x, uint32_t y) {
-    uint64_t color = Image::GetColor(x, y);
-    RGBColor result(0, 0, 0, 0);
-    if (BitDepth == 8) {
-        if (HasAlpha) {
-            result.Alpha = color & 0xFF;
-            color >>= 8;
-        }
-        result.Blue = color & 0xFF;
-        color >>= 8;
-        result.Green = color & 0xFF;
-        color >>= 8;
-        result.Red = color & 0xFF;
-    } else if (BitDepth == 16) {
-        if (HasAlpha) {
-            result.Alpha = color & 0xFFFF;
-            color >>= 16;
-        }
-        result.Blue = color & 0xFFFF;
-        color >>= 16;
-        result.Green = color & 0xFFFF;
-        color >>= 16;
-        result.Red = color & 0xFFFF;
-    } else {
-        throw std::invalid_argument("Invalid Image bit depth: " + BitDepth);
-    }
-    return result;
-}
-
-void RGBImage::SetColor(uint32_t x, uint32_t y, uint16_t red, uint16_t green, uint16_t blue) {
-    if (HasAlpha) {
-        throw std::invalid_argument("Must provide an alpha value for RGBA images");
-    }
-    uint64_t color = red;
-    color <<= BitDepth;
-    color |= green;
-    color <<= BitDepth;
-    color |= blue;
-    Image::SetColor(x, y, color);
-}
-
-void RGBImage::SetColor(uint32_t x, uint32_t y, uint16_t red, uint16_t green, uint16_t blue, uint16_t alpha) {
-    if (!HasAlpha) {
-        throw std::invalid_argument("Must not provide an alpha value for RGB images");
-    }
-    uint64_t color = red;
-    color <<= BitDepth;
-    color |= green;
-    color <<= BitDepth;
-    color |= blue;
-    color <<= BitDepth;
-    color |= alpha;
-    Image::SetColor(x, y, color);
-}
+#include "Image.h"
+#include "RGBImage.h"
+#include "lodepng.h"
+
+using namespace Steg;
+
+RGBImage::RGBImage(uint32_t width, uint32_t height, uint32_t bitDepth, bool hasAlpha)
+        : Image(width, height, Image::GetRGBMode(bitDepth, hasAlpha)) {}
+
+RGBImage::RGBImage(const Image& other)
+        : Image(other) {}
+
+void RGBImage::ConvertTo(const PixelMode& mode) {
+    if (GetChannelCount(mode) < 3) {
+        throw std::invalid_argument("Invalid RGB Pixel Mode");
+    }
+    Image::ConvertTo(mode);
+}
+
+RGBColor RGBImage::GetColor(uint32_t x, uint32_t y) {
+    return DispatchPixelMode(GetPixelMode(), [&]<PixelMode M>() {
+        if constexpr (PixelTraits<M>::IsGray) {
+            throw std::invalid_argument("Invalid RGB Pixel Mode");
+            return RGBColor(0, 0, 0, 0);
+        } else {
+            // Read through the const overload so reading does not mark the row for the next save
+            auto pixel = std::as_const(*this).Row<M>(y)[x];
+            uint16_t alpha = 0;
+            if constexpr (PixelTraits<M>::HasAlpha) {
+                alpha = pixel.GetAlpha();
+            }
+            return RGBColor(pixel.Get(0), pixel.Get(1), pixel.Get(2), alpha);
+        }
+    });
+}
+
+void RGBImage::SetColor(uint32_t x, uint32_t y, uint16_t red, uint16_t green, uint16_t blue) {
+    // Depth and alpha are read from the mode, which ConvertTo may have changed since construction
+    if (GetChannelCount() < 3) {
+        throw std::invalid_argument("Invalid RGB Pixel Mode");
+    }
+    uint32_t bitDepth = GetBitDepth();
+    if (HasAlpha()) {
+        throw std::invalid_argument("Must provide an alpha value for RGBA images");
+    }
+    uint64_t color = red;
+    color <<= bitDepth;
+    color |= green;
+    color <<= bitDepth;
+    color |= blue;
+    Image::SetColor(x, y, color);
+}
+
+void RGBImage::SetColor(uint32_t x, uint32_t y, uint16_t red, uint16_t green, uint16_t blue, uint16_t alpha) {
+    if (GetChannelCount() < 3) {
+        throw std::invalid_argument("Invalid RGB Pixel Mode");
+    }
+    uint32_t bitDepth = GetBitDepth();
+    if (!HasAlpha()) {
+        throw std::invalid_argument("Must not provide an alpha value for RGB images");
+    }
+    uint64_t color = red;
+    color <<= bitDepth;
+    color |= green;
+    color <<= bitDepth;
+    color |= blue;
+    color <<= bitDepth;
+    color |= alpha;
+    Image::SetColor(x, y, color);
+}
@@ -0,0 +1,226 @@
+#include "steg.h"
+
+#include "StegEngine.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+using namespace Steg;
+
+namespace {
+
+    // Per thread, so callers on different threads do not see each other's errors
+    thread_local std::string LastError;
+
+    // Exceptions must not cross into C, anything thrown becomes a status
+    template<typename Function>
+    steg_status Guard(Function&& function) {
+        LastError.clear();
+        try {
+            return function();
+        } catch (const std::invalid_argument& error) {
+            LastError = error.what();
+            return STEG_ERROR_INVALID_ARGUMENT;
+        } catch (const std::length_error& error) {
+            LastError = error.what();
+            return STEG_ERROR_BUFFER_TOO_SMALL;
+        } catch (const std::bad_alloc&) {
+            LastError = "Out of memory";
+            return STEG_ERROR_OUT_OF_MEMORY;
+        } catch (const std::exception& error) {
+            LastError = error.what();
+            return STEG_ERROR_FAILED;
+        } catch (const char* error) {
+            // StegEngine throws a plain string when the header is missing
+            LastError = error;
+            return STEG_ERROR_NO_PAYLOAD;
+        } catch (...) {
+            LastError = "Unknown error";
+            return STEG_ERROR_FAILED;
+        }
+    }
+
+    void CheckNotNull(const void* pointer, const char* name) {
+        if (pointer == nullptr) {
+            throw std::invalid_argument(std::string(name) + " must not be null");
+        }
+    }
+
+    PixelMode ToPixelMode(steg_pixel_mode mode) {
+        switch (mode) {
+            case STEG_PIXEL_GRAY_8:
+                return PixelMode::GRAY_8;
+            case STEG_PIXEL_GRAY_16:
+                return PixelMode::GRAY_16;
+            case STEG_PIXEL_GRAYA_8:
+                return PixelMode::GRAYA_8;
+            case STEG_PIXEL_GRAYA_16:
+                return PixelMode::GRAYA_16;
+            case STEG_PIXEL_RGB_8:
+                return PixelMode::RGB_8;
+            case STEG_PIXEL_RGB_16:
+                return PixelMode::RGB_16;
+            case STEG_PIXEL_RGBA_8:
+                return PixelMode::RGBA_8;
+            case STEG_PIXEL_RGBA_16:
+                return PixelMode::RGBA_16;
+            default:
+                throw std::invalid_argument("Unsupported pixel mode: " + std::to_string(int(mode)));
+        }
+    }
+
+    // The image works on the caller's pixels directly
+    Image WrapImage(const steg_image* image) {
+        CheckNotNull(image, "image");
+        PixelMode mode = ToPixelMode(image->mode);
+        size_t stride = image->stride;
+        if (stride == 0) {
+            stride = DispatchPixelMode(mode, [&]<PixelMode M>() {
+                return size_t(image->width) * PixelTraits<M>::PixelWidth;
+            });
+        }
+        return Image::Wrap(image->pixels, image->width, image->height, stride, mode);
+    }
+
+    EncoderSettings ToSettings(const steg_options* options) {
+
+        // A caller built against an older header passes a shorter struct, the fields it lacks keep their defaults
+        steg_options values;
+        steg_options_init(&values);
+        if (options != nullptr) {
+            if (options->struct_size < sizeof(options->struct_size)) {
+                throw std::invalid_argument("steg_options.struct_size is not set, use steg_options_init");
+            }
+            std::memcpy(&values, options, std::min(options->struct_size, sizeof(values)));
+        }
+
+        EncoderSettings settings;
+        if (values.data_depth != 1 && values.data_depth != 2 && values.data_depth != 4 && values.data_depth != 8) {
+            throw std::invalid_argument("Invalid data depth: " + std::to_string(values.data_depth));
+        }
+        settings.DataDepth = values.data_depth;
+        settings.EncodeInAlpha = values.encode_in_alpha != 0;
+        settings.LocalScatter = values.local_scatter != 0;
+        settings.Pipelined = values.pipelined != 0;
+
+        EncryptionSettings& encryption = settings.Encryption;
+        encryption.EncryptPayload = values.encrypt != 0;
+        if (encryption.EncryptPayload) {
+            if (values.password_length != 0) {
+                CheckNotNull(values.password, "password");
+                encryption.EncryptionPassword.assign(values.password, values.password + values.password_length);
+            }
+            if (values.algorithm > STEG_ALGO_CHACHA20) {
+                throw std::invalid_argument("Unsupported algorithm: " + std::to_string(int(values.algorithm)));
+            }
+            if (values.cipher_mode > STEG_CIPHER_GCM) {
+                throw std::invalid_argument("Unsupported cipher mode: " + std::to_string(int(values.cipher_mode)));
+            }
+            encryption.Algo = StegCrypt::Algorithm(values.algorithm);
+            encryption.CipherMode = StegCrypt::Mode(values.cipher_mode);
+            encryption.KDF.TimeCost = values.kdf_time_cost;
+            encryption.KDF.MemoryCost = values.kdf_memory_cost;
+            encryption.KDF.Lanes = values.kdf_lanes;
+            encryption.KDF.Validate();
+        }
+
+        return settings;
+
+    }
+
+}
+
+uint32_t steg_abi_version(void) {
+    return STEG_ABI_VERSION;
+}
+
+const char* steg_last_error(void) {
+    return LastError.c_str();
+}
+
+void steg_options_init(steg_options* options) {
+    if (options == nullptr) {
+        return;
+    }
+
+    EncoderSettings defaults;
+    *options = steg_options();
+    options->struct_size = sizeof(steg_options);
+    options->data_depth = defaults.DataDepth;
+    options->encode_in_alpha = defaults.EncodeInAlpha;
+    options->local_scatter = defaults.LocalScatter;
+    options->pipelined = defaults.Pipelined;
+    options->encrypt = defaults.Encryption.EncryptPayload;
+    options->algorithm = steg_algorithm(defaults.Encryption.Algo);
+    options->cipher_mode = steg_cipher_mode(defaults.Encryption.CipherMode);
+    options->kdf_time_cost = defaults.Encryption.KDF.TimeCost;
+    options->kdf_memory_cost = defaults.Encryption.KDF.MemoryCost;
+    options->kdf_lanes = defaults.Encryption.KDF.Lanes;
+}
+
+steg_status steg_capacity(const steg_image* image, const steg_options* options, size_t* capacity) {
+    return Guard([&]() {
+        CheckNotNull(capacity, "capacity");
+        *capacity = StegEngine::CalculateAvailableBytes(WrapImage(image), ToSettings(options));
+        return STEG_OK;
+    });
+}
+
+steg_status steg_encode(const steg_image* image, const uint8_t* data, size_t length, const steg_options* options) {
+    return Guard([&]() {
+        if (length != 0) {
+            CheckNotNull(data, "data");
+        }
+        Image wrapped = WrapImage(image);
+        EncoderSettings settings = ToSettings(options);
+
+        // Checked up front so a payload that does not fit has a status of its own
+        if (!StegEngine::HasSpace(wrapped, length, settings)) {
+            LastError = "Not enough space in image to encode data";
+            return STEG_ERROR_NO_SPACE;
+        }
+
+        StegEngine::EncodeSpan(wrapped, std::span<const byte>(data, length), settings);
+        return STEG_OK;
+    });
+}
+
+steg_status steg_payload_size(const steg_image* image, size_t* size) {
+    return Guard([&]() {
+        CheckNotNull(size, "size");
+        uint32_t payloadByteCount;
+        StegEngine::Probe(WrapImage(image), payloadByteCount);
+        *size = payloadByteCount;
+        return STEG_OK;
+    });
+}
+
+steg_status steg_decode(const steg_image* image, const uint8_t* password, size_t password_length,
+                        uint8_t* output, size_t capacity, size_t* length) {
+    return Guard([&]() {
+        CheckNotNull(length, "length");
+        const Image wrapped = WrapImage(image);
+
+        // Only the header is read twice, which is cheap next to the payload
+        uint32_t payloadByteCount;
+        StegEngine::Probe(wrapped, payloadByteCount);
+        if (capacity < payloadByteCount) {
+            *length = payloadByteCount;
+            LastError = "Output buffer is smaller than the payload";
+            return STEG_ERROR_BUFFER_TOO_SMALL;
+        }
+        if (payloadByteCount != 0) {
+            CheckNotNull(output, "output");
+        }
+
+        DecoderSettings settings;
+        if (password_length != 0) {
+            CheckNotNull(password, "password");
+            settings.EncryptionPassword.assign(password, password + password_length);
+        }
+
+        *length = StegEngine::DecodeInto(wrapped, std::span<byte>(output, capacity), settings);
+        return STEG_OK;
+    });
+}
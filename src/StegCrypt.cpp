@@ -1,176 +1,944 @@
-#include "StegCrypt.h"
-
-#include "aes.h"
-#include "argon2.h"
-#include "StegTimer.h"
-
-using namespace Steg;
-
-// These methods will handle the IV in the background
-std::vector<byte> StegCrypt::Encrypt(const std::vector<byte>& pass, const std::vector<byte> data, Algorithm algo) {
-
-    // Start the Encrypt Timer
-    StegTimer::StartTimer(StegTimer::TimerLabel::ENCRYPT);
-
-    // Create a random number generator with seed 0 for the IV
-    RNG rng(0);
-
-    // Get the block length of this algorithm
-    uint32_t blockLength = GetBlockLength(algo);
-
-    // Derive key from the password
-    std::vector<byte> key = DeriveKey(pass, blockLength, rng);
-
-    // IV is BLOCK_SIZE bytes long
-    std::vector<byte> iv = GetIV(rng, blockLength);
-
-    // Data is padded to nearest blockLength bytes
-    std::vector<byte> dataBuffer = AddPadding(data, blockLength);
-
-    byte *ivBytes = &iv[0];
-    byte *keyBytes = &key[0];
-    byte *dataBytes = &dataBuffer[0];
-
-    AES_ctx context;
-    AES128_init_ctx(&context, keyBytes);
-    if (algo == Algorithm::ALGO_AES128) {
-        AES128_init_ctx_iv(&context, keyBytes, ivBytes);
-        AES128_CBC_encrypt_buffer(&context, dataBytes, dataBuffer.size());
-    } else if (algo == Algorithm::ALGO_AES192) {
-        AES192_init_ctx_iv(&context, keyBytes, ivBytes);
-        AES192_CBC_encrypt_buffer(&context, dataBytes, dataBuffer.size());
-    } else if (algo == Algorithm::ALGO_AES256) {
-        AES256_init_ctx_iv(&context, keyBytes, ivBytes);
-        AES256_CBC_encrypt_buffer(&context, dataBytes, dataBuffer.size());
-    } else {
-        throw std::invalid_argument("Unsupported Algorithm");
-    }
-
-    // Prepend IV to the data buffer
-    dataBuffer.insert(dataBuffer.begin(), iv.begin(), iv.end());
-
-    // End the Encrypt Timer
-    StegTimer::EndTimer(StegTimer::TimerLabel::ENCRYPT);
-
-    return dataBuffer;
-
-}
-
-std::vector<byte> StegCrypt::Decrypt(const std::vector<byte>& pass, const std::vector<byte> data, Algorithm algo) {
-
-    // Start the Decrypt Timer
-    StegTimer::StartTimer(StegTimer::TimerLabel::DECRYPT);
-
-    // Create a random number generator with seed 0 for the IV
-    RNG rng(0);
-
-    // Get the block length of this algorithm
-    uint32_t blockLength = GetBlockLength(algo);
-
-    // Derive key from the password
-    std::vector<byte> key = DeriveKey(pass, blockLength, rng);
-
-    // IV is BLOCK_SIZE bytes long
-    std::vector<byte> iv(data.begin(), data.begin() + blockLength);
-
-    // Clip off the IV from the front
-    std::vector<byte> dataBuffer(data.begin() + blockLength, data.end());
-
-    byte *ivBytes = &iv[0];
-    byte *keyBytes = &key[0];
-    byte *dataBytes = &dataBuffer[0];
-
-    AES_ctx context;
-    AES128_init_ctx(&context, keyBytes);
-    if (algo == Algorithm::ALGO_AES128) {
-        AES128_init_ctx_iv(&context, keyBytes, ivBytes);
-        AES128_CBC_decrypt_buffer(&context, dataBytes, dataBuffer.size());
-    } else if (algo == Algorithm::ALGO_AES192) {
-        AES192_init_ctx_iv(&context, keyBytes, ivBytes);
-        AES192_CBC_decrypt_buffer(&context, dataBytes, dataBuffer.size());
-    } else if (algo == Algorithm::ALGO_AES256) {
-        AES256_init_ctx_iv(&context, keyBytes, ivBytes);
-        AES256_CBC_decrypt_buffer(&context, dataBytes, dataBuffer.size());
-    } else {
-        throw std::invalid_argument("Unsupported Algorithm");
-    }
-
-    std::vector<byte> decryptedBytes = RemovePadding(dataBuffer);
-
-    // End the Decrypt Timer
-    StegTimer::EndTimer(StegTimer::TimerLabel::DECRYPT);
-
-    return decryptedBytes;
-
-}
-
-std::vector<byte> StegCrypt::GetIV(RNG& rng, uint32_t ivLength) {
-    std::vector<byte> iv(ivLength);
-    uint64_t rand64 = rng.Next();
-    rand64 <<= 32;
-    rand64 |= rng.Next();
-    int k = 0;
-    for (int i = 0; i < 2; i++) {
-        iv[k++] = ((rand64 >> 56) & 0xFF);
-        iv[k++] = ((rand64 >> 40) & 0xFF);
-        iv[k++] = ((rand64 >> 32) & 0xFF);
-        iv[k++] = ((rand64 >> 48) & 0xFF);
-        iv[k++] = ((rand64 >> 24) & 0xFF);
-        iv[k++] = ((rand64 >> 16) & 0xFF);
-        iv[k++] = ((rand64 >> 8) & 0xFF);
-        iv[k++] = (rand64 & 0xFF);
-    }
-    return iv;
-}
-
-std::vector<byte> StegCrypt::DeriveKey(const std::vector<byte>& pass, uint32_t keySize, RNG& rng) {
-
-    // Generate a cryptographic salt
-    std::vector<byte> salt(keySize);
-    for (uint32_t i = 0; i < keySize; i++) {
-        salt[i] = rng.Next() & 0xFF;
-    }
-
-    // Array to hold the resulting key bytes
-    std::vector<byte> key(keySize);
-
-    // Derive key using Argon2
-    argon2i_hash_raw(2, 1 << 8, 1, &pass[0], pass.size(), &salt[0], salt.size(), &key[0], keySize);
-
-    return key;
-
-}
-
-// PKCS7 Padding
-std::vector<byte> StegCrypt::AddPadding(const std::vector<byte> data, uint32_t blockLength) {
-    std::vector<byte> paddedData(data);
-    uint32_t padAmount = blockLength - (data.size() % blockLength);
-    for (byte i = 0; i < padAmount; i++) {
-        paddedData.push_back(padAmount);
-    }
-    return paddedData;
-}
-
-// PKCS7 Padding
-std::vector<byte> StegCrypt::RemovePadding(const std::vector<byte> data) {
-    std::vector<byte> unpaddedData(data);
-    uint32_t padAmount = data[data.size() - 1];
-    for (byte i = 0; i < padAmount; i++) {
-        unpaddedData.pop_back();
-    }
-    return unpaddedData;
-}
-
-uint32_t StegCrypt::GetBlockLength(Algorithm algo) {
-    switch (algo) {
-        case Algorithm::ALGO_AES128:
-            return 16;
-        case Algorithm::ALGO_AES192:
-            return 24;
-        case Algorithm::ALGO_AES256:
-            return 32;
-        default:
-            throw std::invalid_argument("Unsupported Algorithm");
-            return 0;
-    }
-}
+#include "StegCrypt.h"
+
+#include "AESNI.h"
+#include "argon2.h"
+#include "BlockCipher.h"
+#include "ChaCha20.h"
+#include "GHash.h"
+#include "KeyCache.h"
+#include "Parallel.h"
+#include "StegMemory.h"
+#include "StegTimer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <optional>
+
+using namespace Steg;
+
+namespace {
+
+    // Bytes per task when counter mode work is split across threads (a multiple of the block size)
+    constexpr size_t ParallelChunkSize = 256 * 1024;
+
+    // The backend requested through SetBackend
+    std::atomic<StegCrypt::Backend> SelectedBackend = StegCrypt::Backend::BACKEND_AUTO;
+
+    KeyCache& GetKeyCache() {
+        static KeyCache cache;
+        return cache;
+    }
+
+    // The innermost KeyScope of this thread
+    thread_local KeyCache* ScopedKeys = nullptr;
+
+    // A scope only ever sees a password or two
+    constexpr size_t ScopedKeyCapacity = 4;
+
+    // Writes the counter block nonce || counter (32-bit big-endian)
+    void SetCounterBlock(byte* block, const byte* nonce, uint32_t counter) {
+        std::copy(nonce, nonce + 12, block);
+        block[12] = byte(counter >> 24);
+        block[13] = byte(counter >> 16);
+        block[14] = byte(counter >> 8);
+        block[15] = byte(counter);
+    }
+
+    // XORs data with the keystream E(K, nonce || counter) where the counter starts at firstCounter
+    void CounterXor(const BlockCipher& cipher, const byte* nonce, uint32_t firstCounter, byte* data, size_t length) {
+        constexpr size_t batchBlocks = 16;
+        std::array<byte, batchBlocks * BlockCipher::BlockSize> keystream;
+
+        size_t blockCount = (length + BlockCipher::BlockSize - 1) / BlockCipher::BlockSize;
+        for (size_t block = 0; block < blockCount; block += batchBlocks) {
+            size_t count = std::min(batchBlocks, blockCount - block);
+            for (size_t i = 0; i < count; i++) {
+                SetCounterBlock(&keystream[i * BlockCipher::BlockSize], nonce, firstCounter + uint32_t(block + i));
+            }
+            cipher.EncryptBlocks(keystream.data(), count);
+
+            size_t offset = block * BlockCipher::BlockSize;
+            size_t bytes = std::min(count * BlockCipher::BlockSize, length - offset);
+            for (size_t i = 0; i < bytes; i++) {
+                data[offset + i] ^= keystream[i];
+            }
+        }
+    }
+
+    // Every keystream block only depends on its counter, so chunks are processed concurrently
+    void ParallelCounterXor(const BlockCipher& cipher, const byte* nonce, uint32_t firstCounter, byte* data, size_t length) {
+        size_t chunkCount = (length + ParallelChunkSize - 1) / ParallelChunkSize;
+        ParallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+            size_t offset = begin * ParallelChunkSize;
+            size_t bytes = std::min(end * ParallelChunkSize, length) - offset;
+            uint32_t counter = firstCounter + uint32_t(offset / BlockCipher::BlockSize);
+            CounterXor(cipher, nonce, counter, data + offset, bytes);
+        });
+    }
+
+    // Like ParallelCounterXor, position is the offset of data from the first keystream byte and need not be block aligned
+    void ParallelCounterXorAt(const BlockCipher& cipher, const byte* nonce, uint32_t firstCounter, uint64_t position, byte* data, size_t length) {
+
+        // Finish the keystream block position points into
+        size_t skip = position % BlockCipher::BlockSize;
+        if (skip != 0 && length > 0) {
+            std::array<byte, BlockCipher::BlockSize> keystream;
+            SetCounterBlock(keystream.data(), nonce, firstCounter + uint32_t(position / BlockCipher::BlockSize));
+            cipher.EncryptBlocks(keystream.data(), 1);
+            size_t bytes = std::min<size_t>(length, BlockCipher::BlockSize - skip);
+            for (size_t i = 0; i < bytes; i++) {
+                data[i] ^= keystream[skip + i];
+            }
+            position += bytes;
+            data += bytes;
+            length -= bytes;
+        }
+
+        ParallelCounterXor(cipher, nonce, firstCounter + uint32_t(position / BlockCipher::BlockSize), data, length);
+
+    }
+
+    // Chunks are hashed concurrently from a zero state and then combined in order
+    GHash::Element ParallelGHash(const GHash& ghash, const byte* data, size_t length) {
+        size_t chunkCount = (length + ParallelChunkSize - 1) / ParallelChunkSize;
+        CountedVector<GHash::Element> states(chunkCount);
+        ParallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+            for (size_t chunk = begin; chunk < end; chunk++) {
+                size_t offset = chunk * ParallelChunkSize;
+                size_t bytes = std::min(ParallelChunkSize, length - offset);
+                ghash.Update(states[chunk], data + offset, bytes);
+            }
+        });
+
+        GHash::Element state;
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            size_t bytes = std::min(ParallelChunkSize, length - chunk * ParallelChunkSize);
+            uint64_t blocks = (bytes + BlockCipher::BlockSize - 1) / BlockCipher::BlockSize;
+            state = ghash.Combine(state, states[chunk], blocks);
+        }
+        return state;
+    }
+
+    // The GHASH key is the encryption of the zero block
+    GHash CreateGHash(const BlockCipher& cipher) {
+        std::array<byte, BlockCipher::BlockSize> hashKey = {};
+        cipher.EncryptBlocks(hashKey.data(), 1);
+        return GHash(hashKey.data());
+    }
+
+    // Turns the GHASH state of length bytes of ciphertext into the tag
+    void FinishTag(const BlockCipher& cipher, const GHash& ghash, GHash::Element state, const byte* nonce, size_t length, byte* tag) {
+        ghash.UpdateLengths(state, 0, length);
+
+        // The tag is masked with the encryption of the first counter block
+        std::array<byte, BlockCipher::BlockSize> mask;
+        SetCounterBlock(mask.data(), nonce, 1);
+        cipher.EncryptBlocks(mask.data(), 1);
+
+        GHash::Store(state, tag);
+        for (uint32_t i = 0; i < BlockCipher::BlockSize; i++) {
+            tag[i] ^= mask[i];
+        }
+    }
+
+    // GCM tag over the ciphertext with no additional authenticated data
+    void ComputeTag(const BlockCipher& cipher, const byte* nonce, const byte* ciphertext, size_t length, byte* tag) {
+        StegTimer::StartTimer(StegTimer::TimerLabel::AUTHENTICATE);
+        GHash ghash = CreateGHash(cipher);
+        FinishTag(cipher, ghash, ParallelGHash(ghash, ciphertext, length), nonce, length, tag);
+        StegTimer::EndTimer(StegTimer::TimerLabel::AUTHENTICATE);
+    }
+
+    // XORs data with the ChaCha20 keystream that starts at block 1, position is the offset of data in the ciphertext
+    void ParallelChaChaXor(const ChaCha20& cipher, uint64_t position, byte* data, size_t length) {
+
+        // Finish a keystream block the previous call stopped inside of
+        size_t skip = position % ChaCha20::BlockSize;
+        if (skip != 0 && length > 0) {
+            std::array<byte, ChaCha20::BlockSize> keystream;
+            cipher.Block(1 + uint32_t(position / ChaCha20::BlockSize), keystream.data());
+            size_t bytes = std::min<size_t>(length, ChaCha20::BlockSize - skip);
+            for (size_t i = 0; i < bytes; i++) {
+                data[i] ^= keystream[skip + i];
+            }
+            position += bytes;
+            data += bytes;
+            length -= bytes;
+        }
+
+        // Every keystream block only depends on its counter, like CTR
+        uint32_t firstCounter = 1 + uint32_t(position / ChaCha20::BlockSize);
+        size_t chunkCount = (length + ParallelChunkSize - 1) / ParallelChunkSize;
+        ParallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+            size_t offset = begin * ParallelChunkSize;
+            size_t bytes = std::min(end * ParallelChunkSize, length) - offset;
+            cipher.Xor(firstCounter + uint32_t(offset / ChaCha20::BlockSize), data + offset, bytes);
+        });
+
+    }
+
+    // The Poly1305 key is the first half of keystream block 0
+    Poly1305 CreatePoly1305(const ChaCha20& cipher) {
+        std::array<byte, ChaCha20::BlockSize> keystream;
+        cipher.Block(0, keystream.data());
+        return Poly1305(keystream.data());
+    }
+
+    // Pads length bytes of ciphertext to a whole block and appends the lengths of the (empty) AAD and the ciphertext
+    void FinishPoly1305(Poly1305 mac, uint64_t length, byte* tag) {
+        std::array<byte, 16> block = {};
+        mac.Update(block.data(), (16 - length % 16) % 16);
+        for (int i = 0; i < 8; i++) {
+            block[8 + i] = byte(length >> (8 * i));
+        }
+        mac.Update(block.data(), block.size());
+        mac.Finish(tag);
+    }
+
+    // ChaCha20-Poly1305 tag over the ciphertext with no additional authenticated data
+    void ComputePoly1305Tag(const ChaCha20& cipher, const byte* ciphertext, size_t length, byte* tag) {
+        StegTimer::StartTimer(StegTimer::TimerLabel::AUTHENTICATE);
+        Poly1305 mac = CreatePoly1305(cipher);
+        mac.Update(ciphertext, length);
+        FinishPoly1305(mac, length, tag);
+        StegTimer::EndTimer(StegTimer::TimerLabel::AUTHENTICATE);
+    }
+
+    // Compares every byte so the time taken does not depend on where they differ
+    bool EqualTags(const byte* a, const byte* b, size_t length) {
+        byte difference = 0;
+        for (size_t i = 0; i < length; i++) {
+            difference |= a[i] ^ b[i];
+        }
+        return difference == 0;
+    }
+
+    // ChaCha20-Poly1305 is an AEAD of its own, whatever mode is asked for it has the layout of GCM
+    StegCrypt::Mode GetLayoutMode(StegCrypt::Algorithm algo, StegCrypt::Mode mode) {
+        return algo == StegCrypt::Algorithm::ALGO_CHACHA20 ? StegCrypt::Mode::MODE_GCM : mode;
+    }
+
+}
+
+// These methods will handle the IV in the background
+std::vector<byte> StegCrypt::Encrypt(const std::vector<byte>& pass, const std::vector<byte>& data, Algorithm algo, Mode mode, const KDFParams& kdf) {
+
+    // The encrypted buffer is the only allocation, the data is copied in after the IV or nonce
+    std::vector<byte> buffer(GetEncryptedSize(data.size(), algo, mode));
+    MemoryTracker bufferMemory(buffer);
+    std::copy(data.begin(), data.end(), buffer.begin() + GetDataOffset(algo, mode));
+
+    EncryptInPlace(pass, buffer, data.size(), algo, mode, kdf);
+
+    return buffer;
+
+}
+
+std::vector<byte> StegCrypt::Decrypt(const std::vector<byte>& pass, const std::vector<byte>& data, Algorithm algo, Mode mode, const KDFParams& kdf) {
+
+    uint32_t dataOffset = GetDataOffset(algo, mode);
+    if (data.size() < dataOffset) {
+        throw std::runtime_error("Encrypted payload is too short");
+    }
+
+    // Copy everything after the IV or nonce once, decrypt it in place and cut off the padding or tag
+    std::vector<byte> buffer(data.begin() + dataOffset, data.end());
+    MemoryTracker bufferMemory(buffer);
+    size_t dataSize = DecryptData(pass, &data[0], buffer.data(), buffer.size(), algo, mode, kdf);
+    buffer.resize(dataSize);
+
+    return buffer;
+
+}
+
+void StegCrypt::EncryptInPlace(const std::vector<byte>& pass, std::span<byte> buffer, uint32_t dataSize, Algorithm algo, Mode mode, const KDFParams& kdf) {
+
+    if (buffer.size() != GetEncryptedSize(dataSize, algo, mode)) {
+        throw std::invalid_argument("Buffer size does not match the encrypted size of the data");
+    }
+
+    // Start the Encrypt Timer, it ends when this function returns or throws
+    ScopedTimer timer(StegTimer::TimerLabel::ENCRYPT);
+
+    // Create a random number generator with seed 0 for the salt
+    RNG rng(0);
+
+    // Get the block length of this algorithm
+    uint32_t blockLength = GetBlockLength(algo);
+
+    // Derive key from the password
+    std::vector<byte> key = DeriveKey(pass, blockLength, kdf, rng);
+
+    StegTimer::StartTimer(StegTimer::TimerLabel::CIPHER);
+
+    if (algo == Algorithm::ALGO_CHACHA20) {
+        EncryptChaCha(key, buffer, dataSize);
+    } else {
+        switch (mode) {
+            case Mode::MODE_CBC:
+                EncryptCBC(key, buffer, dataSize, algo);
+                break;
+            case Mode::MODE_CTR:
+            case Mode::MODE_GCM:
+                EncryptCounter(key, buffer, dataSize, mode);
+                break;
+            default:
+                throw std::invalid_argument("Unsupported Mode");
+        }
+    }
+
+    StegTimer::EndTimer(StegTimer::TimerLabel::CIPHER);
+
+}
+
+std::span<byte> StegCrypt::DecryptInPlace(const std::vector<byte>& pass, std::span<byte> buffer, Algorithm algo, Mode mode, const KDFParams& kdf) {
+
+    uint32_t dataOffset = GetDataOffset(algo, mode);
+    if (buffer.size() < dataOffset) {
+        throw std::runtime_error("Encrypted payload is too short");
+    }
+
+    size_t dataSize = DecryptData(pass, buffer.data(), buffer.data() + dataOffset, buffer.size() - dataOffset, algo, mode, kdf);
+    return buffer.subspan(dataOffset, dataSize);
+
+}
+
+void StegCrypt::PatchInPlace(const std::vector<byte>& pass, std::span<const byte> prefix, std::span<byte> body, uint32_t offset, std::span<const byte> data, Algorithm algo, Mode mode, const KDFParams& kdf) {
+
+    if (!CanPatch(algo, mode)) {
+        throw std::invalid_argument("Only CTR payloads can be patched in place");
+    }
+    if (prefix.size() != NonceLength) {
+        throw std::invalid_argument("Prefix size does not match the nonce length");
+    }
+    if (body.size() != data.size()) {
+        throw std::invalid_argument("Body size does not match the size of the patch");
+    }
+
+    // Start the Encrypt Timer, it ends when this function returns or throws
+    ScopedTimer timer(StegTimer::TimerLabel::ENCRYPT);
+
+    // Create a random number generator with seed 0 for the salt
+    RNG rng(0);
+
+    // Derive key from the password
+    std::vector<byte> key = DeriveKey(pass, GetBlockLength(algo), kdf, rng);
+
+    ScopedTimer cipherTimer(StegTimer::TimerLabel::CIPHER);
+
+    BlockCipher cipher(&key[0], key.size());
+    std::copy(data.begin(), data.end(), body.begin());
+    ParallelCounterXorAt(cipher, prefix.data(), 1, offset, body.data(), body.size());
+
+}
+
+bool StegCrypt::CanPatch(Algorithm algo, Mode mode) {
+    return GetLayoutMode(algo, mode) == Mode::MODE_CTR;
+}
+
+uint32_t StegCrypt::GetDataOffset(Algorithm algo, Mode mode) {
+    switch (GetLayoutMode(algo, mode)) {
+        case Mode::MODE_CBC:
+            return GetBlockLength(algo);
+        case Mode::MODE_CTR:
+        case Mode::MODE_GCM:
+            return NonceLength;
+        default:
+            throw std::invalid_argument("Unsupported Mode");
+    }
+}
+
+uint32_t StegCrypt::GetEncryptedSize(uint32_t dataSize, Algorithm algo, Mode mode) {
+    switch (GetLayoutMode(algo, mode)) {
+        case Mode::MODE_CBC: {
+            // IV block followed by the data padded up to the next whole block
+            uint32_t blockLength = GetBlockLength(algo);
+            return blockLength + (dataSize / blockLength + 1) * blockLength;
+        }
+        case Mode::MODE_CTR:
+            return NonceLength + dataSize;
+        case Mode::MODE_GCM:
+            return NonceLength + dataSize + TagLength;
+        default:
+            throw std::invalid_argument("Unsupported Mode");
+    }
+}
+
+uint32_t StegCrypt::GetMaxDataSize(uint32_t encryptedSize, Algorithm algo, Mode mode) {
+    switch (GetLayoutMode(algo, mode)) {
+        case Mode::MODE_CBC: {
+            // Subtract 1 block for the IV
+            // Subtract 1 byte to account for padding
+            // 15n bytes of data will get 1 byte of padding
+            // 16n bytes of data will get 16 bytes of padding even though size % 16 == 0
+            uint32_t blockLength = GetBlockLength(algo);
+            uint32_t maxBlocks = encryptedSize / blockLength;
+            if (maxBlocks < 2) {
+                return 0;
+            }
+            return (maxBlocks - 1) * blockLength - 1;
+        }
+        case Mode::MODE_CTR:
+            return encryptedSize > NonceLength ? encryptedSize - NonceLength : 0;
+        case Mode::MODE_GCM:
+            return encryptedSize > NonceLength + TagLength ? encryptedSize - NonceLength - TagLength : 0;
+        default:
+            throw std::invalid_argument("Unsupported Mode");
+    }
+}
+
+void StegCrypt::SetBackend(Backend backend) {
+    if (backend == Backend::BACKEND_AESNI && !AESNI::IsSupported()) {
+        throw std::runtime_error("AES-NI backend is not supported by this CPU");
+    }
+    SelectedBackend = backend;
+}
+
+StegCrypt::Backend StegCrypt::GetBackend() {
+    Backend backend = SelectedBackend;
+    if (backend == Backend::BACKEND_AUTO) {
+        return AESNI::IsSupported() ? Backend::BACKEND_AESNI : Backend::BACKEND_PORTABLE;
+    }
+    return backend;
+}
+
+void KDFParams::Validate() const {
+    if (TimeCost < 1 || TimeCost > 255) {
+        throw std::invalid_argument("KDF time cost must be between 1 and 255");
+    }
+    if (Lanes < 1 || Lanes > 255) {
+        throw std::invalid_argument("KDF lane count must be between 1 and 255");
+    }
+    if (MemoryCost < 8 * Lanes || (MemoryCost & (MemoryCost - 1)) != 0) {
+        throw std::invalid_argument("KDF memory cost must be a power of two of at least 8 KiB per lane");
+    }
+}
+
+void StegCrypt::SetKeyCacheCapacity(size_t capacity) {
+    GetKeyCache().SetCapacity(capacity);
+}
+
+void StegCrypt::ClearKeyCache() {
+    GetKeyCache().Clear();
+}
+
+StegCrypt::KeyScope::KeyScope() : Cache(CreateScope<KeyCache>(ScopedKeyCapacity)), Outer(ScopedKeys) {
+    ScopedKeys = Cache.get();
+}
+
+// The cache zeroes its keys when it is destroyed
+StegCrypt::KeyScope::~KeyScope() {
+    ScopedKeys = Outer;
+}
+
+size_t StegCrypt::DecryptData(const std::vector<byte>& pass, const byte* iv, byte* data, size_t length, Algorithm algo, Mode mode, const KDFParams& kdf) {
+
+    // Start the Decrypt Timer, it ends when this function returns or throws
+    ScopedTimer timer(StegTimer::TimerLabel::DECRYPT);
+
+    // Create a random number generator with seed 0 for the IV
+    RNG rng(0);
+
+    // Get the block length of this algorithm
+    uint32_t blockLength = GetBlockLength(algo);
+
+    // Derive key from the password
+    std::vector<byte> key = DeriveKey(pass, blockLength, kdf, rng);
+
+    StegTimer::StartTimer(StegTimer::TimerLabel::CIPHER);
+
+    size_t dataSize;
+    if (algo == Algorithm::ALGO_CHACHA20) {
+        dataSize = DecryptChaCha(key, iv, data, length);
+    } else {
+        switch (mode) {
+            case Mode::MODE_CBC:
+                dataSize = DecryptCBC(key, iv, data, length, algo);
+                break;
+            case Mode::MODE_CTR:
+            case Mode::MODE_GCM:
+                dataSize = DecryptCounter(key, iv, data, length, mode);
+                break;
+            default:
+                throw std::invalid_argument("Unsupported Mode");
+        }
+    }
+
+    StegTimer::EndTimer(StegTimer::TimerLabel::CIPHER);
+
+    return dataSize;
+
+}
+
+struct StegCrypt::CipherStream::State {
+
+    bool Encrypt;
+    Algorithm Algo;
+
+    // ChaCha20-Poly1305 uses the layout of GCM
+    Mode CipherMode;
+
+    // Everything after the prefix is the body: data followed by the padding or tag
+    uint64_t DataSize;
+    uint64_t BodySize;
+    uint64_t Position = 0;
+
+    // AES
+    std::optional<BlockCipher> Cipher;
+
+    // CBC: the previous ciphertext block
+    std::array<byte, BlockCipher::BlockSize> Chain;
+
+    // CTR, GCM and ChaCha20-Poly1305
+    std::array<byte, NonceLength> Nonce;
+
+    // GCM: the running GHASH of the ciphertext
+    std::optional<GHash> Hash;
+    GHash::Element HashState;
+
+    // ChaCha20-Poly1305: the cipher and the running MAC of the ciphertext
+    std::optional<ChaCha20> Stream;
+    std::optional<Poly1305> Mac;
+
+    // GCM and ChaCha20-Poly1305: the computed (encryption) or received (decryption) tag
+    std::array<byte, TagLength> Tag;
+    bool HasTag = false;
+
+    // CBC decryption: the last padding byte
+    byte LastByte = 0;
+
+    // The tag of everything hashed so far, once all of the data has been
+    void ComputeTag(byte* tag) const {
+        if (Algo == Algorithm::ALGO_CHACHA20) {
+            FinishPoly1305(*Mac, DataSize, tag);
+        } else {
+            FinishTag(*Cipher, *Hash, HashState, Nonce.data(), DataSize, tag);
+        }
+    }
+
+    // The tag may be split across pieces, encryption writes it out and decryption keeps it for Finish
+    void TransferTag(std::span<byte> piece, size_t dataBytes) {
+        if (dataBytes == piece.size()) {
+            return;
+        }
+        if (Encrypt && !HasTag) {
+            ComputeTag(Tag.data());
+            HasTag = true;
+        }
+        size_t tagOffset = Position + dataBytes - DataSize;
+        for (size_t i = dataBytes; i < piece.size(); i++) {
+            if (Encrypt) {
+                piece[i] = Tag[tagOffset++];
+            } else {
+                Tag[tagOffset++] = piece[i];
+            }
+        }
+    }
+
+};
+
+StegCrypt::CipherStream::CipherStream(const std::vector<byte>& pass, std::span<byte> prefix, uint32_t size, bool encrypt, Algorithm algo, Mode mode, const KDFParams& kdf) {
+
+    uint32_t dataOffset = GetDataOffset(algo, mode);
+    if (prefix.size() != dataOffset) {
+        throw std::invalid_argument("Prefix size does not match the IV or nonce length");
+    }
+    if (!encrypt && size < dataOffset) {
+        throw std::runtime_error("Encrypted payload is too short");
+    }
+
+    // Create a random number generator with seed 0 for the salt
+    RNG rng(0);
+
+    // Get the block length of this algorithm
+    uint32_t blockLength = GetBlockLength(algo);
+
+    // Derive key from the password
+    std::vector<byte> key = DeriveKey(pass, blockLength, kdf, rng);
+
+    Data = CreateScope<State>();
+    Data->Encrypt = encrypt;
+    Data->Algo = algo;
+
+    // From here on ChaCha20-Poly1305 is treated as GCM
+    mode = GetLayoutMode(algo, mode);
+    Data->CipherMode = mode;
+
+    if (encrypt) {
+        Data->DataSize = size;
+        Data->BodySize = GetEncryptedSize(size, algo, mode) - dataOffset;
+    } else {
+        Data->BodySize = size - dataOffset;
+        if (mode == Mode::MODE_CBC && (Data->BodySize == 0 || Data->BodySize % blockLength != 0)) {
+            throw std::runtime_error("Encrypted payload has an invalid length");
+        }
+        if (mode == Mode::MODE_GCM && Data->BodySize < TagLength) {
+            throw std::runtime_error("Encrypted payload is too short");
+        }
+        Data->DataSize = mode == Mode::MODE_GCM ? Data->BodySize - TagLength : Data->BodySize;
+    }
+
+    if (mode == Mode::MODE_CBC) {
+        if (encrypt) {
+            GetIV(prefix);
+        }
+        std::copy(prefix.begin(), prefix.begin() + BlockCipher::BlockSize, Data->Chain.begin());
+    } else {
+        if (encrypt) {
+            GetNonce(prefix);
+        }
+        std::copy(prefix.begin(), prefix.end(), Data->Nonce.begin());
+    }
+
+    if (algo == Algorithm::ALGO_CHACHA20) {
+        Data->Stream.emplace(&key[0], Data->Nonce.data());
+        Data->Mac.emplace(CreatePoly1305(*Data->Stream));
+    } else {
+        Data->Cipher.emplace(&key[0], key.size());
+        if (mode == Mode::MODE_GCM) {
+            Data->Hash.emplace(CreateGHash(*Data->Cipher));
+        }
+    }
+
+}
+
+StegCrypt::CipherStream::~CipherStream() = default;
+
+void StegCrypt::CipherStream::Update(std::span<byte> piece) {
+
+    ScopedTimer timer(StegTimer::TimerLabel::CIPHER);
+
+    State& state = *Data;
+    if (state.Position + piece.size() > state.BodySize) {
+        throw std::invalid_argument("Piece extends past the end of the payload");
+    }
+
+    // Part of the piece that is data, the rest is padding or tag
+    size_t dataBytes = state.Position < state.DataSize ? std::min<uint64_t>(piece.size(), state.DataSize - state.Position) : 0;
+
+    if (state.Algo == Algorithm::ALGO_CHACHA20) {
+
+        // The MAC covers the ciphertext, so hash after encrypting and before decrypting
+        if (state.Encrypt) {
+            ParallelChaChaXor(*state.Stream, state.Position, piece.data(), dataBytes);
+        }
+        state.Mac->Update(piece.data(), dataBytes);
+        if (!state.Encrypt) {
+            ParallelChaChaXor(*state.Stream, state.Position, piece.data(), dataBytes);
+        }
+        state.TransferTag(piece, dataBytes);
+
+    } else {
+
+        BlockCipher& cipher = *state.Cipher;
+        switch (state.CipherMode) {
+            case Mode::MODE_CBC: {
+                if (state.Encrypt) {
+                    std::fill(piece.begin() + dataBytes, piece.end(), byte(state.BodySize - state.DataSize));
+                }
+
+                // A trailing partial block is left as it is, like CBC over the whole buffer
+                size_t blockCount = piece.size() / BlockCipher::BlockSize;
+                if (blockCount == 0) {
+                    break;
+                }
+                byte* lastBlock = piece.data() + (blockCount - 1) * BlockCipher::BlockSize;
+                if (state.Encrypt) {
+                    cipher.EncryptCBC(state.Chain.data(), piece.data(), blockCount);
+                    std::copy(lastBlock, lastBlock + BlockCipher::BlockSize, state.Chain.begin());
+                } else {
+                    std::array<byte, BlockCipher::BlockSize> nextChain;
+                    std::copy(lastBlock, lastBlock + BlockCipher::BlockSize, nextChain.begin());
+                    cipher.DecryptCBC(state.Chain.data(), piece.data(), blockCount);
+                    state.Chain = nextChain;
+                }
+                break;
+            }
+            case Mode::MODE_CTR: {
+                uint32_t counter = 1 + uint32_t(state.Position / BlockCipher::BlockSize);
+                ParallelCounterXor(cipher, state.Nonce.data(), counter, piece.data(), piece.size());
+                break;
+            }
+            case Mode::MODE_GCM: {
+                uint32_t counter = 2 + uint32_t(state.Position / BlockCipher::BlockSize);
+                uint64_t blockCount = (dataBytes + BlockCipher::BlockSize - 1) / BlockCipher::BlockSize;
+
+                // The tag covers the ciphertext, so hash after encrypting and before decrypting
+                if (state.Encrypt) {
+                    ParallelCounterXor(cipher, state.Nonce.data(), counter, piece.data(), dataBytes);
+                }
+                GHash::Element pieceState = ParallelGHash(*state.Hash, piece.data(), dataBytes);
+                state.HashState = state.Hash->Combine(state.HashState, pieceState, blockCount);
+                if (!state.Encrypt) {
+                    ParallelCounterXor(cipher, state.Nonce.data(), counter, piece.data(), dataBytes);
+                }
+                state.TransferTag(piece, dataBytes);
+                break;
+            }
+            default:
+                throw std::invalid_argument("Unsupported Mode");
+        }
+
+    }
+
+    state.Position += piece.size();
+    if (!piece.empty()) {
+        state.LastByte = piece.back();
+    }
+
+}
+
+uint32_t StegCrypt::CipherStream::Finish() {
+
+    State& state = *Data;
+    if (state.Position != state.BodySize) {
+        throw std::runtime_error("Cipher stream ended before the whole payload was processed");
+    }
+
+    if (state.Encrypt) {
+        return uint32_t(state.DataSize);
+    }
+
+    if (state.CipherMode == Mode::MODE_CBC) {
+
+        // PKCS7 Padding
+        uint32_t padAmount = state.LastByte;
+        if (padAmount == 0 || padAmount > GetBlockLength(state.Algo)) {
+            throw std::runtime_error("Encrypted payload has invalid padding");
+        }
+        return uint32_t(state.BodySize - padAmount);
+
+    } else if (state.CipherMode == Mode::MODE_GCM) {
+
+        std::array<byte, TagLength> tag;
+        state.ComputeTag(tag.data());
+        if (!EqualTags(tag.data(), state.Tag.data(), TagLength)) {
+            throw std::runtime_error("Could not authenticate payload");
+        }
+
+    }
+
+    return uint32_t(state.DataSize);
+
+}
+
+// Layout: IV || data || padding
+void StegCrypt::EncryptCBC(const std::vector<byte>& key, std::span<byte> buffer, uint32_t dataSize, Algorithm algo) {
+
+    // Get the block length of this algorithm
+    uint32_t blockLength = GetBlockLength(algo);
+
+    // IV is BLOCK_SIZE bytes long and goes in front of the data
+    std::span<byte> iv = buffer.first(blockLength);
+    GetIV(iv);
+
+    // Data is padded to nearest blockLength bytes
+    std::span<byte> paddedData = buffer.subspan(blockLength);
+    AddPadding(paddedData, dataSize);
+
+    BlockCipher cipher(&key[0], key.size());
+    cipher.EncryptCBC(iv.data(), paddedData.data(), paddedData.size() / BlockCipher::BlockSize);
+
+}
+
+size_t StegCrypt::DecryptCBC(const std::vector<byte>& key, const byte* iv, byte* data, size_t length, Algorithm algo) {
+
+    // Get the block length of this algorithm
+    uint32_t blockLength = GetBlockLength(algo);
+
+    // Data is always padded by at least one byte up to a multiple of blockLength
+    if (length == 0 || length % blockLength != 0) {
+        throw std::runtime_error("Encrypted payload has an invalid length");
+    }
+
+    BlockCipher cipher(&key[0], key.size());
+    cipher.DecryptCBC(iv, data, length / BlockCipher::BlockSize);
+
+    return RemovePadding(std::span<const byte>(data, length), blockLength);
+
+}
+
+// Layout: nonce || ciphertext (|| tag for GCM)
+void StegCrypt::EncryptCounter(const std::vector<byte>& key, std::span<byte> buffer, uint32_t dataSize, Mode mode) {
+
+    BlockCipher cipher(&key[0], key.size());
+
+    // The nonce goes in front of the data
+    std::span<byte> nonce = buffer.first(NonceLength);
+    GetNonce(nonce);
+    byte *dataBytes = &buffer[NonceLength];
+
+    // GCM reserves counter 1 for the tag
+    uint32_t firstCounter = mode == Mode::MODE_GCM ? 2 : 1;
+    ParallelCounterXor(cipher, nonce.data(), firstCounter, dataBytes, dataSize);
+
+    if (mode == Mode::MODE_GCM) {
+        ComputeTag(cipher, nonce.data(), dataBytes, dataSize, dataBytes + dataSize);
+    }
+
+}
+
+size_t StegCrypt::DecryptCounter(const std::vector<byte>& key, const byte* nonce, byte* data, size_t length, Mode mode) {
+
+    uint32_t tagLength = mode == Mode::MODE_GCM ? TagLength : 0;
+    if (length < tagLength) {
+        throw std::runtime_error("Encrypted payload is too short");
+    }
+    size_t dataSize = length - tagLength;
+
+    BlockCipher cipher(&key[0], key.size());
+
+    // Authenticate before decrypting so modified plaintext is never returned
+    if (mode == Mode::MODE_GCM) {
+        std::array<byte, TagLength> tag;
+        ComputeTag(cipher, nonce, data, dataSize, tag.data());
+        if (!EqualTags(tag.data(), data + dataSize, TagLength)) {
+            throw std::runtime_error("Could not authenticate payload");
+        }
+    }
+
+    uint32_t firstCounter = mode == Mode::MODE_GCM ? 2 : 1;
+    ParallelCounterXor(cipher, nonce, firstCounter, data, dataSize);
+
+    return dataSize;
+
+}
+
+// Layout: nonce || ciphertext || tag
+void StegCrypt::EncryptChaCha(const std::vector<byte>& key, std::span<byte> buffer, uint32_t dataSize) {
+
+    // The nonce goes in front of the data
+    std::span<byte> nonce = buffer.first(NonceLength);
+    GetNonce(nonce);
+    byte *dataBytes = &buffer[NonceLength];
+
+    ChaCha20 cipher(&key[0], nonce.data());
+    ParallelChaChaXor(cipher, 0, dataBytes, dataSize);
+
+    // The tag covers the ciphertext
+    ComputePoly1305Tag(cipher, dataBytes, dataSize, dataBytes + dataSize);
+
+}
+
+size_t StegCrypt::DecryptChaCha(const std::vector<byte>& key, const byte* nonce, byte* data, size_t length) {
+
+    if (length < TagLength) {
+        throw std::runtime_error("Encrypted payload is too short");
+    }
+    size_t dataSize = length - TagLength;
+
+    ChaCha20 cipher(&key[0], nonce);
+
+    // Authenticate before decrypting so modified plaintext is never returned
+    std::array<byte, TagLength> tag;
+    ComputePoly1305Tag(cipher, data, dataSize, tag.data());
+    if (!EqualTags(tag.data(), data + dataSize, TagLength)) {
+        throw std::runtime_error("Could not authenticate payload");
+    }
+
+    ParallelChaChaXor(cipher, 0, data, dataSize);
+
+    return dataSize;
+
+}
+
+// A nonce must never repeat under the same key, so it does not come from the seeded RNG
+void StegCrypt::GetNonce(std::span<byte> nonce) {
+    std::random_device device;
+    for (uint32_t i = 0; i < NonceLength; i += 4) {
+        uint32_t value = device();
+        for (uint32_t j = 0; j < 4; j++) {
+            nonce[i + j] = byte(value >> (8 * j));
+        }
+    }
+}
+
+// A CBC IV must not be predictable, and one key encrypts every payload of a password (and every part of an archive),
+// so it does not come from the seeded RNG either
+// Only the first 16 bytes are random, the rest of a longer IV is zero
+void StegCrypt::GetIV(std::span<byte> iv) {
+    std::fill(iv.begin(), iv.end(), 0);
+    std::random_device device;
+    for (uint32_t i = 0; i < BlockCipher::BlockSize; i += 4) {
+        uint32_t value = device();
+        for (uint32_t j = 0; j < 4; j++) {
+            iv[i + j] = byte(value >> (8 * j));
+        }
+    }
+}
+
+std::vector<byte> StegCrypt::DeriveKey(const std::vector<byte>& pass, uint32_t keySize, const KDFParams& kdf, RNG& rng) {
+
+    // Cache hits are timed too, so the KDF statistics show what the cache saves
+    ScopedTimer timer(StegTimer::TimerLabel::KDF);
+
+    kdf.Validate();
+
+    // Generate a cryptographic salt
+    std::vector<byte> salt(keySize);
+    for (uint32_t i = 0; i < keySize; i++) {
+        salt[i] = rng.Next() & 0xFF;
+    }
+
+    // Array to hold the resulting key bytes
+    std::vector<byte> key(keySize);
+
+    // The salt only depends on the key size, so a password always derives the same key
+    if (ScopedKeys && ScopedKeys->Find(pass, salt, kdf, key)) {
+        return key;
+    }
+    KeyCache& cache = GetKeyCache();
+    if (cache.Find(pass, salt, kdf, key)) {
+        if (ScopedKeys) {
+            ScopedKeys->Insert(pass, salt, kdf, key);
+        }
+        return key;
+    }
+
+    // Derive key using Argon2
+    // The reference implementation fills each lane on its own thread
+    int result = argon2i_hash_raw(kdf.TimeCost, kdf.MemoryCost, kdf.Lanes, &pass[0], pass.size(), &salt[0], salt.size(), &key[0], keySize);
+    if (result != ARGON2_OK) {
+        throw std::runtime_error(std::string("Could not derive key: ") + argon2_error_message(result));
+    }
+
+    cache.Insert(pass, salt, kdf, key);
+    if (ScopedKeys) {
+        ScopedKeys->Insert(pass, salt, kdf, key);
+    }
+
+    return key;
+
+}
+
+// PKCS7 Padding
+// Fills everything after the first dataSize bytes with the padding amount
+void StegCrypt::AddPadding(std::span<byte> paddedData, size_t dataSize) {
+    byte padAmount = byte(paddedData.size() - dataSize);
+    std::fill(paddedData.begin() + dataSize, paddedData.end(), padAmount);
+}
+
+// PKCS7 Padding
+// Returns the size of the data without its padding
+size_t StegCrypt::RemovePadding(std::span<const byte> paddedData, uint32_t blockLength) {
+    uint32_t padAmount = paddedData.back();
+    if (padAmount == 0 || padAmount > blockLength) {
+        throw std::runtime_error("Encrypted payload has invalid padding");
+    }
+    return paddedData.size() - padAmount;
+}
+
+uint32_t StegCrypt::GetBlockLength(Algorithm algo) {
+    switch (algo) {
+        case Algorithm::ALGO_AES128:
+            return 16;
+        case Algorithm::ALGO_AES192:
+            return 24;
+        case Algorithm::ALGO_AES256:
+        case Algorithm::ALGO_CHACHA20:
+            return 32;
+        default:
+            throw std::invalid_argument("Unsupported Algorithm");
+            return 0;
+    }
+}
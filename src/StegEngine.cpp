@@ -1,392 +1,1240 @@
-#include "StegEngine.h"
-
-#include "StegCrypt.h"
-#include "RGBImage.h"
-#include "StegTimer.h"
-
-using namespace Steg;
-
-void StegEngine::Encode(Image& image, const std::vector<byte>& data, const EncoderSettings& settings) {
-
-    // Start the Encode Timer
-    StegTimer::StartTimer(StegTimer::TimerLabel::ENCODE);
-
-    // Encrypt the payload if necessary
-    std::vector<byte> payload;
-    if (settings.Encryption.EncryptPayload) {
-        payload = StegCrypt::Encrypt(settings.Encryption.EncryptionPassword, data, settings.Encryption.Algo);
-    } else {
-        payload = data;
-    }
-
-    // Number of bytes in the data payload
-    uint32_t payloadByteCount = payload.size();
-
-    // Check size constraints in a separate method
-    if (!CanEncode(image, payloadByteCount, settings)) {
-        throw std::runtime_error("Not enough space in image to encode data");
-    }
-
-    // Width of the image
-    uint32_t width = image.GetWidth();
-
-    // Height of the image
-    uint32_t height = image.GetHeight();
-
-    // Pixel width of the image
-    uint32_t bytesPerPixel = image.GetPixelWidth();
-
-    // Number of pixels in the image
-    uint32_t pixelCount = width * height;
-
-    // Skip over the alpha channel while encoding
-    bool skipAlpha = !(image.HasAlpha() && settings.EncodeInAlpha);
-
-    /* Prepend data vector with header information */
-
-    std::vector<byte> header;
-
-    // Add headerByteCount to header
-    // This value is 6 right now, but this will be different for variable header sizes
-    // Note: This number includes this byte
-    header.push_back(byte(HeaderSize));
-
-    // Add dataByteCount to header
-    header.push_back((byte) (payloadByteCount >> 24 & 0xFF));
-    header.push_back((byte) (payloadByteCount >> 16 & 0xFF));
-    header.push_back((byte) (payloadByteCount >> 8 & 0xFF));
-    header.push_back((byte) (payloadByteCount & 0xFF));
-
-    // Add encoder settings to header
-    byte settingsByte = settings.ToByte();
-    header.push_back(settingsByte);
-
-    // Create an index vector that holds all possible indices for data to be hidden in
-    // An index corresponds to a byte within a pixel and the seed is the first byte of the first channel of the first pixel
-    // Index 0 is invalid because the seed for the RNG is stored there
-    uint32_t indexCount = pixelCount * bytesPerPixel;
-
-    // Get the seed for the RNG
-    // It will always be the first byte of the image.
-    uint32_t seed = image.GetByte(0);
-
-    // Create the RNG
-    // Random Engine generates integers on [0, indexCount - 2]
-    RNG rng(seed, indexCount - 2);
-
-    // Fill the index vector
-    std::vector<uint32_t> indices = GenerateIndices(indexCount, rng);
-
-    /* Hide information in the image */
-
-    // Write header information first
-    // Since encoding information will be unavailable when decoding, default to the most conservative settings
-    // DataDepth for the header is effectively 1 bit
-    // skipAlpha is effectively true
-    uint32_t byteIndex, k = 0;
-    for (uint32_t i = 0; i < header.size(); i++) {
-        byte datum = header[i];
-
-        // Get each part and insert it into the image
-        for (uint32_t partIndex = 0; partIndex < 8; partIndex++) {
-            // Skip bytes until byteIndex is a color channel
-            do {
-                byteIndex = indices[k++];
-            } while (image.IsAlphaIndex(byteIndex));
-
-            byte shiftAmount = 7 - partIndex;
-            byte part = (datum >> shiftAmount) & 0x1;
-
-            // Combine the data with the image
-            part |= image.GetByte(byteIndex) & (0xFF << 1);
-            image.SetByte(byteIndex, part);
-        }
-    }
-
-    const uint16_t pixelMask = GetPixelMask(image.GetBitDepth(), settings.DataDepth);
-    const byte partMask = GetPartMask(image.GetBitDepth(), settings.DataDepth);
-
-    // Write data payload next
-    // Get a byte of data and insert it into the image
-    for (uint32_t i = 0; i < payloadByteCount; i++) {
-        byte datum = payload[i];
-
-        // Split the byte into parts
-        uint32_t partCount = 8 / settings.DataDepth;
-
-        // Get each part and insert it into the image
-        for (uint32_t partIndex = 0; partIndex < partCount; partIndex++) {
-            byteIndex = indices[k++];
-
-            if (skipAlpha) {
-                // Skip bytes until byteIndex is a color channel
-                while (image.IsAlphaIndex(byteIndex)) {
-                    byteIndex = indices[k++];
-                }
-            }
-
-            byte shiftAmount = (8 - settings.DataDepth) - (partIndex * settings.DataDepth);
-            byte part = (datum >> shiftAmount) & partMask;
-
-            // Combine the data with the image
-            part |= image.GetByte(byteIndex) & pixelMask;
-            image.SetByte(byteIndex, part);
-        }
-    }
-
-    // End the Encode Timer
-    StegTimer::EndTimer(StegTimer::TimerLabel::ENCODE);
-
-}
-
-std::vector<byte> StegEngine::Decode(const Image& image, const std::vector<byte> key) {
-
-    // Start the Decode Timer
-    StegTimer::StartTimer(StegTimer::TimerLabel::DECODE);
-
-    // Width of the image
-    uint32_t width = image.GetWidth();
-
-    // Height of the image
-    uint32_t height = image.GetHeight();
-
-    // Pixel width of the image
-    uint32_t bytesPerPixel = image.GetPixelWidth();
-
-    // Number of pixels in the image
-    uint32_t pixelCount = width * height;
-
-    // Create an index vector that holds all possible indices for data to be hidden in
-    // An index corresponds to a byte within a pixel and the seed is the first byte of the first channel of the first pixel
-    // Index 0 is invalid because the seed for the RNG is stored there
-    uint32_t indexCount = pixelCount * bytesPerPixel;
-
-    // Get the seed for the RNG
-    // It will always be the first byte of the image.
-    uint32_t seed = image.GetByte(0);
-
-    // Create the RNG
-    // Random Engine generates integers on [0, indexCount - 2]
-    RNG rng(seed, indexCount - 2);
-
-    // Fill the index vector
-    std::vector<uint32_t> indices = GenerateIndices(indexCount, rng);
-
-    /* Find information in the image */
-
-    // Get the first byte of the header (header size)
-    uint32_t byteIndex, k = 0;
-    uint32_t headerSize = 0;
-    uint32_t partCount = 8;
-    for (uint32_t partIndex = 0; partIndex < partCount; partIndex++) {
-        // Skip bytes until byteIndex is a color channel
-        do {
-            byteIndex = indices[k++];
-        } while (image.IsAlphaIndex(byteIndex));
-
-        // Extract the data from the image
-        headerSize <<= 1;
-        headerSize |= image.GetByte(byteIndex) & 0x1;
-    }
-
-    if (headerSize == 0) {
-        throw "Could not decode image!";
-    }
-
-    // Read the rest of the header information
-    // Since encoding information is unavailable here, default to the most conservative settings
-    // DataDepth for the header is effectively 1 bit
-    // skipAlpha is effectively true
-    std::vector<byte> header;
-    for (uint32_t i = 0; i < headerSize - uint32_t(1); i++) {
-
-        // Get each part and insert it into the image
-        byte datum = 0;
-        for (uint32_t partIndex = 0; partIndex < partCount; partIndex++) {
-            // Skip bytes until byteIndex is a color channel
-            do {
-                byteIndex = indices[k++];
-            } while (image.IsAlphaIndex(byteIndex));
-
-            // Extract the data from the image
-            datum <<= 1;
-            datum |= image.GetByte(byteIndex) & 0x1;
-        }
-
-        header.push_back(datum);
-    }
-
-    // Compute the size of the payload
-    uint32_t payloadByteCount = header[0];
-    payloadByteCount <<= 8;
-    payloadByteCount |= header[1];
-    payloadByteCount <<= 8;
-    payloadByteCount |= header[2];
-    payloadByteCount <<= 8;
-    payloadByteCount |= header[3];
-
-    // Reconstruct the EncoderSettings
-    byte settingsByte = header[4];
-    EncoderSettings settings = EncoderSettings::FromByte(settingsByte);
-    settings.Encryption.EncryptionPassword = key;
-
-    // Skip over the alpha channel while encoding
-    bool skipAlpha = !(image.HasAlpha() && settings.EncodeInAlpha);
-
-    const uint16_t pixelMask = GetPixelMask(image.GetBitDepth(), settings.DataDepth);
-    const byte partMask = GetPartMask(image.GetBitDepth(), settings.DataDepth);
-
-    // Read data payload next
-    // Get a byte of data and insert it into the image
-    std::vector<byte> payload;
-    for (uint32_t i = 0; i < payloadByteCount; i++) {
-        // Split the byte into parts
-        uint32_t partCount = 8 / settings.DataDepth;
-
-        // Get each part and insert it into the image
-        byte datum = 0;
-        for (uint32_t partIndex = 0; partIndex < partCount; partIndex++) {
-            byteIndex = indices[k++];
-
-            if (skipAlpha) {
-                // Skip bytes until byteIndex is a color channel
-                while (image.IsAlphaIndex(byteIndex)) {
-                    byteIndex = indices[k++];
-                }
-            }
-
-            // Extract the data from the image
-            byte shiftAmount = (8 - settings.DataDepth) - (partIndex * settings.DataDepth);
-            datum |= (image.GetByte(byteIndex) & partMask) << shiftAmount;
-        }
-
-        payload.push_back(datum);
-    }
-
-    // Decrypt the payload if necessary
-    std::vector<byte> data;
-    if (settings.Encryption.EncryptPayload) {
-        data = StegCrypt::Decrypt(settings.Encryption.EncryptionPassword, payload, settings.Encryption.Algo);
-    } else {
-        data = payload;
-    }
-
-    // End the Decode Timer
-    StegTimer::EndTimer(StegTimer::TimerLabel::DECODE);
-
-    return data;
-
-}
-
-uint32_t StegEngine::CalculateAvailableBytes(const Image& image, const EncoderSettings& settings) {
-
-    // Calculate the total available parts
-    uint32_t availableParts;
-    if (settings.EncodeInAlpha || !image.HasAlpha()) {
-        availableParts = image.GetPixelWidth() * image.GetWidth() * image.GetHeight();
-    } else {
-        uint32_t bytesPerChannel = image.GetBitDepth() / 8;
-        availableParts = (image.GetPixelWidth() - bytesPerChannel) * image.GetWidth() * image.GetHeight();
-    }
-
-    // Subtract one byte from the available size for the seed (first byte of the image is unavailable)
-    availableParts--;
-
-    byte dataDepth = settings.DataDepth;
-    uint32_t partsPerByte = 8 / dataDepth;
-
-    if (settings.Encryption.EncryptPayload) {
-
-        uint32_t blockSize = StegCrypt::GetBlockLength(settings.Encryption.Algo);
-
-        // Integer division floors the result (this is good)
-        uint32_t maxBytes = availableParts / partsPerByte;
-
-        // Integer division floors the result (this is good)
-        uint32_t maxBlocks = maxBytes / blockSize;
-
-        // Subtract 1 for the IV
-        uint32_t availableBlocks = maxBlocks - 1;
-
-        // Subtract 1 byte to account for padding
-        // 15n bytes of data will get 1 byte of padding
-        // 16n bytes of data will get 16 bytes of padding even though size % 16 == 0
-        uint32_t availableBytes = availableBlocks * blockSize - 1;
-
-        return availableBytes - HeaderSize;
-
-    } else {
-
-        // Integer division floors the result (this is good)
-        return (availableParts / partsPerByte) - HeaderSize;
-
-    }
-
-}
-
-// Ex: bitDepth = 8, dataDepth = 2 => 1111'1111'1111'1100
-// Ex: bitDepth = 8, dataDepth = 4 => 1111'1111'1111'0000
-uint16_t StegEngine::GetPixelMask(uint32_t imageBitDepth, uint32_t dataBitDepth) {
-    uint16_t mask = 0xFFFF;
-    mask <<= dataBitDepth;
-    if (imageBitDepth == 16) {
-        return mask;
-    } else if (imageBitDepth == 8) {
-        return mask & 0xFF;
-    } else {
-        throw std::invalid_argument("Invalid Image bit depth: " + imageBitDepth);
-    }
-}
-
-byte StegEngine::GetPartMask(uint32_t imageBitDepth, uint32_t dataBitDepth) {
-    byte mask = 0xFF;
-    if (imageBitDepth == 16) {
-        return mask >> (8 - dataBitDepth);
-    } else if (imageBitDepth == 8) {
-        return mask >> (8 - dataBitDepth);
-    } else {
-        throw std::invalid_argument("Invalid Image bit depth: " + imageBitDepth);
-        return 0;
-    }
-}
-
-std::vector<uint32_t> StegEngine::GenerateIndices(uint32_t indexCount, RNG& rng) {
-    std::vector<uint32_t> indices(indexCount - 1);
-    for (uint32_t i = 0; i < indices.size(); i++) {
-        indices[i] = i + 1;
-    }
-
-    // Indices are bytes and they are ordered randomly
-    // Note that we pull *** values from the RNG in the process
-    for (uint32_t i = 0; i < indices.size() - 2; i++) {
-        uint32_t j = i + (rng.Next() % (indexCount - 1 - i));
-        std::iter_swap(indices.begin() + i, indices.begin() + j);
-    }
-    return indices;
-}
-
-bool StegEngine::CanEncode(const Image& image, uint32_t payloadSize, const EncoderSettings& settings) {
-    uint32_t totalSize = HeaderSize + payloadSize;
-
-    // Calculate the total available parts
-    uint32_t availableParts;
-    if (settings.EncodeInAlpha || !image.HasAlpha()) {
-        availableParts = image.GetPixelWidth() * image.GetWidth() * image.GetHeight();
-    } else {
-        uint32_t bytesPerChannel = image.GetBitDepth() / 8;
-        availableParts = (image.GetPixelWidth() - bytesPerChannel) * image.GetWidth() * image.GetHeight();
-    }
-
-    // Subtract one byte from the available size for the seed (first byte of the image is unavailable)
-    availableParts--;
-
-    // Check if the payload can be encoded in the image with the given settings
-    uint32_t totalParts = totalSize * 8 / settings.DataDepth;
-    if (totalParts > availableParts) {
-        return false;
-    }
-
-    // The payload can be encoded into the image with the specified settings
-    return true;
-
-}
+#include "StegEngine.h"
+
+#include "StegCrypt.h"
+#include "Async.h"
+#include "BlockScatter.h"
+#include "IndexCache.h"
+#include "Pipeline.h"
+#include "RGBImage.h"
+#include "StegTimer.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <set>
+#include <unordered_map>
+
+using namespace Steg;
+
+namespace {
+
+    // Bytes per chunk handed from one pipeline stage to the other (a multiple of the cipher block size)
+    constexpr size_t PipelineChunkSize = 64 * 1024;
+
+    IndexCache& GetIndexCache() {
+        static IndexCache cache;
+        return cache;
+    }
+
+    void AppendBigEndian(std::vector<byte>& bytes, uint32_t value) {
+        bytes.push_back(byte(value >> 24));
+        bytes.push_back(byte(value >> 16));
+        bytes.push_back(byte(value >> 8));
+        bytes.push_back(byte(value));
+    }
+
+    uint32_t ReadBigEndian(const byte* bytes) {
+        return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+    }
+
+    // Hands out the indices of GenerateIndices(indexCount, rng) one at a time, drawing from rng in the same order
+    // A position is final once its swap is done, so only the entries swapped further back have to be remembered
+    // and a short prefix of the order costs time and memory in its own length rather than in the size of the image
+    // Once that map would cost more than the plain array GenerateIndices fills, the rest is drawn in one
+    class IndexStream {
+
+    public:
+
+        IndexStream(uint32_t indexCount, RNG& rng) : IndexCount(indexCount), Size(indexCount - 1), Rng(rng) {}
+
+        uint32_t Next() {
+            if (Position >= Size) {
+                throw std::runtime_error("Payload exceeds the image capacity");
+            }
+
+            // GenerateIndices does not swap the last two positions
+            uint32_t index;
+            if (!Dense.empty()) {
+                if (Position + 2 < Size) {
+                    uint32_t j = Position + (Rng.Next() % (IndexCount - 1 - Position));
+                    std::swap(Dense[Position], Dense[j]);
+                }
+                index = Dense[Position];
+            } else if (Position + 2 < Size) {
+                uint32_t j = Position + (Rng.Next() % (IndexCount - 1 - Position));
+                index = Get(j);
+                Moved[j] = Get(Position);
+                Moved.erase(Position);
+            } else {
+                index = Get(Position);
+            }
+
+            Position++;
+            if (Dense.empty() && Moved.size() > Size / DenseRatio) {
+                MakeDense();
+            }
+            return index;
+        }
+
+        uint32_t Remaining() const {
+            return Size - Position;
+        }
+
+    private:
+
+        // Once the map holds more than 1 / DenseRatio of the positions the array is faster
+        static constexpr uint32_t DenseRatio = 256;
+
+        // Entries nobody swapped still hold their starting value
+        uint32_t Get(uint32_t position) const {
+            auto it = Moved.find(position);
+            return it == Moved.end() ? position + 1 : it->second;
+        }
+
+        void MakeDense() {
+            Dense.resize(Size);
+            for (uint32_t i = Position; i < Size; i++) {
+                Dense[i] = i + 1;
+            }
+            for (auto [position, index] : Moved) {
+                Dense[position] = index;
+            }
+            Moved.clear();
+        }
+
+        uint32_t IndexCount;
+        uint32_t Size;
+        uint32_t Position = 0;
+        RNG& Rng;
+
+        // Values of the positions after Position that a swap changed
+        std::unordered_map<uint32_t, uint32_t> Moved;
+
+        // The whole order once the map grew too large, positions before Position are stale
+        CountedVector<uint32_t> Dense;
+
+    };
+
+}
+
+class StegEngine::PayloadCursor {
+
+public:
+
+    explicit PayloadCursor(const Image& image) : Carrier(image), IndexCount(image.GetWidth() * image.GetHeight() * image.GetPixelWidth()),
+                                                 Rng(image.GetByte(0), IndexCount - 2), Stream(IndexCount, Rng) {
+
+        // The seed and order of the indices are the ones Encode used
+        std::vector<uint32_t> headerIndices;
+        Settings = ReadHeader(image, [&]() {
+            headerIndices.push_back(Stream.Next());
+            return headerIndices.back();
+        }, PayloadByteCount);
+
+        // The full order goes on where the header stopped, the block order is drawn from the same RNG
+        if (Settings.LocalScatter) {
+            std::sort(headerIndices.begin(), headerIndices.end());
+            Scatter.emplace(IndexCount, Rng, std::move(headerIndices));
+            Blocks.emplace(*Scatter);
+        }
+
+        SkipAlpha = !(image.HasAlpha() && Settings.EncodeInAlpha);
+        PartCount = 8 / Settings.DataDepth;
+
+        uint32_t remaining = Blocks ? Blocks->Remaining() : Stream.Remaining();
+        if (uint64_t(PayloadByteCount) * PartCount > remaining) {
+            throw std::runtime_error("Payload size in header exceeds the image capacity");
+        }
+
+    }
+
+    const EncoderSettings& GetSettings() const {
+        return Settings;
+    }
+
+    uint32_t GetPayloadSize() const {
+        return PayloadByteCount;
+    }
+
+    // Payload bytes handed out or skipped so far
+    uint32_t GetPosition() const {
+        return Position;
+    }
+
+    // Index positions of the next byteCount payload bytes, including the alpha ones EmbedPayload and ExtractPayload skip
+    CountedVector<uint32_t> Take(uint32_t byteCount) {
+        Advance(byteCount);
+
+        StegTimer::StartTimer(StegTimer::TimerLabel::INDEX_GENERATION);
+        CountedVector<uint32_t> indices;
+        indices.reserve(size_t(byteCount) * PartCount);
+        for (uint32_t i = 0; i < byteCount * PartCount; i++) {
+            uint32_t byteIndex;
+            do {
+                byteIndex = Blocks ? Blocks->Next() : Stream.Next();
+                indices.push_back(byteIndex);
+            } while (SkipAlpha && Carrier.IsAlphaIndex(byteIndex));
+        }
+        StegTimer::EndTimer(StegTimer::TimerLabel::INDEX_GENERATION);
+
+        return indices;
+    }
+
+    // Moves past the next byteCount payload bytes
+    // The blocks in between are not even generated when no alpha index has to be skipped
+    void Skip(uint32_t byteCount) {
+        if (Blocks && !SkipAlpha) {
+            Advance(byteCount);
+            Blocks->Skip(byteCount * PartCount);
+        } else {
+            Take(byteCount);
+        }
+    }
+
+    // Reads the next bytes.size() payload bytes
+    void Read(std::span<byte> bytes) {
+        ExtractPayload(Carrier, bytes, Take(bytes.size()), 0, Settings);
+    }
+
+private:
+
+    void Advance(uint32_t byteCount) {
+        if (byteCount > PayloadByteCount - Position) {
+            throw std::runtime_error("Read past the end of the payload");
+        }
+        Position += byteCount;
+    }
+
+    const Image& Carrier;
+    uint32_t IndexCount;
+    RNG Rng;
+    IndexStream Stream;
+    std::optional<BlockScatter> Scatter;
+    std::optional<BlockScatter::Cursor> Blocks;
+
+    EncoderSettings Settings;
+    uint32_t PayloadByteCount = 0;
+    bool SkipAlpha;
+    uint32_t PartCount;
+    uint32_t Position = 0;
+
+};
+
+void StegEngine::Encode(Image& image, const std::vector<byte>& data, const EncoderSettings& settings) {
+    EncodeSpan(image, data, settings);
+}
+
+void StegEngine::EncodeSpan(Image& image, std::span<const byte> data, const EncoderSettings& settings) {
+    if (settings.Archive) {
+        throw std::invalid_argument("Archives are encoded with EncodeArchive");
+    }
+    EncodePayload(image, data, settings, true);
+}
+
+void StegEngine::EncodePayload(Image& image, std::span<const byte> data, const EncoderSettings& settings, bool encrypt) {
+
+    // Start the Encode Timer, it ends when this function returns or throws
+    ScopedTimer timer(StegTimer::TimerLabel::ENCODE);
+
+    const EncryptionSettings& encryption = settings.Encryption;
+    bool encrypting = encrypt && encryption.EncryptPayload;
+    bool pipelined = encrypting && settings.Pipelined;
+
+    // Number of bytes in the data payload, the size of its encrypted form is known before it is encrypted
+    uint32_t payloadByteCount = encrypting
+            ? StegCrypt::GetEncryptedSize(data.size(), encryption.Algo, encryption.CipherMode)
+            : data.size();
+
+    // Check size constraints in a separate method
+    // This is done before anything else so a payload that does not fit leaves the image as it was
+    if (!CanEncode(image, payloadByteCount, settings)) {
+        throw std::runtime_error("Not enough space in image to encode data");
+    }
+
+    // Bring the image to a canonical PixelMode if requested
+    if (settings.NormalizeImage) {
+        image.ConvertTo(settings.NormalizedMode);
+    }
+
+    // Encrypt the payload if necessary
+    // Unencrypted data is embedded straight from the caller's buffer
+    // A pipelined payload is encrypted into this buffer while it is being embedded
+    std::vector<byte> encrypted;
+    MemoryTracker encryptedMemory;
+    std::span<const byte> payload = data;
+    if (pipelined) {
+        encrypted.resize(payloadByteCount);
+        payload = encrypted;
+    } else if (encrypting) {
+        // The data is copied in after the IV or nonce, like StegCrypt::Encrypt does
+        encrypted.resize(payloadByteCount);
+        std::copy(data.begin(), data.end(), encrypted.begin() + StegCrypt::GetDataOffset(encryption.Algo, encryption.CipherMode));
+        StegCrypt::EncryptInPlace(encryption.EncryptionPassword, encrypted, data.size(), encryption.Algo,
+                                  encryption.CipherMode, encryption.KDF);
+        payload = encrypted;
+    }
+    encryptedMemory.Track(encrypted);
+
+    // A cancelled task stops before anything is written to the image
+    Cancellation::ThrowIfRequested();
+
+    // Width of the image
+    uint32_t width = image.GetWidth();
+
+    // Height of the image
+    uint32_t height = image.GetHeight();
+
+    // Pixel width of the image
+    uint32_t bytesPerPixel = image.GetPixelWidth();
+
+    // Number of pixels in the image
+    uint32_t pixelCount = width * height;
+
+    /* Prepend data vector with header information */
+
+    std::vector<byte> header;
+
+    // Add headerByteCount to header
+    // This value is 6 plus the size of the extended header
+    // Note: This number includes this byte
+    header.push_back(byte(GetHeaderSize(settings)));
+
+    // Add dataByteCount to header
+    header.push_back((byte) (payloadByteCount >> 24 & 0xFF));
+    header.push_back((byte) (payloadByteCount >> 16 & 0xFF));
+    header.push_back((byte) (payloadByteCount >> 8 & 0xFF));
+    header.push_back((byte) (payloadByteCount & 0xFF));
+
+    // Add encoder settings to header
+    byte settingsByte = settings.ToByte();
+    header.push_back(settingsByte);
+
+    // Add extended settings to header
+    std::vector<byte> extendedHeader = settings.ToExtendedHeader();
+    header.insert(header.end(), extendedHeader.begin(), extendedHeader.end());
+
+    // Create an index vector that holds all possible indices for data to be hidden in
+    // An index corresponds to a byte within a pixel and the seed is the first byte of the first channel of the first pixel
+    // Index 0 is invalid because the seed for the RNG is stored there
+    uint32_t indexCount = pixelCount * bytesPerPixel;
+
+    // Get the seed for the RNG
+    // It will always be the first byte of the image.
+    uint32_t seed = image.GetByte(0);
+
+    // Writes the header and returns the position of the first payload index
+    Ref<const CountedVector<uint32_t>> indices;
+    auto writeHeader = [&]() {
+
+        // Create the RNG
+        // Random Engine generates integers on [0, indexCount - 2]
+        RNG rng(seed, indexCount - 2);
+
+        // The header takes the first indices of the full order
+        // With LocalScatter only those are drawn, the payload order is drawn from the same RNG afterwards
+        uint32_t k = 0;
+        std::vector<uint32_t> headerIndices;
+        IndexStream stream(indexCount, rng);
+        std::function<uint32_t()> nextIndex;
+        if (settings.LocalScatter) {
+            nextIndex = [&]() {
+                headerIndices.push_back(stream.Next());
+                return headerIndices.back();
+            };
+        } else {
+            // Fill the index vector, or take it from the index cache
+            StegTimer::StartTimer(StegTimer::TimerLabel::INDEX_GENERATION);
+            indices = GetIndices(indexCount, seed);
+            StegTimer::EndTimer(StegTimer::TimerLabel::INDEX_GENERATION);
+            nextIndex = [&]() { return (*indices)[k++]; };
+        }
+
+        Cancellation::ThrowIfRequested();
+
+        /* Hide information in the image */
+
+        StegTimer::StartTimer(StegTimer::TimerLabel::HEADER_WRITE);
+
+        // Write header information first
+        // Since encoding information will be unavailable when decoding, default to the most conservative settings
+        // DataDepth for the header is effectively 1 bit
+        // skipAlpha is effectively true
+        uint32_t byteIndex;
+        for (uint32_t i = 0; i < header.size(); i++) {
+            byte datum = header[i];
+
+            // Get each part and insert it into the image
+            for (uint32_t partIndex = 0; partIndex < 8; partIndex++) {
+                // Skip bytes until byteIndex is a color channel
+                do {
+                    byteIndex = nextIndex();
+                } while (image.IsAlphaIndex(byteIndex));
+
+                byte shiftAmount = 7 - partIndex;
+                byte part = (datum >> shiftAmount) & 0x1;
+
+                // Combine the data with the image
+                part |= image.GetByte(byteIndex) & (0xFF << 1);
+                image.SetByte(byteIndex, part);
+            }
+        }
+
+        StegTimer::EndTimer(StegTimer::TimerLabel::HEADER_WRITE);
+
+        if (settings.LocalScatter) {
+            StegTimer::StartTimer(StegTimer::TimerLabel::INDEX_GENERATION);
+            indices = CreateRef<const CountedVector<uint32_t>>(GenerateBlockIndices(indexCount, rng, std::move(headerIndices)));
+            StegTimer::EndTimer(StegTimer::TimerLabel::INDEX_GENERATION);
+        }
+
+        return k;
+
+    };
+
+    if (pipelined) {
+
+        // One thread encrypts chunks in place while this one embeds the chunks that are done
+        // Key derivation on the other thread overlaps index generation and the header here
+        std::span<byte> buffer = encrypted;
+        uint32_t dataOffset = StegCrypt::GetDataOffset(encryption.Algo, encryption.CipherMode);
+        uint32_t k = 0;
+        std::optional<ScopedTimer> embedTimer;
+
+        RunPipeline([&](auto&& emit) {
+
+            // Zones on this thread are not nested in the Encode zone
+            ScopedTimer encryptTimer(StegTimer::TimerLabel::ENCRYPT);
+
+            StegCrypt::CipherStream stream(encryption.EncryptionPassword, buffer.first(dataOffset), data.size(), true,
+                                           encryption.Algo, encryption.CipherMode, encryption.KDF);
+            emit(Chunk{0, dataOffset});
+
+            for (size_t offset = dataOffset; offset < buffer.size(); offset += PipelineChunkSize) {
+                std::span<byte> piece = buffer.subspan(offset, std::min(PipelineChunkSize, buffer.size() - offset));
+
+                // Copy in the data part of the chunk, the stream adds the padding or tag after it
+                size_t dataStart = std::min(offset - dataOffset, data.size());
+                size_t dataEnd = std::min(offset - dataOffset + piece.size(), data.size());
+                std::copy(data.begin() + dataStart, data.begin() + dataEnd, piece.begin());
+
+                stream.Update(piece);
+                emit(Chunk{offset, piece.size()});
+            }
+            stream.Finish();
+
+        }, [&](const Chunk& chunk) {
+
+            // Throwing here also stops the encryption thread
+            Cancellation::ThrowIfRequested();
+
+            // Embedding is timed from the first chunk, not while waiting for the key
+            if (!embedTimer) {
+                embedTimer.emplace(StegTimer::TimerLabel::EMBED);
+                k = writeHeader();
+            }
+
+            StegTimer::StartTimer(StegTimer::TimerLabel::PAYLOAD_EMBED);
+            k = EmbedPayload(image, buffer.subspan(chunk.Offset, chunk.Size), *indices, k, settings);
+            StegTimer::EndTimer(StegTimer::TimerLabel::PAYLOAD_EMBED);
+
+        });
+
+    } else {
+
+        ScopedTimer embedTimer(StegTimer::TimerLabel::EMBED);
+
+        uint32_t k = writeHeader();
+
+        StegTimer::StartTimer(StegTimer::TimerLabel::PAYLOAD_EMBED);
+        EmbedPayload(image, payload, *indices, k, settings);
+        StegTimer::EndTimer(StegTimer::TimerLabel::PAYLOAD_EMBED);
+
+    }
+
+}
+
+std::vector<byte> StegEngine::Decode(const Image& image, const std::vector<byte>& key) {
+    DecoderSettings settings;
+    settings.EncryptionPassword = key;
+    return Decode(image, settings);
+}
+
+std::vector<byte> StegEngine::Decode(const Image& image, const DecoderSettings& decoderSettings) {
+
+    // Start the Decode Timer, it ends when this function returns or throws
+    ScopedTimer timer(StegTimer::TimerLabel::DECODE);
+
+    // Start the Extract Timer
+    StegTimer::StartTimer(StegTimer::TimerLabel::EXTRACT);
+
+    // Width of the image
+    uint32_t width = image.GetWidth();
+
+    // Height of the image
+    uint32_t height = image.GetHeight();
+
+    // Pixel width of the image
+    uint32_t bytesPerPixel = image.GetPixelWidth();
+
+    // Number of pixels in the image
+    uint32_t pixelCount = width * height;
+
+    // Create an index vector that holds all possible indices for data to be hidden in
+    // An index corresponds to a byte within a pixel and the seed is the first byte of the first channel of the first pixel
+    // Index 0 is invalid because the seed for the RNG is stored there
+    uint32_t indexCount = pixelCount * bytesPerPixel;
+
+    // Get the seed for the RNG
+    // It will always be the first byte of the image.
+    uint32_t seed = image.GetByte(0);
+
+    // Create the RNG
+    // Random Engine generates integers on [0, indexCount - 2]
+    RNG rng(seed, indexCount - 2);
+
+    /* Find information in the image */
+
+    // The header takes the first indices of the full order, only those are drawn until the settings are known
+    std::vector<uint32_t> headerIndices;
+    IndexStream stream(indexCount, rng);
+    uint32_t payloadByteCount;
+    EncoderSettings settings = ReadHeader(image, [&]() {
+        headerIndices.push_back(stream.Next());
+        return headerIndices.back();
+    }, payloadByteCount);
+
+    if (settings.Archive) {
+        throw std::runtime_error("The image holds an archive, its entries are read with ExtractEntry");
+    }
+
+    // Fill the index vector
+    // The full order is drawn again from the start or taken from the index cache,
+    // the block order continues from where the header stopped
+    StegTimer::StartTimer(StegTimer::TimerLabel::INDEX_GENERATION);
+    Ref<const CountedVector<uint32_t>> order;
+    uint32_t k = 0;
+    if (settings.LocalScatter) {
+        order = CreateRef<const CountedVector<uint32_t>>(GenerateBlockIndices(indexCount, rng, std::move(headerIndices)));
+    } else {
+        order = GetIndices(indexCount, seed);
+        k = headerIndices.size();
+    }
+    const CountedVector<uint32_t>& indices = *order;
+    StegTimer::EndTimer(StegTimer::TimerLabel::INDEX_GENERATION);
+
+    Cancellation::ThrowIfRequested();
+    settings.Encryption.EncryptionPassword = decoderSettings.EncryptionPassword;
+
+    const EncryptionSettings& encryption = settings.Encryption;
+
+    // A corrupt or foreign header must not cause a huge allocation
+    if (uint64_t(payloadByteCount) * (8 / settings.DataDepth) > indices.size() - k) {
+        throw std::runtime_error("Payload size in header exceeds the image capacity");
+    }
+
+    // The data is handed to the caller, so it only counts until this function returns
+    std::vector<byte> data;
+    MemoryTracker dataMemory;
+    if (encryption.EncryptPayload && decoderSettings.Pipelined) {
+
+        // The IV or nonce is extracted first, then one thread extracts chunks while this one decrypts them
+        // The data is extracted to the front of its own buffer so it is returned without moving it
+        uint32_t dataOffset = StegCrypt::GetDataOffset(encryption.Algo, encryption.CipherMode);
+        if (payloadByteCount < dataOffset) {
+            throw std::runtime_error("Encrypted payload is too short");
+        }
+        CountedVector<byte> prefix(dataOffset);
+        k = ExtractPayload(image, prefix, indices, k, settings);
+
+        // The rest is extracted on the other thread, which times it in a zone of its own
+        StegTimer::EndTimer(StegTimer::TimerLabel::EXTRACT);
+
+        data.resize(payloadByteCount - dataOffset);
+        dataMemory.Track(data);
+        std::span<byte> body = data;
+        Scope<StegCrypt::CipherStream> stream;
+
+        RunPipeline([&](auto&& emit) {
+
+            ScopedTimer extractTimer(StegTimer::TimerLabel::EXTRACT);
+
+            for (size_t offset = 0; offset < body.size(); offset += PipelineChunkSize) {
+                std::span<byte> piece = body.subspan(offset, std::min(PipelineChunkSize, body.size() - offset));
+                k = ExtractPayload(image, piece, indices, k, settings);
+                emit(Chunk{offset, piece.size()});
+            }
+
+        }, [&](const Chunk& chunk) {
+
+            // Throwing here also stops the extraction thread
+            Cancellation::ThrowIfRequested();
+
+            if (!stream) {
+                StegTimer::StartTimer(StegTimer::TimerLabel::DECRYPT);
+                stream = CreateScope<StegCrypt::CipherStream>(encryption.EncryptionPassword, prefix, payloadByteCount, false,
+                                                              encryption.Algo, encryption.CipherMode, encryption.KDF);
+            }
+
+            stream->Update(body.subspan(chunk.Offset, chunk.Size));
+
+        });
+
+        // Without any chunks the stream still has to check an empty body
+        if (!stream) {
+            StegTimer::StartTimer(StegTimer::TimerLabel::DECRYPT);
+            stream = CreateScope<StegCrypt::CipherStream>(encryption.EncryptionPassword, prefix, payloadByteCount, false,
+                                                          encryption.Algo, encryption.CipherMode, encryption.KDF);
+        }
+
+        data.resize(stream->Finish());
+
+        StegTimer::EndTimer(StegTimer::TimerLabel::DECRYPT);
+
+    } else {
+
+        // Read data payload next
+        std::vector<byte> payload(payloadByteCount);
+        MemoryTracker payloadMemory(payload);
+        ExtractPayload(image, payload, indices, k, settings);
+
+        StegTimer::EndTimer(StegTimer::TimerLabel::EXTRACT);
+
+        Cancellation::ThrowIfRequested();
+
+        // Decrypt the payload if necessary
+        if (encryption.EncryptPayload) {
+            data = StegCrypt::Decrypt(encryption.EncryptionPassword, payload, encryption.Algo,
+                                      encryption.CipherMode, encryption.KDF);
+        } else {
+            data = std::move(payload);
+        }
+
+        // A moved payload now belongs to data and must not be counted twice
+        payloadMemory.Track(payload);
+        dataMemory.Track(data);
+
+    }
+
+    return data;
+
+}
+
+uint32_t StegEngine::DecodeInto(const Image& image, std::span<byte> output, const DecoderSettings& decoderSettings) {
+
+    // Start the Decode Timer, it ends when this function returns or throws
+    ScopedTimer timer(StegTimer::TimerLabel::DECODE);
+
+    PayloadCursor cursor(image);
+    const EncryptionSettings& encryption = cursor.GetSettings().Encryption;
+    uint32_t payloadByteCount = cursor.GetPayloadSize();
+
+    if (cursor.GetSettings().Archive) {
+        throw std::runtime_error("The image holds an archive, its entries are read with ExtractEntry");
+    }
+    if (output.size() < payloadByteCount) {
+        throw std::length_error("Output buffer is smaller than the payload");
+    }
+
+    // The payload is extracted straight into the caller's buffer
+    std::span<byte> payload = output.first(payloadByteCount);
+    StegTimer::StartTimer(StegTimer::TimerLabel::EXTRACT);
+    cursor.Read(payload);
+    StegTimer::EndTimer(StegTimer::TimerLabel::EXTRACT);
+
+    if (!encryption.EncryptPayload) {
+        return payloadByteCount;
+    }
+
+    Cancellation::ThrowIfRequested();
+
+    // The data ends up behind the IV or nonce and is moved to the front
+    std::span<byte> data = StegCrypt::DecryptInPlace(decoderSettings.EncryptionPassword, payload, encryption.Algo,
+                                                     encryption.CipherMode, encryption.KDF);
+    std::memmove(output.data(), data.data(), data.size());
+    return data.size();
+
+}
+
+EncoderSettings StegEngine::Probe(const Image& image, uint32_t& payloadByteCount) {
+    PayloadCursor cursor(image);
+    payloadByteCount = cursor.GetPayloadSize();
+    return cursor.GetSettings();
+}
+
+Task<void> StegEngine::EncodeAsync(Image& image, std::vector<byte> data, EncoderSettings settings) {
+    co_await ResumeOnPool();
+    Encode(image, data, settings);
+}
+
+Task<std::vector<byte>> StegEngine::DecodeAsync(const Image& image, DecoderSettings settings) {
+    co_await ResumeOnPool();
+    co_return Decode(image, settings);
+}
+
+void StegEngine::Patch(Image& image, uint32_t offset, const std::vector<byte>& bytes, const std::vector<byte>& key) {
+
+    // Start the Patch Timer, it ends when this function returns or throws
+    ScopedTimer timer(StegTimer::TimerLabel::PATCH);
+
+    PayloadCursor cursor(image);
+    EncoderSettings settings = cursor.GetSettings();
+    settings.Encryption.EncryptionPassword = key;
+    uint32_t payloadByteCount = cursor.GetPayloadSize();
+
+    const EncryptionSettings& encryption = settings.Encryption;
+
+    if (settings.Archive) {
+        throw std::runtime_error("Archives cannot be patched");
+    }
+
+    // Where the data starts in the payload and how long it is
+    // Authenticated payloads end with a tag
+    uint32_t dataOffset = 0;
+    uint32_t dataSize = payloadByteCount;
+    bool authenticated = false;
+    if (encryption.EncryptPayload) {
+        // ChaCha20-Poly1305 ignores the cipher mode
+        if (encryption.CipherMode == StegCrypt::Mode::MODE_CBC && encryption.Algo != StegCrypt::Algorithm::ALGO_CHACHA20) {
+            throw std::invalid_argument("Only CTR, GCM and ChaCha20-Poly1305 payloads can be patched");
+        }
+        uint32_t overhead = StegCrypt::GetEncryptedSize(0, encryption.Algo, encryption.CipherMode);
+        if (payloadByteCount < overhead) {
+            throw std::runtime_error("Encrypted payload is too short");
+        }
+        dataOffset = StegCrypt::GetDataOffset(encryption.Algo, encryption.CipherMode);
+        dataSize = payloadByteCount - overhead;
+        authenticated = overhead > dataOffset;
+    }
+
+    if (uint64_t(offset) + bytes.size() > dataSize) {
+        throw std::invalid_argument("Patch range exceeds the payload");
+    }
+
+    uint32_t rangeStart = dataOffset + offset;
+
+    if (!encryption.EncryptPayload) {
+
+        // Nothing before the range has to be read
+        cursor.Skip(rangeStart);
+        EmbedPayload(image, bytes, cursor.Take(bytes.size()), 0, settings);
+
+    } else if (!authenticated) {
+
+        // CTR: Only the nonce and the range take part
+        CountedVector<byte> prefix(dataOffset);
+        cursor.Read(prefix);
+        cursor.Skip(offset);
+
+        CountedVector<byte> body(bytes.size());
+        StegCrypt::PatchInPlace(key, prefix, body, offset, bytes, encryption.Algo, encryption.CipherMode, encryption.KDF);
+        EmbedPayload(image, body, cursor.Take(bytes.size()), 0, settings);
+
+    } else {
+
+        // GCM and ChaCha20-Poly1305: Patching in place would reuse the nonce, so the payload is decrypted, which checks
+        // the tag before anything is written, and sealed again with a fresh nonce
+        // Every carrier byte of the payload is written, only the index positions after it are not drawn
+        CountedVector<byte> payload(payloadByteCount);
+        StegTimer::StartTimer(StegTimer::TimerLabel::EXTRACT);
+        CountedVector<uint32_t> payloadIndices = cursor.Take(payloadByteCount);
+        ExtractPayload(image, payload, payloadIndices, 0, settings);
+        StegTimer::EndTimer(StegTimer::TimerLabel::EXTRACT);
+
+        // The key is derived once for both
+        StegCrypt::KeyScope keys;
+        std::span<byte> data = StegCrypt::DecryptInPlace(key, payload, encryption.Algo, encryption.CipherMode, encryption.KDF);
+        std::copy(bytes.begin(), bytes.end(), data.begin() + offset);
+        StegCrypt::EncryptInPlace(key, payload, dataSize, encryption.Algo, encryption.CipherMode, encryption.KDF);
+
+        EmbedPayload(image, payload, payloadIndices, 0, settings);
+
+    }
+
+}
+
+void StegEngine::EncodeArchive(Image& image, const std::vector<ArchiveEntry>& entries, const EncoderSettings& settings) {
+
+    const EncryptionSettings& encryption = settings.Encryption;
+
+    std::set<std::string> names;
+    for (const ArchiveEntry& entry : entries) {
+        if (entry.Name.size() > 0xFFFF) {
+            throw std::invalid_argument("Archive entry name is too long: " + entry.Name.substr(0, 64) + "...");
+        }
+        if (!names.insert(entry.Name).second) {
+            throw std::invalid_argument("Duplicate archive entry name: " + entry.Name);
+        }
+    }
+
+    // The table and every entry are encrypted on their own with one key
+    StegCrypt::KeyScope keys;
+    auto seal = [&](const std::vector<byte>& data) {
+        if (!encryption.EncryptPayload) {
+            return data;
+        }
+        return StegCrypt::Encrypt(encryption.EncryptionPassword, data, encryption.Algo, encryption.CipherMode, encryption.KDF);
+    };
+
+    // The table has a fixed size per entry, so the offsets are known before it is encrypted
+    uint64_t tableSize = 4;
+    for (const ArchiveEntry& entry : entries) {
+        tableSize += 2 + entry.Name.size() + 8;
+    }
+    if (tableSize > std::numeric_limits<uint32_t>::max() / 2) {
+        throw std::invalid_argument("Archive is too large");
+    }
+    uint32_t sealedTableSize = tableSize;
+    if (encryption.EncryptPayload) {
+        sealedTableSize = StegCrypt::GetEncryptedSize(tableSize, encryption.Algo, encryption.CipherMode);
+    }
+
+    // Encrypt the entries first and then describe them in the table
+    std::vector<std::vector<byte>> sealedEntries;
+    std::vector<byte> table;
+    AppendBigEndian(table, entries.size());
+    uint64_t offset = ArchiveTableOffset + uint64_t(sealedTableSize);
+    for (const ArchiveEntry& entry : entries) {
+        sealedEntries.push_back(seal(entry.Data));
+        uint64_t size = sealedEntries.back().size();
+        if (offset + size > std::numeric_limits<uint32_t>::max()) {
+            throw std::invalid_argument("Archive is too large");
+        }
+
+        table.push_back(byte(entry.Name.size() >> 8));
+        table.push_back(byte(entry.Name.size()));
+        table.insert(table.end(), entry.Name.begin(), entry.Name.end());
+        AppendBigEndian(table, offset);
+        AppendBigEndian(table, size);
+        offset += size;
+    }
+
+    // Layout: sealed table size, sealed table, sealed entries
+    std::vector<byte> payload;
+    MemoryTracker payloadMemory;
+    payload.reserve(offset);
+    AppendBigEndian(payload, sealedTableSize);
+    std::vector<byte> sealedTable = seal(table);
+    payload.insert(payload.end(), sealedTable.begin(), sealedTable.end());
+    for (const std::vector<byte>& sealedEntry : sealedEntries) {
+        payload.insert(payload.end(), sealedEntry.begin(), sealedEntry.end());
+    }
+    payloadMemory.Track(payload);
+
+    EncoderSettings archiveSettings = settings;
+    archiveSettings.Archive = true;
+    EncodePayload(image, payload, archiveSettings, false);
+
+}
+
+std::vector<std::string> StegEngine::ListEntries(const Image& image, const std::vector<byte>& key) {
+
+    ScopedTimer timer(StegTimer::TimerLabel::DECODE);
+
+    PayloadCursor cursor(image);
+    std::vector<std::string> names;
+    for (ArchiveTableEntry& entry : ReadArchiveTable(cursor, key)) {
+        names.push_back(std::move(entry.Name));
+    }
+    return names;
+
+}
+
+std::vector<byte> StegEngine::ExtractEntry(const Image& image, const std::string& name, const std::vector<byte>& key) {
+
+    // Start the Decode Timer, it ends when this function returns or throws
+    ScopedTimer timer(StegTimer::TimerLabel::DECODE);
+
+    // The key derived for the table is used for the entry again
+    StegCrypt::KeyScope keys;
+
+    PayloadCursor cursor(image);
+    std::vector<ArchiveTableEntry> table = ReadArchiveTable(cursor, key);
+    auto entry = std::find_if(table.begin(), table.end(), [&](const ArchiveTableEntry& entry) { return entry.Name == name; });
+    if (entry == table.end()) {
+        throw std::invalid_argument("No archive entry named " + name);
+    }
+
+    // Go straight to the entry, the cursor is at the end of the table
+    cursor.Skip(entry->Offset - cursor.GetPosition());
+    std::vector<byte> sealed(entry->Size);
+    MemoryTracker sealedMemory(sealed);
+    StegTimer::StartTimer(StegTimer::TimerLabel::EXTRACT);
+    cursor.Read(sealed);
+    StegTimer::EndTimer(StegTimer::TimerLabel::EXTRACT);
+
+    const EncryptionSettings& encryption = cursor.GetSettings().Encryption;
+    if (!encryption.EncryptPayload) {
+        return sealed;
+    }
+    return StegCrypt::Decrypt(key, sealed, encryption.Algo, encryption.CipherMode, encryption.KDF);
+
+}
+
+std::vector<StegEngine::ArchiveTableEntry> StegEngine::ReadArchiveTable(PayloadCursor& cursor, const std::vector<byte>& key) {
+
+    if (!cursor.GetSettings().Archive) {
+        throw std::runtime_error("The image does not hold an archive");
+    }
+    uint32_t payloadByteCount = cursor.GetPayloadSize();
+
+    // Size of the sealed table
+    std::array<byte, ArchiveTableOffset> sizeBytes;
+    if (payloadByteCount < sizeBytes.size()) {
+        throw std::runtime_error("Archive table of contents is corrupt");
+    }
+    cursor.Read(sizeBytes);
+    uint32_t sealedTableSize = ReadBigEndian(sizeBytes.data());
+    if (sealedTableSize > payloadByteCount - ArchiveTableOffset) {
+        throw std::runtime_error("Archive table of contents is corrupt");
+    }
+
+    std::vector<byte> table(sealedTableSize);
+    StegTimer::StartTimer(StegTimer::TimerLabel::EXTRACT);
+    cursor.Read(table);
+    StegTimer::EndTimer(StegTimer::TimerLabel::EXTRACT);
+
+    const EncryptionSettings& encryption = cursor.GetSettings().Encryption;
+    if (encryption.EncryptPayload) {
+        table = StegCrypt::Decrypt(key, table, encryption.Algo, encryption.CipherMode, encryption.KDF);
+    }
+
+    // Every entry has to lie after the table and inside the payload, in the order they were written
+    std::vector<ArchiveTableEntry> entries;
+    size_t position = 0;
+    auto require = [&](size_t size) {
+        if (table.size() - position < size) {
+            throw std::runtime_error("Archive table of contents is corrupt");
+        }
+    };
+    require(4);
+    uint32_t entryCount = ReadBigEndian(table.data());
+    position += 4;
+    uint64_t end = ArchiveTableOffset + uint64_t(sealedTableSize);
+    for (uint32_t i = 0; i < entryCount; i++) {
+        ArchiveTableEntry entry;
+        require(2);
+        size_t nameSize = (size_t(table[position]) << 8) | table[position + 1];
+        position += 2;
+        require(nameSize + 8);
+        entry.Name.assign(table.begin() + position, table.begin() + position + nameSize);
+        position += nameSize;
+        entry.Offset = ReadBigEndian(&table[position]);
+        entry.Size = ReadBigEndian(&table[position + 4]);
+        position += 8;
+        if (entry.Offset < end || uint64_t(entry.Offset) + entry.Size > payloadByteCount) {
+            throw std::runtime_error("Archive table of contents is corrupt");
+        }
+        end = uint64_t(entry.Offset) + entry.Size;
+        entries.push_back(std::move(entry));
+    }
+
+    return entries;
+
+}
+
+EncoderSettings StegEngine::ReadHeader(const Image& image, const std::function<uint32_t()>& nextIndex, uint32_t& payloadByteCount) {
+
+    // Get the first byte of the header (header size)
+    uint32_t byteIndex;
+    uint32_t headerSize = 0;
+    uint32_t partCount = 8;
+    for (uint32_t partIndex = 0; partIndex < partCount; partIndex++) {
+        // Skip bytes until byteIndex is a color channel
+        do {
+            byteIndex = nextIndex();
+        } while (image.IsAlphaIndex(byteIndex));
+
+        // Extract the data from the image
+        headerSize <<= 1;
+        headerSize |= image.GetByte(byteIndex) & 0x1;
+    }
+
+    if (headerSize < BaseHeaderSize) {
+        throw "Could not decode image!";
+    }
+
+    // Read the rest of the header information
+    // Since encoding information is unavailable here, default to the most conservative settings
+    // DataDepth for the header is effectively 1 bit
+    // skipAlpha is effectively true
+    std::vector<byte> header;
+    for (uint32_t i = 0; i < headerSize - uint32_t(1); i++) {
+
+        // Get each part and insert it into the image
+        byte datum = 0;
+        for (uint32_t partIndex = 0; partIndex < partCount; partIndex++) {
+            // Skip bytes until byteIndex is a color channel
+            do {
+                byteIndex = nextIndex();
+            } while (image.IsAlphaIndex(byteIndex));
+
+            // Extract the data from the image
+            datum <<= 1;
+            datum |= image.GetByte(byteIndex) & 0x1;
+        }
+
+        header.push_back(datum);
+    }
+
+    // Compute the size of the payload
+    payloadByteCount = header[0];
+    payloadByteCount <<= 8;
+    payloadByteCount |= header[1];
+    payloadByteCount <<= 8;
+    payloadByteCount |= header[2];
+    payloadByteCount <<= 8;
+    payloadByteCount |= header[3];
+
+    // Reconstruct the EncoderSettings
+    byte settingsByte = header[4];
+    EncoderSettings settings = EncoderSettings::FromByte(settingsByte);
+    settings.ReadExtendedHeader(std::vector<byte>(header.begin() + 5, header.end()));
+
+    return settings;
+
+}
+
+uint32_t StegEngine::EmbedPayload(Image& image, std::span<const byte> payload, const CountedVector<uint32_t>& indices, uint32_t k, const EncoderSettings& settings) {
+
+    // Skip over the alpha channel while encoding
+    bool skipAlpha = !(image.HasAlpha() && settings.EncodeInAlpha);
+
+    const uint16_t pixelMask = GetPixelMask(image.GetBitDepth(), settings.DataDepth);
+    const byte partMask = GetPartMask(image.GetBitDepth(), settings.DataDepth);
+
+    // Split each byte into parts
+    uint32_t partCount = 8 / settings.DataDepth;
+
+    // Get a byte of data and insert it into the image
+    uint32_t byteIndex;
+    for (byte datum : payload) {
+
+        // Get each part and insert it into the image
+        for (uint32_t partIndex = 0; partIndex < partCount; partIndex++) {
+            byteIndex = indices[k++];
+
+            if (skipAlpha) {
+                // Skip bytes until byteIndex is a color channel
+                while (image.IsAlphaIndex(byteIndex)) {
+                    byteIndex = indices[k++];
+                }
+            }
+
+            byte shiftAmount = (8 - settings.DataDepth) - (partIndex * settings.DataDepth);
+            byte part = (datum >> shiftAmount) & partMask;
+
+            // Combine the data with the image
+            part |= image.GetByte(byteIndex) & pixelMask;
+            image.SetByte(byteIndex, part);
+        }
+    }
+
+    return k;
+
+}
+
+uint32_t StegEngine::ExtractPayload(const Image& image, std::span<byte> payload, const CountedVector<uint32_t>& indices, uint32_t k, const EncoderSettings& settings) {
+
+    // Skip over the alpha channel while decoding
+    bool skipAlpha = !(image.HasAlpha() && settings.EncodeInAlpha);
+
+    const byte partMask = GetPartMask(image.GetBitDepth(), settings.DataDepth);
+
+    // Split each byte into parts
+    uint32_t partCount = 8 / settings.DataDepth;
+
+    // Get a byte of data out of the image
+    uint32_t byteIndex;
+    for (byte& datum : payload) {
+
+        // Get each part and combine it into the byte
+        datum = 0;
+        for (uint32_t partIndex = 0; partIndex < partCount; partIndex++) {
+            byteIndex = indices[k++];
+
+            if (skipAlpha) {
+                // Skip bytes until byteIndex is a color channel
+                while (image.IsAlphaIndex(byteIndex)) {
+                    byteIndex = indices[k++];
+                }
+            }
+
+            // Extract the data from the image
+            byte shiftAmount = (8 - settings.DataDepth) - (partIndex * settings.DataDepth);
+            datum |= (image.GetByte(byteIndex) & partMask) << shiftAmount;
+        }
+    }
+
+    return k;
+
+}
+
+uint32_t StegEngine::CalculateAvailableBytes(const Image& image, const EncoderSettings& settings) {
+
+    // Calculate the total available parts of the image as it will be encoded
+    PixelMode mode = GetEncodedMode(image, settings);
+    uint32_t availableParts = GetAvailableParts(image.GetWidth() * image.GetHeight(), mode, settings);
+
+    byte dataDepth = settings.DataDepth;
+    uint32_t partsPerByte = 8 / dataDepth;
+
+    uint32_t headerParts = GetHeaderPartCount(mode, settings);
+    if (availableParts < headerParts) {
+        return 0;
+    }
+
+    // Integer division floors the result (this is good)
+    uint32_t maxBytes = (availableParts - headerParts) / partsPerByte;
+
+    if (settings.Encryption.EncryptPayload) {
+
+        // Padding, IV and tag depend on the cipher
+        return StegCrypt::GetMaxDataSize(maxBytes, settings.Encryption.Algo, settings.Encryption.CipherMode);
+
+    } else {
+
+        return maxBytes;
+
+    }
+
+}
+
+bool StegEngine::HasSpace(const Image& image, size_t dataSize, const EncoderSettings& settings) {
+
+    // The header holds the payload size in 32 bits, which must leave room for the IV or nonce, padding and tag
+    if (dataSize > std::numeric_limits<uint32_t>::max() - 256) {
+        return false;
+    }
+
+    uint32_t payloadByteCount = dataSize;
+    if (settings.Encryption.EncryptPayload) {
+        payloadByteCount = StegCrypt::GetEncryptedSize(dataSize, settings.Encryption.Algo, settings.Encryption.CipherMode);
+    }
+    return CanEncode(image, payloadByteCount, settings);
+
+}
+
+uint32_t StegEngine::GetHeaderSize(const EncoderSettings& settings) {
+    return BaseHeaderSize + settings.ToExtendedHeader().size();
+}
+
+PixelMode StegEngine::GetEncodedMode(const Image& image, const EncoderSettings& settings) {
+    return settings.NormalizeImage ? settings.NormalizedMode : image.GetPixelMode();
+}
+
+uint32_t StegEngine::GetAvailableParts(uint32_t pixelCount, const PixelMode& mode, const EncoderSettings& settings) {
+
+    // Every byte of a pixel is a part, except the alpha channel if it is skipped
+    uint32_t availableParts = DispatchPixelMode(mode, [&]<PixelMode M>() {
+        if (settings.EncodeInAlpha || !PixelTraits<M>::HasAlpha) {
+            return PixelTraits<M>::PixelWidth * pixelCount;
+        } else {
+            return (PixelTraits<M>::PixelWidth - PixelTraits<M>::BytesPerSample) * pixelCount;
+        }
+    });
+
+    // Subtract one byte from the available size for the seed (first byte of the image is unavailable)
+    return availableParts - 1;
+
+}
+
+uint32_t StegEngine::GetHeaderPartCount(const PixelMode& mode, const EncoderSettings& settings) {
+
+    // The header is written 1 bit per part
+    uint32_t headerParts = GetHeaderSize(settings) * 8;
+
+    // The header always skips the alpha channel
+    // If the payload counts alpha bytes as available, the ones skipped by the header are lost, so reserve for them too
+    DispatchPixelMode(mode, [&]<PixelMode M>() {
+        if (settings.EncodeInAlpha && PixelTraits<M>::HasAlpha) {
+            uint32_t colorWidth = PixelTraits<M>::PixelWidth - PixelTraits<M>::BytesPerSample;
+            headerParts = headerParts * PixelTraits<M>::PixelWidth / colorWidth + 64;
+        }
+    });
+
+    return headerParts;
+
+}
+
+// Ex: bitDepth = 8, dataDepth = 2 => 1111'1111'1111'1100
+// Ex: bitDepth = 8, dataDepth = 4 => 1111'1111'1111'0000
+uint16_t StegEngine::GetPixelMask(uint32_t imageBitDepth, uint32_t dataBitDepth) {
+    uint16_t mask = 0xFFFF;
+    mask <<= dataBitDepth;
+    if (imageBitDepth == 16) {
+        return mask;
+    } else if (imageBitDepth == 8) {
+        return mask & 0xFF;
+    } else {
+        throw std::invalid_argument("Invalid Image bit depth: " + imageBitDepth);
+    }
+}
+
+byte StegEngine::GetPartMask(uint32_t imageBitDepth, uint32_t dataBitDepth) {
+    byte mask = 0xFF;
+    if (imageBitDepth == 16) {
+        return mask >> (8 - dataBitDepth);
+    } else if (imageBitDepth == 8) {
+        return mask >> (8 - dataBitDepth);
+    } else {
+        throw std::invalid_argument("Invalid Image bit depth: " + imageBitDepth);
+        return 0;
+    }
+}
+
+CountedVector<uint32_t> StegEngine::GenerateIndices(uint32_t indexCount, RNG& rng) {
+    CountedVector<uint32_t> indices(indexCount - 1);
+    for (uint32_t i = 0; i < indices.size(); i++) {
+        indices[i] = i + 1;
+    }
+
+    // Indices are bytes and they are ordered randomly
+    // Note that we pull *** values from the RNG in the process
+    for (uint32_t i = 0; i < indices.size() - 2; i++) {
+        uint32_t j = i + (rng.Next() % (indexCount - 1 - i));
+        std::iter_swap(indices.begin() + i, indices.begin() + j);
+    }
+    return indices;
+}
+
+void StegEngine::SetIndexCacheCapacity(size_t capacity) {
+    GetIndexCache().SetCapacity(capacity);
+}
+
+void StegEngine::ClearIndexCache() {
+    GetIndexCache().Clear();
+}
+
+Ref<const CountedVector<uint32_t>> StegEngine::GetIndices(uint32_t indexCount, uint32_t seed) {
+    IndexCache& cache = GetIndexCache();
+    Ref<const CountedVector<uint32_t>> indices = cache.Find(seed, indexCount);
+    if (!indices) {
+        RNG rng(seed, indexCount - 2);
+        indices = CreateRef<const CountedVector<uint32_t>>(GenerateIndices(indexCount, rng));
+        cache.Insert(seed, indexCount, indices);
+    }
+    return indices;
+}
+
+CountedVector<uint32_t> StegEngine::GenerateBlockIndices(uint32_t indexCount, RNG& rng, std::vector<uint32_t> headerIndices) {
+    std::sort(headerIndices.begin(), headerIndices.end());
+    return BlockScatter(indexCount, rng, std::move(headerIndices)).Generate();
+}
+
+bool StegEngine::CanEncode(const Image& image, uint32_t payloadSize, const EncoderSettings& settings) {
+    // Calculate the total available parts of the image as it will be encoded
+    PixelMode mode = GetEncodedMode(image, settings);
+    uint32_t availableParts = GetAvailableParts(image.GetWidth() * image.GetHeight(), mode, settings);
+
+    // Check if the payload can be encoded in the image with the given settings
+    uint64_t totalParts = GetHeaderPartCount(mode, settings) + uint64_t(payloadSize) * 8 / settings.DataDepth;
+    if (totalParts > availableParts) {
+        return false;
+    }
+
+    // The payload can be encoded into the image with the specified settings
+    return true;
+
+}
@@ -0,0 +1,83 @@
+#include "StegMemory.h"
+
+#include <algorithm>
+#include <atomic>
+
+using namespace Steg;
+
+namespace {
+
+    // Only the owning thread touches these
+    struct ThreadMemory {
+        uint64_t Allocated = 0;
+        int64_t Live = 0;
+
+        // Highest Live since the innermost open zone started
+        int64_t Peak = 0;
+    };
+
+    thread_local ThreadMemory Thread;
+
+    std::atomic<uint64_t> LiveBytes = 0;
+    std::atomic<uint64_t> PeakBytes = 0;
+
+}
+
+void StegMemory::Allocated(size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    Thread.Allocated += size;
+    Thread.Live += int64_t(size);
+    Thread.Peak = std::max(Thread.Peak, Thread.Live);
+
+    // Raise the process peak unless another thread already raised it further
+    uint64_t live = LiveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+    uint64_t peak = PeakBytes.load(std::memory_order_relaxed);
+    while (live > peak && !PeakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+void StegMemory::Deallocated(size_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    Thread.Live -= int64_t(size);
+    LiveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+uint64_t StegMemory::GetThreadAllocatedBytes() {
+    return Thread.Allocated;
+}
+
+int64_t StegMemory::GetThreadLiveBytes() {
+    return Thread.Live;
+}
+
+uint64_t StegMemory::GetLiveBytes() {
+    return LiveBytes.load(std::memory_order_relaxed);
+}
+
+uint64_t StegMemory::GetPeakBytes() {
+    return PeakBytes.load(std::memory_order_relaxed);
+}
+
+void StegMemory::ResetPeak() {
+    PeakBytes = LiveBytes.load(std::memory_order_relaxed);
+}
+
+StegMemory::ZoneMark StegMemory::EnterZone() {
+    ZoneMark mark{Thread.Allocated, Thread.Live, Thread.Peak};
+
+    // The zone's peak is measured from here, the enclosing zone gets it back when this one ends
+    Thread.Peak = Thread.Live;
+    return mark;
+}
+
+StegMemory::ZoneUsage StegMemory::LeaveZone(const ZoneMark& mark) {
+    ZoneUsage usage{Thread.Allocated - mark.Allocated, uint64_t(Thread.Peak - mark.Live)};
+    Thread.Peak = std::max(mark.OuterPeak, Thread.Peak);
+    return usage;
+}
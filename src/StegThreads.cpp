@@ -0,0 +1,13 @@
+#include "StegThreads.h"
+
+#include "ThreadPool.h"
+
+using namespace Steg;
+
+void StegThreads::Configure(const ThreadSettings& settings) {
+    ThreadPool::Configure(settings);
+}
+
+uint32_t StegThreads::GetWorkerCount() {
+    return uint32_t(ThreadPool::Get().GetWorkerCount());
+}
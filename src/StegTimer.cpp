@@ -1,44 +1,284 @@
-#include "StegTimer.h"
-#include <iostream>
-
-using namespace Steg;
-
-std::array<std::chrono::steady_clock::time_point, StegTimer::TimerLabel::TOTAL + 1> StegTimer::timers;
-
-std::array<std::chrono::milliseconds, StegTimer::TimerLabel::TOTAL + 1> StegTimer::elapsed;
-
-void StegTimer::StartTimer(TimerLabel timer) {
-    timers[timer] = std::chrono::steady_clock::now();
-}
-
-void StegTimer::EndTimer(TimerLabel timer) {
-    auto now = std::chrono::steady_clock::now();
-    elapsed[timer] = std::chrono::duration_cast<std::chrono::milliseconds>(now - timers[timer]);
-}
-
-void StegTimer::PrintTimers() {
-    for (int i = 0; i <= TimerLabel::TOTAL; i++) {
-        auto timer = static_cast<TimerLabel>(i);
-        auto duration = elapsed.at(i).count() / double(1000);
-        if (duration != 0) {
-            std::cout << GetTimerName(timer) << ": " << duration << "s" << std::endl;
-        }
-    }
-}
-
-std::string StegTimer::GetTimerName(TimerLabel timer) {
-    switch (timer) {
-        case ENCODE:
-            return "Encode";
-        case ENCRYPT:
-            return "Encrypt";
-        case DECODE:
-            return "Decode";
-        case DECRYPT:
-            return "Decrypt";
-        case TOTAL:
-            return "Total";
-        default:
-            return "Unknown Timer";
-    }
-}
+#include "StegTimer.h"
+
+#include "PerfCounters.h"
+#include "StegMemory.h"
+#include "StegTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <mutex>
+
+using namespace Steg;
+
+namespace {
+
+    // Durations kept per zone for the percentiles
+    constexpr size_t MaxSamples = 1024;
+
+    struct OpenZone {
+        StegTimer::TimerLabel Label;
+        std::chrono::steady_clock::time_point Start;
+        StegMemory::ZoneMark Memory;
+
+        // Counter values at the start, only read while counters are enabled
+        bool Counted;
+        PerfCounters::Values Counters;
+    };
+
+    struct Accumulator {
+        uint64_t Count = 0;
+        uint64_t Total = 0;
+        uint64_t Min = std::numeric_limits<uint64_t>::max();
+        uint64_t Max = 0;
+
+        // Reservoir sample of the durations
+        std::vector<uint64_t> Samples;
+
+        uint64_t AllocatedBytes = 0;
+        uint64_t PeakBytes = 0;
+
+        uint64_t Counted = 0;
+        PerfCounters::Values Counters = {};
+    };
+
+    std::atomic<bool> CountersEnabled = false;
+
+    // Zones are only ended on the thread that started them, so the stack needs no lock
+    thread_local std::vector<OpenZone> OpenZones;
+
+    // Ended zones from every thread
+    struct Registry {
+        std::mutex Mutex;
+        std::map<StegTimer::ZonePath, Accumulator> Zones;
+        std::minstd_rand Random;
+    };
+
+    // Never destroyed, pool workers can still be closing zones while static objects are torn down at exit
+    Registry& GetRegistry() {
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+
+    std::string FormatDuration(uint64_t nanoseconds) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.3fms", nanoseconds / 1e6);
+        return text;
+    }
+
+    std::string FormatBytes(uint64_t bytes) {
+        char text[32];
+        if (bytes < 1024) {
+            std::snprintf(text, sizeof(text), "%lluB", (unsigned long long) bytes);
+        } else if (bytes < 1024 * 1024) {
+            std::snprintf(text, sizeof(text), "%.1fKB", bytes / 1024.0);
+        } else {
+            std::snprintf(text, sizeof(text), "%.1fMB", bytes / (1024.0 * 1024.0));
+        }
+        return text;
+    }
+
+    std::string FormatCounters(const StegTimer::Statistics& statistics) {
+        char text[256];
+        std::snprintf(text, sizeof(text),
+                      ", cycles %llu, instructions %llu (IPC %.2f), LLC misses %llu, dTLB misses %llu, branch misses %llu",
+                      (unsigned long long) statistics.Cycles, (unsigned long long) statistics.Instructions,
+                      statistics.Cycles > 0 ? double(statistics.Instructions) / double(statistics.Cycles) : 0.0,
+                      (unsigned long long) statistics.LLCMisses, (unsigned long long) statistics.DTLBMisses,
+                      (unsigned long long) statistics.BranchMisses);
+        return text;
+    }
+
+}
+
+void StegTimer::StartTimer(TimerLabel timer) {
+    OpenZone zone{timer, {}, StegMemory::EnterZone(), false, {}};
+
+    // A thread whose counters could not be opened just times its zones
+    if (CountersEnabled.load(std::memory_order_relaxed)) {
+        PerfCounters& counters = PerfCounters::ForThread();
+        if (counters.IsAvailable()) {
+            zone.Counted = true;
+            zone.Counters = counters.Read();
+        }
+    }
+
+    zone.Start = std::chrono::steady_clock::now();
+    OpenZones.push_back(zone);
+}
+
+void StegTimer::EndTimer(TimerLabel timer) {
+    auto now = std::chrono::steady_clock::now();
+
+    // Read before the search below so the bookkeeping is not counted
+    PerfCounters::Values counters = {};
+    bool counted = !OpenZones.empty() && CountersEnabled.load(std::memory_order_relaxed);
+    if (counted) {
+        counters = PerfCounters::ForThread().Read();
+    }
+
+    // Find the innermost open zone with this label, an unmatched end is ignored
+    size_t index = OpenZones.size();
+    while (index > 0 && OpenZones[index - 1].Label != timer) {
+        index--;
+    }
+    if (index == 0) {
+        return;
+    }
+    index--;
+
+    uint64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(now - OpenZones[index].Start).count();
+    ZonePath path;
+    for (size_t i = 0; i <= index; i++) {
+        path.push_back(OpenZones[i].Label);
+    }
+    StegTrace::Record(timer, OpenZones[index].Start, now);
+
+    // Dropped zones give their peaks back before this one is measured
+    for (size_t i = OpenZones.size() - 1; i > index; i--) {
+        StegMemory::LeaveZone(OpenZones[i].Memory);
+    }
+    StegMemory::ZoneUsage memory = StegMemory::LeaveZone(OpenZones[index].Memory);
+
+    // Zones started before counters were enabled have no start values
+    counted = counted && OpenZones[index].Counted;
+    if (counted) {
+        for (size_t i = 0; i < PerfCounters::COUNT; i++) {
+            counters[i] -= OpenZones[index].Counters[i];
+        }
+    }
+    OpenZones.resize(index);
+
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.Mutex);
+    Accumulator& zone = registry.Zones[path];
+    zone.Count++;
+    zone.Total += duration;
+    zone.Min = std::min(zone.Min, duration);
+    zone.Max = std::max(zone.Max, duration);
+    zone.AllocatedBytes += memory.Allocated;
+    zone.PeakBytes = std::max(zone.PeakBytes, memory.Peak);
+    if (counted) {
+        zone.Counted++;
+        for (size_t i = 0; i < PerfCounters::COUNT; i++) {
+            zone.Counters[i] += counters[i];
+        }
+    }
+
+    // Once the reservoir is full every duration replaces a sample with probability MaxSamples / Count
+    if (zone.Samples.size() < MaxSamples) {
+        zone.Samples.push_back(duration);
+    } else {
+        uint64_t slot = registry.Random() % zone.Count;
+        if (slot < MaxSamples) {
+            zone.Samples[slot] = duration;
+        }
+    }
+}
+
+void StegTimer::PrintTimers() {
+    // The map is ordered by path, so every zone comes right after its parent
+    for (const auto& [path, statistics] : GetStatistics()) {
+        std::cout << std::string(2 * (path.size() - 1), ' ') << GetTimerName(path.back()) << ": "
+                  << statistics.Count << "x, total " << FormatDuration(statistics.Total)
+                  << ", min " << FormatDuration(statistics.Min)
+                  << ", p50 " << FormatDuration(statistics.P50)
+                  << ", p99 " << FormatDuration(statistics.P99)
+                  << ", max " << FormatDuration(statistics.Max)
+                  << ", allocated " << FormatBytes(statistics.AllocatedBytes)
+                  << ", peak " << FormatBytes(statistics.PeakBytes)
+                  << (statistics.Counted > 0 ? FormatCounters(statistics) : "") << std::endl;
+    }
+}
+
+std::map<StegTimer::ZonePath, StegTimer::Statistics> StegTimer::GetStatistics() {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.Mutex);
+
+    std::map<ZonePath, Statistics> result;
+    for (const auto& [path, zone] : registry.Zones) {
+        std::vector<uint64_t> samples = zone.Samples;
+        std::sort(samples.begin(), samples.end());
+
+        Statistics& statistics = result[path];
+        statistics.Count = zone.Count;
+        statistics.Total = zone.Total;
+        statistics.Min = zone.Min;
+        statistics.Max = zone.Max;
+        statistics.P50 = samples[(samples.size() - 1) * 50 / 100];
+        statistics.P99 = samples[(samples.size() - 1) * 99 / 100];
+        statistics.AllocatedBytes = zone.AllocatedBytes;
+        statistics.PeakBytes = zone.PeakBytes;
+        statistics.Counted = zone.Counted;
+        statistics.Cycles = zone.Counters[PerfCounters::CYCLES];
+        statistics.Instructions = zone.Counters[PerfCounters::INSTRUCTIONS];
+        statistics.LLCMisses = zone.Counters[PerfCounters::LLC_MISSES];
+        statistics.DTLBMisses = zone.Counters[PerfCounters::DTLB_MISSES];
+        statistics.BranchMisses = zone.Counters[PerfCounters::BRANCH_MISSES];
+    }
+    return result;
+}
+
+void StegTimer::ResetTimers() {
+    Registry& registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.Mutex);
+    registry.Zones.clear();
+}
+
+bool StegTimer::EnableCounters(bool enable) {
+    // Opening them on the calling thread tells whether this process may count at all
+    if (enable && !PerfCounters::ForThread().IsAvailable()) {
+        enable = false;
+    }
+    CountersEnabled = enable;
+    return enable;
+}
+
+bool StegTimer::AreCountersEnabled() {
+    return CountersEnabled.load(std::memory_order_relaxed);
+}
+
+std::string StegTimer::GetTimerName(TimerLabel timer) {
+    switch (timer) {
+        case ENCODE:
+            return "Encode";
+        case ENCRYPT:
+            return "Encrypt";
+        case DECODE:
+            return "Decode";
+        case DECRYPT:
+            return "Decrypt";
+        case EMBED:
+            return "Embed";
+        case EXTRACT:
+            return "Extract";
+        case INDEX_GENERATION:
+            return "Index Generation";
+        case HEADER_WRITE:
+            return "Header Write";
+        case PAYLOAD_EMBED:
+            return "Payload Embed";
+        case KDF:
+            return "KDF";
+        case CIPHER:
+            return "Cipher";
+        case PNG_LOAD:
+            return "PNG Load";
+        case PNG_SAVE:
+            return "PNG Save";
+        case PNG_COMPRESS:
+            return "PNG Compress";
+        case AUTHENTICATE:
+            return "Authenticate";
+        case PIXEL_CONVERT:
+            return "Pixel Convert";
+        case PATCH:
+            return "Patch";
+        case TOTAL:
+            return "Total";
+        default:
+            return "Unknown Timer";
+    }
+}
@@ -0,0 +1,140 @@
+#include "StegTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+using namespace Steg;
+
+namespace {
+
+    struct Event {
+        StegTimer::TimerLabel Label;
+        std::chrono::steady_clock::time_point Start;
+        std::chrono::steady_clock::time_point End;
+    };
+
+    // Only its own thread appends, the lock is for Write and Start running on other threads
+    struct ThreadBuffer {
+        uint32_t ThreadId;
+        std::mutex Mutex;
+        std::vector<Event> Events;
+    };
+
+    struct Recorder {
+        std::atomic<bool> Recording = false;
+        std::chrono::steady_clock::time_point Origin;
+
+        // Guards Buffers and Origin
+        std::mutex Mutex;
+        std::vector<Ref<ThreadBuffer>> Buffers;
+        uint32_t NextThreadId = 1;
+    };
+
+    Recorder& GetRecorder() {
+        static Recorder recorder;
+        return recorder;
+    }
+
+    // The buffer is shared with the recorder so its events outlive the thread
+    ThreadBuffer& GetThreadBuffer() {
+        thread_local Ref<ThreadBuffer> buffer;
+        if (!buffer) {
+            Recorder& recorder = GetRecorder();
+            std::lock_guard<std::mutex> lock(recorder.Mutex);
+            buffer = CreateRef<ThreadBuffer>();
+            buffer->ThreadId = recorder.NextThreadId++;
+            recorder.Buffers.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    // Trace timestamps are microseconds, fractions keep the nanoseconds
+    std::string FormatMicroseconds(std::chrono::steady_clock::duration duration) {
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.3f", std::chrono::duration<double, std::micro>(duration).count());
+        return text;
+    }
+
+}
+
+void StegTrace::Start() {
+    Recorder& recorder = GetRecorder();
+    std::lock_guard<std::mutex> lock(recorder.Mutex);
+
+    // Buffers only referenced by the recorder belong to threads that have exited
+    std::erase_if(recorder.Buffers, [](const Ref<ThreadBuffer>& buffer) {
+        return buffer.use_count() == 1;
+    });
+    for (const Ref<ThreadBuffer>& buffer : recorder.Buffers) {
+        std::lock_guard<std::mutex> bufferLock(buffer->Mutex);
+        buffer->Events.clear();
+    }
+
+    recorder.Origin = std::chrono::steady_clock::now();
+    recorder.Recording = true;
+}
+
+void StegTrace::Stop() {
+    GetRecorder().Recording = false;
+}
+
+bool StegTrace::IsRecording() {
+    return GetRecorder().Recording.load(std::memory_order_relaxed);
+}
+
+void StegTrace::Record(StegTimer::TimerLabel label, std::chrono::steady_clock::time_point start,
+                       std::chrono::steady_clock::time_point end) {
+    if (!IsRecording()) {
+        return;
+    }
+    ThreadBuffer& buffer = GetThreadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.Mutex);
+    buffer.Events.push_back(Event{label, start, end});
+}
+
+void StegTrace::Write(std::ostream& stream) {
+    Recorder& recorder = GetRecorder();
+    std::lock_guard<std::mutex> lock(recorder.Mutex);
+
+    // Complete ("X") events carry both ends of a zone, so zones cut short by an exception never leave one unmatched
+    stream << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    for (const Ref<ThreadBuffer>& buffer : recorder.Buffers) {
+        std::lock_guard<std::mutex> bufferLock(buffer->Mutex);
+        if (buffer->Events.empty()) {
+            continue;
+        }
+
+        stream << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->ThreadId
+               << ",\"args\":{\"name\":\"Thread " << buffer->ThreadId << "\"}}";
+        first = false;
+
+        for (const Event& event : buffer->Events) {
+            if (event.End < recorder.Origin) {
+                continue;
+            }
+
+            // Zones that were already open when recording started are clipped to the start
+            auto start = std::max(event.Start, recorder.Origin);
+            stream << ",\n{\"name\":\"" << StegTimer::GetTimerName(event.Label) << "\",\"cat\":\"steg\",\"ph\":\"X\""
+                   << ",\"ts\":" << FormatMicroseconds(start - recorder.Origin)
+                   << ",\"dur\":" << FormatMicroseconds(event.End - start)
+                   << ",\"pid\":1,\"tid\":" << buffer->ThreadId << "}";
+        }
+    }
+    stream << "\n]}\n";
+}
+
+void StegTrace::WriteFile(const std::string& path) {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("Could not open trace file: " + path);
+    }
+    Write(file);
+    if (!file) {
+        throw std::runtime_error("Could not write trace file: " + path);
+    }
+}
@@ -0,0 +1,248 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace Steg;
+
+namespace {
+
+    // The pool and worker index of the calling thread, if it is a worker
+    thread_local ThreadPool* CurrentPool = nullptr;
+    thread_local size_t CurrentWorker = 0;
+
+    struct PoolHolder {
+        std::mutex Mutex;
+        ThreadSettings Settings;
+        Scope<ThreadPool> Pool;
+        std::atomic<ThreadPool*> Instance = nullptr;
+    };
+
+    PoolHolder& GetHolder() {
+        static PoolHolder holder;
+        return holder;
+    }
+
+    void SetAffinity(std::thread& thread, uint32_t cpu) {
+#ifdef __linux__
+        // The OS refuses CPUs that do not exist, the worker then stays unpinned
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+    }
+
+}
+
+/* ThreadPool */
+
+ThreadPool& ThreadPool::Get() {
+    PoolHolder& holder = GetHolder();
+    ThreadPool* pool = holder.Instance.load(std::memory_order_acquire);
+    if (pool != nullptr) {
+        return *pool;
+    }
+
+    std::lock_guard<std::mutex> lock(holder.Mutex);
+    if (!holder.Pool) {
+        holder.Pool = Scope<ThreadPool>(new ThreadPool(holder.Settings));
+        holder.Instance.store(holder.Pool.get(), std::memory_order_release);
+    }
+    return *holder.Pool;
+}
+
+void ThreadPool::Configure(const ThreadSettings& settings) {
+#ifdef __linux__
+    for (uint32_t cpu : settings.CpuAffinity) {
+        if (cpu >= CPU_SETSIZE) {
+            throw std::invalid_argument("Invalid CPU for thread affinity: " + std::to_string(cpu));
+        }
+    }
+#endif
+
+    PoolHolder& holder = GetHolder();
+    std::lock_guard<std::mutex> lock(holder.Mutex);
+    if (holder.Pool) {
+        throw std::runtime_error("The thread pool is already running and can no longer be configured");
+    }
+    holder.Settings = settings;
+}
+
+ThreadPool::ThreadPool(const ThreadSettings& settings) {
+    size_t workerCount = settings.WorkerCount;
+    if (workerCount == 0) {
+        workerCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    // Every deque exists before any worker can try to steal from it
+    for (size_t i = 0; i < workerCount; i++) {
+        Workers.push_back(CreateScope<Worker>());
+    }
+    for (size_t i = 0; i < workerCount; i++) {
+        Workers[i]->Thread = std::thread([this, i]() { Run(i); });
+        if (!settings.CpuAffinity.empty()) {
+            SetAffinity(Workers[i]->Thread, settings.CpuAffinity[i % settings.CpuAffinity.size()]);
+        }
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Stopping = true;
+    }
+    Available.notify_all();
+    for (auto& worker : Workers) {
+        worker->Thread.join();
+    }
+}
+
+void ThreadPool::Submit(Job job) {
+    if (CurrentPool == this) {
+        Worker& worker = *Workers[CurrentWorker];
+        std::lock_guard<std::mutex> lock(worker.Mutex);
+        worker.Jobs.push_back(std::move(job));
+    } else {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Shared.push_back(std::move(job));
+    }
+
+    // Pairs with Run: either the sleeper sees the job or this sees the sleeper
+    Pending.fetch_add(1);
+    if (Sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Available.notify_one();
+    }
+}
+
+void ThreadPool::Run(size_t index) {
+    CurrentPool = this;
+    CurrentWorker = index;
+
+    while (true) {
+        Job job;
+        if (TryTake(index, job)) {
+            job();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(Mutex);
+        Sleeping.fetch_add(1);
+        Available.wait(lock, [&]() { return Stopping || Pending.load() > 0; });
+        Sleeping.fetch_sub(1);
+
+        // Jobs submitted before the pool was destroyed still run
+        if (Stopping && Pending.load() == 0) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::TryTake(size_t index, Job& job) {
+    {
+        Worker& own = *Workers[index];
+        std::lock_guard<std::mutex> lock(own.Mutex);
+        if (!own.Jobs.empty()) {
+            job = std::move(own.Jobs.back());
+            own.Jobs.pop_back();
+            Pending.fetch_sub(1);
+            return true;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (!Shared.empty()) {
+            job = std::move(Shared.front());
+            Shared.pop_front();
+            Pending.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // Start with the next worker so thieves spread over the victims
+    for (size_t i = 1; i < Workers.size(); i++) {
+        Worker& victim = *Workers[(index + i) % Workers.size()];
+        std::lock_guard<std::mutex> lock(victim.Mutex);
+        if (!victim.Jobs.empty()) {
+            job = std::move(victim.Jobs.front());
+            victim.Jobs.pop_front();
+            Pending.fetch_sub(1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* TaskGroup */
+
+TaskGroup::~TaskGroup() {
+    try {
+        Wait();
+    } catch (...) {
+    }
+}
+
+void TaskGroup::Run(std::function<void()> function) {
+    Ref<Item> item = CreateRef<Item>();
+    item->Function = std::move(function);
+    Items.push_back(item);
+    State->Remaining.fetch_add(1, std::memory_order_relaxed);
+
+    Ref<Shared> state = State;
+    ThreadPool::Get().Submit([state, item]() {
+        Execute(*state, *item);
+    });
+}
+
+void TaskGroup::Wait() {
+    // Newest first, since thieves take the oldest
+    for (auto item = Items.rbegin(); item != Items.rend(); item++) {
+        Execute(*State, **item);
+    }
+
+    // The rest are running on workers
+    size_t remaining = State->Remaining.load(std::memory_order_acquire);
+    while (remaining != 0) {
+        State->Remaining.wait(remaining, std::memory_order_acquire);
+        remaining = State->Remaining.load(std::memory_order_acquire);
+    }
+    Items.clear();
+
+    std::exception_ptr error;
+    {
+        std::lock_guard<std::mutex> lock(State->Mutex);
+        error = std::exchange(State->Error, nullptr);
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void TaskGroup::Execute(Shared& shared, Item& item) {
+    if (item.Claimed.exchange(true, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    try {
+        item.Function();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(shared.Mutex);
+        if (!shared.Error) {
+            shared.Error = std::current_exception();
+        }
+    }
+
+    // Captures are released before the group can see the job as done
+    item.Function = nullptr;
+    if (shared.Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        shared.Remaining.notify_all();
+    }
+}
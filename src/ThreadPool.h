@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Core.h"
+#include "StegThreads.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace Steg {
+
+    // Work-stealing pool behind StegThreads
+    // Jobs submitted by a worker go to the back of its own deque and it takes them back LIFO, which keeps data hot,
+    // idle workers steal the oldest job from the front of another deque
+    // Jobs submitted from other threads go through a shared FIFO queue
+    class ThreadPool {
+
+    public:
+
+        using Job = std::function<void()>;
+
+        // The library's pool, started on first use with the settings from Configure
+        static ThreadPool& Get();
+
+        // Throws std::runtime_error once the pool has started
+        static void Configure(const ThreadSettings& settings);
+
+        // Waits for the jobs already submitted, then stops the workers
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool& other) = delete;
+
+        ThreadPool& operator=(const ThreadPool& other) = delete;
+
+        // job must not throw
+        void Submit(Job job);
+
+        size_t GetWorkerCount() const {
+            return Workers.size();
+        }
+
+        bool HasIdleWorker() const {
+            return Sleeping.load(std::memory_order_relaxed) > 0;
+        }
+
+    private:
+
+        struct Worker {
+            std::mutex Mutex;
+            std::deque<Job> Jobs;
+            std::thread Thread;
+        };
+
+        explicit ThreadPool(const ThreadSettings& settings);
+
+        void Run(size_t index);
+
+        // Own deque first, then the shared queue, then the other workers' deques
+        bool TryTake(size_t index, Job& job);
+
+
+        std::vector<Scope<Worker>> Workers;
+
+        // Guards Shared and Stopping, and is what idle workers sleep on
+        std::mutex Mutex;
+        std::condition_variable Available;
+        std::deque<Job> Shared;
+        bool Stopping = false;
+
+        // Jobs submitted and not taken yet, anywhere in the pool
+        std::atomic<size_t> Pending = 0;
+        std::atomic<size_t> Sleeping = 0;
+
+    };
+
+    // Jobs on the pool that are waited for together, for fork-join parallelism
+    // Wait first runs the jobs no worker has started yet on the calling thread,
+    // so it cannot deadlock even when every worker is itself waiting on a group
+    // Run and Wait must be called from the thread that owns the group
+    class TaskGroup {
+
+    public:
+
+        TaskGroup() = default;
+
+        // Waits for the jobs that are still running, their exceptions are dropped
+        ~TaskGroup();
+
+        TaskGroup(const TaskGroup& other) = delete;
+
+        TaskGroup& operator=(const TaskGroup& other) = delete;
+
+        void Run(std::function<void()> function);
+
+        // Rethrows the first exception thrown by a job of this group
+        void Wait();
+
+    private:
+
+        // Shared with the pool, which may still hold a claimed item after the group is gone
+        struct Item {
+            std::atomic<bool> Claimed = false;
+            std::function<void()> Function;
+        };
+
+        struct Shared {
+            std::atomic<size_t> Remaining = 0;
+            std::mutex Mutex;
+            std::exception_ptr Error;
+        };
+
+        static void Execute(Shared& shared, Item& item);
+
+
+        Ref<Shared> State = CreateRef<Shared>();
+        std::vector<Ref<Item>> Items;
+
+    };
+
+}
@@ -0,0 +1,369 @@
+// Command-line front end meant for shell pipelines, nothing is written to disk
+// Usage:
+//   steg encode --payload-fd N [options] < carrier.png > stego.png
+//   steg decode [--payload-fd N] [options] < stego.png > payload
+//   steg probe [--daemon PATH] < stego.png
+//   steg stats --daemon PATH
+// The payload is read from (encode) or written to (decode) file descriptor N, which defaults to stdout for decode
+// Passwords are read from a descriptor or an environment variable so they never show up in the process list
+// With --daemon the descriptors are handed to a running stegd, which keeps keys and index orders from earlier calls
+
+#include "StegEngine.h"
+#include "StegProtocol.h"
+#include "StegThreads.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <optional>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define read _read
+#define write _write
+#else
+#include <unistd.h>
+#endif
+
+using namespace Steg;
+
+namespace {
+
+    // Bytes asked for per read, the buffer grows by this much while a descriptor has more
+    constexpr size_t ReadChunkSize = 64 * 1024;
+
+    void PrintUsage() {
+        std::cerr << "Usage:\n"
+                     "  steg encode --payload-fd N [options] < carrier.png > stego.png\n"
+                     "  steg decode [--payload-fd N] [options] < stego.png > payload\n"
+                     "  steg probe [--daemon PATH] < stego.png\n"
+                     "  steg stats --daemon PATH\n"
+                     "Options:\n"
+                     "  --daemon PATH        let the stegd listening on socket PATH do the work (Linux only)\n"
+                     "  --payload-fd N       descriptor the payload is read from or written to (decode default: 1)\n"
+                     "  --password-fd N      read the encryption password from descriptor N\n"
+                     "  --password-env NAME  read the encryption password from environment variable NAME\n"
+                     "  --pipelined          encrypt or decrypt on a pool thread while embedding or extracting\n"
+                     "  --threads N          worker threads of the library's pool (default: one per hardware thread)\n"
+                     "Encode options:\n"
+                     "  --depth 1|2|4|8      bits hidden per channel byte (default: 2)\n"
+                     "  --alpha              hide data in the alpha channel too\n"
+                     "  --local-scatter      hide data in random 4 KiB blocks of the image, faster on large carriers\n"
+                     "  --algo aes128|aes192|aes256|chacha20  cipher used with a password (default: aes128)\n"
+                     "  --mode cbc|ctr|gcm   AES mode used with a password (default: cbc)\n";
+    }
+
+    // Reads until end of file, straight into the returned buffer
+    std::vector<byte> ReadAll(int descriptor) {
+        std::vector<byte> data;
+        size_t size = 0;
+        while (true) {
+            data.resize(size + ReadChunkSize);
+            auto count = read(descriptor, data.data() + size, ReadChunkSize);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Could not read descriptor " + std::to_string(descriptor) + ": " + std::strerror(errno));
+            }
+            if (count == 0) {
+                break;
+            }
+            size += size_t(count);
+        }
+        data.resize(size);
+        return data;
+    }
+
+    void WriteAll(int descriptor, std::span<const byte> data) {
+        while (!data.empty()) {
+            auto count = write(descriptor, data.data(), unsigned(std::min(data.size(), ReadChunkSize)));
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Could not write descriptor " + std::to_string(descriptor) + ": " + std::strerror(errno));
+            }
+            data = data.subspan(size_t(count));
+        }
+    }
+
+    int ParseDescriptor(const std::string& text) {
+        char* end = nullptr;
+        long descriptor = std::strtol(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || descriptor < 0 || descriptor > 65535) {
+            throw std::invalid_argument("Invalid file descriptor: " + text);
+        }
+        return int(descriptor);
+    }
+
+    uint32_t ParseThreadCount(const std::string& text) {
+        char* end = nullptr;
+        long count = std::strtol(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || count < 1 || count > 1024) {
+            throw std::invalid_argument("Invalid thread count: " + text);
+        }
+        return uint32_t(count);
+    }
+
+    StegCrypt::Algorithm ParseAlgorithm(const std::string& text) {
+        if (text == "aes128") {
+            return StegCrypt::Algorithm::ALGO_AES128;
+        } else if (text == "aes192") {
+            return StegCrypt::Algorithm::ALGO_AES192;
+        } else if (text == "aes256") {
+            return StegCrypt::Algorithm::ALGO_AES256;
+        } else if (text == "chacha20") {
+            return StegCrypt::Algorithm::ALGO_CHACHA20;
+        }
+        throw std::invalid_argument("Invalid algorithm: " + text);
+    }
+
+    StegCrypt::Mode ParseMode(const std::string& text) {
+        if (text == "cbc") {
+            return StegCrypt::Mode::MODE_CBC;
+        } else if (text == "ctr") {
+            return StegCrypt::Mode::MODE_CTR;
+        } else if (text == "gcm") {
+            return StegCrypt::Mode::MODE_GCM;
+        }
+        throw std::invalid_argument("Invalid cipher mode: " + text);
+    }
+
+    struct Options {
+        std::string Command;
+        std::optional<std::string> Daemon;
+        std::optional<int> PayloadDescriptor;
+        std::optional<std::vector<byte>> Password;
+        EncoderSettings Settings;
+        bool Pipelined = false;
+        ThreadSettings Threads;
+    };
+
+    Options ParseOptions(int argc, char** argv) {
+        if (argc < 2) {
+            throw std::invalid_argument("Missing command");
+        }
+
+        Options options;
+        options.Command = argv[1];
+        if (options.Command != "encode" && options.Command != "decode" && options.Command != "probe" && options.Command != "stats") {
+            throw std::invalid_argument("Unknown command: " + options.Command);
+        }
+
+        for (int i = 2; i < argc; i++) {
+            std::string option = argv[i];
+
+            // Every option except the flags takes one value
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    throw std::invalid_argument("Missing value for " + option);
+                }
+                return argv[++i];
+            };
+
+            if (option == "--daemon") {
+                options.Daemon = value();
+            } else if (option == "--payload-fd") {
+                options.PayloadDescriptor = ParseDescriptor(value());
+            } else if (option == "--password-fd") {
+                std::vector<byte> password = ReadAll(ParseDescriptor(value()));
+
+                // A password piped from echo or a file usually ends with a newline that is not part of it
+                while (!password.empty() && (password.back() == '\n' || password.back() == '\r')) {
+                    password.pop_back();
+                }
+                options.Password = password;
+            } else if (option == "--password-env") {
+                std::string name = value();
+                const char* password = std::getenv(name.c_str());
+                if (password == nullptr) {
+                    throw std::invalid_argument("Environment variable is not set: " + name);
+                }
+                options.Password = std::vector<byte>(password, password + std::strlen(password));
+            } else if (option == "--pipelined") {
+                options.Pipelined = true;
+            } else if (option == "--threads") {
+                options.Threads.WorkerCount = ParseThreadCount(value());
+            } else if (option == "--depth") {
+                std::string depth = value();
+                if (depth != "1" && depth != "2" && depth != "4" && depth != "8") {
+                    throw std::invalid_argument("Invalid depth: " + depth);
+                }
+                options.Settings.DataDepth = byte(std::stoi(depth));
+            } else if (option == "--alpha") {
+                options.Settings.EncodeInAlpha = true;
+            } else if (option == "--local-scatter") {
+                options.Settings.LocalScatter = true;
+            } else if (option == "--algo") {
+                options.Settings.Encryption.Algo = ParseAlgorithm(value());
+            } else if (option == "--mode") {
+                options.Settings.Encryption.CipherMode = ParseMode(value());
+            } else {
+                throw std::invalid_argument("Unknown option: " + option);
+            }
+        }
+
+        if (options.Command == "encode" && !options.PayloadDescriptor) {
+            throw std::invalid_argument("encode needs --payload-fd, stdin already carries the image");
+        }
+        if (options.Password && options.Password->empty()) {
+            throw std::invalid_argument("The password is empty");
+        }
+        if (options.Command == "stats" && !options.Daemon) {
+            throw std::invalid_argument("stats needs --daemon");
+        }
+#ifndef __linux__
+        if (options.Daemon) {
+            throw std::invalid_argument("--daemon is only available on Linux");
+        }
+#endif
+        return options;
+    }
+
+    void Encode(const Options& options) {
+        Image image(ReadAll(0));
+        std::vector<byte> payload = ReadAll(*options.PayloadDescriptor);
+
+        EncoderSettings settings = options.Settings;
+        settings.Pipelined = options.Pipelined;
+        if (options.Password) {
+            settings.Encryption.EncryptPayload = true;
+            settings.Encryption.EncryptionPassword = *options.Password;
+        }
+
+        StegEngine::Encode(image, payload, settings);
+        WriteAll(1, image.EncodePNG());
+    }
+
+    void Decode(const Options& options) {
+        Image image(ReadAll(0));
+
+        DecoderSettings settings;
+        settings.Pipelined = options.Pipelined;
+        if (options.Password) {
+            settings.EncryptionPassword = *options.Password;
+        }
+
+        WriteAll(options.PayloadDescriptor.value_or(1), StegEngine::Decode(image, settings));
+    }
+
+    void PrintFields(const std::map<std::string, std::string>& fields) {
+        std::string line;
+        for (const auto& [key, value] : fields) {
+            line += (line.empty() ? "" : " ") + key + "=" + value;
+        }
+        std::cout << line << std::endl;
+    }
+
+    void Probe() {
+        Image image(ReadAll(0));
+        uint32_t payloadByteCount;
+        EncoderSettings settings = StegEngine::Probe(image, payloadByteCount);
+        PrintFields(StegProtocol::GetProbeFields(settings, payloadByteCount));
+    }
+
+#ifdef __linux__
+    // Hands this process's descriptors to stegd, which reads and writes them the way Encode and Decode would
+    void Forward(const Options& options) {
+        StegProtocol::Message request;
+        request.Command = options.Command;
+        if (options.Command == "encode") {
+            const EncoderSettings& settings = options.Settings;
+            request.Fields["depth"] = std::to_string(settings.DataDepth);
+            request.Fields["alpha"] = std::to_string(int(settings.EncodeInAlpha));
+            request.Fields["scatter"] = std::to_string(int(settings.LocalScatter));
+            if (options.Password) {
+                request.Fields["algo"] = std::to_string(int(settings.Encryption.Algo));
+                request.Fields["mode"] = std::to_string(int(settings.Encryption.CipherMode));
+            }
+            request.Descriptors = {0, *options.PayloadDescriptor, 1};
+        } else if (options.Command == "decode") {
+            request.Descriptors = {0, options.PayloadDescriptor.value_or(1)};
+        } else if (options.Command == "probe") {
+            request.Descriptors = {0};
+        }
+        if (options.Command == "encode" || options.Command == "decode") {
+            request.Fields["pipelined"] = std::to_string(int(options.Pipelined));
+            if (options.Password) {
+                request.Fields["password"] = StegProtocol::ToHex(*options.Password);
+            }
+        }
+
+        int socket = StegProtocol::Connect(*options.Daemon);
+        StegProtocol::Message response;
+        bool answered;
+        try {
+            StegProtocol::Send(socket, request);
+            answered = StegProtocol::Receive(socket, response);
+        } catch (...) {
+            close(socket);
+            throw;
+        }
+        close(socket);
+        for (int descriptor : response.Descriptors) {
+            close(descriptor);
+        }
+
+        if (!answered) {
+            throw std::runtime_error("stegd closed the connection");
+        }
+        if (response.Command != "ok") {
+            throw std::runtime_error(response.Body.empty() ? "stegd failed" : response.Body);
+        }
+        if (options.Command == "probe") {
+            PrintFields(response.Fields);
+        } else if (options.Command == "stats") {
+            std::cout << response.Body << std::flush;
+        }
+    }
+#endif
+
+}
+
+int main(int argc, char** argv) {
+
+#ifdef _WIN32
+    // Pipes are text mode by default on Windows, which would mangle PNG and payload bytes
+    _setmode(0, _O_BINARY);
+    _setmode(1, _O_BINARY);
+#endif
+
+    Options options;
+    try {
+        options = ParseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "steg: " << e.what() << std::endl;
+        PrintUsage();
+        return 2;
+    }
+
+    try {
+#ifdef __linux__
+        if (options.Daemon) {
+            Forward(options);
+            return 0;
+        }
+#endif
+        StegThreads::Configure(options.Threads);
+        if (options.Command == "encode") {
+            Encode(options);
+        } else if (options.Command == "decode") {
+            Decode(options);
+        } else {
+            Probe();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "steg: " << e.what() << std::endl;
+        return 1;
+    } catch (const char* message) {
+        // Decode reports a missing header this way
+        std::cerr << "steg: " << message << std::endl;
+        return 1;
+    }
+
+    return 0;
+
+}
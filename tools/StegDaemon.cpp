@@ -0,0 +1,479 @@
+// Local service that keeps the library warm between requests, Linux only
+// Usage:
+//   stegd --socket PATH [options]
+// Derived keys, index orders, raster buffers and the thread pool outlive each request, so a series of steg --daemon calls
+// pays for key derivation and shuffling once per password and image size instead of once per call
+// Every connection is served on a thread of its own, see StegProtocol.h for the messages and stats for request latency
+
+#include "BufferAllocator.h"
+#include "StegEngine.h"
+#include "StegProtocol.h"
+#include "StegThreads.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <sys/stat.h>
+
+using namespace Steg;
+using StegProtocol::Message;
+
+namespace {
+
+    // Bytes asked for per read, the buffer grows by this much while a descriptor has more
+    constexpr size_t ReadChunkSize = 64 * 1024;
+
+    void PrintUsage() {
+        std::cerr << "Usage:\n"
+                     "  stegd --socket PATH [options]\n"
+                     "Options:\n"
+                     "  --threads N          worker threads of the library's pool (default: one per hardware thread)\n"
+                     "  --key-cache N        derived keys kept in memory (default: 16)\n"
+                     "  --index-cache N      index orders kept in memory, 4 bytes per image byte each (default: 4)\n"
+                     "  --pool-bytes N       raster memory kept for reuse between requests (default: 1073741824)\n";
+    }
+
+    struct DaemonOptions {
+        std::string SocketPath;
+        ThreadSettings Threads;
+        size_t KeyCacheCapacity = 16;
+        size_t IndexCacheCapacity = 4;
+        size_t PoolBytes = size_t(1) << 30;
+    };
+
+    // Latency of one request type, the percentiles are taken over the most recent requests
+    class LatencyStats {
+
+    public:
+
+        static constexpr size_t WindowSize = 1024;
+
+        void Add(double milliseconds, bool failed) {
+            std::lock_guard<std::mutex> lock(Mutex);
+            Count++;
+            Errors += failed;
+            Total += milliseconds;
+            Max = std::max(Max, milliseconds);
+            if (Window.size() < WindowSize) {
+                Window.push_back(milliseconds);
+            } else {
+                Window[Count % WindowSize] = milliseconds;
+            }
+        }
+
+        std::string Format(const std::string& name) const {
+            std::lock_guard<std::mutex> lock(Mutex);
+            std::vector<double> sorted = Window;
+            std::sort(sorted.begin(), sorted.end());
+            // Nearest rank
+            auto percentile = [&](double fraction) {
+                return sorted.empty() ? 0.0 : sorted[std::max<size_t>(size_t(std::ceil(fraction * double(sorted.size()))), 1) - 1];
+            };
+
+            std::ostringstream line;
+            line.setf(std::ios::fixed);
+            line.precision(3);
+            line << name << " count=" << Count << " errors=" << Errors
+                 << " mean_ms=" << (Count == 0 ? 0.0 : Total / double(Count))
+                 << " p50_ms=" << percentile(0.5) << " p90_ms=" << percentile(0.9) << " p99_ms=" << percentile(0.99)
+                 << " max_ms=" << Max;
+            return line.str();
+        }
+
+    private:
+
+        mutable std::mutex Mutex;
+        uint64_t Count = 0;
+        uint64_t Errors = 0;
+        double Total = 0;
+        double Max = 0;
+        std::vector<double> Window;
+
+    };
+
+    const std::array<std::string, 4> Commands = {"encode", "decode", "probe", "stats"};
+    std::array<LatencyStats, 4> Latency;
+
+    const auto StartTime = std::chrono::steady_clock::now();
+    std::atomic<uint64_t> ConnectionCount = 0;
+    Ref<PooledBufferAllocator> Allocator;
+
+    // Removed again when the daemon is stopped, the handler cannot use a std::string
+    char SocketPath[sizeof(sockaddr_un::sun_path)];
+
+    size_t ParseCount(const std::string& text, const std::string& name, size_t max) {
+        char* end = nullptr;
+        unsigned long long count = std::strtoull(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || text[0] == '-' || count > max) {
+            throw std::invalid_argument("Invalid " + name + ": " + text);
+        }
+        return size_t(count);
+    }
+
+    bool ParseFlag(const Message& request, const std::string& name) {
+        auto field = request.Fields.find(name);
+        if (field == request.Fields.end() || field->second == "0") {
+            return false;
+        } else if (field->second == "1") {
+            return true;
+        }
+        throw std::invalid_argument("Invalid " + name + ": " + field->second);
+    }
+
+    // Reads until end of file into data, which keeps its capacity from earlier requests
+    void ReadAll(int descriptor, std::vector<byte>& data) {
+        size_t size = 0;
+        while (true) {
+            data.resize(size + ReadChunkSize);
+            auto count = read(descriptor, data.data() + size, ReadChunkSize);
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Could not read descriptor: ") + std::strerror(errno));
+            }
+            if (count == 0) {
+                break;
+            }
+            size += size_t(count);
+        }
+        data.resize(size);
+    }
+
+    void WriteAll(int descriptor, std::span<const byte> data) {
+        while (!data.empty()) {
+            auto count = write(descriptor, data.data(), std::min(data.size(), ReadChunkSize));
+            if (count < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Could not write descriptor: ") + std::strerror(errno));
+            }
+            data = data.subspan(size_t(count));
+        }
+    }
+
+    // Buffers of one connection, reused by each of its requests
+    struct Buffers {
+        std::vector<byte> File;
+        std::vector<byte> Payload;
+    };
+
+    void CheckDescriptors(const Message& request, size_t count) {
+        if (request.Descriptors.size() != count) {
+            throw std::invalid_argument(request.Command + " takes " + std::to_string(count) + " descriptors, got " +
+                                        std::to_string(request.Descriptors.size()));
+        }
+    }
+
+    EncoderSettings ParseSettings(const Message& request) {
+        EncoderSettings settings;
+        auto depth = request.Fields.find("depth");
+        if (depth != request.Fields.end()) {
+            settings.DataDepth = byte(ParseCount(depth->second, "depth", 8));
+            if (settings.DataDepth != 1 && settings.DataDepth != 2 && settings.DataDepth != 4 && settings.DataDepth != 8) {
+                throw std::invalid_argument("Invalid depth: " + depth->second);
+            }
+        }
+        settings.EncodeInAlpha = ParseFlag(request, "alpha");
+        settings.LocalScatter = ParseFlag(request, "scatter");
+        settings.Pipelined = ParseFlag(request, "pipelined");
+
+        auto password = request.Fields.find("password");
+        if (password != request.Fields.end()) {
+            EncryptionSettings& encryption = settings.Encryption;
+            encryption.EncryptPayload = true;
+            encryption.EncryptionPassword = StegProtocol::FromHex(password->second);
+            if (request.Fields.count("algo")) {
+                encryption.Algo = StegCrypt::Algorithm(ParseCount(request.Fields.at("algo"), "algo", size_t(StegCrypt::Algorithm::ALGO_CHACHA20)));
+            }
+            if (request.Fields.count("mode")) {
+                encryption.CipherMode = StegCrypt::Mode(ParseCount(request.Fields.at("mode"), "mode", size_t(StegCrypt::Mode::MODE_GCM)));
+            }
+        }
+        return settings;
+    }
+
+    Message Encode(const Message& request, Buffers& buffers) {
+        CheckDescriptors(request, 3);
+        EncoderSettings settings = ParseSettings(request);
+
+        ReadAll(request.Descriptors[0], buffers.File);
+        Image image{std::span<const byte>(buffers.File)};
+        ReadAll(request.Descriptors[1], buffers.Payload);
+
+        StegEngine::Encode(image, buffers.Payload, settings);
+        std::vector<byte> png = image.EncodePNG();
+        WriteAll(request.Descriptors[2], png);
+
+        Message response;
+        response.Command = "ok";
+        response.Fields["length"] = std::to_string(png.size());
+        return response;
+    }
+
+    Message Decode(const Message& request, Buffers& buffers) {
+        CheckDescriptors(request, 2);
+        DecoderSettings settings;
+        settings.Pipelined = ParseFlag(request, "pipelined");
+        if (request.Fields.count("password")) {
+            settings.EncryptionPassword = StegProtocol::FromHex(request.Fields.at("password"));
+        }
+
+        ReadAll(request.Descriptors[0], buffers.File);
+        Image image{std::span<const byte>(buffers.File)};
+
+        // Unless it is pipelined the payload is decoded into the connection's buffer
+        std::span<const byte> data;
+        std::vector<byte> decoded;
+        if (settings.Pipelined) {
+            decoded = StegEngine::Decode(image, settings);
+            data = decoded;
+        } else {
+            uint32_t payloadByteCount;
+            StegEngine::Probe(image, payloadByteCount);
+            buffers.Payload.resize(payloadByteCount);
+            data = std::span<const byte>(buffers.Payload).first(StegEngine::DecodeInto(image, buffers.Payload, settings));
+        }
+        WriteAll(request.Descriptors[1], data);
+
+        Message response;
+        response.Command = "ok";
+        response.Fields["length"] = std::to_string(data.size());
+        return response;
+    }
+
+    Message Probe(const Message& request, Buffers& buffers) {
+        CheckDescriptors(request, 1);
+        ReadAll(request.Descriptors[0], buffers.File);
+        Image image{std::span<const byte>(buffers.File)};
+
+        uint32_t payloadByteCount;
+        EncoderSettings settings = StegEngine::Probe(image, payloadByteCount);
+
+        Message response;
+        response.Command = "ok";
+        response.Fields = StegProtocol::GetProbeFields(settings, payloadByteCount);
+        return response;
+    }
+
+    Message Stats(const Message& request) {
+        CheckDescriptors(request, 0);
+        double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - StartTime).count();
+
+        std::ostringstream report;
+        report << "uptime_s=" << uint64_t(uptime) << " connections=" << ConnectionCount.load()
+               << " live_bytes=" << StegMemory::GetLiveBytes() << " peak_bytes=" << StegMemory::GetPeakBytes()
+               << " pooled_bytes=" << Allocator->GetCachedBytes() << "\n";
+        for (size_t i = 0; i < Commands.size(); i++) {
+            report << Latency[i].Format(Commands[i]) << "\n";
+        }
+
+        Message response;
+        response.Command = "ok";
+        response.Body = report.str();
+        return response;
+    }
+
+    Message Handle(const Message& request, Buffers& buffers) {
+        if (request.Command == "encode") {
+            return Encode(request, buffers);
+        } else if (request.Command == "decode") {
+            return Decode(request, buffers);
+        } else if (request.Command == "probe") {
+            return Probe(request, buffers);
+        } else if (request.Command == "stats") {
+            return Stats(request);
+        }
+        throw std::invalid_argument("Unknown command: " + request.Command);
+    }
+
+    Message ErrorResponse(const std::string& error) {
+        Message response;
+        response.Command = "error";
+        response.Body = error;
+        return response;
+    }
+
+    // Answers the requests of one client until it hangs up
+    void Serve(int connection) {
+        ConnectionCount++;
+        Buffers buffers;
+        while (true) {
+            Message request;
+            try {
+                if (!StegProtocol::Receive(connection, request)) {
+                    break;
+                }
+            } catch (const std::exception& e) {
+                // A request that cannot be read leaves the connection in an unknown state
+                std::cerr << "stegd: " << e.what() << std::endl;
+                break;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            Message response;
+            try {
+                response = Handle(request, buffers);
+            } catch (const std::exception& e) {
+                response = ErrorResponse(e.what());
+            } catch (const char* message) {
+                // Decode reports a missing header this way
+                response = ErrorResponse(message);
+            }
+            double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            for (int descriptor : request.Descriptors) {
+                close(descriptor);
+            }
+
+            auto command = std::find(Commands.begin(), Commands.end(), request.Command);
+            if (command != Commands.end()) {
+                Latency[command - Commands.begin()].Add(milliseconds, response.Command != "ok");
+            }
+
+            try {
+                StegProtocol::Send(connection, response);
+            } catch (const std::exception& e) {
+                std::cerr << "stegd: " << e.what() << std::endl;
+                break;
+            }
+        }
+        close(connection);
+    }
+
+    DaemonOptions ParseOptions(int argc, char** argv) {
+        DaemonOptions options;
+        for (int i = 1; i < argc; i++) {
+            std::string option = argv[i];
+
+            // Every option takes one value
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value for " + option);
+            }
+            std::string value = argv[++i];
+
+            if (option == "--socket") {
+                options.SocketPath = value;
+            } else if (option == "--threads") {
+                options.Threads.WorkerCount = uint32_t(ParseCount(value, "thread count", 1024));
+                if (options.Threads.WorkerCount == 0) {
+                    throw std::invalid_argument("Invalid thread count: " + value);
+                }
+            } else if (option == "--key-cache") {
+                options.KeyCacheCapacity = ParseCount(value, "key cache size", 1 << 16);
+            } else if (option == "--index-cache") {
+                options.IndexCacheCapacity = ParseCount(value, "index cache size", 1 << 10);
+            } else if (option == "--pool-bytes") {
+                options.PoolBytes = ParseCount(value, "pool size", SIZE_MAX);
+            } else {
+                throw std::invalid_argument("Unknown option: " + option);
+            }
+        }
+        if (options.SocketPath.empty()) {
+            throw std::invalid_argument("Missing --socket");
+        }
+        return options;
+    }
+
+    // Binds the socket, replacing a stale one that nothing listens on
+    int Listen(const std::string& path) {
+        sockaddr_un address = StegProtocol::GetAddress(path);
+
+        struct stat info;
+        if (lstat(path.c_str(), &info) == 0) {
+            if (!S_ISSOCK(info.st_mode)) {
+                throw std::runtime_error(path + " exists and is not a socket");
+            }
+            int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+            bool listening = probe >= 0 && connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+            if (probe >= 0) {
+                close(probe);
+            }
+            if (listening) {
+                throw std::runtime_error("Another daemon is listening on " + path);
+            }
+            unlink(path.c_str());
+        }
+
+        int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (listener < 0) {
+            throw std::runtime_error(std::string("Could not create socket: ") + std::strerror(errno));
+        }
+
+        // Only the user running the daemon may connect
+        mode_t mask = umask(0077);
+        int result = bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        umask(mask);
+        if (result != 0 || listen(listener, 64) != 0) {
+            int error = errno;
+            close(listener);
+            throw std::runtime_error("Could not listen on " + path + ": " + std::strerror(error));
+        }
+        return listener;
+    }
+
+    void Stop(int) {
+        unlink(SocketPath);
+        _exit(0);
+    }
+
+}
+
+int main(int argc, char** argv) {
+
+    DaemonOptions options;
+    try {
+        options = ParseOptions(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "stegd: " << e.what() << std::endl;
+        PrintUsage();
+        return 2;
+    }
+
+    int listener;
+    try {
+        StegThreads::Configure(options.Threads);
+        StegThreads::GetWorkerCount();
+
+        // Everything that is expensive to set up once per process is set up here and kept
+        StegCrypt::SetKeyCacheCapacity(options.KeyCacheCapacity);
+        StegEngine::SetIndexCacheCapacity(options.IndexCacheCapacity);
+        Allocator = CreateRef<PooledBufferAllocator>(options.PoolBytes);
+        Image::SetAllocator(Allocator);
+
+        listener = Listen(options.SocketPath);
+    } catch (const std::exception& e) {
+        std::cerr << "stegd: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::memcpy(SocketPath, options.SocketPath.c_str(), options.SocketPath.size() + 1);
+    std::signal(SIGINT, Stop);
+    std::signal(SIGTERM, Stop);
+
+    // Output descriptors may be pipes whose reader went away
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::cerr << "stegd: listening on " << options.SocketPath << std::endl;
+    while (true) {
+        int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            std::cerr << "stegd: accept failed: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        std::thread(Serve, connection).detach();
+    }
+
+}
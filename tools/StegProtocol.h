@@ -0,0 +1,232 @@
+#pragma once
+
+// Messages between steg --daemon and stegd, the socket part is Linux only
+// Every request and response is one packet on a SOCK_SEQPACKET Unix domain socket with the descriptors it refers to
+// attached, so payloads never pass through the socket itself
+// A packet is a line holding a command or status and key=value fields, optionally followed by a body
+// Requests:
+//   encode depth=N alpha=0|1 scatter=0|1 pipelined=0|1 [password=HEX algo=N mode=N]   carrier PNG, payload, output
+//   decode pipelined=0|1 [password=HEX]                                               stego PNG, output
+//   probe                                                                              stego PNG
+//   stats
+// algo and mode are the values of StegCrypt::Algorithm and StegCrypt::Mode
+// Responses start with ok or error, the body of an error is its message and the body of stats is the report
+// stegd reads and writes the descriptors the way steg reads stdin and writes stdout, so both give the same result
+
+#include "StegEngine.h"
+
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <span>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace StegProtocol {
+
+    using Steg::byte;
+
+    // What steg probe prints and the fields of stegd's answer to probe, sorted by name
+    inline std::map<std::string, std::string> GetProbeFields(const Steg::EncoderSettings& settings, uint32_t payloadByteCount) {
+        std::map<std::string, std::string> fields;
+        fields["size"] = std::to_string(payloadByteCount);
+        fields["depth"] = std::to_string(settings.DataDepth);
+        fields["alpha"] = std::to_string(int(settings.EncodeInAlpha));
+        fields["scatter"] = std::to_string(int(settings.LocalScatter));
+        fields["archive"] = std::to_string(int(settings.Archive));
+        fields["encrypted"] = std::to_string(int(settings.Encryption.EncryptPayload));
+        if (settings.Encryption.EncryptPayload) {
+            fields["algo"] = std::to_string(int(settings.Encryption.Algo));
+            fields["mode"] = std::to_string(int(settings.Encryption.CipherMode));
+        }
+        return fields;
+    }
+
+    inline std::string ToHex(std::span<const byte> bytes) {
+        static constexpr char Digits[] = "0123456789abcdef";
+        std::string text;
+        text.reserve(bytes.size() * 2);
+        for (byte value : bytes) {
+            text.push_back(Digits[value >> 4]);
+            text.push_back(Digits[value & 0xF]);
+        }
+        return text;
+    }
+
+    inline std::vector<byte> FromHex(const std::string& text) {
+        auto digit = [&](char c) -> byte {
+            if (c >= '0' && c <= '9') {
+                return byte(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                return byte(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                return byte(c - 'A' + 10);
+            }
+            throw std::invalid_argument("Invalid hex: " + text);
+        };
+        if (text.size() % 2 != 0) {
+            throw std::invalid_argument("Invalid hex: " + text);
+        }
+        std::vector<byte> bytes(text.size() / 2);
+        for (size_t i = 0; i < bytes.size(); i++) {
+            bytes[i] = byte(digit(text[2 * i]) << 4 | digit(text[2 * i + 1]));
+        }
+        return bytes;
+    }
+
+#ifdef __linux__
+
+    // Largest packet and most descriptors in one
+    constexpr size_t MaxMessageSize = 64 * 1024;
+    constexpr size_t MaxDescriptors = 4;
+
+    struct Message {
+        std::string Command;
+        std::map<std::string, std::string> Fields;
+        std::string Body;
+
+        // Received descriptors belong to the receiver, which has to close them
+        std::vector<int> Descriptors;
+    };
+
+    inline sockaddr_un GetAddress(const std::string& path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            throw std::invalid_argument("Invalid socket path: " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    inline int Connect(const std::string& path) {
+        sockaddr_un address = GetAddress(path);
+        int socket = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (socket < 0) {
+            throw std::runtime_error(std::string("Could not create socket: ") + std::strerror(errno));
+        }
+        if (connect(socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+            int error = errno;
+            close(socket);
+            throw std::runtime_error("Could not connect to " + path + ": " + std::strerror(error));
+        }
+        return socket;
+    }
+
+    inline void Send(int socket, const Message& message) {
+        std::string text = message.Command;
+        for (const auto& [key, value] : message.Fields) {
+            text += " " + key + "=" + value;
+        }
+        if (!message.Body.empty()) {
+            text += "\n" + message.Body;
+        }
+        if (text.size() > MaxMessageSize || message.Descriptors.size() > MaxDescriptors) {
+            throw std::invalid_argument("Message is too large");
+        }
+
+        iovec data{text.data(), text.size()};
+        msghdr header{};
+        header.msg_iov = &data;
+        header.msg_iovlen = 1;
+
+        // The descriptors ride along in one SCM_RIGHTS control message
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MaxDescriptors)] = {};
+        if (!message.Descriptors.empty()) {
+            size_t size = sizeof(int) * message.Descriptors.size();
+            header.msg_control = control;
+            header.msg_controllen = CMSG_SPACE(size);
+            cmsghdr* rights = CMSG_FIRSTHDR(&header);
+            rights->cmsg_level = SOL_SOCKET;
+            rights->cmsg_type = SCM_RIGHTS;
+            rights->cmsg_len = CMSG_LEN(size);
+            std::memcpy(CMSG_DATA(rights), message.Descriptors.data(), size);
+        }
+
+        while (sendmsg(socket, &header, MSG_NOSIGNAL) < 0) {
+            if (errno != EINTR) {
+                throw std::runtime_error(std::string("Could not send message: ") + std::strerror(errno));
+            }
+        }
+    }
+
+    // Returns false once the other side closed the connection
+    inline bool Receive(int socket, Message& message) {
+        std::vector<char> text(MaxMessageSize);
+        iovec data{text.data(), text.size()};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * MaxDescriptors)];
+        msghdr header{};
+        header.msg_iov = &data;
+        header.msg_iovlen = 1;
+        header.msg_control = control;
+        header.msg_controllen = sizeof(control);
+
+        ssize_t size;
+        while ((size = recvmsg(socket, &header, MSG_CMSG_CLOEXEC)) < 0) {
+            if (errno != EINTR) {
+                throw std::runtime_error(std::string("Could not receive message: ") + std::strerror(errno));
+            }
+        }
+
+        message = Message();
+        for (cmsghdr* rights = CMSG_FIRSTHDR(&header); rights != nullptr; rights = CMSG_NXTHDR(&header, rights)) {
+            if (rights->cmsg_level == SOL_SOCKET && rights->cmsg_type == SCM_RIGHTS) {
+                size_t count = (rights->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                size_t offset = message.Descriptors.size();
+                message.Descriptors.resize(offset + count);
+                std::memcpy(message.Descriptors.data() + offset, CMSG_DATA(rights), count * sizeof(int));
+            }
+        }
+
+        // The descriptors of a message that is rejected are closed right away, the caller never sees them
+        auto closeDescriptors = [&]() {
+            for (int descriptor : message.Descriptors) {
+                close(descriptor);
+            }
+            message.Descriptors.clear();
+        };
+
+        // A cut off message cannot be trusted
+        if ((header.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0) {
+            closeDescriptors();
+            throw std::runtime_error("Message is too large");
+        }
+        if (size == 0 && message.Descriptors.empty()) {
+            return false;
+        }
+
+        try {
+            std::string line(text.data(), size_t(size));
+            size_t end = line.find('\n');
+            if (end != std::string::npos) {
+                message.Body = line.substr(end + 1);
+                line.resize(end);
+            }
+
+            std::istringstream words(line);
+            words >> message.Command;
+            std::string field;
+            while (words >> field) {
+                size_t equals = field.find('=');
+                if (equals == std::string::npos) {
+                    throw std::invalid_argument("Invalid field: " + field);
+                }
+                message.Fields[field.substr(0, equals)] = field.substr(equals + 1);
+            }
+        } catch (...) {
+            closeDescriptors();
+            throw;
+        }
+        return true;
+    }
+
+#endif
+
+}
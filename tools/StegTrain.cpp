@@ -0,0 +1,236 @@
+// Training workload for profile-guided builds, run by the steg-pgo-train target
+// Usage: steg-train [--quick]
+// Every path a typical caller takes is run with realistic sizes and checked, a profile of a broken run is worthless
+// 1. cmake -DSTEG_PGO=GENERATE -DSTEG_LTO=ON, build and run steg-pgo-train
+// 2. cmake -DSTEG_PGO=USE and rebuild, the library is then optimized for the branches and loops this program took
+
+#include "GrayImage.h"
+#include "RGBImage.h"
+#include "StegCrypt.h"
+#include "StegEngine.h"
+#include "StegTimer.h"
+
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+using namespace Steg;
+
+namespace {
+
+    constexpr PixelMode AllModes[] = {
+        PixelMode::GRAY_8, PixelMode::GRAY_16,
+        PixelMode::GRAYA_8, PixelMode::GRAYA_16,
+        PixelMode::RGB_8, PixelMode::RGB_16,
+        PixelMode::RGBA_8, PixelMode::RGBA_16
+    };
+
+    bool IsWide(PixelMode mode) {
+        return mode == PixelMode::GRAY_16 || mode == PixelMode::GRAYA_16 || mode == PixelMode::RGB_16 || mode == PixelMode::RGBA_16;
+    }
+
+    void Check(bool condition, const std::string& message) {
+        if (!condition) {
+            throw std::runtime_error("Training run failed: " + message);
+        }
+    }
+
+    // How often a zone ended since the timers were last reset, wherever it was nested
+    uint64_t CountZone(StegTimer::TimerLabel label) {
+        uint64_t count = 0;
+        for (const auto& [path, statistics] : StegTimer::GetStatistics()) {
+            if (path.back() == label) {
+                count += statistics.Count;
+            }
+        }
+        return count;
+    }
+
+    // Deterministic bytes with some structure, like photos and documents have
+    std::vector<byte> MakeData(size_t size, uint32_t seed) {
+        std::vector<byte> data(size);
+        uint32_t state = seed;
+        for (size_t i = 0; i < size; i++) {
+            state = state * 1664525 + 1013904223;
+            data[i] = (i & 0x100) ? byte(i) : byte(state >> 24);
+        }
+        return data;
+    }
+
+    // Calls fn with a size x size carrier of the given mode filled with noise
+    template<typename Function>
+    void WithCarrier(PixelMode mode, uint32_t size, Function fn) {
+        auto fill = [&](Image& image) {
+            std::vector<byte> noise = MakeData(size_t(size) * size * image.GetPixelWidth(), uint32_t(mode) + size);
+            for (uint32_t i = 0; i < noise.size(); i++) {
+                image.SetByte(i, noise[i]);
+            }
+            fn(image);
+        };
+
+        bool gray = mode == PixelMode::GRAY_8 || mode == PixelMode::GRAY_16 || mode == PixelMode::GRAYA_8 || mode == PixelMode::GRAYA_16;
+        bool alpha = mode == PixelMode::GRAYA_8 || mode == PixelMode::GRAYA_16 || mode == PixelMode::RGBA_8 || mode == PixelMode::RGBA_16;
+        if (gray) {
+            GrayImage image(size, size, IsWide(mode) ? 16 : 8, alpha);
+            fill(image);
+        } else {
+            RGBImage image(size, size, IsWide(mode) ? 16 : 8, alpha);
+            fill(image);
+        }
+    }
+
+    // Plain encode and decode of every mode, depth and alpha setting, with full and small payloads
+    void TrainEngine(uint32_t size) {
+        for (PixelMode mode : AllModes) {
+            WithCarrier(mode, size, [&](Image& image) {
+                for (byte depth : {1, 2, 4, 8}) {
+                    for (bool alpha : {false, true}) {
+                        if (alpha && !image.HasAlpha()) {
+                            continue;
+                        }
+
+                        EncoderSettings settings;
+                        settings.DataDepth = depth;
+                        settings.EncodeInAlpha = alpha;
+
+                        uint32_t capacity = StegEngine::CalculateAvailableBytes(image, settings);
+                        for (uint32_t payloadSize : {capacity, std::min<uint32_t>(capacity, 1024)}) {
+                            std::vector<byte> data = MakeData(payloadSize, depth);
+                            StegEngine::Encode(image, data, settings);
+                            Check(StegEngine::Decode(image, std::vector<byte>()) == data, "decode of an unencrypted payload");
+                        }
+                    }
+                }
+            });
+        }
+    }
+
+    // Encrypted payloads through the engine, serial and pipelined, for every algorithm and mode
+    void TrainEncryptedEngine(uint32_t size) {
+        std::vector<byte> password = {'t', 'r', 'a', 'i', 'n'};
+
+        WithCarrier(PixelMode::RGBA_8, size, [&](Image& image) {
+            for (auto algo : {StegCrypt::Algorithm::ALGO_AES128, StegCrypt::Algorithm::ALGO_AES192, StegCrypt::Algorithm::ALGO_AES256, StegCrypt::Algorithm::ALGO_CHACHA20}) {
+                for (auto mode : {StegCrypt::Mode::MODE_CBC, StegCrypt::Mode::MODE_CTR, StegCrypt::Mode::MODE_GCM}) {
+                    for (bool pipelined : {false, true}) {
+                        EncoderSettings settings;
+                        settings.Encryption.EncryptPayload = true;
+                        settings.Encryption.EncryptionPassword = password;
+                        settings.Encryption.Algo = algo;
+                        settings.Encryption.CipherMode = mode;
+                        settings.Pipelined = pipelined;
+
+                        // Leave room for the IV, padding or tag
+                        std::vector<byte> data = MakeData(StegEngine::CalculateAvailableBytes(image, settings) - 64, uint32_t(algo));
+                        StegEngine::Encode(image, data, settings);
+
+                        DecoderSettings decoderSettings;
+                        decoderSettings.EncryptionPassword = password;
+                        decoderSettings.Pipelined = pipelined;
+                        Check(StegEngine::Decode(image, decoderSettings) == data, "decode of an encrypted payload");
+                    }
+                }
+            }
+        });
+    }
+
+    // Large buffers straight through StegCrypt, including the threaded counter modes and a tampered tag
+    void TrainCrypt(size_t size) {
+        std::vector<byte> password = {'t', 'r', 'a', 'i', 'n'};
+        std::vector<byte> data = MakeData(size, 7);
+
+        for (auto algo : {StegCrypt::Algorithm::ALGO_AES128, StegCrypt::Algorithm::ALGO_AES256, StegCrypt::Algorithm::ALGO_CHACHA20}) {
+            for (auto mode : {StegCrypt::Mode::MODE_CBC, StegCrypt::Mode::MODE_CTR, StegCrypt::Mode::MODE_GCM}) {
+                std::vector<byte> encrypted = StegCrypt::Encrypt(password, data, algo, mode);
+                Check(StegCrypt::Decrypt(password, encrypted, algo, mode) == data, "decrypt");
+
+                // Authenticated modes reject a modified payload
+                if (mode == StegCrypt::Mode::MODE_GCM) {
+                    encrypted.back() ^= 1;
+                    bool rejected = false;
+                    try {
+                        StegCrypt::Decrypt(password, encrypted, algo, mode);
+                    } catch (const std::exception&) {
+                        rejected = true;
+                    }
+                    Check(rejected, "tampered payload was accepted");
+                }
+            }
+        }
+    }
+
+    // PNG round trips of encoded carriers and the conversions callers use to normalize them
+    void TrainPNG(uint32_t size) {
+        std::string path = (std::filesystem::temp_directory_path() / "steg-train.png").string();
+
+        for (PixelMode mode : AllModes) {
+            WithCarrier(mode, size, [&](Image& image) {
+
+                // 16-bit images cannot be saved yet, so they are normalized to the 8-bit mode of their color type first
+                // Every mode a normalized carrier can end up in is then saved and reloaded
+                EncoderSettings settings;
+                settings.NormalizeImage = IsWide(mode);
+                if (image.GetChannelCount() <= 2) {
+                    settings.NormalizedMode = image.HasAlpha() ? PixelMode::GRAYA_8 : PixelMode::GRAY_8;
+                } else {
+                    settings.NormalizedMode = image.HasAlpha() ? PixelMode::RGBA_8 : PixelMode::RGB_8;
+                }
+
+                std::vector<byte> data = MakeData(1024, 3);
+                StegEngine::Encode(image, data, settings);
+
+                // Saves only go through the compression zone when the library was built with zlib
+                StegTimer::ResetTimers();
+                image.SaveImage(path);
+                bool incremental = CountZone(StegTimer::TimerLabel::PNG_COMPRESS) > 0;
+
+                // A PNG loads in the mode it was saved in, so a normalized carrier still decodes
+                Image loaded(path);
+                Check(loaded.GetPixelMode() == image.GetPixelMode(), "mode of a loaded PNG");
+
+                // It also keeps its compressed rows, so saving it unchanged compresses nothing
+                if (incremental) {
+                    StegTimer::ResetTimers();
+                    loaded.EncodePNG();
+                    Check(CountZone(StegTimer::TimerLabel::PNG_COMPRESS) == 0, "compressed rows of a loaded PNG were dropped");
+                }
+                Check(StegEngine::Decode(loaded, std::vector<byte>()) == data, "decode of a loaded PNG");
+
+                // Saving it again after a new payload only compresses the rows the payload changed
+                std::vector<byte> update = MakeData(512, 5);
+                StegEngine::Encode(loaded, update, EncoderSettings());
+                Image saved(loaded.EncodePNG());
+                Check(StegEngine::Decode(saved, std::vector<byte>()) == update, "decode of a PNG saved again");
+            });
+        }
+
+        std::filesystem::remove(path);
+    }
+
+}
+
+int main(int argc, char** argv) {
+
+    bool quick = argc > 1 && std::strcmp(argv[1], "--quick") == 0;
+
+    // Carrier edge length in pixels, typical of photos people share
+    uint32_t size = quick ? 256 : 1024;
+
+    try {
+        std::cerr << "Training engine" << std::endl;
+        TrainEngine(size);
+        std::cerr << "Training encrypted engine" << std::endl;
+        TrainEncryptedEngine(size);
+        std::cerr << "Training crypt" << std::endl;
+        TrainCrypt(quick ? size_t(1) << 20 : size_t(16) << 20);
+        std::cerr << "Training PNG" << std::endl;
+        TrainPNG(size);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cerr << "Training finished" << std::endl;
+    return 0;
+
+}